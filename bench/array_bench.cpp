@@ -0,0 +1,79 @@
+#include "bench.hpp"
+#include "codegen/ObjectCache.hpp"
+#include "codegen/TargetMachines.hpp"
+#include "codegen/codegen.hpp"
+#include "parser/ToyParser.hpp"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include <cstdint>
+#include <fmt/format.h>
+#include <sstream>
+#include <vector>
+
+// Run time of a * k + b over arrays of doubles compiled at -O3 for the
+// host's CPU: called from here once per element, as toy code had to be
+// before it had arrays; as a loop over 'a[i]', whose bounds checks are
+// left out of the copy of the loop that runs when the bound keeps i inside
+// every array; and as a loop over 'a[i + 0]', which checks every index.
+// The arrays come from here, so the toy functions see them as C does,
+// 'double *, int64_t' each.
+//   array_bench [n]    default: 1000000
+
+namespace {
+const char *kernels = R"(
+def axpy_one(x y k) x * k + y
+def axpy(a[] b[] k) for i = 0, i < len(a) - 1 in a[i] = a[i] * k + b[i]
+def axpy_checked(a[] b[] k) for i = 0, i < len(a) - 1 in a[i + 0] = a[i + 0] * k + b[i + 0]
+)";
+
+template<typename Fn> Fn *lookup(llvm::orc::LLJIT &jit, const char *name)
+{
+    auto symbol = llvm::cantFail(jit.lookup(name));
+    return reinterpret_cast<Fn *>(symbol.getAddress());
+}
+}// namespace
+
+int main(int argc, char **argv)
+{
+    auto n = static_cast<std::size_t>(argc > 1 ? std::stod(argv[1]) : 1e6);
+    // The length as the toy functions take it.
+    auto length = static_cast<int64_t>(n);
+    initialize_target(TargetSpec().triple);
+
+    ToyParser parser;
+    std::istringstream is(kernels);
+    auto unit = parser.MainLoop(SourceBuffer::from_stream(is));
+
+    TargetSpec native;
+    native.cpu = llvm::sys::getHostCPUName().str();
+    native.features = host_features();
+    auto mod = codegen(unit.top_expressions, { native.cpu, native.features, {} });
+    std::string report;
+    mod->TheContext->setDiagnosticHandler(std::make_unique<LoopReport>(report));
+    auto TM = target_machines().acquire(native, OptimizationLevel::O3);
+    auto object = object_code(*mod->TheModule, *std::get<0>(TM), OptimizationLevel::O3);
+
+    auto jit = llvm::cantFail(llvm::orc::LLJITBuilder().create());
+    llvm::cantFail(jit->addObjectFile(
+        llvm::MemoryBuffer::getMemBufferCopy(llvm::StringRef(object.data(), object.size()), "kernels.o")));
+    using array_fn = double(double *, int64_t, double *, int64_t, double);
+    auto *axpy_one = lookup<double(double, double, double)>(*jit, "axpy_one");
+    auto *axpy = lookup<array_fn>(*jit, "axpy");
+    auto *axpy_checked = lookup<array_fn>(*jit, "axpy_checked");
+
+    std::vector<double> a(n, 1.0), b(n, 0.5);
+    double sink = 0;
+    auto keep = [&](double v) { sink += v; };
+    fmt::print("host cpu: {}, {} elements\n", native.cpu, n);
+    fmt::print("  {:<12} {:>8.2f} ms\n", "per element", bench::best_of(5, [&] {
+        for (std::size_t i = 0; i < n; i++) a[i] = axpy_one(a[i], b[i], 0.5);
+        return a[n - 1];
+    }, keep) * 1e3);
+    fmt::print("  {:<12} {:>8.2f} ms\n", "elided", bench::best_of(5, [&] { return axpy(a.data(), length, b.data(), length, 0.5); }, keep) * 1e3);
+    fmt::print("  {:<12} {:>8.2f} ms\n", "checked", bench::best_of(5, [&] { return axpy_checked(a.data(), length, b.data(), length, 0.5); }, keep) * 1e3);
+    std::istringstream lines(report);
+    for (std::string line; std::getline(lines, line);)
+    {
+        if (line.find("vectoriz") != std::string::npos) fmt::print("  {}\n", line);
+    }
+    return 0;
+}
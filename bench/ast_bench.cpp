@@ -0,0 +1,63 @@
+#include "bench.hpp"
+#include "parser/ToyParser.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <fmt/format.h>
+#include <new>
+#include <sys/resource.h>
+
+// Heap allocations and peak RSS for parsing a large program into an AST and
+// tearing it down again.
+//   ast_bench [file.toy]    default: 100k generated functions
+
+namespace {
+std::atomic<std::size_t> allocations{ 0 };
+
+long peak_rss_kb()
+{
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+}// namespace
+
+void *operator new(std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+int main(int argc, char **argv)
+{
+    auto source = argc > 1 ? bench::read_file(argv[1]) : bench::synthetic_functions(100000);
+    auto rss_before = peak_rss_kb();
+
+    std::size_t parse_allocs = 0, free_allocs = 0, items = 0, arena_bytes = 0;
+    double parse_time = 0, free_time = 0;
+    {
+        ToyParser parser;
+        std::istringstream is(source);
+        auto start_allocs = allocations.load();
+        auto start = std::chrono::steady_clock::now();
+        auto unit = parser.MainLoop(SourceBuffer::from_stream(is));
+        parse_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        parse_allocs = allocations.load() - start_allocs;
+        items = unit.top_expressions.size();
+        arena_bytes = unit.arena.bytes_used();
+
+        start = std::chrono::steady_clock::now();
+        unit = TranslationUnit();
+        free_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        free_allocs = allocations.load() - start_allocs - parse_allocs;
+    }
+
+    fmt::print("input:        {:.1f} MB, {} top level items\n", static_cast<double>(source.size()) / (1 << 20), items);
+    fmt::print("parse:        {:.3f} s, {} heap allocations\n", parse_time, parse_allocs);
+    fmt::print("arena:        {:.1f} MB of nodes\n", static_cast<double>(arena_bytes) / (1 << 20));
+    fmt::print("teardown:     {:.4f} s, {} allocations\n", free_time, free_allocs);
+    fmt::print("peak RSS:     {} MB (+{} MB while parsing)\n", peak_rss_kb() / 1024, (peak_rss_kb() - rss_before) / 1024);
+    return 0;
+}
@@ -0,0 +1,104 @@
+#ifndef __BENCH_H_
+#define __BENCH_H_
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <string>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace bench {
+
+/// best_of - Run fn reps times and return the fastest wall-clock time in
+/// seconds. fn's result is passed to sink so the work can't be optimised out.
+template<typename Fn, typename Sink> double best_of(int reps, Fn &&fn, Sink &&sink)
+{
+    double best = 1e300;
+    for (int i = 0; i < reps; ++i)
+    {
+        auto start = std::chrono::steady_clock::now();
+        sink(fn());
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+/// cache_misses - Hardware cache misses (last level, as the kernel defines
+/// them) of this thread while running fn, or nullopt where performance
+/// counters aren't available, e.g. in most containers and VMs.
+template<typename Fn> std::optional<std::uint64_t> cache_misses(Fn &&fn)
+{
+#ifdef __linux__
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    if (fd >= 0)
+    {
+        std::uint64_t count = 0;
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        fn();
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        bool ok = ::read(fd, &count, sizeof(count)) == sizeof(count);
+        close(fd);
+        if (ok) return count;
+        return std::nullopt;
+    }
+#endif
+    fn();
+    return std::nullopt;
+}
+
+inline std::string read_file(const std::string &filename)
+{
+    std::ifstream is(filename, std::ios::binary);
+    return { std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>() };
+}
+
+/// synthetic_function - One function of the generated benchmark programs,
+/// restricted to what both the Flex and native scanners accept (integer
+/// literals, block comments).
+inline void synthetic_function(std::string &src, std::size_t i)
+{
+    auto n = std::to_string(i);
+    src += "/* generated helper number " + n + ", do not edit by hand */\n";
+    src += "def helper_function_" + n + "(accumulator_value step_size limit)\n";
+    src += "    if accumulator_value < limit then\n";
+    src += "        helper_function_" + n + "(accumulator_value + step_size * 2, step_size, limit - 1)\n";
+    src += "    else\n";
+    src += "        accumulator_value * " + n + " + 12345\n\n";
+}
+
+/// synthetic_program - About target_bytes of generated functions.
+inline std::string synthetic_program(std::size_t target_bytes)
+{
+    std::string src;
+    src.reserve(target_bytes + 256);
+    for (std::size_t i = 0; src.size() < target_bytes; ++i) synthetic_function(src, i);
+    return src;
+}
+
+/// synthetic_functions - A generated program of exactly count functions.
+inline std::string synthetic_functions(std::size_t count)
+{
+    std::string src;
+    for (std::size_t i = 0; i < count; ++i) synthetic_function(src, i);
+    return src;
+}
+
+}// namespace bench
+
+#endif// __BENCH_H_
@@ -0,0 +1,94 @@
+#include "bench.hpp"
+#include "codegen/ObjectCache.hpp"
+#include "codegen/codegen.hpp"
+#include "parser/ToyParser.hpp"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Target/TargetOptions.h"
+#include <fmt/format.h>
+#include <sstream>
+
+// Build time of a generated program through the object cache: with the
+// cache empty, full after the same build, and after editing every
+// hundredth function, against building it without the cache.
+//   cache_bench [functions] [opt level 0-3]    default: 5000 functions, -O0
+
+namespace {
+/// program - functions generated functions, those whose index is a multiple
+/// of 100 edited if edited.
+std::string program(std::size_t functions, bool edited)
+{
+    std::string src;
+    for (std::size_t i = 0; i < functions; ++i)
+    {
+        std::string function;
+        bench::synthetic_function(function, i);
+        if (edited && i % 100 == 0) function.replace(function.rfind("12345"), 5, "54321");
+        src += function;
+    }
+    return src;
+}
+
+TranslationUnit parse(const std::string &source)
+{
+    ToyParser parser;
+    std::istringstream is(source);
+    return parser.MainLoop(SourceBuffer::from_stream(is));
+}
+}// namespace
+
+int main(int argc, char **argv)
+{
+    std::size_t functions = argc > 1 ? std::stoul(argv[1]) : 5000;
+    const OptimizationLevel levels[] = {
+        OptimizationLevel::O0, OptimizationLevel::O1, OptimizationLevel::O2, OptimizationLevel::O3
+    };
+    auto level = levels[argc > 2 ? std::stoi(argv[2]) & 3 : 0];
+
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    auto TargetTriple = llvm::sys::getDefaultTargetTriple();
+    std::string Error;
+    auto *Target = llvm::TargetRegistry::lookupTarget(TargetTriple, Error);
+    std::unique_ptr<llvm::TargetMachine> TM(Target->createTargetMachine(
+        TargetTriple, "generic", "", llvm::TargetOptions(), llvm::None, llvm::None, codegen_opt_level(level)));
+
+    llvm::SmallString<128> dir;
+    llvm::sys::fs::createUniqueDirectory("toy-cache-bench", dir);
+    ObjectCache cache(std::string(dir.str()));
+
+    auto original = program(functions, false);
+    auto edited = program(functions, true);
+    std::size_t sink = 0;
+
+    auto uncached = [&](const std::string &source) {
+        auto unit = parse(source);
+        auto start = std::chrono::steady_clock::now();
+        auto mod = codegen(unit.top_expressions);
+        sink += object_code(*mod->TheModule, *TM, level).size();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+    auto cached = [&](const char *name, const std::string &source) {
+        auto unit = parse(source);
+        auto start = std::chrono::steady_clock::now();
+        auto build = build_cached(unit.top_expressions, cache, *TM, level);
+        double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        sink += build.objects.size();
+        fmt::print("{:<22} {:>10.3f} ms  {:>5.1f}% hits, {} generated\n",
+            name,
+            t * 1e3,
+            100.0 * static_cast<double>(build.hits) / static_cast<double>(build.hits + build.misses),
+            build.misses);
+    };
+
+    fmt::print("{} functions, {}\n", functions, TargetTriple);
+    fmt::print("{:<22} {:>10.3f} ms\n", "without cache", uncached(original) * 1e3);
+    cached("cache empty", original);
+    cached("cache full", original);
+    cached("1% of functions edited", edited);
+
+    llvm::sys::fs::remove_directories(dir);
+    return sink == 0;
+}
@@ -0,0 +1,77 @@
+#include "bench.hpp"
+#include "codegen/codegen.hpp"
+#include "parser/ToyParser.hpp"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+#include <fmt/format.h>
+#include <functional>
+#include <sstream>
+#include <thread>
+
+// Time to compile a large program to in-memory objects with codegen(...,
+// jobs, ...) at several job counts, and a check that every job count
+// produces the same objects.
+//   codegen_bench [file.toy]    default: 20k generated functions
+
+namespace {
+llvm::SmallVector<char, 0> emit_object(llvm::Module &module)
+{
+    auto TargetTriple = llvm::sys::getDefaultTargetTriple();
+    std::string Error;
+    auto *Target = llvm::TargetRegistry::lookupTarget(TargetTriple, Error);
+    std::unique_ptr<llvm::TargetMachine> TM(
+        Target->createTargetMachine(TargetTriple, "generic", "", llvm::TargetOptions(), llvm::None));
+    module.setTargetTriple(TargetTriple);
+    module.setDataLayout(TM->createDataLayout());
+
+    llvm::SmallVector<char, 0> object;
+    llvm::raw_svector_ostream os(object);
+    llvm::legacy::PassManager pass;
+    TM->addPassesToEmitFile(pass, os, nullptr, llvm::CGFT_ObjectFile);
+    pass.run(module);
+    return object;
+}
+}// namespace
+
+int main(int argc, char **argv)
+{
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+
+    auto source = argc > 1 ? bench::read_file(argv[1]) : bench::synthetic_functions(20000);
+    ToyParser parser;
+    std::istringstream is(source);
+    auto unit = parser.MainLoop(SourceBuffer::from_stream(is));
+
+    auto cores = std::max(1u, std::thread::hardware_concurrency());
+    auto units = codegen_unit_count(unit.top_expressions.size());
+    fmt::print("{} top level items in {} units, {} hardware threads\n", unit.top_expressions.size(), units, cores);
+
+    double serial = 0;
+    std::size_t expected = 0;
+    for (unsigned jobs : { 1u, 2u, 4u, 8u, cores })
+    {
+        std::vector<std::size_t> hashes(units);
+        auto start = std::chrono::steady_clock::now();
+        codegen(unit.top_expressions, jobs, [&](std::size_t i, CodeModule &part) {
+            auto object = emit_object(*part.TheModule);
+            hashes[i] = std::hash<std::string_view>()(std::string_view(object.data(), object.size()));
+        });
+        std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+
+        std::size_t hash = 0;
+        for (auto h : hashes) hash = hash * 31 + h;
+        if (jobs == 1)
+        {
+            serial = t.count();
+            expected = hash;
+        }
+        fmt::print("jobs {:>3}: {:8.3f} s  speedup {:5.2f}x{}\n",
+            jobs, t.count(), serial / t.count(), hash == expected ? "" : "  OBJECTS DIFFER");
+    }
+    return 0;
+}
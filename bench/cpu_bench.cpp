@@ -0,0 +1,94 @@
+#include "bench.hpp"
+#include "codegen/ObjectCache.hpp"
+#include "codegen/TargetMachines.hpp"
+#include "codegen/codegen.hpp"
+#include "parser/ToyParser.hpp"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include <fmt/format.h>
+#include <sstream>
+
+// Run time of numeric toy kernels compiled at -O3 for a generic CPU of the
+// host's kind, as toycompiler does by default, and for the host's own CPU
+// and features (--mcpu=native), with and without AVX-512. Each kernel is
+// emitted to an object file the way toycompiler does it, then loaded with
+// LLJIT and called from here.
+//   cpu_bench
+
+namespace {
+const char *kernels = R"(
+def horner(x n)
+    if n < 1 then 1 else x * horner(x, n - 1) + 0.5
+
+def poly_sum(n)
+    for i = 0, i < n in horner(i * 0.001, 32)
+
+def mix(a b) a * b + a * 0.25 + b * 0.75
+
+def row(i n)
+    if n < 1 then 0 else mix(i, n) * mix(n, i) + mix(i * 0.5, n * 0.5) + row(i, n - 1)
+
+def grid(n)
+    if n < 1 then 0 else row(n, 1000) + grid(n - 1)
+)";
+
+struct tuning
+{
+    const char *name;
+    TargetSpec target;
+    CodeOptions code;
+};
+
+llvm::SmallVector<char, 0> compile(TranslationUnit &unit, const tuning &t)
+{
+    auto mod = codegen(unit.top_expressions, t.code);
+    auto TM = target_machines().acquire(t.target, OptimizationLevel::O3);
+    return object_code(*mod->TheModule, *std::get<0>(TM), OptimizationLevel::O3);
+}
+
+template<typename Fn> Fn *lookup(llvm::orc::LLJIT &jit, const char *name)
+{
+    auto symbol = llvm::cantFail(jit.lookup(name));
+    return reinterpret_cast<Fn *>(symbol.getAddress());
+}
+}// namespace
+
+int main()
+{
+    initialize_target(TargetSpec().triple);
+
+    ToyParser parser;
+    std::istringstream is(kernels);
+    auto unit = parser.MainLoop(SourceBuffer::from_stream(is));
+
+    TargetSpec generic;
+    TargetSpec native;
+    native.cpu = llvm::sys::getHostCPUName().str();
+    native.features = host_features();
+    TargetSpec no_avx512 = native;
+    no_avx512.features += ",-avx512f";
+    const tuning tunings[] = {
+        { "generic", generic, {} },
+        { "native", native, { native.cpu, native.features, {} } },
+        { "native -avx512f", no_avx512, { no_avx512.cpu, no_avx512.features, {} } },
+    };
+
+    fmt::print("host cpu: {}\n", native.cpu);
+    fmt::print("{:<16} {:>10} {:>12} {:>12}\n", "tuning", "object", "poly_sum", "grid(3000)");
+    for (auto &t : tunings)
+    {
+        auto object = compile(unit, t);
+        auto jit = llvm::cantFail(llvm::orc::LLJITBuilder().create());
+        llvm::cantFail(jit->addObjectFile(
+            llvm::MemoryBuffer::getMemBufferCopy(llvm::StringRef(object.data(), object.size()), "kernels.o")));
+
+        auto *poly_sum = lookup<double(double)>(*jit, "poly_sum");
+        auto *grid = lookup<double(double)>(*jit, "grid");
+
+        double sink = 0;
+        auto keep = [&](double v) { sink += v; };
+        auto poly_time = bench::best_of(3, [&] { return poly_sum(400000); }, keep);
+        auto grid_time = bench::best_of(3, [&] { return grid(3000); }, keep);
+        fmt::print("{:<16} {:>8} B {:>10.1f} ms {:>10.1f} ms\n", t.name, object.size(), poly_time * 1e3, grid_time * 1e3);
+    }
+    return 0;
+}
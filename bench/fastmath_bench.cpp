@@ -0,0 +1,93 @@
+#include "bench.hpp"
+#include "codegen/ObjectCache.hpp"
+#include "codegen/TargetMachines.hpp"
+#include "codegen/codegen.hpp"
+#include "parser/ToyParser.hpp"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include <fmt/format.h>
+#include <sstream>
+
+// Run time of summation loops compiled at -O3 for the host's CPU with strict
+// IEEE arithmetic, as toycompiler does by default, with multiplies and adds
+// fused (--fp-contract=fast) and with all fast-math flags (--ffast-math),
+// which let the loop vectorizer reorder the sums. Each kernel is emitted to
+// an object file the way toycompiler does it, then loaded with LLJIT and
+// called from here. The sums differ in the last digits, as reordering
+// rounds differently.
+//   fastmath_bench
+
+namespace {
+const char *kernels = R"(
+def term(i) i * 0.5 + 1
+def sum(i n acc) if i < n then sum(i + 1, n, acc + term(i)) else acc
+def total() sum(0, 10000000, 0)
+
+def square(i) i * i * 0.000001 + i * 0.25
+def sum_squares(i n acc) if i < n then sum_squares(i + 1, n, acc + square(i)) else acc
+def total_squares() sum_squares(0, 10000000, 0)
+)";
+
+struct mode
+{
+    const char *name;
+    unsigned flags;// llvm::FastMathFlags bits
+};
+
+llvm::SmallVector<char, 0> compile(TranslationUnit &unit, TargetSpec target)
+{
+    auto mod = codegen(unit.top_expressions, { target.cpu, target.features, target.fast_math });
+    auto TM = target_machines().acquire(target, OptimizationLevel::O3);
+    return object_code(*mod->TheModule, *std::get<0>(TM), OptimizationLevel::O3);
+}
+
+template<typename Fn> Fn *lookup(llvm::orc::LLJIT &jit, const char *name)
+{
+    auto symbol = llvm::cantFail(jit.lookup(name));
+    return reinterpret_cast<Fn *>(symbol.getAddress());
+}
+}// namespace
+
+int main()
+{
+    initialize_target(TargetSpec().triple);
+
+    ToyParser parser;
+    std::istringstream is(kernels);
+    auto unit = parser.MainLoop(SourceBuffer::from_stream(is));
+
+    TargetSpec native;
+    native.cpu = llvm::sys::getHostCPUName().str();
+    native.features = host_features();
+    const mode modes[] = {
+        { "strict", 0 },
+        { "fp-contract=fast", llvm::FastMathFlags::AllowContract },
+        { "ffast-math", fast_math_bits(llvm::FastMathFlags::getFast()) },
+    };
+
+    fmt::print("host cpu: {}, 10M terms per sum\n", native.cpu);
+    fmt::print("{:<18} {:>10} {:>24} {:>10} {:>24}\n", "mode", "total", "", "squares", "");
+    for (auto &m : modes)
+    {
+        auto target = native;
+        target.fast_math = fast_math_flags(m.flags);
+        auto object = compile(unit, target);
+        auto jit = llvm::cantFail(llvm::orc::LLJITBuilder().create());
+        llvm::cantFail(jit->addObjectFile(
+            llvm::MemoryBuffer::getMemBufferCopy(llvm::StringRef(object.data(), object.size()), "kernels.o")));
+
+        auto *total = lookup<double()>(*jit, "total");
+        auto *total_squares = lookup<double()>(*jit, "total_squares");
+
+        double sink = 0;
+        auto keep = [&](double v) { sink += v; };
+        auto total_time = bench::best_of(5, total, keep);
+        auto squares_time = bench::best_of(5, total_squares, keep);
+        fmt::print("{:<18} {:>7.2f} ms {:>24.17g} {:>7.2f} ms {:>24.17g}\n",
+            m.name,
+            total_time * 1e3,
+            total(),
+            squares_time * 1e3,
+            total_squares());
+    }
+    return 0;
+}
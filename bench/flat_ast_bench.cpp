@@ -0,0 +1,105 @@
+#include "bench.hpp"
+#include "codegen/codegen.hpp"
+#include "parser/ToyParser.hpp"
+#include <fmt/format.h>
+#include <sstream>
+
+// Walks the node tree and the flat AST of the same program: a recursive node
+// count over every function, a linear pass over the flat arrays, and full
+// codegen. Reports nodes per second and, where the kernel allows it, cache
+// misses.
+//   flat_ast_bench [file.toy]    default: 100k generated functions
+
+namespace {
+template<typename Parser> auto parse(const std::string &source)
+{
+    Parser parser;
+    std::istringstream is(source);
+    return parser.MainLoop(SourceBuffer::from_stream(is));
+}
+
+std::size_t walk(const TranslationUnit &unit)
+{
+    std::size_t n = 0;
+    for (auto &item : unit.top_expressions)
+        n += std::visit([](auto *node) { return node ? node->countNodes() : 0; }, item);
+    return n;
+}
+
+std::size_t walk(const FlatAST &ast)
+{
+    std::size_t n = 0;
+    for (auto &item : ast.top_level)
+        if (auto *f = std::get_if<FlatFn>(&item); f && *f) n += ast.countNodes(ast.function(*f).body);
+    return n;
+}
+
+/// scan - Stand-in for a pass that visits nodes in any order, e.g. collecting
+/// every literal: a straight loop over the kind array.
+std::size_t scan(const FlatAST &ast)
+{
+    std::size_t n = 0;
+    for (auto kind : ast.kinds) n += kind != FlatKind::none;
+    return n;
+}
+
+std::size_t bytes(const FlatAST &ast)
+{
+    return ast.kinds.size() * (sizeof(FlatKind) + sizeof(char) + 2 * sizeof(uint32_t))
+           + ast.numbers.size() * sizeof(double) + ast.extra.size() * sizeof(uint32_t)
+           + ast.prototypes.size() * sizeof(FlatAST::Prototype) + ast.params.size() * sizeof(Symbol)
+           + ast.functions.size() * sizeof(FlatAST::Function);
+}
+
+std::size_t instructions(const CodeModule &mod)
+{
+    std::size_t n = 0;
+    for (auto &F : *mod.TheModule) n += F.getInstructionCount();
+    return n;
+}
+
+void report(const char *name, std::size_t nodes, double seconds, std::optional<std::uint64_t> misses)
+{
+    fmt::print("{:<16} {:8.3f} s {:10.2f} Mnodes/s   cache misses: {}\n",
+        name,
+        seconds,
+        static_cast<double>(nodes) / seconds / 1e6,
+        misses ? fmt::format("{} ({:.3f}/node)", *misses, static_cast<double>(*misses) / static_cast<double>(nodes))
+               : std::string("n/a"));
+}
+}// namespace
+
+int main(int argc, char **argv)
+{
+    auto source = argc > 1 ? bench::read_file(argv[1]) : bench::synthetic_functions(100000);
+    auto unit = parse<ToyParser>(source);
+    auto flat = parse<FlatToyParser>(source);
+
+    std::size_t tree_nodes = 0, flat_nodes = 0, scanned = 0;
+    auto walk_tree = [&] { return walk(unit); };
+    auto walk_flat = [&] { return walk(flat); };
+    auto scan_flat = [&] { return scan(flat); };
+    fmt::print("input: {:.1f} MB, {} nodes\n", static_cast<double>(source.size()) / (1 << 20), flat.size());
+    fmt::print("size:  tree {:.1f} MB, flat {:.1f} MB\n",
+        static_cast<double>(unit.arena.bytes_used()) / (1 << 20),
+        static_cast<double>(bytes(flat)) / (1 << 20));
+
+    auto t = bench::best_of(5, walk_tree, [&](std::size_t n) { tree_nodes = n; });
+    report("tree walk", tree_nodes, t, bench::cache_misses(walk_tree));
+    t = bench::best_of(5, walk_flat, [&](std::size_t n) { flat_nodes = n; });
+    report("flat walk", flat_nodes, t, bench::cache_misses(walk_flat));
+    t = bench::best_of(5, scan_flat, [&](std::size_t n) { scanned = n; });
+    report("flat scan", scanned, t, bench::cache_misses(scan_flat));
+
+    std::size_t tree_insts = 0, flat_insts = 0;
+    auto gen_tree = [&] { return instructions(*codegen(unit.top_expressions)); };
+    auto gen_flat = [&] { return instructions(*codegen(flat)); };
+    t = bench::best_of(3, gen_tree, [&](std::size_t n) { tree_insts = n; });
+    report("tree codegen", tree_nodes, t, bench::cache_misses(gen_tree));
+    t = bench::best_of(3, gen_flat, [&](std::size_t n) { flat_insts = n; });
+    report("flat codegen", flat_nodes, t, bench::cache_misses(gen_flat));
+
+    if (tree_nodes != flat_nodes || tree_insts != flat_insts)
+        fmt::print(stderr, "warning: the representations disagree ({} vs {} nodes)\n", tree_nodes, flat_nodes);
+    return 0;
+}
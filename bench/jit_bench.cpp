@@ -0,0 +1,51 @@
+#include "bench.hpp"
+#include "jit/ToyJIT.hpp"
+#include "parser/ToyParser.hpp"
+#include "llvm/Support/TargetSelect.h"
+#include <fmt/format.h>
+#include <sstream>
+
+// Time to the first result, and to the last, of running a large program in
+// the JIT when only a handful of its functions are called, compiling every
+// function up front (--jit) or each on its first call (--jit --lazy).
+//   jit_bench [functions]    default: 10000
+
+int main(int argc, char **argv)
+{
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+
+    std::size_t count = argc > 1 ? std::stoul(argv[1]) : 10000;
+    auto source = bench::synthetic_functions(count);
+    for (std::size_t i = 0; i < 5; ++i) source += fmt::format("helper_function_{}(1, 1, 3)\n", i * (count - 1) / 4);
+
+    ToyParser parser;
+    std::istringstream is(source);
+    auto unit = parser.MainLoop(SourceBuffer::from_stream(is));
+    fmt::print("{} top level items, 5 of them calls\n", unit.top_expressions.size());
+
+    for (bool lazy : { false, true })
+    {
+        using clock = std::chrono::steady_clock;
+        double first = 1e300, last = 1e300, sum = 0;
+        for (int rep = 0; rep < 5; ++rep)
+        {
+            auto start = clock::now();
+            auto TheJIT = ToyJIT::create(OptimizationLevel::O0, lazy);
+            std::optional<clock::time_point> first_result;
+            sum = 0;
+            jit_run(unit.top_expressions, *std::get<0>(TheJIT), [&](double value) {
+                if (!first_result) first_result = clock::now();
+                sum += value;
+            });
+            auto done = clock::now();
+            first = std::min(first, std::chrono::duration<double>(*first_result - start).count());
+            last = std::min(last, std::chrono::duration<double>(done - start).count());
+        }
+        fmt::print("{:<6} first result {:8.2f} ms, all results {:8.2f} ms (sum {})\n",
+            lazy ? "lazy" : "eager",
+            first * 1e3,
+            last * 1e3,
+            sum);
+    }
+}
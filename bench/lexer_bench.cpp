@@ -0,0 +1,52 @@
+#include "bench.hpp"
+#include "lexer/NativeLexer.hpp"
+#include "lexer/ToyFlexLexer.hpp"
+#include <fmt/format.h>
+
+// Tokens per second for the Flex scanner and the hand-written NativeScanner
+// over the same buffer.
+//   lexer_bench [file.toy]    default: 32MB synthetic program
+
+namespace {
+std::size_t lex_flex(std::string_view text)
+{
+    ToyFlexLexer lexer(text);
+    std::size_t count = 0;
+    int t;
+    while ((t = lexer.yylex()) != 0)
+    {
+        auto lexeme = text.substr(lexer.token_offset, static_cast<std::size_t>(lexer.YYLeng()));
+        token tok(static_cast<token_t>(t), lexeme, lexer.token_offset, t == tok_number ? parse_number(lexeme) : std::nullopt);
+        count += tok.length() != 0;
+    }
+    return count;
+}
+
+std::size_t lex_native(std::string_view text)
+{
+    NativeScanner scanner(text);
+    std::size_t count = 0;
+    for (auto tok = scanner.next(); tok != tok_eof; tok = scanner.next()) count += tok.length() != 0;
+    return count;
+}
+}// namespace
+
+int main(int argc, char **argv)
+{
+    auto source = argc > 1 ? bench::read_file(argv[1]) : bench::synthetic_program(32u << 20u);
+    std::size_t flex_tokens = 0, native_tokens = 0;
+
+    auto flex_time = bench::best_of(5, [&] { return lex_flex(source); }, [&](std::size_t n) { flex_tokens = n; });
+    auto native_time =
+        bench::best_of(5, [&] { return lex_native(source); }, [&](std::size_t n) { native_tokens = n; });
+
+    auto mb = static_cast<double>(source.size()) / (1 << 20);
+    fmt::print("input: {:.1f} MB\n", mb);
+    fmt::print("flex:   {:>10} tokens {:8.3f} s {:8.2f} Mtok/s {:8.1f} MB/s\n",
+        flex_tokens, flex_time, static_cast<double>(flex_tokens) / flex_time / 1e6, mb / flex_time);
+    fmt::print("native: {:>10} tokens {:8.3f} s {:8.2f} Mtok/s {:8.1f} MB/s\n",
+        native_tokens, native_time, static_cast<double>(native_tokens) / native_time / 1e6, mb / native_time);
+    fmt::print("speedup: {:.2f}x\n", flex_time / native_time);
+    if (flex_tokens != native_tokens) fmt::print(stderr, "warning: scanners disagree on the token count\n");
+    return 0;
+}
@@ -0,0 +1,76 @@
+#include "bench.hpp"
+#include "codegen/ObjectCache.hpp"
+#include "codegen/TargetMachines.hpp"
+#include "codegen/codegen.hpp"
+#include "parser/ToyParser.hpp"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include <fmt/format.h>
+#include <sstream>
+
+// Run time of a summing for loop compiled at -O3 for the host's CPU: counted
+// with an integer, as a loop from a whole number while 'i < n' is; with a
+// vectorize(8) hint, which lets the vectorizer reorder the sum; and from a
+// start only known at run time, which leaves the loop counting in doubles.
+// Each is compiled with strict IEEE arithmetic and with --ffast-math, and
+// what the vectorizer did is reported from its remarks (--loop-report).
+//   loop_bench [n]    default: 10000000
+
+namespace {
+const char *kernels = R"(
+def counted(n) var s = 0 in (for i = 0, i < n in s = s + i * 0.5) + s
+def hinted(n) var s = 0 in (for i = 0, i < n vectorize(8) in s = s + i * 0.5) + s
+def floating(z n) var s = 0 in (for i = z, i < n in s = s + i * 0.5) + s
+)";
+
+template<typename Fn> Fn *lookup(llvm::orc::LLJIT &jit, const char *name)
+{
+    auto symbol = llvm::cantFail(jit.lookup(name));
+    return reinterpret_cast<Fn *>(symbol.getAddress());
+}
+}// namespace
+
+int main(int argc, char **argv)
+{
+    double n = argc > 1 ? std::stod(argv[1]) : 1e7;
+    initialize_target(TargetSpec().triple);
+
+    ToyParser parser;
+    std::istringstream is(kernels);
+    auto unit = parser.MainLoop(SourceBuffer::from_stream(is));
+
+    TargetSpec native;
+    native.cpu = llvm::sys::getHostCPUName().str();
+    native.features = host_features();
+
+    fmt::print("host cpu: {}, {} iterations\n", native.cpu, n);
+    for (bool fast : { false, true })
+    {
+        auto target = native;
+        if (fast) target.fast_math = llvm::FastMathFlags::getFast();
+        auto mod = codegen(unit.top_expressions, { target.cpu, target.features, target.fast_math });
+        std::string report;
+        mod->TheContext->setDiagnosticHandler(std::make_unique<LoopReport>(report));
+        auto TM = target_machines().acquire(target, OptimizationLevel::O3);
+        auto object = object_code(*mod->TheModule, *std::get<0>(TM), OptimizationLevel::O3);
+
+        auto jit = llvm::cantFail(llvm::orc::LLJITBuilder().create());
+        llvm::cantFail(jit->addObjectFile(
+            llvm::MemoryBuffer::getMemBufferCopy(llvm::StringRef(object.data(), object.size()), "kernels.o")));
+        auto *counted = lookup<double(double)>(*jit, "counted");
+        auto *hinted = lookup<double(double)>(*jit, "hinted");
+        auto *floating = lookup<double(double, double)>(*jit, "floating");
+
+        double sink = 0;
+        auto keep = [&](double v) { sink += v; };
+        fmt::print("\n{}\n", fast ? "--ffast-math" : "strict");
+        fmt::print("  {:<10} {:>8.2f} ms\n", "counted", bench::best_of(5, [&] { return counted(n); }, keep) * 1e3);
+        fmt::print("  {:<10} {:>8.2f} ms\n", "hinted", bench::best_of(5, [&] { return hinted(n); }, keep) * 1e3);
+        fmt::print("  {:<10} {:>8.2f} ms\n", "floating", bench::best_of(5, [&] { return floating(0, n); }, keep) * 1e3);
+        std::istringstream lines(report);
+        for (std::string line; std::getline(lines, line);)
+        {
+            if (line.find("vectoriz") != std::string::npos) fmt::print("  {}\n", line);
+        }
+    }
+    return 0;
+}
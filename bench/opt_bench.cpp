@@ -0,0 +1,112 @@
+#include "bench.hpp"
+#include "codegen/codegen.hpp"
+#include "codegen/optimizer.hpp"
+#include "parser/ToyParser.hpp"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+#include <fmt/format.h>
+#include <sstream>
+
+// Run time of toy kernels compiled at each --opt level. Each kernel is
+// optimized and emitted to an object file the way toycompiler does it, then
+// loaded with LLJIT and called from here.
+//   opt_bench
+
+namespace {
+const char *kernels = R"(
+def fib(n)
+    if n < 3 then 1 else fib(n - 1) + fib(n - 2)
+
+def horner(x n)
+    if n < 1 then 1 else x * horner(x, n - 1) + 1
+
+def poly_sum(n)
+    for i = 0, i < n in horner(i < 3, 64)
+
+def grid(n)
+    for i = 0, i < n in
+        for j = 0, j < n in
+            fib(8) * (i < j) + horner(i, 4)
+)";
+
+struct level
+{
+    const char *name;
+    OptimizationLevel opt;
+};
+
+llvm::SmallVector<char, 0> compile(TranslationUnit &unit, OptimizationLevel opt)
+{
+    auto mod = codegen(unit.top_expressions);
+    auto TargetTriple = llvm::sys::getDefaultTargetTriple();
+    std::string Error;
+    auto *Target = llvm::TargetRegistry::lookupTarget(TargetTriple, Error);
+    std::unique_ptr<llvm::TargetMachine> TM(Target->createTargetMachine(TargetTriple,
+        llvm::sys::getHostCPUName(),
+        "",
+        llvm::TargetOptions(),
+        llvm::Reloc::PIC_,
+        llvm::None,
+        codegen_opt_level(opt)));
+    mod->TheModule->setTargetTriple(TargetTriple);
+    mod->TheModule->setDataLayout(TM->createDataLayout());
+    optimize(*mod->TheModule, *TM, opt);
+
+    llvm::SmallVector<char, 0> object;
+    llvm::raw_svector_ostream os(object);
+    llvm::legacy::PassManager pass;
+    TM->addPassesToEmitFile(pass, os, nullptr, llvm::CGFT_ObjectFile);
+    pass.run(*mod->TheModule);
+    return object;
+}
+
+template<typename Fn> Fn *lookup(llvm::orc::LLJIT &jit, const char *name)
+{
+    auto symbol = llvm::cantFail(jit.lookup(name));
+    return reinterpret_cast<Fn *>(symbol.getAddress());
+}
+}// namespace
+
+int main()
+{
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+
+    ToyParser parser;
+    std::istringstream is(kernels);
+    auto unit = parser.MainLoop(SourceBuffer::from_stream(is));
+
+    const level levels[] = { { "O0", OptimizationLevel::O0 },
+        { "O1", OptimizationLevel::O1 },
+        { "O2", OptimizationLevel::O2 },
+        { "O3", OptimizationLevel::O3 },
+        { "Os", OptimizationLevel::Os },
+        { "Oz", OptimizationLevel::Oz } };
+
+    fmt::print("{:<4} {:>10} {:>12} {:>12} {:>12}\n", "opt", "object", "fib(30)", "poly_sum", "grid(600)");
+    for (auto &[name, opt] : levels)
+    {
+        auto object = compile(unit, opt);
+        auto jit = llvm::cantFail(llvm::orc::LLJITBuilder().create());
+        llvm::cantFail(jit->addObjectFile(llvm::MemoryBuffer::getMemBufferCopy(
+            llvm::StringRef(object.data(), object.size()), "kernels.o")));
+
+        auto *fib = lookup<double(double)>(*jit, "fib");
+        auto *poly_sum = lookup<double(double)>(*jit, "poly_sum");
+        auto *grid = lookup<double(double)>(*jit, "grid");
+
+        double sink = 0;
+        auto keep = [&](double v) { sink += v; };
+        auto fib_time = bench::best_of(3, [&] { return fib(30); }, keep);
+        auto poly_time = bench::best_of(3, [&] { return poly_sum(200000); }, keep);
+        auto grid_time = bench::best_of(3, [&] { return grid(600); }, keep);
+        fmt::print("{:<4} {:>8} B {:>10.1f} ms {:>10.1f} ms {:>10.1f} ms\n",
+            name, object.size(), fib_time * 1e3, poly_time * 1e3, grid_time * 1e3);
+    }
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include "bench.hpp"
+#include "lexer/SimdScan.hpp"
+#include <fmt/format.h>
+#include <vector>
+
+// Per character class timings of the SimdScan kernels. The run starts are
+// taken from the input the same way NativeScanner reaches them, so the run
+// length mix is that of real (or synthetic) source rather than an ideal one.
+//   scan_bench [file.toy]    default: 32MB synthetic program
+
+namespace {
+struct run_starts
+{
+    std::vector<const char *> space, ident, comment;
+};
+
+run_starts collect_runs(const char *p, const char *end)
+{
+    using namespace simd_scan;
+    run_starts runs;
+    while (p != end)
+    {
+        if (scalar::is_space(*p))
+        {
+            runs.space.push_back(p + 1);
+            p = scalar::skip_space(p + 1, end);
+        }
+        else if (scalar::is_ident(*p))
+        {
+            runs.ident.push_back(p + 1);
+            p = scalar::skip_ident(p + 1, end);
+        }
+        else if (*p == '/' && p + 1 != end && p[1] == '*')
+        {
+            runs.comment.push_back(p + 2);
+            p = scalar::find_comment_end(p + 2, end);
+        }
+        else
+            ++p;
+    }
+    return runs;
+}
+
+void time_class(const char *label,
+    const std::vector<const char *> &starts,
+    const char *end,
+    simd_scan::kernel_fn simd_scan::kernels::*kernel)
+{
+    std::vector<const simd_scan::kernels *> sets{ &simd_scan::scalar::table };
+#ifdef TOY_SIMD_X86
+    sets.push_back(&simd_scan::sse2::table);
+    if (__builtin_cpu_supports("avx2")) sets.push_back(&simd_scan::avx2::table);
+#endif
+    std::size_t bytes = 0;
+    double scalar_time = 0;
+    for (auto *set : sets)
+    {
+        auto fn = set->*kernel;
+        auto time = bench::best_of(
+            5,
+            [&] {
+                std::size_t n = 0;
+                for (auto *p : starts) n += static_cast<std::size_t>(fn(p, end) - p);
+                return n;
+            },
+            [&](std::size_t n) { bytes = n; });
+        if (set == sets.front()) scalar_time = time;
+        fmt::print("{:<8} {:<7} {:>9} runs {:6.1f} avg len {:7.2f} ns/run {:7.2f} GB/s {:5.2f}x\n",
+            label,
+            set->name,
+            starts.size(),
+            static_cast<double>(bytes) / static_cast<double>(starts.size()),
+            time * 1e9 / static_cast<double>(starts.size()),
+            static_cast<double>(bytes) / time / 1e9,
+            scalar_time / time);
+    }
+}
+}// namespace
+
+int main(int argc, char **argv)
+{
+    auto source = argc > 1 ? bench::read_file(argv[1]) : bench::synthetic_program(32u << 20u);
+    const char *end = source.data() + source.size();
+    auto runs = collect_runs(source.data(), end);
+
+    fmt::print("runtime selection: {}\n", simd_scan::active().name);
+    time_class("space", runs.space, end, &simd_scan::kernels::skip_space);
+    time_class("ident", runs.ident, end, &simd_scan::kernels::skip_ident);
+    time_class("comment", runs.comment, end, &simd_scan::kernels::find_comment_end);
+    return 0;
+}
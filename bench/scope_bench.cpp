@@ -0,0 +1,100 @@
+#include "bench.hpp"
+#include "codegen/codegen.hpp"
+#include "parser/ToyParser.hpp"
+#include <fmt/format.h>
+#include <sstream>
+
+// Codegen time of programs whose functions nest var and for scopes deeply
+// and bind many variables, which is where the scoped NamedValues table does
+// its work: every binding is pushed on entering its scope and popped on
+// leaving it, and every use is a lookup.
+//   scope_bench [depth] [functions]    default: 64 deep, 200 functions
+
+namespace {
+/// nested_vars - Each function binds depth variables, one var per level,
+/// each initialized from the two before it.
+std::string nested_vars(int depth, int functions)
+{
+    std::string src;
+    for (int f = 0; f < functions; ++f)
+    {
+        src += fmt::format("def vars{}(x)\n", f);
+        for (int i = 0; i < depth; ++i)
+            src += fmt::format("    var v{} = {} + {} in\n",
+                i,
+                i > 0 ? fmt::format("v{}", i - 1) : "x",
+                i > 1 ? fmt::format("v{}", i - 2) : "x");
+        src += fmt::format("    v{}\n", depth - 1);
+    }
+    return src;
+}
+
+/// nested_loops - Each function nests depth for loops; every body reads all
+/// the loop variables in scope.
+std::string nested_loops(int depth, int functions)
+{
+    std::string src;
+    for (int f = 0; f < functions; ++f)
+    {
+        src += fmt::format("def loops{}(n)\n", f);
+        for (int i = 0; i < depth; ++i) src += fmt::format("    for i{} = 0, i{} < n in\n", i, i);
+        src += "    n";
+        for (int i = 0; i < depth; ++i) src += fmt::format(" + i{}", i);
+        src += "\n";
+    }
+    return src;
+}
+
+/// shadowing - Each function rebinds one name depth times, so every scope
+/// shadows the one outside it and restores it on the way out.
+std::string shadowing(int depth, int functions)
+{
+    std::string src;
+    for (int f = 0; f < functions; ++f)
+    {
+        src += fmt::format("def shadow{}(a)\n", f);
+        for (int i = 0; i < depth; ++i) src += "    var a = a + 1 in\n";
+        src += "    a\n";
+    }
+    return src;
+}
+}// namespace
+
+int main(int argc, char **argv)
+{
+    int depth = argc > 1 ? std::stoi(argv[1]) : 64;
+    int functions = argc > 2 ? std::stoi(argv[2]) : 200;
+
+    struct program
+    {
+        const char *name;
+        std::string source;
+    };
+    const program programs[] = {
+        { "nested var", nested_vars(depth, functions) },
+        { "nested for", nested_loops(depth, functions) },
+        { "shadowing var", shadowing(depth, functions) },
+    };
+
+    std::size_t sink = 0;
+    auto keep = [&](std::size_t v) { sink += v; };
+    fmt::print("{} functions {} scopes deep\n", functions, depth);
+    for (auto &p : programs)
+    {
+        ToyParser parser;
+        std::istringstream is(p.source);
+        auto unit = parser.MainLoop(SourceBuffer::from_stream(is));
+
+        std::size_t instructions = 0;
+        auto t = bench::best_of(
+            5,
+            [&] {
+                auto mod = codegen(unit.top_expressions);
+                instructions = mod->TheModule->getInstructionCount();
+                return instructions;
+            },
+            keep);
+        fmt::print("{:<14} {:>9.3f} ms  {:>8} instructions\n", p.name, t * 1e3, instructions);
+    }
+    return sink == 0;
+}
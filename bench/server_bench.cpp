@@ -0,0 +1,112 @@
+#include "bench.hpp"
+#include "codegen/ObjectCache.hpp"
+#include "codegen/TargetMachines.hpp"
+#include "codegen/codegen.hpp"
+#include "parser/ToyParser.hpp"
+#include "server/CompileServer.hpp"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Target/TargetOptions.h"
+#include <csignal>
+#include <fmt/format.h>
+#include <sstream>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Latency of many small compiles, each as a new compiler process does it,
+// initializing the targets and creating a TargetMachine first, and sent to
+// a compile server that did that once. A new process also has to start and
+// load LLVM, which this leaves out; toyclient saves that as well.
+//   server_bench [compiles]    default: 200
+
+namespace {
+const char *small_program = "def scale(x) x * 3 + 1\n"
+                            "def count(n) for i = 0, i < n in scale(i)\n"
+                            "def pick(x) if x < 10 then scale(x) else count(x) * 2\n";
+
+std::unique_ptr<llvm::TargetMachine> target_machine()
+{
+    auto TargetTriple = llvm::sys::getDefaultTargetTriple();
+    std::string Error;
+    auto *Target = llvm::TargetRegistry::lookupTarget(TargetTriple, Error);
+    return std::unique_ptr<llvm::TargetMachine>(Target->createTargetMachine(
+        TargetTriple, "generic", "", llvm::TargetOptions(), llvm::None, llvm::None, codegen_opt_level(OptimizationLevel::O0)));
+}
+
+void initialize_targets() { initialize_target(TargetSpec().triple); }
+
+llvm::SmallVector<char, 0> compile(const std::string &source, llvm::TargetMachine &TM)
+{
+    ToyParser parser;
+    std::istringstream is(source);
+    auto unit = parser.MainLoop(SourceBuffer::from_stream(is));
+    auto mod = codegen(unit.top_expressions);
+    return object_code(*mod->TheModule, TM, OptimizationLevel::O0);
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+}// namespace
+
+int main(int argc, char **argv)
+{
+    int compiles = argc > 1 ? std::stoi(argv[1]) : 200;
+    std::string source = small_program;
+
+    // Each compile in a fresh process, forked before anything of LLVM was
+    // set up here, so that it has to be set up every time.
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < compiles; ++i)
+    {
+        auto pid = fork();
+        if (pid == 0)
+        {
+            initialize_targets();
+            auto TM = target_machine();
+            _exit(compile(source, *TM).empty());
+        }
+        waitpid(pid, nullptr, 0);
+    }
+    double cold = seconds_since(start) / compiles;
+
+    llvm::SmallString<128> socket;
+    llvm::sys::fs::getPotentiallyUniqueTempFileName("toy-server-bench", "sock", socket);
+    auto server = fork();
+    if (server == 0)
+    {
+        initialize_targets();
+        auto TM = target_machine();
+        compile(source, *TM);
+        _exit(serve(std::string(socket), 1, [&](const CompileRequest &request, std::string &object) {
+            auto code = compile(request.source, *TM);
+            object.assign(code.begin(), code.end());
+            return 0;
+        }));
+    }
+
+    CompileRequest request;
+    request.source = source;
+    // Wait for the server to listen.
+    while (std::holds_alternative<std::string>(compile_remote(std::string(socket), request))) usleep(1000);
+
+    std::size_t sink = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < compiles; ++i)
+    {
+        auto result = compile_remote(std::string(socket), request);
+        if (auto *done = std::get_if<CompileResult>(&result)) sink += done->object.size();
+    }
+    double served = seconds_since(start) / compiles;
+    kill(server, SIGTERM);
+    waitpid(server, nullptr, 0);
+    llvm::sys::fs::remove(socket);
+
+    fmt::print("{} compiles of {} bytes of source\n", compiles, source.size());
+    fmt::print("{:<28} {:>8.3f} ms per compile\n", "setting up LLVM every time", cold * 1e3);
+    fmt::print("{:<28} {:>8.3f} ms per compile\n", "on a compile server", served * 1e3);
+    return sink == 0;
+}
@@ -0,0 +1,94 @@
+#include "bench.hpp"
+#include "AST/Simplify.hpp"
+#include "codegen/codegen.hpp"
+#include "parser/ToyParser.hpp"
+#include <fmt/format.h>
+#include <sstream>
+
+// Codegen time and IR size of generated code full of literal arithmetic,
+// constant if conditions and calls of a pure helper with literal arguments,
+// as templating tends to produce, with and without running simplify first,
+// and the time simplify itself takes.
+//   simplify_bench [functions]    default: 5000
+
+namespace {
+/// templated - functions that each compute with a chain of literal terms
+/// and a helper's result for literal arguments, and pick a branch by a
+/// literal flag.
+std::string templated(int functions)
+{
+    std::string src = "def power(b n) if n < 1 then 1 else b * power(b, n - 1)\n";
+    for (int f = 0; f < functions; ++f)
+    {
+        src += fmt::format("def templated{}(x)\n", f);
+        src += fmt::format("    var scale = 2 * {} + 1 in\n", f % 7);
+        src += "    if 1 < 2 then\n";
+        src += "        x * 1 * (1 + 2 * 3 - 4)";
+        for (int i = 0; i < 8; ++i) src += fmt::format(" + {} * {}", i, f % 5 + i);
+        src += fmt::format(" + scale * x * power(2, {})\n", f % 10);
+        src += fmt::format("    else\n        x * {} - 1\n", f);
+    }
+    return src;
+}
+
+TranslationUnit parse(const std::string &source)
+{
+    ToyParser parser;
+    std::istringstream is(source);
+    return parser.MainLoop(SourceBuffer::from_stream(is));
+}
+}// namespace
+
+int main(int argc, char **argv)
+{
+    int functions = argc > 1 ? std::stoi(argv[1]) : 5000;
+    auto source = templated(functions);
+
+    std::size_t sink = 0;
+    auto keep = [&](std::size_t v) { sink += v; };
+
+    auto plain = parse(source);
+    std::size_t plain_instructions = 0;
+    auto plain_time = bench::best_of(
+        5,
+        [&] {
+            auto mod = codegen(plain.top_expressions);
+            plain_instructions = mod->TheModule->getInstructionCount();
+            return plain_instructions;
+        },
+        keep);
+
+    // simplify works in place, so each run gets a fresh tree.
+    double simplify_time = 1e300;
+    SimplifyStats stats;
+    for (int i = 0; i < 5; ++i)
+    {
+        auto unit = parse(source);
+        simplify_time = std::min(simplify_time, bench::best_of(1, [&] {
+            stats = simplify(unit);
+            return stats.removed;
+        },
+            keep));
+    }
+
+    auto simplified = parse(source);
+    simplify(simplified);
+    std::size_t simplified_instructions = 0;
+    auto simplified_time = bench::best_of(
+        5,
+        [&] {
+            auto mod = codegen(simplified.top_expressions);
+            simplified_instructions = mod->TheModule->getInstructionCount();
+            return simplified_instructions;
+        },
+        keep);
+
+    fmt::print("{} functions, simplify removed {} nodes and evaluated {} calls in {:.3f} ms\n",
+        functions,
+        stats.removed,
+        stats.evaluated,
+        simplify_time * 1e3);
+    fmt::print("{:<12} {:>9.3f} ms  {:>8} instructions\n", "codegen", plain_time * 1e3, plain_instructions);
+    fmt::print("{:<12} {:>9.3f} ms  {:>8} instructions\n", "simplified", simplified_time * 1e3, simplified_instructions);
+    return sink == 0;
+}
@@ -0,0 +1,128 @@
+#include "bench.hpp"
+#include "codegen/codegen.hpp"
+#include "interpreter/Interpreter.hpp"
+#include "jit/ToyJIT.hpp"
+#include "parser/ToyParser.hpp"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+#include <fmt/format.h>
+#include <sstream>
+
+// Source to result latency of small programs when interpreted (--interpret),
+// run in the JIT (--jit) and compiled to an object file. The object column
+// stops at the object in memory: linking and starting the program come on
+// top. The first run of each path in the process is reported separately from
+// the best of the later ones, and LLVM's one time target initialization,
+// which the interpreter doesn't need, on its own line.
+//   startup_bench
+
+namespace {
+struct program
+{
+    const char *name;
+    const char *source;
+};
+
+const program programs[] = {
+    { "add", "def add(x y) x + y\nadd(1, 2)\n" },
+    { "fib(15)", "def fib(n) if n < 3 then 1 else fib(n - 1) + fib(n - 2)\nfib(15)\n" },
+    { "loop(1000)", "def loop(n) for i = 0, i < n in i * 2\nloop(1000)\n" },
+};
+
+TranslationUnit parse(const char *source)
+{
+    ToyParser parser;
+    std::istringstream is(source);
+    return parser.MainLoop(SourceBuffer::from_stream(is));
+}
+
+double interpreted(const char *source)
+{
+    auto unit = parse(source);
+    Interpreter interp;
+    double result = 0;
+    interpret(unit.top_expressions, interp, [&](double value) { result += value; });
+    return result;
+}
+
+double jitted(const char *source)
+{
+    auto unit = parse(source);
+    auto TheJIT = ToyJIT::create(OptimizationLevel::O0);
+    double result = 0;
+    jit_run(unit.top_expressions, *std::get<0>(TheJIT), [&](double value) { result += value; });
+    return result;
+}
+
+double compiled(const char *source)
+{
+    auto unit = parse(source);
+    auto mod = codegen(unit.top_expressions);
+    auto TargetTriple = llvm::sys::getDefaultTargetTriple();
+    std::string Error;
+    auto *Target = llvm::TargetRegistry::lookupTarget(TargetTriple, Error);
+    std::unique_ptr<llvm::TargetMachine> TM(
+        Target->createTargetMachine(TargetTriple, "generic", "", llvm::TargetOptions(), llvm::None));
+    mod->TheModule->setTargetTriple(TargetTriple);
+    mod->TheModule->setDataLayout(TM->createDataLayout());
+
+    llvm::SmallVector<char, 0> object;
+    llvm::raw_svector_ostream os(object);
+    llvm::legacy::PassManager pass;
+    TM->addPassesToEmitFile(pass, os, nullptr, llvm::CGFT_ObjectFile);
+    pass.run(*mod->TheModule);
+    return static_cast<double>(object.size());
+}
+
+double once(double (*path)(const char *), const char *source, double &sink)
+{
+    return bench::best_of(1, [&] { return path(source); }, [&](double v) { sink += v; });
+}
+}// namespace
+
+int main()
+{
+    double sink = 0;
+    fmt::print("{:<12} {:>24} {:>24} {:>24}\n", "", "interpret first/best", "jit first/best", "object first/best");
+
+    // Everything first runs once per path, the interpreter before LLVM is set
+    // up at all.
+    std::vector<std::array<double, 3>> first;
+    for (auto &p : programs) first.push_back({ once(interpreted, p.source, sink), 0, 0 });
+    auto init = bench::best_of(
+        1,
+        [] {
+            llvm::InitializeNativeTarget();
+            llvm::InitializeNativeTargetAsmPrinter();
+            return 0.0;
+        },
+        [](double) {});
+    for (std::size_t i = 0; i < std::size(programs); ++i)
+    {
+        first[i][1] = once(jitted, programs[i].source, sink);
+        first[i][2] = once(compiled, programs[i].source, sink);
+    }
+
+    for (std::size_t i = 0; i < std::size(programs); ++i)
+    {
+        auto *source = programs[i].source;
+        auto keep = [&](double v) { sink += v; };
+        auto interpret_time = bench::best_of(20, [&] { return interpreted(source); }, keep);
+        auto jit_time = bench::best_of(20, [&] { return jitted(source); }, keep);
+        auto object_time = bench::best_of(20, [&] { return compiled(source); }, keep);
+        fmt::print("{:<12} {:>10.3f} / {:>7.3f} ms {:>10.3f} / {:>7.3f} ms {:>10.3f} / {:>7.3f} ms\n",
+            programs[i].name,
+            first[i][0] * 1e3,
+            interpret_time * 1e3,
+            first[i][1] * 1e3,
+            jit_time * 1e3,
+            first[i][2] * 1e3,
+            object_time * 1e3);
+    }
+    fmt::print("native target initialization, JIT and object only: {:.3f} ms\n", init * 1e3);
+    return sink == 0;
+}
@@ -0,0 +1,131 @@
+#include "bench.hpp"
+#include "codegen/ObjectCache.hpp"
+#include "codegen/TargetMachines.hpp"
+#include "codegen/codegen.hpp"
+#include "parser/ToyParser.hpp"
+#include <fmt/format.h>
+#include <sstream>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Wall-clock time a new compiler process takes to set up its target and
+// generate a small module's object code, once and for a run of modules
+// (the units of --jobs, or a compile server's requests): initializing all
+// of LLVM's backends and creating a TargetMachine per module, as the driver
+// used to, against initializing the host's backend only and reusing one
+// TargetMachine. Every run is in a process forked before LLVM was touched,
+// so nothing is set up yet; the best of several runs is reported.
+//   target_bench [runs]    default: 20
+
+namespace {
+const char *small_program = "def scale(x) x * 3 + 1\n"
+                            "def count(n) for i = 0, i < n in scale(i)\n";
+
+enum class setup { all_targets, host_target };
+
+/// compile_modules - Set up the target as s says, then generate modules
+/// objects. Returns the seconds spent on setting up and creating
+/// TargetMachines, and in total.
+std::pair<double, double> compile_modules(setup s, int modules)
+{
+    auto start = std::chrono::steady_clock::now();
+    double setup_time = 0;
+    auto since = [](std::chrono::steady_clock::time_point from) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - from).count();
+    };
+
+    if (s == setup::all_targets)
+    {
+        llvm::InitializeAllTargetInfos();
+        llvm::InitializeAllTargets();
+        llvm::InitializeAllTargetMCs();
+        llvm::InitializeAllAsmParsers();
+        llvm::InitializeAllAsmPrinters();
+    }
+    else
+        initialize_target(TargetSpec().triple);
+    setup_time += since(start);
+
+    std::size_t sink = 0;
+    for (int i = 0; i < modules; ++i)
+    {
+        ToyParser parser;
+        std::istringstream is(small_program);
+        auto unit = parser.MainLoop(SourceBuffer::from_stream(is));
+        auto mod = codegen(unit.top_expressions);
+
+        auto created = std::chrono::steady_clock::now();
+        std::unique_ptr<llvm::TargetMachine> own;
+        std::optional<std::variant<TargetMachines::Lease, std::string>> lease;
+        llvm::TargetMachine *TM;
+        if (s == setup::all_targets)
+        {
+            TargetSpec target;
+            std::string Error;
+            own.reset(llvm::TargetRegistry::lookupTarget(target.triple, Error)
+                          ->createTargetMachine(target.triple,
+                              target.cpu,
+                              "",
+                              llvm::TargetOptions(),
+                              llvm::None,
+                              llvm::None,
+                              codegen_opt_level(OptimizationLevel::O0)));
+            TM = own.get();
+        }
+        else
+        {
+            lease.emplace(target_machines().acquire(TargetSpec(), OptimizationLevel::O0));
+            TM = &*std::get<0>(*lease);
+        }
+        setup_time += since(created);
+        sink += object_code(*mod->TheModule, *TM, OptimizationLevel::O0).size();
+    }
+    if (sink == 0) std::abort();
+    return { setup_time, since(start) };
+}
+
+/// cold - compile_modules in a new process, best of runs.
+std::pair<double, double> cold(setup s, int modules, int runs)
+{
+    std::pair<double, double> best{ 1e300, 1e300 };
+    for (int run = 0; run < runs; ++run)
+    {
+        int results[2];
+        if (pipe(results) != 0) std::abort();
+        auto pid = fork();
+        if (pid == 0)
+        {
+            auto times = compile_modules(s, modules);
+            _exit(write(results[1], &times, sizeof(times)) == sizeof(times) ? 0 : 1);
+        }
+        close(results[1]);
+        std::pair<double, double> times;
+        if (read(results[0], &times, sizeof(times)) != sizeof(times)) std::abort();
+        close(results[0]);
+        waitpid(pid, nullptr, 0);
+        best.first = std::min(best.first, times.first);
+        best.second = std::min(best.second, times.second);
+    }
+    return best;
+}
+}// namespace
+
+int main(int argc, char **argv)
+{
+    int runs = argc > 1 ? std::stoi(argv[1]) : 20;
+    fmt::print("{:<34} {:>10} {:>10}\n", "", "setup", "total");
+    for (int modules : { 1, 64 })
+    {
+        auto all = cold(setup::all_targets, modules, runs);
+        auto host = cold(setup::host_target, modules, runs);
+        fmt::print("{:<34} {:>7.3f} ms {:>7.3f} ms\n",
+            fmt::format("{} module(s), all targets, TM each", modules),
+            all.first * 1e3,
+            all.second * 1e3);
+        fmt::print("{:<34} {:>7.3f} ms {:>7.3f} ms\n",
+            fmt::format("{} module(s), host, TM reused", modules),
+            host.first * 1e3,
+            host.second * 1e3);
+    }
+    return 0;
+}
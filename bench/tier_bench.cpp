@@ -0,0 +1,98 @@
+#include "bench.hpp"
+#include "bytecode/BytecodeCompiler.hpp"
+#include "bytecode/VM.hpp"
+#include "jit/Tiered.hpp"
+#include "jit/ToyJIT.hpp"
+#include "parser/ToyParser.hpp"
+#include "llvm/Support/TargetSelect.h"
+#include <fmt/format.h>
+#include <sstream>
+
+// Source to result time of --tiered against staying in the VM (--vm) and
+// compiling everything up front with the JIT (--jit) at -O0 and -O3, for a
+// program that never gets hot, and for ones whose time goes into a few hot
+// functions. Each time is the best of a few runs in a fresh runtime.
+//   tier_bench [hot]
+
+namespace {
+struct program
+{
+    const char *name;
+    const char *source;
+};
+
+const program programs[] = {
+    { "setup only",
+        "def scale(x) x * 3\n"
+        "def offset(x) x + 7\n"
+        "def clamp(x) if x < 0 then 0 else x\n"
+        "scale(2)\noffset(5)\nclamp(0 - 4)\n" },
+    { "fib(30)", "def fib(n) if n < 3 then 1 else fib(n - 1) + fib(n - 2)\nfib(30)\n" },
+    { "kernel x 20000",
+        "def kernel(n) for i = 0, i < n in i * 2\n"
+        "def drive(k) for j = 0, j < k in kernel(1000)\n"
+        "drive(20000)\n" },
+};
+
+TranslationUnit parse(const char *source)
+{
+    ToyParser parser;
+    std::istringstream is(source);
+    return parser.MainLoop(SourceBuffer::from_stream(is));
+}
+
+double vm(const char *source)
+{
+    auto unit = parse(source);
+    BytecodeModule module;
+    compile_program(unit.top_expressions, module);
+    VM vm(module);
+    double result = 0;
+    vm_run(module, vm, [&](double value) { result += value; });
+    return result;
+}
+
+double tiered(const char *source, uint32_t hot)
+{
+    auto unit = parse(source);
+    auto runtime = TieredRuntime::create(unit.top_expressions, hot);
+    double result = 0;
+    runtime->run([&](double value) { result += value; });
+    return result;
+}
+
+double jitted(const char *source, OptimizationLevel level)
+{
+    auto unit = parse(source);
+    auto TheJIT = ToyJIT::create(level);
+    double result = 0;
+    jit_run(unit.top_expressions, *std::get<0>(TheJIT), [&](double value) { result += value; });
+    return result;
+}
+}// namespace
+
+int main(int argc, char **argv)
+{
+    uint32_t hot = argc > 1 ? static_cast<uint32_t>(std::stoul(argv[1])) : 1000;
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+
+    double sink = 0;
+    auto keep = [&](double v) { sink += v; };
+    fmt::print("hot after {} calls and loop iterations\n", hot);
+    fmt::print("{:<16} {:>12} {:>12} {:>12} {:>12}\n", "", "vm", "tiered", "jit -O0", "jit -O3");
+    for (auto &p : programs)
+    {
+        auto vm_time = bench::best_of(3, [&] { return vm(p.source); }, keep);
+        auto tiered_time = bench::best_of(3, [&] { return tiered(p.source, hot); }, keep);
+        auto o0_time = bench::best_of(3, [&] { return jitted(p.source, OptimizationLevel::O0); }, keep);
+        auto o3_time = bench::best_of(3, [&] { return jitted(p.source, OptimizationLevel::O3); }, keep);
+        fmt::print("{:<16} {:>9.3f} ms {:>9.3f} ms {:>9.3f} ms {:>9.3f} ms\n",
+            p.name,
+            vm_time * 1e3,
+            tiered_time * 1e3,
+            o0_time * 1e3,
+            o3_time * 1e3);
+    }
+    return sink == 0;
+}
@@ -0,0 +1,136 @@
+#include "bench.hpp"
+#include "bytecode/BytecodeCompiler.hpp"
+#include "bytecode/VM.hpp"
+#include "interpreter/Interpreter.hpp"
+#include "jit/ToyJIT.hpp"
+#include "parser/ToyParser.hpp"
+#include "llvm/Support/TargetSelect.h"
+#include <fmt/format.h>
+#include <sstream>
+
+// The bytecode VM (--vm) against the tree walking interpreter (--interpret)
+// and the JIT (--jit). "run" times only execution, of a program parsed (and
+// for the VM compiled) beforehand, with the VM's rate in bytecode
+// instructions per second. The end to end columns go from source to result;
+// "vm bytes" starts from the serialized bytecode instead, as --vm does with a
+// file written by --emit-bytecode.
+//   vm_bench
+
+namespace {
+struct program
+{
+    const char *name;
+    const char *source;
+};
+
+const program programs[] = {
+    { "fib(25)", "def fib(n) if n < 3 then 1 else fib(n - 1) + fib(n - 2)\nfib(25)\n" },
+    { "loop(1e6)", "def loop(n) for i = 0, i < n in i * 2\nloop(1000000)\n" },
+    { "nested(1000)",
+        "def inner(n) for j = 0, j < n in j\n"
+        "def outer(n) for i = 0, i < n in inner(n)\n"
+        "outer(1000)\n" },
+};
+
+TranslationUnit parse(const char *source)
+{
+    ToyParser parser;
+    std::istringstream is(source);
+    return parser.MainLoop(SourceBuffer::from_stream(is));
+}
+
+BytecodeModule compiled(TranslationUnit &unit)
+{
+    BytecodeModule module;
+    compile_program(unit.top_expressions, module);
+    return module;
+}
+
+double vm_result(const BytecodeModule &module)
+{
+    VM vm(module);
+    double result = 0;
+    vm_run(module, vm, [&](double value) { result += value; });
+    return result;
+}
+}// namespace
+
+int main()
+{
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+
+    double sink = 0;
+    auto keep = [&](double v) { sink += v; };
+    fmt::print("{:<14} {:>14} {:>14} {:>10}   {:>12} {:>12} {:>12} {:>12}\n",
+        "",
+        "interpret run",
+        "vm run",
+        "vm Minst/s",
+        "interpret",
+        "vm",
+        "vm bytes",
+        "jit");
+
+    for (auto &p : programs)
+    {
+        auto unit = parse(p.source);
+        auto module = compiled(unit);
+        auto bytes = serialize(module);
+
+        auto interpret_run = bench::best_of(
+            5,
+            [&] {
+                Interpreter interp;
+                double result = 0;
+                interpret(unit.top_expressions, interp, [&](double value) { result += value; });
+                return result;
+            },
+            keep);
+        auto vm_run_time = bench::best_of(5, [&] { return vm_result(module); }, keep);
+
+        uint64_t executed = 0;
+        VM counting(module);
+        for (auto index : module.top_level) sink += counting.run<true>(index, &executed).value_or(0);
+
+        auto interpret_total = bench::best_of(
+            5,
+            [&] {
+                auto fresh = parse(p.source);
+                Interpreter interp;
+                double result = 0;
+                interpret(fresh.top_expressions, interp, [&](double value) { result += value; });
+                return result;
+            },
+            keep);
+        auto vm_total = bench::best_of(
+            5,
+            [&] {
+                auto fresh = parse(p.source);
+                return vm_result(compiled(fresh));
+            },
+            keep);
+        auto vm_bytes = bench::best_of(5, [&] { return vm_result(std::get<BytecodeModule>(deserialize(bytes))); }, keep);
+        auto jit_total = bench::best_of(
+            5,
+            [&] {
+                auto fresh = parse(p.source);
+                auto TheJIT = ToyJIT::create(OptimizationLevel::O0);
+                double result = 0;
+                jit_run(fresh.top_expressions, *std::get<0>(TheJIT), [&](double value) { result += value; });
+                return result;
+            },
+            keep);
+
+        fmt::print("{:<14} {:>11.3f} ms {:>11.3f} ms {:>10.1f}   {:>9.3f} ms {:>9.3f} ms {:>9.3f} ms {:>9.3f} ms\n",
+            p.name,
+            interpret_run * 1e3,
+            vm_run_time * 1e3,
+            static_cast<double>(executed) / vm_run_time / 1e6,
+            interpret_total * 1e3,
+            vm_total * 1e3,
+            vm_bytes * 1e3,
+            jit_total * 1e3);
+    }
+    return sink == 0;
+}
@@ -2,46 +2,97 @@
 #include "AST.hpp"
 #include "../misc/util.hpp"
 #include <fmt/format.h>
+#include <mutex>
 
-std::map<std::string, uint32_t> BinopPrecedence{ { "<", 10 }, { "+", 20 }, { "-", 20 }, { "*", 40 } };
+std::map<std::string, uint32_t, std::less<>> BinopPrecedence{ { "=", 2 }, { "<", 10 }, { "+", 20 }, { "-", 20 }, { "*", 40 } };
+
+// Functions may be generated on several threads at once (see codegen.hpp), so
+// codegen goes through these to change the operator table.
+static std::mutex BinopPrecedenceMutex;
+
+void installBinop(std::string_view Name, uint32_t Precedence)
+{
+    std::lock_guard<std::mutex> lock(BinopPrecedenceMutex);
+    BinopPrecedence[std::string(Name)] = Precedence;
+}
+
+void removeBinop(std::string_view Name)
+{
+    std::lock_guard<std::mutex> lock(BinopPrecedenceMutex);
+    if (auto it = BinopPrecedence.find(Name); it != BinopPrecedence.end()) BinopPrecedence.erase(it);
+}
 
 llvm::Value *LogErrorV(std::string_view Str) { return util::logError<llvm::Value *>(Str); }
 
-llvm::Function *getFunction(std::string Name, CodeModule &code_module)
+llvm::StringRef getSymbolName(Symbol Name)
+{
+    auto name = symbols().name(Name);
+    return { name.data(), name.size() };
+}
+
+llvm::Function *getFunction(Symbol Name, CodeModule &code_module)
 {
     // First, see if the function has already been added to the current module.
-    if (auto *F = code_module.TheModule->getFunction(Name)) return F;
+    if (auto *F = code_module.TheModule->getFunction(getSymbolName(Name))) return F;
 
     // If not, check whether we can codegen the declaration from some existing
     // prototype.
-    auto FI = code_module.FunctionProtos.find(Name);
-    if (FI != code_module.FunctionProtos.end()) return FI->second->codegen(code_module);
+    if (auto &Proto = code_module.FunctionProtos[Name]) return Proto->codegen(code_module);
 
     // If no existing prototype exists, return null.
     return nullptr;
 }
 
-/// CreateEntryBlockAlloca - Create an alloca instruction in the entry block of
-/// the function.  This is used for mutable variables etc.
-llvm::AllocaInst *CreateEntryBlockAlloca(llvm::Function *TheFunction, llvm::StringRef VarName, CodeModule &code_module)
+llvm::Value *readVariable(SSAVariable V, CodeModule &code_module)
+{
+    return code_module.SSA.read(V, code_module.Builder.GetInsertBlock());
+}
+
+void writeVariable(SSAVariable V, llvm::Value *Val, CodeModule &code_module)
+{
+    code_module.SSA.write(V, code_module.Builder.GetInsertBlock(), Val);
+}
+
+/// elementAddress - The address of element Index of the array named Array,
+/// after checking Index is within its bounds. Indexing with the variable of
+/// a counted loop uses the loop's i64, which needs no conversion, and no
+/// check either if the loop checked its range before it started.
+static llvm::Value *elementAddress(Symbol Array, ExprAST *Index, CodeModule &code_module)
 {
-    llvm::IRBuilder<> TmpB(&TheFunction->getEntryBlock(), TheFunction->getEntryBlock().begin());
-    return TmpB.CreateAlloca(llvm::Type::getDoubleTy(code_module.TheContext), nullptr, VarName);
+    auto &Builder = code_module.Builder;
+    ArrayValue A = code_module.NamedArrays.lookup(Array);
+    if (!A) return LogErrorV(fmt::format("Unknown array name: {}", symbols().name(Array)));
+
+    if (auto Name = Index->getVariable())
+    {
+        if (auto *Loop = code_module.countedLoop(code_module.NamedValues.lookup(*Name)))
+        {
+            if (!llvm::is_contained(Loop->InBounds, A.Data))
+                array_trap(Builder, code_module.SSA, Builder.CreateICmpULT(Loop->Counter, A.Length));
+            return array_element(Builder, A, Loop->Counter);
+        }
+    }
+
+    llvm::Value *IndexVal = Index->codegen(code_module);
+    if (!IndexVal) return nullptr;
+    return array_element(Builder, A, array_index(Builder, code_module.SSA, A, IndexVal));
 }
 
 llvm::Value *NumberExprAST::codegen(CodeModule &code_module)
 {
-    return llvm::ConstantFP::get(code_module.TheContext, llvm::APFloat(Val));
+    return llvm::ConstantFP::get(*code_module.TheContext, llvm::APFloat(Val));
 }
 
 llvm::Value *VariableExprAST::codegen(CodeModule &code_module)
 {
     // Look this variable up in the function.
-    llvm::Value *V = code_module.NamedValues[Name];
-    if (!V) return LogErrorV(fmt::format("Unknown variable name: {}", Name));
+    SSAVariable V = code_module.NamedValues.lookup(Name);
+    if (!V && code_module.NamedArrays.lookup(Name))
+        return LogErrorV(fmt::format("{} is an array: index it, or pass it for an array parameter", symbols().name(Name)));
+    if (!V) return LogErrorV(fmt::format("Unknown variable name: {}", symbols().name(Name)));
 
-    // Load the value.
-    return code_module.Builder.CreateLoad(V, Name.c_str());
+    // Its value here.
+    return readVariable(V, code_module);
 }
 
 llvm::Value *UnaryExprAST::codegen(CodeModule &code_module)
@@ -49,7 +100,7 @@ llvm::Value *UnaryExprAST::codegen(CodeModule &code_module)
     llvm::Value *OperandV = Operand->codegen(code_module);
     if (!OperandV) return nullptr;
 
-    llvm::Function *F = getFunction(std::string("unary") + Opcode, code_module);
+    llvm::Function *F = getFunction(symbols().lookup(std::string("unary") + Opcode), code_module);
     if (!F) return LogErrorV("Unknown unary operator");
 
     return code_module.Builder.CreateCall(F, OperandV, "unop");
@@ -60,21 +111,32 @@ llvm::Value *BinaryExprAST::codegen(CodeModule &code_module)
     // Special case '=' because we don't want to emit the LHS as an expression.
     if (Op == '=')
     {
+        // Or an array element, which is stored to.
+        if (auto Element = LHS->getElement())
+        {
+            llvm::Value *Val = RHS->codegen(code_module);
+            if (!Val) return nullptr;
+            llvm::Value *Address = elementAddress(Element->first, Element->second, code_module);
+            if (!Address) return nullptr;
+            code_module.Builder.CreateAlignedStore(Val, Address, llvm::Align(sizeof(double)));
+            return Val;
+        }
+
         // Assignment requires the LHS to be an identifier.
         // This assume we're building without RTTI because LLVM builds that way by
         // default.  If you build LLVM with RTTI this can be changed to a
         // dynamic_cast for automatic error checking.
-        VariableExprAST *LHSE = static_cast<VariableExprAST *>(LHS.get());
+        VariableExprAST *LHSE = static_cast<VariableExprAST *>(LHS);
         if (!LHSE) return LogErrorV("destination of '=' must be a variable");
         // Codegen the RHS.
         llvm::Value *Val = RHS->codegen(code_module);
         if (!Val) return nullptr;
 
         // Look up the name.
-        llvm::Value *Variable = code_module.NamedValues[LHSE->getName()];
+        SSAVariable Variable = code_module.NamedValues.lookup(LHSE->getName());
         if (!Variable) return LogErrorV("Unknown variable name");
 
-        code_module.Builder.CreateStore(Val, Variable);
+        writeVariable(Variable, Val, code_module);
         return Val;
     }
 
@@ -93,14 +155,14 @@ llvm::Value *BinaryExprAST::codegen(CodeModule &code_module)
     case '<':
         L = code_module.Builder.CreateFCmpULT(L, R, "cmptmp");
         // Convert bool 0/1 to double 0.0 or 1.0
-        return code_module.Builder.CreateUIToFP(L, llvm::Type::getDoubleTy(code_module.TheContext), "booltmp");
+        return code_module.Builder.CreateUIToFP(L, llvm::Type::getDoubleTy(*code_module.TheContext), "booltmp");
     default:
         break;
     }
 
     // If it wasn't a builtin binary operator, it must be a user defined one. Emit
     // a call to it.
-    llvm::Function *F = getFunction(std::string("binary") + Op, code_module);
+    llvm::Function *F = getFunction(symbols().lookup(std::string("binary") + Op), code_module);
     assert(F && "binary operator not found!");
 
     llvm::Value *Ops[] = { L, R };
@@ -113,12 +175,26 @@ llvm::Value *CallExprAST::codegen(CodeModule &code_module)
     llvm::Function *CalleeF = getFunction(Callee, code_module);
     if (!CalleeF) return LogErrorV("Unknown function referenced");
 
-    // If argument mismatch error.
-    if (CalleeF->arg_size() != Args.size()) return LogErrorV("Incorrect # arguments passed");
+    // If argument mismatch error. An array parameter is two, a pointer and
+    // a length.
+    std::size_t Params = CalleeF->arg_size();
+    for (auto &Param : CalleeF->args()) Params -= Param.getType()->isPointerTy();
+    if (Params != Args.size()) return LogErrorV("Incorrect # arguments passed");
 
     std::vector<llvm::Value *> ArgsV;
     for (size_t i = 0, e = Args.size(); i != e; ++i)
     {
+        if (CalleeF->getArg(static_cast<unsigned>(ArgsV.size()))->getType()->isPointerTy())
+        {
+            auto Name = Args[i]->getVariable();
+            ArrayValue A = Name ? code_module.NamedArrays.lookup(*Name) : ArrayValue{};
+            if (!A)
+                return LogErrorV(
+                    fmt::format("Expected an array for argument {} of {}", i + 1, symbols().name(Callee)));
+            ArgsV.push_back(A.Data);
+            ArgsV.push_back(A.Length);
+            continue;
+        }
         ArgsV.push_back(Args[i]->codegen(code_module));
         if (!ArgsV.back()) return nullptr;
     }
@@ -133,17 +209,19 @@ llvm::Value *IfExprAST::codegen(CodeModule &code_module)
 
     // Convert condition to a bool by comparing non-equal to 0.0.
     CondV = code_module.Builder.CreateFCmpONE(
-        CondV, llvm::ConstantFP::get(code_module.TheContext, llvm::APFloat(0.0)), "ifcond");
+        CondV, llvm::ConstantFP::get(*code_module.TheContext, llvm::APFloat(0.0)), "ifcond");
 
     llvm::Function *TheFunction = code_module.Builder.GetInsertBlock()->getParent();
 
     // Create blocks for the then and else cases.  Insert the 'then' block at the
     // end of the function.
-    llvm::BasicBlock *ThenBB = llvm::BasicBlock::Create(code_module.TheContext, "then", TheFunction);
-    llvm::BasicBlock *ElseBB = llvm::BasicBlock::Create(code_module.TheContext, "else");
-    llvm::BasicBlock *MergeBB = llvm::BasicBlock::Create(code_module.TheContext, "ifcont");
+    llvm::BasicBlock *ThenBB = llvm::BasicBlock::Create(*code_module.TheContext, "then", TheFunction);
+    llvm::BasicBlock *ElseBB = llvm::BasicBlock::Create(*code_module.TheContext, "else");
+    llvm::BasicBlock *MergeBB = llvm::BasicBlock::Create(*code_module.TheContext, "ifcont");
 
     code_module.Builder.CreateCondBr(CondV, ThenBB, ElseBB);
+    code_module.SSA.seal(ThenBB);
+    code_module.SSA.seal(ElseBB);
 
     // Emit then value.
     code_module.Builder.SetInsertPoint(ThenBB);
@@ -169,123 +247,255 @@ llvm::Value *IfExprAST::codegen(CodeModule &code_module)
     // Emit merge block.
     TheFunction->getBasicBlockList().push_back(MergeBB);
     code_module.Builder.SetInsertPoint(MergeBB);
-    llvm::PHINode *PN = code_module.Builder.CreatePHI(llvm::Type::getDoubleTy(code_module.TheContext), 2, "iftmp");
+    code_module.SSA.seal(MergeBB);
+    llvm::PHINode *PN = code_module.Builder.CreatePHI(llvm::Type::getDoubleTy(*code_module.TheContext), 2, "iftmp");
 
     PN->addIncoming(ThenV, ThenBB);
     PN->addIncoming(ElseV, ElseBB);
     return PN;
 }
 
+/// isInvariant - Whether E has the same value in every iteration of a loop
+/// with variable Var that assigns to Assigned: it is made of numbers, other
+/// variables the loop doesn't assign, array lengths and the builtin
+/// arithmetic operators, so it can also be computed once before the loop.
+static bool isInvariant(ExprAST *E, Symbol Var, const std::vector<Symbol> &Assigned)
+{
+    if (E->getNumber() || E->getLength()) return true;
+    if (auto Read = E->getVariable()) return *Read != Var && !llvm::is_contained(Assigned, *Read);
+    if (auto Binary = E->getBinary())
+    {
+        auto [Op, L, R] = *Binary;
+        return (Op == '+' || Op == '-' || Op == '*') && isInvariant(L, Var, Assigned) && isInvariant(R, Var, Assigned);
+    }
+    return false;
+}
+
 // Output for-loop as:
-//   var = alloca double
 //   ...
 //   start = startexpr
-//   store start -> var
 //   goto loop
 // loop:
+//   variable = phi [start, loopheader], [nextvariable, loopend]
 //   ...
 //   bodyexpr
 //   ...
 // loopend:
 //   step = stepexpr
 //   endcond = endexpr
-//
-//   curvar = load var
-//   nextvar = curvar + step
-//   store nextvar -> var
+//   nextvariable = variable + step
 //   br endcond, loop, endloop
 // outloop:
+// The phis for the loop variable and anything the body assigns are placed
+// by code_module.SSA, which can only complete them once the loop's back edge
+// exists.
+//
+// A loop from a whole number by a whole step while 'variable < bound', with
+// a bound the loop doesn't change, counts with an i64 instead, from which
+// the variable is converted; see counted_bound. The loop's hints go on the
+// branch back to the header.
+//
+// If such a loop starts at 0 or more and its body indexes arrays with just
+// the variable, the largest value the body sees is compared with their
+// lengths once before the loop: if all are greater, a copy of the loop that
+// doesn't check those indices runs, else one that does.
 llvm::Value *ForExprAST::codegen(CodeModule &code_module)
 {
-    llvm::Function *TheFunction = code_module.Builder.GetInsertBlock()->getParent();
-
-    // Create an alloca for the variable in the entry block.
-    llvm::AllocaInst *Alloca = CreateEntryBlockAlloca(TheFunction, VarName, code_module);
+    auto &Builder = code_module.Builder;
+    llvm::Function *TheFunction = Builder.GetInsertBlock()->getParent();
 
     // Emit the start code first, without 'variable' in scope.
     llvm::Value *StartVal = Start->codegen(code_module);
     if (!StartVal) return nullptr;
 
-    // Store the value into the alloca.
-    code_module.Builder.CreateStore(StartVal, Alloca);
-
-    // Make the new basic block for the loop header, inserting after current
-    // block.
-    llvm::BasicBlock *LoopBB = llvm::BasicBlock::Create(code_module.TheContext, "loop", TheFunction);
-
-    // Insert an explicit fall through from the current block to the LoopBB.
-    code_module.Builder.CreateBr(LoopBB);
-
-    // Start insertion in LoopBB.
-    code_module.Builder.SetInsertPoint(LoopBB);
-
-    // Within the loop, the variable is defined equal to the PHI node.  If it
-    // shadows an existing variable, we have to restore it, so save it now.
-    llvm::AllocaInst *OldVal = code_module.NamedValues[VarName];
-    code_module.NamedValues[VarName] = Alloca;
-
-    // Emit the body of the loop.  This, like any other expr, can change the
-    // current BB.  Note that we ignore the value computed by the body, but don't
-    // allow an error.
-    if (!Body->codegen(code_module)) return nullptr;
-
-    // Emit the step value.
-    llvm::Value *StepVal = nullptr;
-    if (Step)
+    SSAVariable Variable = code_module.SSA.create(getSymbolName(VarName));
+    writeVariable(Variable, StartVal, code_module);
+
+    // Only the variable and those the loop assigns to can change around the
+    // back edge; anything else read inside keeps its value from before.
+    std::vector<Symbol> Assigned;
+    End->collectAssigned(Assigned);
+    if (Step) Step->collectAssigned(Assigned);
+    Body->collectAssigned(Assigned);
+
+    auto From = counted_start(Start->getNumber());
+    auto By = Step ? counted_step(Step->getNumber()) : std::optional<int64_t>(1);
+    // A loop that assigns its variable itself has to keep it in a double.
+    ExprAST *BoundExpr = nullptr;
+    if (auto Compare = End->getBinary(); Compare && std::get<0>(*Compare) == '<'
+                                         && std::get<1>(*Compare)->getVariable() == VarName
+                                         && isInvariant(std::get<2>(*Compare), VarName, Assigned)
+                                         && !llvm::is_contained(Assigned, VarName))
+        BoundExpr = std::get<2>(*Compare);
+    llvm::Value *Bound = nullptr;
+    if (From && By && BoundExpr)
     {
-        StepVal = Step->codegen(code_module);
-        if (!StepVal) return nullptr;
+        llvm::Value *EndVal = BoundExpr->codegen(code_module);
+        if (!EndVal) return nullptr;
+        Bound = counted_bound(Builder, EndVal);
     }
-    else
+
+    // The body sees the start, then each value up to the first that isn't
+    // below the bound.
+    llvm::SmallVector<llvm::Value *, 4> InBounds;
+    llvm::Value *AllInBounds = nullptr;
+    if (Bound && *From >= 0)
     {
-        // If not specified, use 1.0.
-        StepVal = llvm::ConstantFP::get(code_module.TheContext, llvm::APFloat(1.0));
+        std::vector<Symbol> Indexed;
+        Body->collectIndexed(VarName, Indexed);
+        llvm::Value *Last = nullptr;
+        for (Symbol Name : Indexed)
+        {
+            ArrayValue A = code_module.NamedArrays.lookup(Name);
+            if (!A || llvm::is_contained(InBounds, A.Data)) continue;
+            if (!Last)
+            {
+                Last = Builder.CreateAdd(Bound, counted_constant(Builder, *By - 1), "last");
+                Last = Builder.CreateSelect(Builder.CreateICmpSGT(Last, counted_constant(Builder, *From)), Last,
+                    counted_constant(Builder, *From), "last");
+            }
+            llvm::Value *Below = Builder.CreateICmpSLT(Last, A.Length, "inbounds");
+            AllInBounds = AllInBounds ? Builder.CreateAnd(AllInBounds, Below, "inbounds") : Below;
+            InBounds.push_back(A.Data);
+        }
     }
 
-    // Compute the end condition.
-    llvm::Value *EndCond = End->codegen(code_module);
-    if (!EndCond) return nullptr;
+    llvm::BasicBlock *PreheaderBB = Builder.GetInsertBlock();
+    llvm::BasicBlock *AfterBB = llvm::BasicBlock::Create(*code_module.TheContext, "afterloop");
+
+    // Emit the loop from header LoopBB to the branch to AfterBB, with the
+    // indices into the arrays in Unchecked not checked, and CopyHints; Copy
+    // says which copy it is in the loop report.
+    auto EmitLoop = [&](llvm::BasicBlock *LoopBB,
+                        llvm::ArrayRef<llvm::Value *> Unchecked,
+                        LoopHints CopyHints,
+                        LoopName::Copy Copy) {
+        // Start insertion in LoopBB.
+        Builder.SetInsertPoint(LoopBB);
+        llvm::PHINode *Counter = nullptr;
+        if (Bound)
+        {
+            Counter = Builder.CreatePHI(Builder.getInt64Ty(), 2, getSymbolName(VarName));
+            Counter->addIncoming(counted_constant(Builder, *From), PreheaderBB);
+            writeVariable(
+                Variable, Builder.CreateSIToFP(Counter, Builder.getDoubleTy(), getSymbolName(VarName)), code_module);
+        }
 
-    // Reload, increment, and restore the alloca.  This handles the case where
-    // the body of the loop mutates the variable.
-    llvm::Value *CurVar = code_module.Builder.CreateLoad(Alloca, VarName.c_str());
-    llvm::Value *NextVar = code_module.Builder.CreateFAdd(CurVar, StepVal, "nextvar");
-    code_module.Builder.CreateStore(NextVar, Alloca);
+        // Within the loop, the variable is defined equal to the PHI node.
+        // Binding it in a new scope saves any variable it shadows.
+        auto Scope = code_module.NamedValues.scope();
+        code_module.NamedValues.bind(VarName, Variable);
 
-    // Convert condition to a bool by comparing non-equal to 0.0.
-    EndCond = code_module.Builder.CreateFCmpONE(
-        EndCond, llvm::ConstantFP::get(code_module.TheContext, llvm::APFloat(0.0)), "loopcond");
+        llvm::SmallVector<SSAVariable, 8> Changing;
+        if (!Bound) Changing.push_back(Variable);
+        for (Symbol Name : Assigned)
+        {
+            if (SSAVariable V = code_module.NamedValues.lookup(Name)) Changing.push_back(V);
+        }
+        code_module.SSA.loop(LoopBB, Changing);
+
+        // Emit the body of the loop.  This, like any other expr, can change
+        // the current BB.  Note that we ignore the value computed by the
+        // body, but don't allow an error.
+        if (Counter) code_module.CountedLoops.push_back({ Variable, Counter, { Unchecked.begin(), Unchecked.end() } });
+        bool BodyOk = Body->codegen(code_module);
+        if (Counter) code_module.CountedLoops.pop_back();
+        if (!BodyOk) return false;
+
+        llvm::Value *EndCond = nullptr;
+        if (Bound)
+        {
+            llvm::Value *Next = Builder.CreateNSWAdd(Counter, counted_constant(Builder, *By), "next");
+            Counter->addIncoming(Next, Builder.GetInsertBlock());
+            EndCond = Builder.CreateICmpSLT(Counter, Bound, "loopcond");
+        }
+        else
+        {
+            // Emit the step value.
+            llvm::Value *StepVal = nullptr;
+            if (Step)
+            {
+                StepVal = Step->codegen(code_module);
+                if (!StepVal) return false;
+            }
+            else
+            {
+                // If not specified, use 1.0.
+                StepVal = llvm::ConstantFP::get(*code_module.TheContext, llvm::APFloat(1.0));
+            }
+
+            // Compute the end condition.
+            EndCond = End->codegen(code_module);
+            if (!EndCond) return false;
+
+            // Increment the variable as it is now.  This handles the case
+            // where the body of the loop mutates the variable.
+            llvm::Value *CurVar = readVariable(Variable, code_module);
+            llvm::Value *NextVar = Builder.CreateFAdd(CurVar, StepVal, "nextvar");
+            writeVariable(Variable, NextVar, code_module);
+
+            // Convert condition to a bool by comparing non-equal to 0.0.
+            EndCond = Builder.CreateFCmpONE(
+                EndCond, llvm::ConstantFP::get(*code_module.TheContext, llvm::APFloat(0.0)), "loopcond");
+        }
 
-    // Create the "after loop" block and insert it.
-    llvm::BasicBlock *AfterBB = llvm::BasicBlock::Create(code_module.TheContext, "afterloop", TheFunction);
+        // Insert the conditional branch into the end of LoopEndBB.
+        auto *Latch = Builder.CreateCondBr(EndCond, LoopBB, AfterBB);
+        Latch->setMetadata(llvm::LLVMContext::MD_loop,
+            loop_id(*code_module.TheContext, CopyHints, { TheFunction->getName(), getSymbolName(VarName), Copy }));
 
-    // Insert the conditional branch into the end of LoopEndBB.
-    code_module.Builder.CreateCondBr(EndCond, LoopBB, AfterBB);
+        // The back edge is in place, so the loop header has all its
+        // predecessors.
+        code_module.SSA.seal(LoopBB);
 
-    // Any new code will be inserted in AfterBB.
-    code_module.Builder.SetInsertPoint(AfterBB);
+        // Restore the unshadowed variable.
+        code_module.NamedValues.restore(Scope);
+        return true;
+    };
 
-    // Restore the unshadowed variable.
-    if (OldVal)
-        code_module.NamedValues[VarName] = OldVal;
+    // Make the new basic block for the loop header, inserting after current
+    // block, and an explicit fall through to it.
+    auto Header = [&](const llvm::Twine &Name) {
+        return llvm::BasicBlock::Create(*code_module.TheContext, Name, TheFunction);
+    };
+    if (AllInBounds)
+    {
+        // The checked copy gets no hints: it ends in a trap unless the body
+        // skips the elements out of bounds, and the vectorizer would only
+        // warn that it can't follow them.
+        llvm::BasicBlock *LoopBB = Header("loop." + getSymbolName(VarName));
+        llvm::BasicBlock *CheckedBB =
+            llvm::BasicBlock::Create(*code_module.TheContext, "loop." + getSymbolName(VarName) + ".checked");
+        Builder.CreateCondBr(AllInBounds, LoopBB, CheckedBB);
+        if (!EmitLoop(LoopBB, InBounds, Hints, LoopName::Elided)) return nullptr;
+        TheFunction->getBasicBlockList().push_back(CheckedBB);
+        if (!EmitLoop(CheckedBB, {}, {}, LoopName::Checked)) return nullptr;
+    }
     else
-        code_module.NamedValues.erase(VarName);
+    {
+        llvm::BasicBlock *LoopBB = Header("loop." + getSymbolName(VarName));
+        Builder.CreateBr(LoopBB);
+        if (!EmitLoop(LoopBB, {}, Hints, LoopName::Only)) return nullptr;
+    }
+
+    // Any new code will be inserted in AfterBB, the "after loop" block.
+    TheFunction->getBasicBlockList().push_back(AfterBB);
+    code_module.SSA.seal(AfterBB);
+    Builder.SetInsertPoint(AfterBB);
 
     // for expr always returns 0.0.
-    return llvm::Constant::getNullValue(llvm::Type::getDoubleTy(code_module.TheContext));
+    return llvm::Constant::getNullValue(llvm::Type::getDoubleTy(*code_module.TheContext));
 }
 
 llvm::Value *VarExprAST::codegen(CodeModule &code_module)
 {
-    std::vector<llvm::AllocaInst *> OldBindings;
-
-    llvm::Function *TheFunction = code_module.Builder.GetInsertBlock()->getParent();
+    auto Scope = code_module.NamedValues.scope();
 
     // Register all variables and emit their initializer.
     for (size_t i = 0, e = VarNames.size(); i != e; ++i)
     {
-        const std::string &VarName = VarNames[i].first;
-        ExprAST *Init = VarNames[i].second.get();
+        Symbol VarName = VarNames[i].first;
+        ExprAST *Init = VarNames[i].second;
 
         // Emit the initializer before adding the variable to scope, this prevents
         // the initializer from referencing the variable itself, and permits stuff
@@ -300,18 +510,14 @@ llvm::Value *VarExprAST::codegen(CodeModule &code_module)
         }
         else
         {// If not specified, use 0.0.
-            InitVal = llvm::ConstantFP::get(code_module.TheContext, llvm::APFloat(0.0));
+            InitVal = llvm::ConstantFP::get(*code_module.TheContext, llvm::APFloat(0.0));
         }
 
-        llvm::AllocaInst *Alloca = CreateEntryBlockAlloca(TheFunction, VarName, code_module);
-        code_module.Builder.CreateStore(InitVal, Alloca);
+        SSAVariable Variable = code_module.SSA.create(getSymbolName(VarName));
+        writeVariable(Variable, InitVal, code_module);
 
-        // Remember the old variable binding so that we can restore the binding when
-        // we unrecurse.
-        OldBindings.push_back(code_module.NamedValues[VarName]);
-
-        // Remember this binding.
-        code_module.NamedValues[VarName] = Alloca;
+        // Remember this binding; the scope keeps the one it shadows.
+        code_module.NamedValues.bind(VarName, Variable);
     }
 
     // Codegen the body, now that all vars are in scope.
@@ -319,58 +525,131 @@ llvm::Value *VarExprAST::codegen(CodeModule &code_module)
     if (!BodyVal) return nullptr;
 
     // Pop all our variables from scope.
-    for (size_t i = 0, e = VarNames.size(); i != e; ++i) code_module.NamedValues[VarNames[i].first] = OldBindings[i];
+    code_module.NamedValues.restore(Scope);
 
     // Return the body computation.
     return BodyVal;
 }
 
-llvm::Function *PrototypeAST::codegen(CodeModule &code_module)
+llvm::Value *IndexExprAST::codegen(CodeModule &code_module)
+{
+    llvm::Value *Address = elementAddress(Array, Index, code_module);
+    if (!Address) return nullptr;
+    return code_module.Builder.CreateAlignedLoad(
+        code_module.Builder.getDoubleTy(), Address, llvm::Align(sizeof(double)), "elttmp");
+}
+
+llvm::Value *LengthExprAST::codegen(CodeModule &code_module)
+{
+    ArrayValue A = code_module.NamedArrays.lookup(Array);
+    if (!A) return LogErrorV(fmt::format("Unknown array name: {}", symbols().name(Array)));
+    return code_module.Builder.CreateSIToFP(A.Length, code_module.Builder.getDoubleTy(), "lentmp");
+}
+
+llvm::Value *ArrayVarExprAST::codegen(CodeModule &code_module)
+{
+    // Emit the length before the array is in scope, like a var initializer.
+    llvm::Value *LengthVal = Length->codegen(code_module);
+    if (!LengthVal) return nullptr;
+
+    auto &Builder = code_module.Builder;
+    ArrayValue A = allocate_array(*code_module.TheModule, Builder, code_module.SSA, array_length(Builder, LengthVal));
+    auto Scope = code_module.NamedArrays.scope();
+    code_module.NamedArrays.bind(Name, A);
+
+    llvm::Value *BodyVal = Body->codegen(code_module);
+    if (!BodyVal) return nullptr;
+
+    // Nothing can keep the elements past the body.
+    code_module.NamedArrays.restore(Scope);
+    free_array(*code_module.TheModule, Builder, A);
+    return BodyVal;
+}
+
+llvm::FunctionType *PrototypeAST::functionType(llvm::LLVMContext &C) const
 {
-    // Make the function type:  double(double,double) etc.
-    std::vector<llvm::Type *> Doubles(Args.size(), llvm::Type::getDoubleTy(code_module.TheContext));
-    llvm::FunctionType *FT = llvm::FunctionType::get(llvm::Type::getDoubleTy(code_module.TheContext), Doubles, false);
+    auto *Double = llvm::Type::getDoubleTy(C);
+    std::vector<llvm::Type *> Params;
+    for (std::size_t i = 0; i < Args.size(); ++i)
+    {
+        if (!isArrayArg(i))
+        {
+            Params.push_back(Double);
+            continue;
+        }
+        Params.push_back(Double->getPointerTo());
+        Params.push_back(llvm::Type::getInt64Ty(C));
+    }
+    return llvm::FunctionType::get(Double, Params, false);
+}
 
-    llvm::Function *F = llvm::Function::Create(FT, llvm::Function::ExternalLinkage, Name, code_module.TheModule.get());
+llvm::Function *PrototypeAST::codegen(CodeModule &code_module)
+{
+    llvm::FunctionType *FT = functionType(*code_module.TheContext);
+    llvm::Function *F =
+        llvm::Function::Create(FT, llvm::Function::ExternalLinkage, getSymbolName(Name), code_module.TheModule.get());
 
     // Set names for all arguments.
-    unsigned Idx = 0;
-    for (auto &Arg : F->args()) Arg.setName(Args[Idx++]);
+    auto Arg = F->arg_begin();
+    for (std::size_t i = 0; i < Args.size(); ++i)
+    {
+        (Arg++)->setName(getSymbolName(Args[i]));
+        if (isArrayArg(i)) (Arg++)->setName(getSymbolName(Args[i]) + ".len");
+    }
+    code_module.setFunctionAttributes(*F);
 
     return F;
 }
 
 llvm::Function *FunctionAST::codegen(CodeModule &code_module)
 {
-    // Transfer ownership of the prototype to the FunctionProtos map, but keep a
-    // reference to it for use below.
+    // Register the prototype in the FunctionProtos map, but keep a reference
+    // to it for use below.
     auto &P = *Proto;
-    code_module.FunctionProtos[Proto->getName()] = std::move(Proto);
-    llvm::Function *TheFunction = getFunction(P.getName(), code_module);
+    code_module.FunctionProtos[P.getSymbol()] = Proto;
+    llvm::Function *TheFunction = getFunction(P.getSymbol(), code_module);
     if (!TheFunction) return nullptr;
+    if (TheFunction->getFunctionType() != P.functionType(*code_module.TheContext))
+    {
+        LogErrorV(fmt::format("{} was declared with other parameters", P.getName()));
+        return nullptr;
+    }
 
     // If this is an operator, install it.
-    if (P.isBinaryOp()) BinopPrecedence[P.getName()] = P.getBinaryPrecedence();
+    if (P.isBinaryOp()) installBinop(P.getName(), P.getBinaryPrecedence());
 
     // Create a new basic block to start insertion into.
-    llvm::BasicBlock *BB = llvm::BasicBlock::Create(code_module.TheContext, "entry", TheFunction);
+    llvm::BasicBlock *BB = llvm::BasicBlock::Create(*code_module.TheContext, "entry", TheFunction);
     code_module.Builder.SetInsertPoint(BB);
+    code_module.SSA.seal(BB);
 
-    // Record the function arguments in the NamedValues map.
+    // Record the function arguments in the NamedValues map, and the arrays
+    // in NamedArrays.
     code_module.NamedValues.clear();
-    for (auto &Arg : TheFunction->args())
+    code_module.NamedArrays.clear();
+    auto Arg = TheFunction->arg_begin();
+    for (std::size_t i = 0; i < P.getArgs().size(); ++i)
     {
-        // Create an alloca for this variable.
-        llvm::AllocaInst *Alloca = CreateEntryBlockAlloca(TheFunction, Arg.getName(), code_module);
+        Symbol Name = P.getArgs()[i];
+        if (P.isArrayArg(i))
+        {
+            llvm::Value *Data = &*Arg++;
+            code_module.NamedArrays.bind(Name, { Data, &*Arg++ });
+            continue;
+        }
 
-        // Store the initial value into the alloca.
-        code_module.Builder.CreateStore(&Arg, Alloca);
+        // Each argument is a variable whose value starts out as the argument.
+        SSAVariable Variable = code_module.SSA.create(getSymbolName(Name));
+        writeVariable(Variable, &*Arg++, code_module);
 
         // Add arguments to variable symbol table.
-        code_module.NamedValues[std::string(Arg.getName())] = Alloca;
+        code_module.NamedValues.bind(Name, Variable);
     }
 
-    if (llvm::Value *RetVal = Body->codegen(code_module))
+    llvm::Value *RetVal = Body->codegen(code_module);
+    // Done with the variables, and the phis SSA construction removed.
+    code_module.SSA.reset();
+    if (RetVal)
     {
         // Finish off the function.
         code_module.Builder.CreateRet(RetVal);
@@ -384,6 +663,6 @@ llvm::Function *FunctionAST::codegen(CodeModule &code_module)
     // Error reading body, remove function.
     TheFunction->eraseFromParent();
 
-    if (P.isBinaryOp()) BinopPrecedence.erase(P.getName());
+    if (P.isBinaryOp()) removeBinop(P.getName());
     return nullptr;
 }
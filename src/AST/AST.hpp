@@ -3,24 +3,91 @@
 
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Instructions.h"
+#include "../bytecode/Bytecode.hpp"
 #include "../codegen/codemodule.hpp"
+#include "../codegen/loops.hpp"
+#include "../misc/symbol.hpp"
+#include "ASTArena.hpp"
+#include <map>
+#include <optional>
+#include <span>
+#include <tuple>
+#include <variant>
+#include <vector>
+
+// Nodes live in the translation unit's ASTArena (see TranslationUnit below),
+// so child pointers don't own anything and nodes have no teardown.
+
+extern std::map<std::string, uint32_t, std::less<>> BinopPrecedence;
+void installBinop(std::string_view Name, uint32_t Precedence);
+void removeBinop(std::string_view Name);
+
+// Codegen helpers shared by the tree AST and FlatAST.
+llvm::Value *LogErrorV(std::string_view Str);
+llvm::StringRef getSymbolName(Symbol Name);
+/// readVariable, writeVariable - A variable's value where code is being
+/// generated, and a new value for it from there on; see codegen/ssa.hpp.
+llvm::Value *readVariable(SSAVariable V, CodeModule &code_module);
+void writeVariable(SSAVariable V, llvm::Value *Val, CodeModule &code_module);
+
+class Interpreter;
+class BytecodeCompiler;
+class Simplifier;
+class ASTHasher;
 
-extern std::map<std::string, uint32_t> BinopPrecedence;
 /// ExprAST - Base class for all expression nodes.
 class ExprAST
 {
   public:
     virtual ~ExprAST() = default;
     virtual llvm::Value *codegen(CodeModule &code_module) = 0;
+    /// evaluate - Value of this expression in interp's current call, or
+    /// nullopt after reporting an error. See interpreter/Interpreter.cpp.
+    virtual std::optional<double> evaluate(Interpreter &interp) = 0;
+    /// compile - Emit bytecode computing this expression into dst, or into
+    /// no register at all if it is a variable, and return where the value
+    /// ended up; nullopt after reporting an error. See
+    /// bytecode/BytecodeCompiler.cpp.
+    virtual std::optional<Register> compile(BytecodeCompiler &bc, Register dst) = 0;
+    /// countNodes - Number of nodes in this subtree.
+    virtual std::size_t countNodes() const = 0;
+    /// collectAssigned - Append the names this subtree assigns to with '='.
+    virtual void collectAssigned(std::vector<Symbol> &Names) const = 0;
+    /// collectIndexed - Append the arrays this subtree indexes with just the
+    /// variable Index, as in a[Index].
+    virtual void collectIndexed(Symbol Index, std::vector<Symbol> &Arrays) const = 0;
+    /// simplify - Simplify the subtrees in place, and return this node or a
+    /// simpler one with the same value and effects. See AST/Simplify.cpp.
+    virtual ExprAST *simplify(Simplifier &s) = 0;
+    /// getNumber - The value of a numeric literal, nullopt for other nodes.
+    virtual std::optional<double> getNumber() const { return std::nullopt; }
+    /// getVariable - The variable a variable reference reads, nullopt for
+    /// other nodes.
+    virtual std::optional<Symbol> getVariable() const { return std::nullopt; }
+    /// getBinary - The operator and operands of a binary operator, nullopt
+    /// for other nodes.
+    virtual std::optional<std::tuple<char, ExprAST *, ExprAST *>> getBinary() const { return std::nullopt; }
+    /// getElement - The array and index of an array element, nullopt for
+    /// other nodes.
+    virtual std::optional<std::pair<Symbol, ExprAST *>> getElement() const { return std::nullopt; }
+    /// getLength - The array whose length len() reads, nullopt for other
+    /// nodes.
+    virtual std::optional<Symbol> getLength() const { return std::nullopt; }
+    /// hash - Add this subtree to a function's cache key. See
+    /// codegen/ObjectCache.cpp.
+    virtual void hash(ASTHasher &h) const = 0;
 };
 
 
+class PrototypeAST;
 class FnAST
 {
   public:
     virtual ~FnAST() = default;
 
     virtual llvm::Function *codegen(CodeModule &code_module) = 0;
+    virtual std::size_t countNodes() const = 0;
+    virtual PrototypeAST *getPrototype() = 0;
 };
 
 // NumberExprAST - Expression class for numeric literals like "1.0".
@@ -33,123 +100,333 @@ class NumberExprAST : public ExprAST
     explicit NumberExprAST(double _val) : Val(_val) {}
 
     llvm::Value *codegen(CodeModule &code_module) override;
+    std::optional<double> evaluate(Interpreter &interp) override;
+    std::optional<Register> compile(BytecodeCompiler &bc, Register dst) override;
+    ExprAST *simplify(Simplifier &s) override;
+    void hash(ASTHasher &h) const override;
+    std::size_t countNodes() const override { return 1; }
+    void collectAssigned(std::vector<Symbol> &) const override {}
+    void collectIndexed(Symbol, std::vector<Symbol> &) const override {}
+    std::optional<double> getNumber() const override { return Val; }
 };
 
 /// VariableExprAST - Expression class for referencing a variable, like "a".
 class VariableExprAST : public ExprAST
 {
-    std::string Name;
+    Symbol Name;
 
   public:
-    explicit VariableExprAST(const std::string &_name) : Name(_name) {}
+    explicit VariableExprAST(Symbol _name) : Name(_name) {}
 
     llvm::Value *codegen(CodeModule &code_module) override;
-    const std::string &getName() const { return Name; }
+    std::optional<double> evaluate(Interpreter &interp) override;
+    std::optional<Register> compile(BytecodeCompiler &bc, Register dst) override;
+    ExprAST *simplify(Simplifier &s) override;
+    void hash(ASTHasher &h) const override;
+    std::size_t countNodes() const override { return 1; }
+    void collectAssigned(std::vector<Symbol> &) const override {}
+    void collectIndexed(Symbol, std::vector<Symbol> &) const override {}
+    Symbol getName() const { return Name; }
+    std::optional<Symbol> getVariable() const override { return Name; }
 };
 
 /// UnaryExprAST - Expression class for a unary operator.
 class UnaryExprAST : public ExprAST
 {
     char Opcode;
-    std::unique_ptr<ExprAST> Operand;
+    ExprAST *Operand;
 
   public:
-    UnaryExprAST(char _opcode, std::unique_ptr<ExprAST> _operand) : Opcode(_opcode), Operand(std::move(_operand)) {}
+    UnaryExprAST(char _opcode, ExprAST *_operand) : Opcode(_opcode), Operand(_operand) {}
 
     llvm::Value *codegen(CodeModule &code_module) override;
+    std::optional<double> evaluate(Interpreter &interp) override;
+    std::optional<Register> compile(BytecodeCompiler &bc, Register dst) override;
+    ExprAST *simplify(Simplifier &s) override;
+    void hash(ASTHasher &h) const override;
+    std::size_t countNodes() const override { return 1 + Operand->countNodes(); }
+    void collectAssigned(std::vector<Symbol> &Names) const override { Operand->collectAssigned(Names); }
+    void collectIndexed(Symbol Index, std::vector<Symbol> &Arrays) const override
+    {
+        Operand->collectIndexed(Index, Arrays);
+    }
 };
 
 /// BinaryExprAST - Expression class for a binary operator.
 class BinaryExprAST : public ExprAST
 {
     char Op;
-    std::unique_ptr<ExprAST> LHS, RHS;
+    ExprAST *LHS, *RHS;
 
   public:
-    BinaryExprAST(char _op, std::unique_ptr<ExprAST> _lhs, std::unique_ptr<ExprAST> _rhs)
-        : Op(_op), LHS(std::move(_lhs)), RHS(std::move(_rhs))
-    {}
+    BinaryExprAST(char _op, ExprAST *_lhs, ExprAST *_rhs) : Op(_op), LHS(_lhs), RHS(_rhs) {}
 
     llvm::Value *codegen(CodeModule &code_module) override;
+    std::optional<double> evaluate(Interpreter &interp) override;
+    std::optional<Register> compile(BytecodeCompiler &bc, Register dst) override;
+    ExprAST *simplify(Simplifier &s) override;
+    void hash(ASTHasher &h) const override;
+    std::size_t countNodes() const override { return 1 + LHS->countNodes() + RHS->countNodes(); }
+    void collectAssigned(std::vector<Symbol> &Names) const override
+    {
+        // An array element assigned to is no variable.
+        if (auto Variable = LHS->getVariable(); Op == '=' && Variable) Names.push_back(*Variable);
+        LHS->collectAssigned(Names);
+        RHS->collectAssigned(Names);
+    }
+    void collectIndexed(Symbol Index, std::vector<Symbol> &Arrays) const override
+    {
+        LHS->collectIndexed(Index, Arrays);
+        RHS->collectIndexed(Index, Arrays);
+    }
+    std::optional<std::tuple<char, ExprAST *, ExprAST *>> getBinary() const override
+    {
+        return std::tuple{ Op, LHS, RHS };
+    }
 };
 
 /// CallExprAST - Expression class for function calls.
 class CallExprAST : public ExprAST
 {
-    std::string Callee;
-    std::vector<std::unique_ptr<ExprAST>> Args;
+    Symbol Callee;
+    std::span<ExprAST *const> Args;
 
   public:
-    CallExprAST(const std::string &_callee, std::vector<std::unique_ptr<ExprAST>> _args)
-        : Callee(_callee), Args(std::move(_args))
-    {}
+    CallExprAST(Symbol _callee, std::span<ExprAST *const> _args) : Callee(_callee), Args(_args) {}
 
     llvm::Value *codegen(CodeModule &code_module) override;
+    std::optional<double> evaluate(Interpreter &interp) override;
+    std::optional<Register> compile(BytecodeCompiler &bc, Register dst) override;
+    ExprAST *simplify(Simplifier &s) override;
+    void hash(ASTHasher &h) const override;
+    std::size_t countNodes() const override
+    {
+        std::size_t n = 1;
+        for (auto *Arg : Args) n += Arg->countNodes();
+        return n;
+    }
+    void collectAssigned(std::vector<Symbol> &Names) const override
+    {
+        for (auto *Arg : Args) Arg->collectAssigned(Names);
+    }
+    void collectIndexed(Symbol Index, std::vector<Symbol> &Arrays) const override
+    {
+        for (auto *Arg : Args) Arg->collectIndexed(Index, Arrays);
+    }
 };
 
 /// IfExprAST - Expression class for if/then/else.
 class IfExprAST : public ExprAST
 {
-    std::unique_ptr<ExprAST> Cond, Then, Else;
+    ExprAST *Cond, *Then, *Else;
 
   public:
-    IfExprAST(std::unique_ptr<ExprAST> _cond, std::unique_ptr<ExprAST> _then, std::unique_ptr<ExprAST> _else)
-        : Cond(std::move(_cond)), Then(std::move(_then)), Else(std::move(_else))
-    {}
+    IfExprAST(ExprAST *_cond, ExprAST *_then, ExprAST *_else) : Cond(_cond), Then(_then), Else(_else) {}
 
     llvm::Value *codegen(CodeModule &code_module) override;
+    std::optional<double> evaluate(Interpreter &interp) override;
+    std::optional<Register> compile(BytecodeCompiler &bc, Register dst) override;
+    ExprAST *simplify(Simplifier &s) override;
+    void hash(ASTHasher &h) const override;
+    std::size_t countNodes() const override
+    {
+        return 1 + Cond->countNodes() + Then->countNodes() + Else->countNodes();
+    }
+    void collectAssigned(std::vector<Symbol> &Names) const override
+    {
+        Cond->collectAssigned(Names);
+        Then->collectAssigned(Names);
+        Else->collectAssigned(Names);
+    }
+    void collectIndexed(Symbol Index, std::vector<Symbol> &Arrays) const override
+    {
+        Cond->collectIndexed(Index, Arrays);
+        Then->collectIndexed(Index, Arrays);
+        Else->collectIndexed(Index, Arrays);
+    }
 };
 
 /// ForExprAST - Expression class for for/in.
 class ForExprAST : public ExprAST
 {
-    std::string VarName;
-    std::unique_ptr<ExprAST> Start, End, Step, Body;
+    Symbol VarName;
+    ExprAST *Start, *End, *Step, *Body;
+    LoopHints Hints;
 
   public:
-    ForExprAST(const std::string &_varName,
-        std::unique_ptr<ExprAST> _start,
-        std::unique_ptr<ExprAST> _end,
-        std::unique_ptr<ExprAST> _step,
-        std::unique_ptr<ExprAST> _body)
-        : VarName(_varName), Start(std::move(_start)), End(std::move(_end)), Step(std::move(_step)),
-          Body(std::move(_body))
+    ForExprAST(Symbol _varName, ExprAST *_start, ExprAST *_end, ExprAST *_step, ExprAST *_body, LoopHints _hints = {})
+        : VarName(_varName), Start(_start), End(_end), Step(_step), Body(_body), Hints(_hints)
     {}
 
     llvm::Value *codegen(CodeModule &code_module) override;
+    std::optional<double> evaluate(Interpreter &interp) override;
+    std::optional<Register> compile(BytecodeCompiler &bc, Register dst) override;
+    ExprAST *simplify(Simplifier &s) override;
+    void hash(ASTHasher &h) const override;
+    std::size_t countNodes() const override
+    {
+        return 1 + Start->countNodes() + End->countNodes() + (Step ? Step->countNodes() : 0) + Body->countNodes();
+    }
+    void collectAssigned(std::vector<Symbol> &Names) const override
+    {
+        Start->collectAssigned(Names);
+        End->collectAssigned(Names);
+        if (Step) Step->collectAssigned(Names);
+        Body->collectAssigned(Names);
+    }
+    void collectIndexed(Symbol Index, std::vector<Symbol> &Arrays) const override
+    {
+        Start->collectIndexed(Index, Arrays);
+        End->collectIndexed(Index, Arrays);
+        if (Step) Step->collectIndexed(Index, Arrays);
+        Body->collectIndexed(Index, Arrays);
+    }
 };
 
 /// VarExprAST - Expression class for var/in
 class VarExprAST : public ExprAST
 {
-    std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> VarNames;
-    std::unique_ptr<ExprAST> Body;
+    std::span<const std::pair<Symbol, ExprAST *>> VarNames;
+    ExprAST *Body;
 
   public:
-    VarExprAST(std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> _varNames, std::unique_ptr<ExprAST> _body)
-        : VarNames(std::move(_varNames)), Body(std::move(_body))
+    VarExprAST(std::span<const std::pair<Symbol, ExprAST *>> _varNames, ExprAST *_body)
+        : VarNames(_varNames), Body(_body)
     {}
 
     llvm::Value *codegen(CodeModule &code_module) override;
+    std::optional<double> evaluate(Interpreter &interp) override;
+    std::optional<Register> compile(BytecodeCompiler &bc, Register dst) override;
+    ExprAST *simplify(Simplifier &s) override;
+    void hash(ASTHasher &h) const override;
+    std::size_t countNodes() const override
+    {
+        std::size_t n = 1 + Body->countNodes();
+        for (auto &[Name, Init] : VarNames) n += Init ? Init->countNodes() : 0;
+        return n;
+    }
+    void collectAssigned(std::vector<Symbol> &Names) const override
+    {
+        for (auto &[Name, Init] : VarNames)
+        {
+            if (Init) Init->collectAssigned(Names);
+        }
+        Body->collectAssigned(Names);
+    }
+    void collectIndexed(Symbol Index, std::vector<Symbol> &Arrays) const override
+    {
+        for (auto &[Name, Init] : VarNames)
+        {
+            if (Init) Init->collectIndexed(Index, Arrays);
+        }
+        Body->collectIndexed(Index, Arrays);
+    }
+};
+
+/// IndexExprAST - Expression class for an element of an array, like "a[i]",
+/// which can also be assigned to.
+class IndexExprAST : public ExprAST
+{
+    Symbol Array;
+    ExprAST *Index;
+
+  public:
+    IndexExprAST(Symbol _array, ExprAST *_index) : Array(_array), Index(_index) {}
+
+    llvm::Value *codegen(CodeModule &code_module) override;
+    std::optional<double> evaluate(Interpreter &interp) override;
+    std::optional<Register> compile(BytecodeCompiler &bc, Register dst) override;
+    ExprAST *simplify(Simplifier &s) override;
+    void hash(ASTHasher &h) const override;
+    std::size_t countNodes() const override { return 1 + Index->countNodes(); }
+    void collectAssigned(std::vector<Symbol> &Names) const override { Index->collectAssigned(Names); }
+    void collectIndexed(Symbol Var, std::vector<Symbol> &Arrays) const override
+    {
+        if (Index->getVariable() == Var) Arrays.push_back(Array);
+        Index->collectIndexed(Var, Arrays);
+    }
+    std::optional<std::pair<Symbol, ExprAST *>> getElement() const override { return std::pair{ Array, Index }; }
+};
+
+/// LengthExprAST - Expression class for the length of an array, "len(a)".
+class LengthExprAST : public ExprAST
+{
+    Symbol Array;
+
+  public:
+    explicit LengthExprAST(Symbol _array) : Array(_array) {}
+
+    llvm::Value *codegen(CodeModule &code_module) override;
+    std::optional<double> evaluate(Interpreter &interp) override;
+    std::optional<Register> compile(BytecodeCompiler &bc, Register dst) override;
+    ExprAST *simplify(Simplifier &s) override;
+    void hash(ASTHasher &h) const override;
+    std::size_t countNodes() const override { return 1; }
+    void collectAssigned(std::vector<Symbol> &) const override {}
+    void collectIndexed(Symbol, std::vector<Symbol> &) const override {}
+    std::optional<Symbol> getLength() const override { return Array; }
+};
+
+/// ArrayVarExprAST - Expression class for an array binding of var/in,
+/// "var a[n] in body": n zeroed elements, freed after the body.
+class ArrayVarExprAST : public ExprAST
+{
+    Symbol Name;
+    ExprAST *Length, *Body;
+
+  public:
+    ArrayVarExprAST(Symbol _name, ExprAST *_length, ExprAST *_body) : Name(_name), Length(_length), Body(_body) {}
+
+    llvm::Value *codegen(CodeModule &code_module) override;
+    std::optional<double> evaluate(Interpreter &interp) override;
+    std::optional<Register> compile(BytecodeCompiler &bc, Register dst) override;
+    ExprAST *simplify(Simplifier &s) override;
+    void hash(ASTHasher &h) const override;
+    std::size_t countNodes() const override { return 1 + Length->countNodes() + Body->countNodes(); }
+    void collectAssigned(std::vector<Symbol> &Names) const override
+    {
+        Length->collectAssigned(Names);
+        Body->collectAssigned(Names);
+    }
+    void collectIndexed(Symbol Index, std::vector<Symbol> &Arrays) const override
+    {
+        Length->collectIndexed(Index, Arrays);
+        Body->collectIndexed(Index, Arrays);
+    }
 };
 
 /// PrototypeAST - This class represents the "prototype" for a function,
 /// which captures its name, and its argument names (thus implicitly the number
-/// of arguments the function takes), as well as if it is an operator.
+/// of arguments the function takes), as well as if it is an operator. An
+/// argument declared "a[]" is an array; ArrayArgs says which are, and is
+/// empty if none are.
 class PrototypeAST : public FnAST
 {
-    std::string Name;
-    std::vector<std::string> Args;
+    Symbol Name;
+    std::span<const Symbol> Args;
     bool IsOperator;
     uint32_t Precedence;// Precedence if a binary op.
+    std::span<const bool> ArrayArgs;
 
   public:
-    PrototypeAST(const std::string &name, std::vector<std::string> args, bool isOperator = false, uint32_t prec = 0)
-        : Name(name), Args(std::move(args)), IsOperator(isOperator), Precedence(prec)
+    PrototypeAST(Symbol name,
+        std::span<const Symbol> args,
+        bool isOperator = false,
+        uint32_t prec = 0,
+        std::span<const bool> arrayArgs = {})
+        : Name(name), Args(args), IsOperator(isOperator), Precedence(prec), ArrayArgs(arrayArgs)
     {}
 
     llvm::Function *codegen(CodeModule &code_module) override;
-    const std::string &getName() const { return Name; }
+    /// functionType - double(double,double) etc., where an array argument
+    /// is a pointer to doubles and an i64 length.
+    llvm::FunctionType *functionType(llvm::LLVMContext &C) const;
+    std::size_t countNodes() const override { return 0; }
+    PrototypeAST *getPrototype() override { return this; }
+    Symbol getSymbol() const { return Name; }
+    std::string_view getName() const { return symbols().name(Name); }
+    std::span<const Symbol> getArgs() const { return Args; }
+    bool isArrayArg(std::size_t i) const { return !ArrayArgs.empty() && ArrayArgs[i]; }
 
     bool isUnaryOp() const { return IsOperator && Args.size() == 1; }
     bool isBinaryOp() const { return IsOperator && Args.size() == 2; }
@@ -157,7 +434,7 @@ class PrototypeAST : public FnAST
     char getOperatorName() const
     {
         assert(isUnaryOp() || isBinaryOp());
-        return Name[Name.size() - 1];
+        return getName().back();
     }
 
     uint32_t getBinaryPrecedence() const { return Precedence; }
@@ -166,15 +443,26 @@ class PrototypeAST : public FnAST
 /// FunctionAST - This class represents a function definition itself.
 class FunctionAST : public FnAST
 {
-    std::unique_ptr<PrototypeAST> Proto;
-    std::unique_ptr<ExprAST> Body;
+    PrototypeAST *Proto;
+    ExprAST *Body;
 
   public:
-    FunctionAST(std::unique_ptr<PrototypeAST> proto, std::unique_ptr<ExprAST> body)
-        : Proto(std::move(proto)), Body(std::move(body))
-    {}
+    FunctionAST(PrototypeAST *proto, ExprAST *body) : Proto(proto), Body(body) {}
 
     llvm::Function *codegen(CodeModule &code_module) override;
+    std::size_t countNodes() const override { return Body->countNodes(); }
+    PrototypeAST *getPrototype() override { return Proto; }
+    ExprAST *getBody() const { return Body; }
+    /// simplify - Simplify the body; see ExprAST::simplify.
+    void simplify(Simplifier &s);
+};
+
+/// TranslationUnit - Everything parsed from one source: the top level items in
+/// order, and the arena that holds every node reachable from them.
+struct TranslationUnit
+{
+    ASTArena arena;
+    std::vector<std::variant<ExprAST *, FnAST *>> top_expressions;
 };
 
 #endif
@@ -0,0 +1,82 @@
+#ifndef __ASTARENA_H_
+#define __ASTARENA_H_
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/// ASTArena - Bump-pointer allocator for the AST of one translation unit.
+/// Nodes are carved out of large blocks and never destroyed one by one: the
+/// whole tree goes away in a single release when the arena does. Anything put
+/// in the arena must therefore not own memory outside of it.
+class ASTArena
+{
+    static constexpr std::size_t block_size = 256 * 1024;
+
+    std::vector<std::unique_ptr<std::byte[]>> blocks;
+    std::byte *cur = nullptr;
+    std::size_t left = 0;
+    std::size_t used = 0;
+
+    void *allocate(std::size_t size, std::size_t align)
+    {
+        auto pad = (align - reinterpret_cast<std::uintptr_t>(cur) % align) % align;
+        if (pad + size > left)
+        {
+            auto bytes = std::max(block_size, size + align);
+            blocks.push_back(std::make_unique<std::byte[]>(bytes));
+            cur = blocks.back().get();
+            left = bytes;
+            pad = (align - reinterpret_cast<std::uintptr_t>(cur) % align) % align;
+        }
+        void *p = cur + pad;
+        cur += pad + size;
+        left -= pad + size;
+        used += size;
+        return p;
+    }
+
+  public:
+    ASTArena() = default;
+    ASTArena(const ASTArena &) = delete;
+    ASTArena &operator=(const ASTArena &) = delete;
+    ASTArena(ASTArena &&other) noexcept
+        : blocks(std::move(other.blocks)), cur(std::exchange(other.cur, nullptr)),
+          left(std::exchange(other.left, 0)), used(std::exchange(other.used, 0))
+    {}
+    ASTArena &operator=(ASTArena &&other) noexcept
+    {
+        blocks = std::move(other.blocks);
+        cur = std::exchange(other.cur, nullptr);
+        left = std::exchange(other.left, 0);
+        used = std::exchange(other.used, 0);
+        return *this;
+    }
+
+    template<typename T, typename... Args> T *make(Args &&...args)
+    {
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    /// copy - Move items into the arena as one array, e.g. to freeze a
+    /// parser scratch list into a node.
+    template<typename T> std::span<const T> copy(std::span<const T> items)
+    {
+        static_assert(std::is_trivially_destructible_v<T>, "arena arrays are never destroyed");
+        if (items.empty()) return {};
+        auto *dst = static_cast<T *>(allocate(sizeof(T) * items.size(), alignof(T)));
+        std::uninitialized_copy(items.begin(), items.end(), dst);
+        return { dst, items.size() };
+    }
+
+    /// bytes_used - Bytes handed out so far, excluding alignment padding.
+    std::size_t bytes_used() const { return used; }
+    std::size_t blocks_allocated() const { return blocks.size(); }
+};
+
+#endif// __ASTARENA_H_
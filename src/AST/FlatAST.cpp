@@ -0,0 +1,385 @@
+#include "llvm/IR/Verifier.h"
+#include "FlatAST.hpp"
+#include "AST.hpp"
+#include <fmt/format.h>
+
+// Each case mirrors the matching ExprAST::codegen() in AST.cpp, down to the
+// value names, so both representations produce identical modules.
+
+llvm::Function *FlatCodegen::getFunction(Symbol Name)
+{
+    // First, see if the function has already been added to the current module.
+    if (auto *F = code_module.TheModule->getFunction(getSymbolName(Name))) return F;
+
+    // If not, check whether we can codegen the declaration from some existing
+    // prototype.
+    if (auto Proto = FunctionProtos[Name]) return emit(Proto);
+
+    // If no existing prototype exists, return null.
+    return nullptr;
+}
+
+llvm::Value *FlatCodegen::emit(FlatExpr e)
+{
+    switch (ast.kind(e))
+    {
+    case FlatKind::number:
+        return llvm::ConstantFP::get(*code_module.TheContext, llvm::APFloat(ast.number(e)));
+    case FlatKind::variable: {
+        SSAVariable V = code_module.NamedValues.lookup(ast.symbol(e));
+        if (!V) return LogErrorV(fmt::format("Unknown variable name: {}", symbols().name(ast.symbol(e))));
+        return readVariable(V, code_module);
+    }
+    case FlatKind::unary: {
+        llvm::Value *OperandV = emit(ast.lhs(e));
+        if (!OperandV) return nullptr;
+
+        llvm::Function *F = getFunction(symbols().lookup(std::string("unary") + ast.op(e)));
+        if (!F) return LogErrorV("Unknown unary operator");
+
+        return code_module.Builder.CreateCall(F, OperandV, "unop");
+    }
+    case FlatKind::binary:
+        return emitBinary(e);
+    case FlatKind::call:
+        return emitCall(e);
+    case FlatKind::if_expr:
+        return emitIf(e);
+    case FlatKind::for_expr:
+        return emitFor(e);
+    case FlatKind::var_expr:
+        return emitVar(e);
+    case FlatKind::none:
+        break;
+    }
+    return nullptr;
+}
+
+llvm::Value *FlatCodegen::emitBinary(FlatExpr e)
+{
+    char Op = ast.op(e);
+    // Special case '=' because we don't want to emit the LHS as an expression.
+    if (Op == '=')
+    {
+        // Assignment requires the LHS to be an identifier.
+        if (ast.kind(ast.lhs(e)) != FlatKind::variable) return LogErrorV("destination of '=' must be a variable");
+        llvm::Value *Val = emit(ast.rhs(e));
+        if (!Val) return nullptr;
+
+        SSAVariable Variable = code_module.NamedValues.lookup(ast.symbol(ast.lhs(e)));
+        if (!Variable) return LogErrorV("Unknown variable name");
+
+        writeVariable(Variable, Val, code_module);
+        return Val;
+    }
+
+    llvm::Value *L = emit(ast.lhs(e));
+    llvm::Value *R = emit(ast.rhs(e));
+    if (!L || !R) return nullptr;
+
+    switch (Op)
+    {
+    case '+':
+        return code_module.Builder.CreateFAdd(L, R, "addtmp");
+    case '-':
+        return code_module.Builder.CreateFSub(L, R, "subtmp");
+    case '*':
+        return code_module.Builder.CreateFMul(L, R, "multmp");
+    case '<':
+        L = code_module.Builder.CreateFCmpULT(L, R, "cmptmp");
+        return code_module.Builder.CreateUIToFP(L, llvm::Type::getDoubleTy(*code_module.TheContext), "booltmp");
+    default:
+        break;
+    }
+
+    llvm::Function *F = getFunction(symbols().lookup(std::string("binary") + Op));
+    assert(F && "binary operator not found!");
+
+    llvm::Value *Ops[] = { L, R };
+    return code_module.Builder.CreateCall(F, Ops, "binop");
+}
+
+llvm::Value *FlatCodegen::emitCall(FlatExpr e)
+{
+    llvm::Function *CalleeF = getFunction(ast.symbol(e));
+    if (!CalleeF) return LogErrorV("Unknown function referenced");
+
+    const uint32_t *Tail = ast.tail(e);
+    if (CalleeF->arg_size() != Tail[0]) return LogErrorV("Incorrect # arguments passed");
+
+    std::vector<llvm::Value *> ArgsV;
+    for (uint32_t i = 1; i <= Tail[0]; ++i)
+    {
+        ArgsV.push_back(emit(FlatExpr{ Tail[i] }));
+        if (!ArgsV.back()) return nullptr;
+    }
+
+    return code_module.Builder.CreateCall(CalleeF, ArgsV, "calltmp");
+}
+
+llvm::Value *FlatCodegen::emitIf(FlatExpr e)
+{
+    const uint32_t *Tail = ast.tail(e);
+    llvm::Value *CondV = emit(ast.lhs(e));
+    if (!CondV) return nullptr;
+
+    CondV = code_module.Builder.CreateFCmpONE(
+        CondV, llvm::ConstantFP::get(*code_module.TheContext, llvm::APFloat(0.0)), "ifcond");
+
+    llvm::Function *TheFunction = code_module.Builder.GetInsertBlock()->getParent();
+
+    llvm::BasicBlock *ThenBB = llvm::BasicBlock::Create(*code_module.TheContext, "then", TheFunction);
+    llvm::BasicBlock *ElseBB = llvm::BasicBlock::Create(*code_module.TheContext, "else");
+    llvm::BasicBlock *MergeBB = llvm::BasicBlock::Create(*code_module.TheContext, "ifcont");
+
+    code_module.Builder.CreateCondBr(CondV, ThenBB, ElseBB);
+    code_module.SSA.seal(ThenBB);
+    code_module.SSA.seal(ElseBB);
+
+    code_module.Builder.SetInsertPoint(ThenBB);
+    llvm::Value *ThenV = emit(FlatExpr{ Tail[0] });
+    if (!ThenV) return nullptr;
+
+    code_module.Builder.CreateBr(MergeBB);
+    ThenBB = code_module.Builder.GetInsertBlock();
+
+    TheFunction->getBasicBlockList().push_back(ElseBB);
+    code_module.Builder.SetInsertPoint(ElseBB);
+    llvm::Value *ElseV = emit(FlatExpr{ Tail[1] });
+    if (!ElseV) return nullptr;
+
+    code_module.Builder.CreateBr(MergeBB);
+    ElseBB = code_module.Builder.GetInsertBlock();
+
+    TheFunction->getBasicBlockList().push_back(MergeBB);
+    code_module.Builder.SetInsertPoint(MergeBB);
+    code_module.SSA.seal(MergeBB);
+    llvm::PHINode *PN = code_module.Builder.CreatePHI(llvm::Type::getDoubleTy(*code_module.TheContext), 2, "iftmp");
+
+    PN->addIncoming(ThenV, ThenBB);
+    PN->addIncoming(ElseV, ElseBB);
+    return PN;
+}
+
+llvm::Value *FlatCodegen::emitFor(FlatExpr e)
+{
+    Symbol VarName = ast.symbol(e);
+    const uint32_t *Tail = ast.tail(e);
+    FlatExpr Start{ Tail[0] }, End{ Tail[1] }, Step{ Tail[2] }, Body{ Tail[3] };
+    LoopHints Hints{ Tail[4], Tail[5] };
+
+    llvm::Function *TheFunction = code_module.Builder.GetInsertBlock()->getParent();
+
+    llvm::Value *StartVal = emit(Start);
+    if (!StartVal) return nullptr;
+    SSAVariable Variable = code_module.SSA.create(getSymbolName(VarName));
+    writeVariable(Variable, StartVal, code_module);
+
+    std::vector<Symbol> Assigned;
+    for (FlatExpr Part : { End, Step, Body })
+    {
+        if (Part) ast.collectAssigned(Part, Assigned);
+    }
+
+    // Counted with an i64 like ForExprAST::codegen does.
+    auto number = [&](FlatExpr x) {
+        return ast.kind(x) == FlatKind::number ? std::optional<double>(ast.number(x)) : std::nullopt;
+    };
+    auto From = counted_start(number(Start));
+    auto By = Step ? counted_step(number(Step)) : std::optional<int64_t>(1);
+    FlatExpr BoundExpr;
+    // With a bound as isInvariant there allows, minus the array lengths.
+    auto invariant = [&](auto &self, FlatExpr x) -> bool {
+        switch (ast.kind(x))
+        {
+        case FlatKind::number:
+            return true;
+        case FlatKind::variable:
+            return ast.symbol(x) != VarName
+                   && std::find(Assigned.begin(), Assigned.end(), ast.symbol(x)) == Assigned.end();
+        case FlatKind::binary:
+            return (ast.op(x) == '+' || ast.op(x) == '-' || ast.op(x) == '*') && self(self, ast.lhs(x))
+                   && self(self, ast.rhs(x));
+        default:
+            return false;
+        }
+    };
+    if (ast.kind(End) == FlatKind::binary && ast.op(End) == '<' && ast.kind(ast.lhs(End)) == FlatKind::variable
+        && ast.symbol(ast.lhs(End)) == VarName && invariant(invariant, ast.rhs(End))
+        && !llvm::is_contained(Assigned, VarName))
+        BoundExpr = ast.rhs(End);
+    llvm::Value *Bound = nullptr;
+    if (From && By && BoundExpr)
+    {
+        llvm::Value *EndVal = emit(BoundExpr);
+        if (!EndVal) return nullptr;
+        Bound = counted_bound(code_module.Builder, EndVal);
+    }
+
+    llvm::BasicBlock *PreheaderBB = code_module.Builder.GetInsertBlock();
+    llvm::BasicBlock *LoopBB = llvm::BasicBlock::Create(
+        *code_module.TheContext, "loop." + getSymbolName(VarName), TheFunction);
+    code_module.Builder.CreateBr(LoopBB);
+    code_module.Builder.SetInsertPoint(LoopBB);
+    llvm::PHINode *Counter = nullptr;
+    if (Bound)
+    {
+        Counter = code_module.Builder.CreatePHI(code_module.Builder.getInt64Ty(), 2, getSymbolName(VarName));
+        Counter->addIncoming(counted_constant(code_module.Builder, *From), PreheaderBB);
+        writeVariable(Variable,
+            code_module.Builder.CreateSIToFP(Counter, code_module.Builder.getDoubleTy(), getSymbolName(VarName)),
+            code_module);
+    }
+
+    auto Scope = code_module.NamedValues.scope();
+    code_module.NamedValues.bind(VarName, Variable);
+
+    llvm::SmallVector<SSAVariable, 8> Changing;
+    if (!Bound) Changing.push_back(Variable);
+    for (Symbol Name : Assigned)
+    {
+        if (SSAVariable V = code_module.NamedValues.lookup(Name)) Changing.push_back(V);
+    }
+    code_module.SSA.loop(LoopBB, Changing);
+
+    if (!emit(Body)) return nullptr;
+
+    llvm::Value *EndCond = nullptr;
+    if (Bound)
+    {
+        llvm::Value *Next = code_module.Builder.CreateNSWAdd(Counter, counted_constant(code_module.Builder, *By), "next");
+        Counter->addIncoming(Next, code_module.Builder.GetInsertBlock());
+        EndCond = code_module.Builder.CreateICmpSLT(Counter, Bound, "loopcond");
+    }
+    else
+    {
+        llvm::Value *StepVal = nullptr;
+        if (Step)
+        {
+            StepVal = emit(Step);
+            if (!StepVal) return nullptr;
+        }
+        else
+        {
+            StepVal = llvm::ConstantFP::get(*code_module.TheContext, llvm::APFloat(1.0));
+        }
+
+        EndCond = emit(End);
+        if (!EndCond) return nullptr;
+
+        llvm::Value *CurVar = readVariable(Variable, code_module);
+        llvm::Value *NextVar = code_module.Builder.CreateFAdd(CurVar, StepVal, "nextvar");
+        writeVariable(Variable, NextVar, code_module);
+
+        EndCond = code_module.Builder.CreateFCmpONE(
+            EndCond, llvm::ConstantFP::get(*code_module.TheContext, llvm::APFloat(0.0)), "loopcond");
+    }
+
+    llvm::BasicBlock *AfterBB = llvm::BasicBlock::Create(*code_module.TheContext, "afterloop", TheFunction);
+    auto *Latch = code_module.Builder.CreateCondBr(EndCond, LoopBB, AfterBB);
+    Latch->setMetadata(llvm::LLVMContext::MD_loop,
+        loop_id(*code_module.TheContext, Hints, { TheFunction->getName(), getSymbolName(VarName) }));
+    code_module.SSA.seal(LoopBB);
+    code_module.SSA.seal(AfterBB);
+    code_module.Builder.SetInsertPoint(AfterBB);
+
+    code_module.NamedValues.restore(Scope);
+
+    return llvm::Constant::getNullValue(llvm::Type::getDoubleTy(*code_module.TheContext));
+}
+
+llvm::Value *FlatCodegen::emitVar(FlatExpr e)
+{
+    const uint32_t *Tail = ast.tail(e);
+    uint32_t Count = Tail[0];
+    auto Scope = code_module.NamedValues.scope();
+
+    for (uint32_t i = 0; i != Count; ++i)
+    {
+        Symbol VarName{ Tail[1 + 2 * i] };
+        FlatExpr Init{ Tail[2 + 2 * i] };
+
+        llvm::Value *InitVal;
+        if (Init)
+        {
+            InitVal = emit(Init);
+            if (!InitVal) return nullptr;
+        }
+        else
+        {
+            InitVal = llvm::ConstantFP::get(*code_module.TheContext, llvm::APFloat(0.0));
+        }
+
+        SSAVariable Variable = code_module.SSA.create(getSymbolName(VarName));
+        writeVariable(Variable, InitVal, code_module);
+
+        code_module.NamedValues.bind(VarName, Variable);
+    }
+
+    llvm::Value *BodyVal = emit(ast.lhs(e));
+    if (!BodyVal) return nullptr;
+
+    code_module.NamedValues.restore(Scope);
+
+    return BodyVal;
+}
+
+llvm::Function *FlatCodegen::emit(FlatProto p)
+{
+    const auto &P = ast.prototype(p);
+    auto Params = ast.params_of(P);
+
+    std::vector<llvm::Type *> Doubles(Params.size(), llvm::Type::getDoubleTy(*code_module.TheContext));
+    llvm::FunctionType *FT = llvm::FunctionType::get(llvm::Type::getDoubleTy(*code_module.TheContext), Doubles, false);
+
+    llvm::Function *F =
+        llvm::Function::Create(FT, llvm::Function::ExternalLinkage, getSymbolName(P.name), code_module.TheModule.get());
+
+    unsigned Idx = 0;
+    for (auto &Arg : F->args()) Arg.setName(getSymbolName(Params[Idx++]));
+    code_module.setFunctionAttributes(*F);
+
+    return F;
+}
+
+llvm::Function *FlatCodegen::emit(FlatFn f)
+{
+    const auto &Fn = ast.function(f);
+    const auto &P = ast.prototype(Fn.proto);
+    auto Params = ast.params_of(P);
+    bool IsBinaryOp = P.is_operator && Params.size() == 2;
+
+    FunctionProtos[P.name] = Fn.proto;
+    llvm::Function *TheFunction = getFunction(P.name);
+    if (!TheFunction) return nullptr;
+
+    if (IsBinaryOp) installBinop(symbols().name(P.name), P.precedence);
+
+    llvm::BasicBlock *BB = llvm::BasicBlock::Create(*code_module.TheContext, "entry", TheFunction);
+    code_module.Builder.SetInsertPoint(BB);
+    code_module.SSA.seal(BB);
+
+    code_module.NamedValues.clear();
+    unsigned Idx = 0;
+    for (auto &Arg : TheFunction->args())
+    {
+        Symbol Name = Params[Idx++];
+        SSAVariable Variable = code_module.SSA.create(getSymbolName(Name));
+        writeVariable(Variable, &Arg, code_module);
+        code_module.NamedValues.bind(Name, Variable);
+    }
+
+    llvm::Value *RetVal = emit(Fn.body);
+    code_module.SSA.reset();
+    if (RetVal)
+    {
+        code_module.Builder.CreateRet(RetVal);
+        llvm::verifyFunction(*TheFunction);
+        return TheFunction;
+    }
+
+    TheFunction->eraseFromParent();
+
+    if (IsBinaryOp) removeBinop(symbols().name(P.name));
+    return nullptr;
+}
@@ -0,0 +1,199 @@
+#ifndef __FLATAST_H_
+#define __FLATAST_H_
+#include "../codegen/codemodule.hpp"
+#include "../misc/symbol.hpp"
+#include <cstdint>
+#include <span>
+#include <variant>
+#include <vector>
+
+/// FlatId - Index of an entry in one of FlatAST's tables. Index 0 of every
+/// table is a placeholder, so a default FlatId means "none", like a null
+/// pointer in the tree AST.
+template<typename Tag> struct FlatId
+{
+    uint32_t index = 0;
+
+    explicit operator bool() const { return index != 0; }
+    bool operator==(const FlatId &) const = default;
+};
+using FlatExpr = FlatId<struct FlatExprTag>;
+using FlatProto = FlatId<struct FlatProtoTag>;
+using FlatFn = FlatId<struct FlatFnTag>;
+
+enum class FlatKind : uint8_t { none, number, variable, unary, binary, call, if_expr, for_expr, var_expr };
+
+/// FlatAST - The expressions of a translation unit as parallel arrays instead
+/// of a tree of objects: node i is kinds[i], ops[i], first[i] and second[i].
+/// Children are indices and always precede their parent, so the nodes of a
+/// function are contiguous and a pass that doesn't care about shape can be a
+/// linear scan. What first and second hold depends on the kind:
+///
+///   number     first = index into numbers
+///   variable   first = symbol id
+///   unary      first = operand                     ops = operator
+///   binary     first = lhs, second = rhs           ops = operator
+///   call       first = callee symbol id, second -> extra: argc, args...
+///   if_expr    first = cond, second -> extra: then, else
+///   for_expr   first = variable symbol id, second -> extra: start, end, step (0 if none), body,
+///              vectorize, unroll (LoopHints)
+///   var_expr   first = body, second -> extra: count, (symbol id, init or 0)...
+struct FlatAST
+{
+    struct Prototype
+    {
+        Symbol name;
+        uint32_t params_begin = 0, params_count = 0;
+        bool is_operator = false;
+        uint32_t precedence = 0;
+    };
+    struct Function
+    {
+        FlatProto proto;
+        FlatExpr body;
+    };
+
+    std::vector<FlatKind> kinds{ FlatKind::none };
+    std::vector<char> ops{ 0 };
+    std::vector<uint32_t> first{ 0 };
+    std::vector<uint32_t> second{ 0 };
+    std::vector<double> numbers;
+    std::vector<uint32_t> extra;
+
+    std::vector<Prototype> prototypes{ Prototype{} };
+    std::vector<Symbol> params;
+    std::vector<Function> functions{ Function{} };
+
+    /// top_level - Externs and definitions in source order; a default id
+    /// marks an item that failed to parse.
+    std::vector<std::variant<FlatProto, FlatFn>> top_level;
+
+    std::size_t size() const { return kinds.size() - 1; }
+
+    FlatKind kind(FlatExpr e) const { return kinds[e.index]; }
+    char op(FlatExpr e) const { return ops[e.index]; }
+    double number(FlatExpr e) const { return numbers[first[e.index]]; }
+    Symbol symbol(FlatExpr e) const { return Symbol{ first[e.index] }; }
+    FlatExpr lhs(FlatExpr e) const { return FlatExpr{ first[e.index] }; }
+    FlatExpr rhs(FlatExpr e) const { return FlatExpr{ second[e.index] }; }
+    /// tail - The extra entries of a call, if, for or var node, counts included.
+    const uint32_t *tail(FlatExpr e) const { return extra.data() + second[e.index]; }
+
+    const Prototype &prototype(FlatProto p) const { return prototypes[p.index]; }
+    std::span<const Symbol> params_of(const Prototype &p) const
+    {
+        return std::span<const Symbol>(params).subspan(p.params_begin, p.params_count);
+    }
+    const Function &function(FlatFn f) const { return functions[f.index]; }
+
+    /// countNodes - Number of nodes in the subtree rooted at e. Walks the
+    /// tree shape like ExprAST::countNodes does; counting every node of the
+    /// unit is just size().
+    std::size_t countNodes(FlatExpr e) const
+    {
+        const uint32_t *t = tail(e);
+        switch (kind(e))
+        {
+        case FlatKind::number:
+        case FlatKind::variable:
+            return 1;
+        case FlatKind::unary:
+            return 1 + countNodes(lhs(e));
+        case FlatKind::binary:
+            return 1 + countNodes(lhs(e)) + countNodes(rhs(e));
+        case FlatKind::call: {
+            std::size_t n = 1;
+            for (uint32_t i = 1; i <= t[0]; ++i) n += countNodes(FlatExpr{ t[i] });
+            return n;
+        }
+        case FlatKind::if_expr:
+            return 1 + countNodes(lhs(e)) + countNodes(FlatExpr{ t[0] }) + countNodes(FlatExpr{ t[1] });
+        case FlatKind::for_expr: {
+            std::size_t n = 1;
+            for (uint32_t i = 0; i < 4; ++i) n += t[i] ? countNodes(FlatExpr{ t[i] }) : 0;
+            return n;
+        }
+        case FlatKind::var_expr: {
+            std::size_t n = 1 + countNodes(lhs(e));
+            for (uint32_t i = 0; i < t[0]; ++i) n += t[2 + 2 * i] ? countNodes(FlatExpr{ t[2 + 2 * i] }) : 0;
+            return n;
+        }
+        case FlatKind::none:
+            break;
+        }
+        return 0;
+    }
+
+    /// collectAssigned - Append the names the subtree rooted at e assigns to
+    /// with '=', like ExprAST::collectAssigned.
+    void collectAssigned(FlatExpr e, std::vector<Symbol> &names) const
+    {
+        const uint32_t *t = tail(e);
+        switch (kind(e))
+        {
+        case FlatKind::unary:
+            collectAssigned(lhs(e), names);
+            break;
+        case FlatKind::binary:
+            if (op(e) == '=') names.push_back(symbol(lhs(e)));
+            collectAssigned(lhs(e), names);
+            collectAssigned(rhs(e), names);
+            break;
+        case FlatKind::call:
+            for (uint32_t i = 1; i <= t[0]; ++i) collectAssigned(FlatExpr{ t[i] }, names);
+            break;
+        case FlatKind::if_expr:
+            collectAssigned(lhs(e), names);
+            collectAssigned(FlatExpr{ t[0] }, names);
+            collectAssigned(FlatExpr{ t[1] }, names);
+            break;
+        case FlatKind::for_expr:
+            for (uint32_t i = 0; i < 4; ++i)
+            {
+                if (t[i]) collectAssigned(FlatExpr{ t[i] }, names);
+            }
+            break;
+        case FlatKind::var_expr:
+            for (uint32_t i = 0; i < t[0]; ++i)
+            {
+                if (t[2 + 2 * i]) collectAssigned(FlatExpr{ t[2 + 2 * i] }, names);
+            }
+            collectAssigned(lhs(e), names);
+            break;
+        case FlatKind::number:
+        case FlatKind::variable:
+        case FlatKind::none:
+            break;
+        }
+    }
+};
+
+/// FlatCodegen - Emits the items of a FlatAST into a CodeModule, producing
+/// the same IR as the tree AST's codegen() methods. Walks the arrays with a
+/// switch on the node kind instead of a virtual call per node.
+class FlatCodegen
+{
+    const FlatAST &ast;
+    CodeModule &code_module;
+    SymbolMap<FlatProto> FunctionProtos;
+
+    llvm::Function *getFunction(Symbol Name);
+    llvm::Value *emit(FlatExpr e);
+    llvm::Value *emitBinary(FlatExpr e);
+    llvm::Value *emitCall(FlatExpr e);
+    llvm::Value *emitIf(FlatExpr e);
+    llvm::Value *emitFor(FlatExpr e);
+    llvm::Value *emitVar(FlatExpr e);
+
+  public:
+    FlatCodegen(const FlatAST &_ast, CodeModule &_code_module) : ast(_ast), code_module(_code_module) {}
+
+    /// addPrototype - Make p known without emitting it; a declaration is
+    /// added to the module if something calls it.
+    void addPrototype(FlatProto p) { FunctionProtos[ast.prototype(p).name] = p; }
+
+    llvm::Function *emit(FlatProto p);
+    llvm::Function *emit(FlatFn f);
+};
+
+#endif// __FLATAST_H_
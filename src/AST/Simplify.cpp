@@ -0,0 +1,234 @@
+#include "Simplify.hpp"
+#include <cmath>
+
+// Each simplify leaves the value and side effects of its node as they were:
+// operations are folded with the same double arithmetic codegen emits, and
+// an identity only applies if it holds for NaN, infinities and signed zeros
+// too. That rules out x + 0 (-0 + 0 is +0) and x * 0 (NaN, infinities and
+// the sign), but not x * 1, x - 0 or x + -0. Calls, including those of
+// user defined operators, are evaluated if all their arguments are constant
+// and the function is pure; see Simplifier.
+
+namespace {
+/// is_true - A condition as codegen tests it: ordered and not equal to 0.0,
+/// so NaN is false.
+bool is_true(double V) { return V < 0.0 || V > 0.0; }
+
+bool is(std::optional<double> V, double C) { return V && *V == C && std::signbit(*V) == std::signbit(C); }
+
+/// operator_symbol - The function defining a user operator, e.g. "binary|".
+Symbol operator_symbol(const char *kind, char op) { return symbols().lookup(std::string(kind) + op); }
+}// namespace
+
+void Simplifier::begin(FunctionAST &function)
+{
+    current = function.getPrototype()->getSymbol();
+    current_pure = functions[current] == purity::unknown;
+}
+
+void Simplifier::end(FunctionAST &function)
+{
+    if (!current_pure) return;
+    functions[current] = purity::pure;
+    interp.define(function);
+}
+
+bool Simplifier::calls(Symbol callee)
+{
+    if (functions[callee] == purity::pure) return true;
+    if (callee != current) current_pure = false;
+    return false;
+}
+
+ExprAST *NumberExprAST::simplify(Simplifier &) { return this; }
+
+ExprAST *VariableExprAST::simplify(Simplifier &) { return this; }
+
+ExprAST *UnaryExprAST::simplify(Simplifier &s)
+{
+    // Unary operators are all user defined.
+    Operand = Operand->simplify(s);
+    auto V = Operand->getNumber();
+    if (s.calls(operator_symbol("unary", Opcode)) && V)
+    {
+        if (auto Result = s.evaluate([&](Interpreter &interp) { return interp.unary(Opcode, *V); }))
+            return s.replace(1, s.number(*Result));
+    }
+    return this;
+}
+
+ExprAST *BinaryExprAST::simplify(Simplifier &s)
+{
+    // The LHS of '=' is the variable assigned, not a value; the index of an
+    // array element assigned is one though.
+    if (Op != '=' || LHS->getElement()) LHS = LHS->simplify(s);
+    RHS = RHS->simplify(s);
+    auto L = LHS->getNumber();
+    auto R = RHS->getNumber();
+
+    if (L && R)
+    {
+        switch (Op)
+        {
+        case '+':
+            return s.replace(2, s.number(*L + *R));
+        case '-':
+            return s.replace(2, s.number(*L - *R));
+        case '*':
+            return s.replace(2, s.number(*L * *R));
+        case '<':
+            // Unordered or less than, like codegen's fcmp ult.
+            return s.replace(2, s.number(!(*L >= *R) ? 1.0 : 0.0));
+        default:
+            break;
+        }
+    }
+
+    switch (Op)
+    {
+    case '=':
+    case '+':
+    case '-':
+    case '*':
+    case '<':
+        break;
+    default:
+        // A user defined operator.
+        if (s.calls(operator_symbol("binary", Op)) && L && R)
+        {
+            if (auto Result = s.evaluate([&](Interpreter &interp) { return interp.binary(Op, *L, *R); }))
+                return s.replace(2, s.number(*Result));
+        }
+        return this;
+    }
+
+    switch (Op)
+    {
+    case '+':
+        if (is(R, -0.0)) return s.replace(2, LHS);
+        if (is(L, -0.0)) return s.replace(2, RHS);
+        break;
+    case '-':
+        if (is(R, 0.0)) return s.replace(2, LHS);
+        break;
+    case '*':
+        if (is(R, 1.0)) return s.replace(2, LHS);
+        if (is(L, 1.0)) return s.replace(2, RHS);
+        break;
+    default:
+        break;
+    }
+    return this;
+}
+
+ExprAST *CallExprAST::simplify(Simplifier &s)
+{
+    // The argument array is only const to the nodes' users; it is arena
+    // memory like the nodes.
+    bool Constant = true;
+    for (auto *&Arg : std::span(const_cast<ExprAST **>(Args.data()), Args.size()))
+    {
+        Arg = Arg->simplify(s);
+        Constant &= Arg->getNumber().has_value();
+    }
+    if (s.calls(Callee) && Constant)
+    {
+        if (auto Result = s.evaluate([&](Interpreter &interp) { return interp.call(Callee, Args); }))
+            return s.replace(Args.size(), s.number(*Result));
+    }
+    return this;
+}
+
+ExprAST *IfExprAST::simplify(Simplifier &s)
+{
+    Cond = Cond->simplify(s);
+    if (auto C = Cond->getNumber())
+    {
+        // Only the branch taken is left, and this node and the condition
+        // go with the other one.
+        if (is_true(*C)) return s.replace(2 + Else->countNodes(), Then->simplify(s));
+        return s.replace(2 + Then->countNodes(), Else->simplify(s));
+    }
+    Then = Then->simplify(s);
+    Else = Else->simplify(s);
+    return this;
+}
+
+// The body runs at least once whatever the end condition, so the loop stays.
+ExprAST *ForExprAST::simplify(Simplifier &s)
+{
+    Start = Start->simplify(s);
+    End = End->simplify(s);
+    if (Step) Step = Step->simplify(s);
+    Body = Body->simplify(s);
+    return this;
+}
+
+ExprAST *VarExprAST::simplify(Simplifier &s)
+{
+    // Arena memory, like CallExprAST's arguments.
+    auto *Vars = const_cast<std::pair<Symbol, ExprAST *> *>(VarNames.data());
+    for (auto &[Name, Init] : std::span(Vars, VarNames.size()))
+    {
+        if (Init) Init = Init->simplify(s);
+    }
+    Body = Body->simplify(s);
+    return this;
+}
+
+ExprAST *IndexExprAST::simplify(Simplifier &s)
+{
+    s.uses_arrays();
+    Index = Index->simplify(s);
+    return this;
+}
+
+ExprAST *LengthExprAST::simplify(Simplifier &s)
+{
+    s.uses_arrays();
+    return this;
+}
+
+ExprAST *ArrayVarExprAST::simplify(Simplifier &s)
+{
+    s.uses_arrays();
+    Length = Length->simplify(s);
+    Body = Body->simplify(s);
+    return this;
+}
+
+void FunctionAST::simplify(Simplifier &s)
+{
+    s.begin(*this);
+    Body = Body->simplify(s);
+    s.end(*this);
+}
+
+SimplifyStats simplify(TranslationUnit &unit)
+{
+    Simplifier s(unit.arena);
+
+    // Functions defined twice, or also declared extern, and the top level
+    // expressions, are not pure.
+    SymbolMap<uint32_t> declared;
+    for (auto &item : unit.top_expressions)
+    {
+        auto **fn = std::get_if<FnAST *>(&item);
+        if (!fn || !*fn) continue;
+        auto *proto = (*fn)->getPrototype();
+        if (++declared[proto->getSymbol()] > 1 || proto->getName() == "__anon_expr") s.exclude(proto->getSymbol());
+    }
+
+    for (auto &item : unit.top_expressions)
+    {
+        if (auto **E = std::get_if<ExprAST *>(&item))
+        {
+            if (*E) *E = (*E)->simplify(s);
+            continue;
+        }
+        // Prototypes of externs have nothing to simplify.
+        auto *fn = std::get<FnAST *>(item);
+        if (fn && fn->getPrototype() != fn) static_cast<FunctionAST *>(fn)->simplify(s);
+    }
+    return s.result();
+}
@@ -0,0 +1,96 @@
+#ifndef __SIMPLIFY_H_
+#define __SIMPLIFY_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include "AST.hpp"
+#include "ASTArena.hpp"
+#include "../interpreter/Interpreter.hpp"
+
+/// SimplifyStats - What a simplify pass did.
+struct SimplifyStats
+{
+    std::size_t removed = 0;// Nodes dropped from the tree.
+    std::size_t evaluated = 0;// Calls replaced by their value.
+    std::size_t abandoned = 0;// Calls that failed or ran out of budget.
+};
+
+/// Simplifier - One simplification pass over a translation unit, in order:
+/// the arena new literals go in, what the pass has done, and the functions
+/// found pure so far, which it can evaluate. A function is pure if it is
+/// defined once, before its uses, and calls only pure functions and itself,
+/// so no externs, and no operators that aren't pure in turn. The nodes'
+/// simplify methods do the rest; see AST/Simplify.cpp.
+class Simplifier
+{
+    enum class purity : char
+    {
+        unknown,
+        pure,
+        impure,
+    };
+
+    ASTArena &arena;
+    SimplifyStats stats;
+    SymbolMap<purity> functions;
+    // Evaluates calls of the pure functions, which are defined in it.
+    Interpreter interp;
+    uint64_t steps_left = unit_steps;
+    // The function being simplified, and whether it is pure so far.
+    Symbol current;
+    bool current_pure = false;
+
+  public:
+    /// Evaluation budget: calls and loop iterations for each call evaluated
+    /// and for the whole translation unit, and how deep calls may nest.
+    static constexpr uint64_t call_steps = 1'000'000;
+    static constexpr uint64_t unit_steps = 10'000'000;
+    static constexpr std::size_t call_depth = 1000;
+
+    explicit Simplifier(ASTArena &_arena) : arena(_arena) { interp.silence(); }
+
+    /// number - A new literal node.
+    ExprAST *number(double value) { return arena.make<NumberExprAST>(value); }
+    /// replace - Count nodes dropped to make with the replacement of a node,
+    /// and return with.
+    ExprAST *replace(std::size_t nodes, ExprAST *with)
+    {
+        stats.removed += nodes;
+        return with;
+    }
+
+    /// exclude - Never treat function as pure, e.g. as it is defined twice.
+    void exclude(Symbol function) { functions[function] = purity::impure; }
+    /// begin, end - Simplify the body of function in between; end defines
+    /// it for evaluation if it turned out pure.
+    void begin(FunctionAST &function);
+    void end(FunctionAST &function);
+    /// calls - Note that the function being simplified calls callee, and
+    /// return whether such a call can be evaluated, as callee is pure.
+    bool calls(Symbol callee);
+    /// uses_arrays - Note that the function being simplified uses arrays,
+    /// which the interpreter can't evaluate.
+    void uses_arrays() { current_pure = false; }
+    /// evaluate - The value evaluate(interp) computes, or nullopt if it
+    /// fails or runs out of budget.
+    template<typename Evaluate> std::optional<double> evaluate(Evaluate evaluate)
+    {
+        auto budget = std::min(call_steps, steps_left);
+        interp.limit(budget, call_depth);
+        auto value = evaluate(interp);
+        steps_left -= budget - interp.steps();
+        ++(value ? stats.evaluated : stats.abandoned);
+        return value;
+    }
+
+    const SimplifyStats &result() const { return stats; }
+};
+
+/// simplify - Fold constant arithmetic and calls of pure functions with
+/// constant arguments, drop the branches constant if conditions never take
+/// and apply the identities that hold for every double, in each function of
+/// unit, before codegen.
+SimplifyStats simplify(TranslationUnit &unit);
+
+#endif// __SIMPLIFY_H_
@@ -1,29 +1,134 @@
 #ifndef __ARGPARSER_H_
 #define __ARGPARSER_H_
 
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
 #include <docopt/docopt.h>
 #include <fmt/format.h>
+#include <optional>
+#include <string_view>
 #include <variant>
 #include <stdexcept>
+#include <thread>
 
 
+/// fp_flag_names - The fast-math flags --fp-flags takes, by their names in
+/// LLVM IR. Bit i of Arguments::fp_flags is fp_flag_names[i].
+inline constexpr std::string_view fp_flag_names[] = { "reassoc", "nnan", "ninf", "nsz", "arcp", "contract", "afn" };
+
+/// max_jobs - The most threads --jobs takes, far more than any machine has
+/// cores for.
+inline constexpr unsigned max_jobs = 1024;
+
+/// bad_option - An option given a value it doesn't take, e.g. --jobs=abc.
+/// Carries the option as it was written, to be reported, and why.
+struct bad_option : std::invalid_argument
+{
+    std::string argument;
+
+    bad_option(std::string_view option, std::string_view value, const std::string &why)
+        : std::invalid_argument(why), argument(fmt::format("{}={}", option, value))
+    {}
+};
+
+/// parse_count - The whole number text, the value of option, spells, for an
+/// option like --jobs=N. Anything else, or a number above max, throws
+/// bad_option.
+inline unsigned parse_count(std::string_view option, std::string_view text, unsigned max)
+{
+    unsigned count = 0;
+    auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), count);
+    if (ec != std::errc() || end != text.data() + text.size() || count > max)
+        throw bad_option(option, text, fmt::format("expected a whole number up to {}", max));
+    return count;
+}
+
 struct Arguments
 {
     std::string srcfilename;
     std::string outfilename = "output.o";
-    int8_t opt_level;
+    char opt_level = '0';// one of 0 1 2 3 s z
+    bool flat_ast = false;
+    bool jit = false;
+    bool lazy = false;
+    bool interpret = false;
+    bool vm = false;
+    bool emit_bytecode = false;
+    bool tiered = false;
+    uint32_t hot = 1000;
+    std::optional<unsigned> jobs;
+    std::optional<std::string> cache_dir;
+    std::optional<std::string> target;// triple, the host's if not given
+    std::optional<std::string> mcpu;
+    std::optional<std::string> mattr;
+    uint8_t fp_flags = 0;// fast-math flags, see fp_flag_names
+    bool loop_report = false;
+    bool simplify_report = false;
+    std::optional<std::string> serve_socket;
+    std::optional<std::string> connect_socket;
 };
 
 const char USAGE[] =
     R"(toy compiler
     Usage:
-      toycomp <filename> [--out=filename] [--opt=level]
+      toycomp <filename> [--out=filename] [--opt=level] [--jobs=N] [--flat-ast] [--target=triple] [--mcpu=cpu] [--mattr=features] [--ffast-math] [--fp-flags=flags] [--fp-contract=mode] [--loop-report] [--simplify-report]
+      toycomp <filename> --cache=dir [--out=filename] [--opt=level] [--target=triple] [--mcpu=cpu] [--mattr=features] [--ffast-math] [--fp-flags=flags] [--fp-contract=mode]
+      toycomp <filename> --connect=socket [--out=filename] [--opt=level]
+      toycomp --serve=socket [--jobs=N]
+      toycomp <filename> --jit [--lazy] [--opt=level] [--simplify-report]
+      toycomp <filename> --interpret
+      toycomp <filename> --vm
+      toycomp <filename> --emit-bytecode [--out=filename]
+      toycomp <filename> --tiered [--hot=N]
       toycomp (-h | --help)
 
     Options:
+      <filename>                        Source file, - reads it from standard input.
       -h --help                         Show this screen.
-      -o filname --out=filename       Specify output object file name
-      -O level --opt=level            Specify optimization level [1,2,3])";
+      -o filname --out=filename         Specify output object file name
+      -O level --opt=level              Specify optimization level [0,1,2,3,s,z], default 0
+      -j N --jobs=N                     Generate code on N threads, up to 1024, 0 for one per core. Programs
+                                        of more than 512 functions are written as several objects.
+      --target=triple                   Generate code for triple, e.g. aarch64-linux-gnu, instead of the host.
+      --mcpu=cpu                        Tune for and use the instructions of cpu, e.g. skylake, instead of a
+                                        generic one. native is the host's CPU, with the features it has,
+                                        and can't be used with --target.
+      --mattr=features                  Turn features of the target on or off, e.g. +avx2,+fma,-avx512f.
+      --ffast-math                      Give up strict IEEE arithmetic for speed: all of --fp-flags.
+      --fp-flags=flags                  Allow some of what --ffast-math does, a comma separated list of
+                                        reassoc (reorder, e.g. to vectorize sums), nnan (assume no NaNs),
+                                        ninf (no infinities), nsz (ignore the sign of zero), arcp (use
+                                        reciprocals), contract (fuse into FMAs), afn (approximate functions).
+      --fp-contract=mode                fast fuses multiplies and adds into FMAs, off doesn't, even with
+                                        --ffast-math. Default off, or fast with --ffast-math.
+      --loop-report                     Report on stderr which loops were vectorized or unrolled, and why
+                                        others weren't. A loop is named by its function and variable, and
+                                        whether it is the copy with its array bounds checks or without.
+      --simplify-report                 Report on stderr how much constant folding and compile time
+                                        evaluation removed from the program.
+      --flat-ast                        Parse into the flat (struct of arrays) AST instead of the node tree.
+                                        It skips constant folding and compile time evaluation.
+      --cache=dir                       Keep each function's object code in dir and reuse it while the
+                                        function is unchanged. The output is then a static archive of
+                                        per-function objects.
+      --serve=socket                    Run as a compile server on the Unix domain socket socket, with
+                                        the targets set up once instead of per compile, compiling
+                                        for up to N clients at once (--jobs, default one per core).
+      --connect=socket                  Compile on the server at socket instead of in this process.
+                                        The output and messages are those of a compile in process.
+                                        toyclient does the same, faster, as it doesn't load LLVM.
+      --jit                             Run the program in process instead of writing an object file,
+                                        printing the value of each top level expression.
+      --lazy                            With --jit, generate and compile each function on its first call.
+      --interpret                       Like --jit, but evaluate the AST directly without LLVM.
+      --vm                              Like --interpret, but compile to bytecode and run that. <filename>
+                                        may also be a file written by --emit-bytecode.
+      --emit-bytecode                   Write the program as bytecode for --vm, to output.tbc by default.
+      --tiered                          Like --vm, but compile hot functions with the JIT at -O3 in the
+                                        background and switch to the native code when it is ready.
+      --hot=N                           With --tiered, a function is hot after N calls and loop
+                                        iterations, default 1000.)";
 
 inline auto get_args_map(int argc, char **argv)
 {
@@ -37,7 +142,6 @@ inline auto get_args_map(int argc, char **argv)
 
 inline std::variant<Arguments, std::string> get_args(int argc, char **argv)
 {
-    size_t arg_position = 0;
     try
     {
         Arguments args;
@@ -47,25 +151,96 @@ inline std::variant<Arguments, std::string> get_args(int argc, char **argv)
         {
             auto filter_str = args_map["--out"].asString();
             args.outfilename = filter_str;
-            arg_position++;
         }
 
         if (args_map["<filename>"])
         {
             args.srcfilename = args_map["<filename>"].asString();
-            arg_position++;
         }
 
 
         if (args_map["--opt"])
         {
-            args.opt_level = std::stoi(args_map["--opt"].asString());
-            arg_position++;
+            auto level = args_map["--opt"].asString();
+            if (level.size() != 1 || std::string_view("0123sz").find(level[0]) == std::string_view::npos)
+                throw bad_option("--opt", level, "expected one of 0, 1, 2, 3, s or z");
+            args.opt_level = level[0];
+        }
+        if (args_map["--hot"])
+        {
+            auto hot = args_map["--hot"].asString();
+            args.hot = parse_count("--hot", hot, UINT32_MAX);
+            if (args.hot < 1) throw bad_option("--hot", hot, "expected at least 1");
+        }
+        if (args_map["--cache"])
+        {
+            args.cache_dir = args_map["--cache"].asString();
+        }
+        if (args_map["--target"])
+        {
+            args.target = args_map["--target"].asString();
         }
+        if (args_map["--mcpu"])
+        {
+            args.mcpu = args_map["--mcpu"].asString();
+        }
+        if (args_map["--mattr"])
+        {
+            args.mattr = args_map["--mattr"].asString();
+        }
+        if (args_map["--ffast-math"] && args_map["--ffast-math"].asBool())
+            args.fp_flags = static_cast<uint8_t>((1u << std::size(fp_flag_names)) - 1);
+        if (args_map["--fp-flags"])
+        {
+            auto list = args_map["--fp-flags"].asString();
+            std::string_view flags = list;
+            while (!flags.empty())
+            {
+                auto name = flags.substr(0, flags.find(','));
+                flags.remove_prefix(std::min(flags.size(), name.size() + 1));
+                auto known = std::find(std::begin(fp_flag_names), std::end(fp_flag_names), name);
+                if (known == std::end(fp_flag_names))
+                    throw bad_option("--fp-flags", list, fmt::format("unknown fast-math flag \"{}\"", name));
+                auto flag = static_cast<uint8_t>(1u << (known - std::begin(fp_flag_names)));
+                args.fp_flags = static_cast<uint8_t>(args.fp_flags | flag);
+            }
+        }
+        if (args_map["--fp-contract"])
+        {
+            auto mode = args_map["--fp-contract"].asString();
+            if (mode != "fast" && mode != "off") throw bad_option("--fp-contract", mode, "expected fast or off");
+            auto contract = static_cast<uint8_t>(
+                1u << (std::find(std::begin(fp_flag_names), std::end(fp_flag_names), "contract") - std::begin(fp_flag_names)));
+            args.fp_flags = static_cast<uint8_t>(mode == "fast" ? args.fp_flags | contract : args.fp_flags & ~contract);
+        }
+        if (args_map["--serve"])
+        {
+            args.serve_socket = args_map["--serve"].asString();
+        }
+        if (args_map["--connect"])
+        {
+            args.connect_socket = args_map["--connect"].asString();
+        }
+        if (args_map["--jobs"])
+        {
+            auto jobs = parse_count("--jobs", args_map["--jobs"].asString(), max_jobs);
+            args.jobs = jobs ? jobs : std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        args.flat_ast = args_map["--flat-ast"] && args_map["--flat-ast"].asBool();
+        args.jit = args_map["--jit"] && args_map["--jit"].asBool();
+        args.lazy = args_map["--lazy"] && args_map["--lazy"].asBool();
+        args.interpret = args_map["--interpret"] && args_map["--interpret"].asBool();
+        args.vm = args_map["--vm"] && args_map["--vm"].asBool();
+        args.emit_bytecode = args_map["--emit-bytecode"] && args_map["--emit-bytecode"].asBool();
+        args.tiered = args_map["--tiered"] && args_map["--tiered"].asBool();
+        args.loop_report = args_map["--loop-report"] && args_map["--loop-report"].asBool();
+        args.simplify_report = args_map["--simplify-report"] && args_map["--simplify-report"].asBool();
+        if (args.emit_bytecode && !args_map["--out"]) args.outfilename = "output.tbc";
         return std::variant<Arguments, std::string>(args);
-    } catch (const std::invalid_argument &e)
+    } catch (const bad_option &e)
     {
-        return fmt::format("Error: invalid argument \"\x1b[38;2;225;100;40m{}\x1b[0m\"\n", argv[arg_position]);
+        return fmt::format("Error: invalid argument \"\x1b[38;2;225;100;40m{}\x1b[0m\": {}\n", e.argument, e.what());
     }
 }
 
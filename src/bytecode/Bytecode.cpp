@@ -0,0 +1,236 @@
+#include "Bytecode.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fmt/format.h>
+
+namespace {
+constexpr std::string_view magic = "\x7fTBC";
+constexpr uint32_t version = 1;
+
+class writer
+{
+    std::string &out;
+
+  public:
+    explicit writer(std::string &o) : out(o) {}
+
+    void u8(uint8_t v) { out.push_back(static_cast<char>(v)); }
+    void u16(uint16_t v)
+    {
+        u8(static_cast<uint8_t>(v));
+        u8(static_cast<uint8_t>(v >> 8));
+    }
+    void u32(uint32_t v)
+    {
+        u16(static_cast<uint16_t>(v));
+        u16(static_cast<uint16_t>(v >> 16));
+    }
+    void u64(uint64_t v)
+    {
+        u32(static_cast<uint32_t>(v));
+        u32(static_cast<uint32_t>(v >> 32));
+    }
+    void f64(double v)
+    {
+        uint64_t bits;
+        std::memcpy(&bits, &v, sizeof bits);
+        u64(bits);
+    }
+    void str(std::string_view s)
+    {
+        u32(static_cast<uint32_t>(s.size()));
+        out.append(s);
+    }
+};
+
+/// reader - Reads what writer wrote. Reading past the end yields zeros and
+/// sets failed, so callers check once at the end.
+class reader
+{
+    std::string_view in;
+
+  public:
+    bool failed = false;
+    explicit reader(std::string_view i) : in(i) {}
+
+    bool take(std::size_t n)
+    {
+        if (in.size() < n) failed = true;
+        return !failed;
+    }
+    uint8_t u8()
+    {
+        if (!take(1)) return 0;
+        auto v = static_cast<uint8_t>(in[0]);
+        in.remove_prefix(1);
+        return v;
+    }
+    uint16_t u16() { return static_cast<uint16_t>(u8() | u8() << 8); }
+    uint32_t u32() { return u16() | static_cast<uint32_t>(u16()) << 16; }
+    uint64_t u64() { return u32() | static_cast<uint64_t>(u32()) << 32; }
+    double f64()
+    {
+        uint64_t bits = u64();
+        double v;
+        std::memcpy(&v, &bits, sizeof v);
+        return v;
+    }
+    std::string str()
+    {
+        auto n = u32();
+        if (!take(n)) return {};
+        std::string s(in.substr(0, n));
+        in.remove_prefix(n);
+        return s;
+    }
+    /// count - An element count, refused if there can't be that many
+    /// elements of at least min_size bytes left.
+    uint32_t count(std::size_t min_size)
+    {
+        auto n = u32();
+        if (n > in.size() / min_size) failed = true;
+        return failed ? 0 : n;
+    }
+};
+}// namespace
+
+bool is_bytecode(std::string_view bytes) { return bytes.substr(0, magic.size()) == magic; }
+
+std::string serialize(const BytecodeModule &module)
+{
+    std::string out(magic);
+    writer w(out);
+    w.u32(version);
+
+    w.u32(static_cast<uint32_t>(module.functions.size()));
+    for (auto &f : module.functions)
+    {
+        w.str(f.name);
+        w.u16(f.params);
+        w.u16(f.registers);
+        w.u32(static_cast<uint32_t>(f.constants.size()));
+        for (double k : f.constants) w.f64(k);
+        w.u32(static_cast<uint32_t>(f.code.size()));
+        for (auto &I : f.code)
+        {
+            w.u8(static_cast<uint8_t>(I.op));
+            w.u16(I.a);
+            w.u16(I.b);
+            w.u16(I.c);
+        }
+    }
+
+    w.u32(static_cast<uint32_t>(module.externs.size()));
+    for (auto &e : module.externs)
+    {
+        w.str(e.name);
+        w.u16(e.params);
+    }
+
+    w.u32(static_cast<uint32_t>(module.top_level.size()));
+    for (auto index : module.top_level) w.u32(index);
+    return out;
+}
+
+std::variant<BytecodeModule, std::string> deserialize(std::string_view bytes)
+{
+    if (!is_bytecode(bytes)) return std::string("Not a bytecode file\n");
+    reader r(bytes.substr(magic.size()));
+    if (auto v = r.u32(); v != version) return fmt::format("Unsupported bytecode version {}\n", v);
+
+    BytecodeModule module;
+    module.functions.resize(r.count(16));
+    for (auto &f : module.functions)
+    {
+        f.name = r.str();
+        f.params = r.u16();
+        f.registers = r.u16();
+        f.constants.resize(r.count(8));
+        for (double &k : f.constants) k = r.f64();
+        f.code.resize(r.count(7));
+        for (auto &I : f.code)
+        {
+            I.op = static_cast<Op>(r.u8());
+            I.a = r.u16();
+            I.b = r.u16();
+            I.c = r.u16();
+        }
+    }
+
+    module.externs.resize(r.count(6));
+    for (auto &e : module.externs)
+    {
+        e.name = r.str();
+        e.params = r.u16();
+    }
+
+    module.top_level.resize(r.count(4));
+    for (auto &index : module.top_level) index = r.u32();
+
+    if (r.failed) return std::string("Truncated bytecode file\n");
+    if (auto error = verify(module); !error.empty()) return error;
+    return module;
+}
+
+std::string verify(const BytecodeModule &module)
+{
+    for (auto &f : module.functions)
+    {
+        auto bad = [&](std::size_t pc, std::string_view what) {
+            return fmt::format("Invalid bytecode in {} at {}: {}\n", f.name, pc, what);
+        };
+        if (f.registers < std::max<uint16_t>(f.params, 1)) return bad(0, "too few registers");
+        if (f.code.empty() || (f.code.back().op != Op::Jump && f.code.back().op != Op::Return))
+            return bad(f.code.size(), "falls off the end");
+
+        for (std::size_t pc = 0; pc < f.code.size(); ++pc)
+        {
+            auto &I = f.code[pc];
+            auto reg = [&](std::size_t r) { return r < f.registers; };
+            auto jump = [&] { return I.target() < f.code.size(); };
+            // A call's arguments, and its result, are R[a] to R[a + c - 1].
+            auto window = [&] { return static_cast<std::size_t>(I.a) + std::max<uint16_t>(I.c, 1) <= f.registers; };
+
+            bool ok = false;
+            switch (I.op)
+            {
+            case Op::Const:
+                ok = reg(I.a) && I.b < f.constants.size();
+                break;
+            case Op::Move:
+                ok = reg(I.a) && reg(I.b);
+                break;
+            case Op::Add:
+            case Op::Sub:
+            case Op::Mul:
+            case Op::Less:
+                ok = reg(I.a) && reg(I.b) && reg(I.c);
+                break;
+            case Op::Jump:
+                ok = jump();
+                break;
+            case Op::JumpIfFalse:
+            case Op::JumpIfTrue:
+                ok = reg(I.a) && jump();
+                break;
+            case Op::Call:
+                ok = I.b < module.functions.size() && module.functions[I.b].params == I.c && window();
+                break;
+            case Op::CallExtern:
+                ok = I.b < module.externs.size() && module.externs[I.b].params == I.c && window();
+                break;
+            case Op::Return:
+                ok = reg(I.a);
+                break;
+            }
+            if (!ok) return bad(pc, "operand out of range");
+        }
+    }
+
+    for (auto index : module.top_level)
+    {
+        if (index >= module.functions.size() || module.functions[index].params != 0)
+            return fmt::format("Invalid bytecode: top level expression {}\n", index);
+    }
+    return {};
+}
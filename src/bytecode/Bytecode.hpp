@@ -0,0 +1,97 @@
+#ifndef __BYTECODE_H_
+#define __BYTECODE_H_
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+// Register based bytecode for Kaleidoscope. Every value is a double, so
+// registers are plain doubles: no tags, no NaN boxing. Nothing here or in the
+// VM depends on LLVM; only the compiler from the AST does.
+
+/// Register - Index of a register in the running function's frame.
+using Register = uint16_t;
+
+/// Op - The instructions. R[x] is register x, K[x] constant x of the
+/// running function.
+enum class Op : uint8_t {
+    Const,// R[a] = K[b]
+    Move,// R[a] = R[b]
+    Add,// R[a] = R[b] + R[c]
+    Sub,// R[a] = R[b] - R[c]
+    Mul,// R[a] = R[b] * R[c]
+    Less,// R[a] = R[b] < R[c] or unordered ? 1.0 : 0.0
+    Jump,// goto target
+    JumpIfFalse,// if R[a] is 0.0 or NaN goto target
+    JumpIfTrue,// if R[a] is neither goto target
+    Call,// R[a] = functions[b](R[a], ..., R[a + c - 1])
+    CallExtern,// R[a] = externs[b](R[a], ..., R[a + c - 1])
+    Return,// return R[a]
+};
+constexpr std::size_t op_count = static_cast<std::size_t>(Op::Return) + 1;
+
+/// Instruction - One fixed size instruction. Jumps keep their target in b
+/// (low half) and c (high half).
+struct Instruction
+{
+    Op op;
+    uint16_t a = 0, b = 0, c = 0;
+
+    uint32_t target() const { return b | static_cast<uint32_t>(c) << 16; }
+    void set_target(uint32_t t)
+    {
+        b = static_cast<uint16_t>(t);
+        c = static_cast<uint16_t>(t >> 16);
+    }
+};
+static_assert(sizeof(Instruction) == 8);
+
+/// BytecodeFunction - One function: its code, its constant pool, and how
+/// many registers its frame needs. The parameters arrive in the first
+/// registers.
+struct BytecodeFunction
+{
+    std::string name;
+    uint16_t params = 0;
+    uint16_t registers = 0;
+    std::vector<double> constants;
+    std::vector<Instruction> code;
+};
+
+/// BytecodeExtern - A function the program declares but doesn't define,
+/// bound to a builtin by name when the VM is set up.
+struct BytecodeExtern
+{
+    std::string name;
+    uint16_t params = 0;
+};
+
+/// BytecodeModule - A compiled program. top_level holds the functions made
+/// of the top level expressions, to be run in order.
+struct BytecodeModule
+{
+    std::vector<BytecodeFunction> functions;
+    std::vector<BytecodeExtern> externs;
+    std::vector<uint32_t> top_level;
+};
+
+/// is_bytecode - Whether bytes start like a serialized BytecodeModule.
+bool is_bytecode(std::string_view bytes);
+
+/// serialize - module as bytes, little endian whatever the host, so the
+/// files can be moved between machines.
+std::string serialize(const BytecodeModule &module);
+
+/// deserialize - The module serialize made bytes from. The module is
+/// verified, so the VM can run it without further checks; any problem is
+/// reported as an error message instead.
+std::variant<BytecodeModule, std::string> deserialize(std::string_view bytes);
+
+/// verify - Check that every register, constant, jump and call in module is
+/// in range and every function ends in a jump or return. Returns an error
+/// message, or an empty string if module is fine.
+std::string verify(const BytecodeModule &module);
+
+#endif// __BYTECODE_H_
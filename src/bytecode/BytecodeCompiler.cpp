@@ -0,0 +1,329 @@
+#include "BytecodeCompiler.hpp"
+#include <cstring>
+#include <fmt/format.h>
+
+namespace {
+/// LogErrorR - Report a compile error, the bytecode compiler's LogErrorV.
+std::optional<Register> LogErrorR(std::string_view Str)
+{
+    fmt::print(stderr, "Error: {}\n", Str);
+    return std::nullopt;
+}
+
+constexpr std::string_view no_arrays = "arrays need compiled code, not --vm or --tiered";
+}// namespace
+
+void BytecodeCompiler::declare(PrototypeAST &proto)
+{
+    auto &index = extern_index[proto.getSymbol()];
+    if (index) return;
+    module.externs.push_back({ std::string(proto.getName()), static_cast<uint16_t>(proto.getArgs().size()) });
+    index = static_cast<uint32_t>(module.externs.size());
+}
+
+bool BytecodeCompiler::define(FunctionAST &fn)
+{
+    auto &P = *fn.getPrototype();
+    // Enter the function before compiling its body, so it can call itself.
+    auto previous = function_index[P.getSymbol()];
+    function_index[P.getSymbol()] = static_cast<uint32_t>(module.functions.size() + 1);
+    if (!compileFunction(fn))
+    {
+        function_index[P.getSymbol()] = previous;
+        return false;
+    }
+
+    if (P.isBinaryOp()) installBinop(P.getName(), P.getBinaryPrecedence());
+    return true;
+}
+
+bool BytecodeCompiler::top_level(FunctionAST &fn)
+{
+    auto index = compileFunction(fn);
+    if (!index) return false;
+    module.top_level.push_back(*index);
+    return true;
+}
+
+std::optional<uint32_t> BytecodeCompiler::compileFunction(FunctionAST &fn)
+{
+    auto &P = *fn.getPrototype();
+    auto index = static_cast<uint32_t>(module.functions.size());
+    function = &module.functions.emplace_back();
+    function->name = P.getName();
+    function->params = static_cast<uint16_t>(P.getArgs().size());
+    bindings.clear();
+    next = 0;
+    overflow = P.getArgs().size() >= 0xffff;
+
+    // The arguments arrive in the first registers.
+    for (auto Arg : P.getArgs()) bind(Arg, temp());
+
+    auto result = fn.getBody()->compile(*this, temp());
+    if (result && overflow) LogErrorR(fmt::format("Function too large: {}", P.getName()));
+    if (!result || overflow)
+    {
+        module.functions.pop_back();
+        function = nullptr;
+        return std::nullopt;
+    }
+    emit(Op::Return, *result);
+    function = nullptr;
+    return index;
+}
+
+uint16_t BytecodeCompiler::constant(double value)
+{
+    auto &pool = function->constants;
+    for (std::size_t i = 0; i < pool.size(); ++i)
+    {
+        // Bitwise, so 0.0 and -0.0 stay apart.
+        if (std::memcmp(&pool[i], &value, sizeof value) == 0) return static_cast<uint16_t>(i);
+    }
+    if (pool.size() > 0xffff)
+    {
+        overflow = true;
+        return 0;
+    }
+    pool.push_back(value);
+    return static_cast<uint16_t>(pool.size() - 1);
+}
+
+std::optional<Register> BytecodeCompiler::into(ExprAST &expr, Register dst)
+{
+    auto R = expr.compile(*this, dst);
+    if (!R) return std::nullopt;
+    if (*R != dst) emit(Op::Move, dst, *R);
+    return dst;
+}
+
+std::optional<Register> BytecodeCompiler::call(Symbol callee, std::span<ExprAST *const> args, Register dst)
+{
+    Op op;
+    uint32_t index;
+    uint16_t params;
+    if (auto F = function_index[callee])
+    {
+        op = Op::Call;
+        index = F - 1;
+        params = module.functions[index].params;
+    }
+    else if (auto E = extern_index[callee])
+    {
+        op = Op::CallExtern;
+        index = E - 1;
+        params = module.externs[index].params;
+    }
+    else
+        return LogErrorR("Unknown function referenced");
+
+    if (params != args.size()) return LogErrorR("Incorrect # arguments passed");
+    if (index > 0xffff) return LogErrorR("Too many functions");
+
+    // Put the arguments in consecutive registers at the top of the frame,
+    // where the callee's frame will start. A call with no arguments still
+    // needs one for the result.
+    auto m = mark();
+    auto base = static_cast<Register>(next);
+    if (args.empty()) temp();
+    for (auto *Arg : args)
+    {
+        auto R = temp();
+        if (!into(*Arg, R)) return std::nullopt;
+        release(R + 1);
+    }
+    emit(op, base, static_cast<uint16_t>(index), static_cast<uint16_t>(args.size()));
+    release(m);
+    emit(Op::Move, dst, base);
+    return dst;
+}
+
+std::optional<Register> NumberExprAST::compile(BytecodeCompiler &bc, Register dst)
+{
+    bc.emit(Op::Const, dst, bc.constant(Val));
+    return dst;
+}
+
+std::optional<Register> VariableExprAST::compile(BytecodeCompiler &bc, Register)
+{
+    // A variable is read where it lives, without a copy.
+    if (auto R = bc.variable(Name)) return R;
+    return LogErrorR(fmt::format("Unknown variable name: {}", symbols().name(Name)));
+}
+
+std::optional<Register> UnaryExprAST::compile(BytecodeCompiler &bc, Register dst)
+{
+    auto Callee = symbols().lookup(fmt::format("unary{}", Opcode));
+    if (!bc.callable(Callee)) return LogErrorR("Unknown unary operator");
+    ExprAST *const Args[] = { Operand };
+    return bc.call(Callee, Args, dst);
+}
+
+std::optional<Register> BinaryExprAST::compile(BytecodeCompiler &bc, Register dst)
+{
+    // Special case '=' because we don't want to evaluate the LHS as an
+    // expression.
+    if (Op == '=')
+    {
+        // Assignment requires the LHS to be an identifier.
+        if (LHS->getElement()) return LHS->compile(bc, dst);
+        VariableExprAST *LHSE = static_cast<VariableExprAST *>(LHS);
+        auto Variable = bc.variable(LHSE->getName());
+        if (!Variable) return LogErrorR("Unknown variable name");
+
+        auto Val = RHS->compile(bc, dst);
+        if (!Val) return std::nullopt;
+        if (*Val != *Variable) bc.emit(::Op::Move, *Variable, *Val);
+        bc.stored();
+        return Variable;
+    }
+
+    ::Op op;
+    switch (Op)
+    {
+    case '+':
+        op = ::Op::Add;
+        break;
+    case '-':
+        op = ::Op::Sub;
+        break;
+    case '*':
+        op = ::Op::Mul;
+        break;
+    case '<':
+        op = ::Op::Less;
+        break;
+    default: {
+        // If it wasn't a builtin binary operator, it must be a user defined one.
+        auto Callee = symbols().lookup(fmt::format("binary{}", Op));
+        if (!bc.callable(Callee)) return LogErrorR("binary operator not found!");
+        ExprAST *const Args[] = { LHS, RHS };
+        return bc.call(Callee, Args, dst);
+    }
+    }
+
+    auto start = bc.here();
+    auto stores = bc.store_count();
+    auto m = bc.mark();
+    auto L = LHS->compile(bc, dst);
+    if (!L) return std::nullopt;
+    auto R = RHS->compile(bc, bc.temp());
+    if (!R) return std::nullopt;
+
+    // If the LHS is a variable read in place and the RHS assigns, read the
+    // variable again into dst first so the RHS can't change the LHS value.
+    if (*L != dst && bc.store_count() != stores)
+    {
+        bc.rewind(start);
+        bc.release(m);
+        if (!bc.into(*LHS, dst)) return std::nullopt;
+        L = dst;
+        R = RHS->compile(bc, bc.temp());
+        if (!R) return std::nullopt;
+    }
+
+    bc.release(m);
+    bc.emit(op, dst, *L, *R);
+    return dst;
+}
+
+std::optional<Register> CallExprAST::compile(BytecodeCompiler &bc, Register dst) { return bc.call(Callee, Args, dst); }
+
+std::optional<Register> IfExprAST::compile(BytecodeCompiler &bc, Register dst)
+{
+    auto CondV = Cond->compile(bc, dst);
+    if (!CondV) return std::nullopt;
+    auto ToElse = bc.emit(Op::JumpIfFalse, *CondV);
+
+    if (!bc.into(*Then, dst)) return std::nullopt;
+    auto ToMerge = bc.emit(Op::Jump);
+
+    bc.patch(ToElse, bc.here());
+    if (!bc.into(*Else, dst)) return std::nullopt;
+    bc.patch(ToMerge, bc.here());
+    return dst;
+}
+
+// Compiled like the loop codegen emits: the body runs at least once, then
+// the step and end condition are evaluated and the variable incremented.
+std::optional<Register> ForExprAST::compile(BytecodeCompiler &bc, Register dst)
+{
+    auto m = bc.mark();
+
+    // Emit the start code first, without 'variable' in scope.
+    auto Variable = bc.temp();
+    if (!bc.into(*Start, Variable)) return std::nullopt;
+    bc.bind(VarName, Variable);
+
+    auto Loop = bc.here();
+    auto BodyMark = bc.mark();
+    auto BodyV = Body->compile(bc, bc.temp());
+    bc.release(BodyMark);
+
+    // If not specified, use 1.0. Step and end are copied out of the variables
+    // they may name, since the increment changes the loop variable.
+    std::optional<Register> StepV;
+    if (BodyV)
+    {
+        Register StepR = bc.temp();
+        if (Step)
+            StepV = bc.into(*Step, StepR);
+        else
+        {
+            bc.emit(Op::Const, StepR, bc.constant(1.0));
+            StepV = StepR;
+        }
+    }
+
+    auto EndCond = StepV ? bc.into(*End, bc.temp()) : std::nullopt;
+
+    bc.unbind(1);
+    bc.release(m);
+    if (!EndCond) return std::nullopt;
+
+    bc.emit(Op::Add, Variable, Variable, *StepV);
+    auto Back = bc.emit(Op::JumpIfTrue, *EndCond);
+    bc.patch(Back, Loop);
+
+    // for expr always returns 0.0.
+    bc.emit(Op::Const, dst, bc.constant(0.0));
+    return dst;
+}
+
+std::optional<Register> VarExprAST::compile(BytecodeCompiler &bc, Register dst)
+{
+    auto m = bc.mark();
+    std::size_t bound = 0;
+    std::optional<Register> BodyVal;
+
+    for (auto &[VarName, Init] : VarNames)
+    {
+        // Compile the initializer before adding the variable to scope, so
+        // var a = a in ... refers to an outer 'a'. If not specified, use 0.0.
+        auto R = bc.temp();
+        if (Init)
+        {
+            if (!bc.into(*Init, R)) break;
+        }
+        else
+            bc.emit(Op::Const, R, bc.constant(0.0));
+        bc.bind(VarName, R);
+        ++bound;
+    }
+
+    // The variables' registers are freed below, so copy the value out.
+    if (bound == VarNames.size()) BodyVal = bc.into(*Body, dst);
+
+    // Pop all our variables from scope.
+    bc.unbind(bound);
+    bc.release(m);
+    return BodyVal;
+}
+
+// Arrays only exist in code LLVM generates.
+
+std::optional<Register> IndexExprAST::compile(BytecodeCompiler &, Register) { return LogErrorR(no_arrays); }
+
+std::optional<Register> LengthExprAST::compile(BytecodeCompiler &, Register) { return LogErrorR(no_arrays); }
+
+std::optional<Register> ArrayVarExprAST::compile(BytecodeCompiler &, Register) { return LogErrorR(no_arrays); }
@@ -0,0 +1,141 @@
+#ifndef __BYTECODE_COMPILER_H_
+#define __BYTECODE_COMPILER_H_
+
+#include <cstddef>
+#include <optional>
+#include <span>
+#include <variant>
+#include <vector>
+#include "../AST/AST.hpp"
+#include "../codegen/codemodule.hpp"
+#include "../misc/symbol.hpp"
+#include "Bytecode.hpp"
+
+/// BytecodeCompiler - Compiles the tree AST into a BytecodeModule. Holds the
+/// functions and externs compiled so far and the registers of the function
+/// being compiled; the nodes' compile methods do the rest.
+///
+/// Registers are allocated like a stack: variables and temporaries take the
+/// next free register and give it back when they go out of scope, so a call
+/// can put its arguments at the top and the callee's frame starts there.
+class BytecodeCompiler
+{
+    struct binding
+    {
+        Symbol name;
+        Register reg;
+    };
+
+    BytecodeModule &module;
+    // Index + 1 into module.functions / module.externs, 0 if not there.
+    SymbolMap<uint32_t> function_index;
+    SymbolMap<uint32_t> extern_index;
+
+    BytecodeFunction *function = nullptr;
+    std::vector<binding> bindings;
+    std::size_t next = 0;
+    bool overflow = false;
+    // Counts the assignments compiled, so a binary operator can tell whether
+    // its right hand side may have changed a variable it read on the left.
+    std::size_t stores = 0;
+
+    std::optional<uint32_t> compileFunction(FunctionAST &fn);
+
+  public:
+    explicit BytecodeCompiler(BytecodeModule &m) : module(m) {}
+
+    /// declare - Make an extern callable.
+    void declare(PrototypeAST &proto);
+    /// define - Compile a function definition, replacing any earlier one of
+    /// the same name for the calls compiled from now on. Returns false after
+    /// reporting an error.
+    bool define(FunctionAST &fn);
+    /// top_level - Compile a top level expression and append it to
+    /// module.top_level. Returns false after reporting an error.
+    bool top_level(FunctionAST &fn);
+
+    // Helpers for the nodes' compile methods.
+
+    /// temp - A fresh register, free again after release.
+    Register temp()
+    {
+        if (next >= 0xffff)
+        {
+            overflow = true;
+            return 0;
+        }
+        if (next >= function->registers) function->registers = static_cast<uint16_t>(next + 1);
+        return static_cast<Register>(next++);
+    }
+    /// mark, release - Free every register allocated since mark.
+    std::size_t mark() const { return next; }
+    void release(std::size_t m) { next = m; }
+
+    /// bind - Bring a variable into scope in reg; unbind takes it out again.
+    void bind(Symbol name, Register reg) { bindings.push_back({ name, reg }); }
+    void unbind(std::size_t count) { bindings.resize(bindings.size() - count); }
+    /// variable - The register of the innermost variable called name.
+    std::optional<Register> variable(Symbol name) const
+    {
+        for (auto i = bindings.size(); i-- > 0;)
+        {
+            if (bindings[i].name == name) return bindings[i].reg;
+        }
+        return std::nullopt;
+    }
+    void stored() { ++stores; }
+    std::size_t store_count() const { return stores; }
+
+    /// constant - Index of value in the constant pool, added if needed.
+    uint16_t constant(double value);
+
+    /// emit - Append an instruction, returning its index.
+    std::size_t emit(Op op, Register a = 0, uint16_t b = 0, uint16_t c = 0)
+    {
+        function->code.push_back({ op, a, b, c });
+        return function->code.size() - 1;
+    }
+    /// here - Index of the next instruction, for jumps.
+    std::size_t here() const { return function->code.size(); }
+    /// patch - Point the jump at index at target.
+    void patch(std::size_t index, std::size_t target) { function->code[index].set_target(static_cast<uint32_t>(target)); }
+    /// rewind - Drop the instructions emitted since index.
+    void rewind(std::size_t index) { function->code.resize(index); }
+
+    /// into - Compile expr so its value ends up in dst.
+    std::optional<Register> into(ExprAST &expr, Register dst);
+
+    /// callable - Whether a function or extern called name is known.
+    bool callable(Symbol name) { return function_index[name] || extern_index[name]; }
+    /// call - Compile a call of callee with args into dst.
+    std::optional<Register> call(Symbol callee, std::span<ExprAST *const> args, Register dst);
+};
+
+/// compile_program - Compile a whole program into module in order, defining
+/// functions and declaring externs as they come. Returns false if anything
+/// failed to compile; the rest of the program is still compiled.
+inline bool compile_program(std::vector<std::variant<ExprAST *, FnAST *>> &top_expressions, BytecodeModule &module)
+{
+    BytecodeCompiler bc(module);
+    bool ok = true;
+    for (auto &item : top_expressions)
+    {
+        auto **fn = std::get_if<FnAST *>(&item);
+        if (!fn || !*fn) continue;
+        auto *proto = (*fn)->getPrototype();
+        if (proto == *fn)
+        {
+            bc.declare(*proto);
+            continue;
+        }
+
+        auto &function = static_cast<FunctionAST &>(**fn);
+        if (proto->getName() == "__anon_expr")
+            ok &= bc.top_level(function);
+        else
+            ok &= bc.define(function);
+    }
+    return ok;
+}
+
+#endif// __BYTECODE_COMPILER_H_
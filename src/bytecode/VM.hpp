@@ -0,0 +1,284 @@
+#ifndef __VM_H_
+#define __VM_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <vector>
+#include <fmt/format.h>
+#include "../interpreter/Builtins.hpp"
+#include "Bytecode.hpp"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TOY_VM_COMPUTED_GOTO 1
+#endif
+
+/// VM - Runs a verified BytecodeModule. Frames are windows onto one register
+/// stack: a call's arguments are the first registers of the callee's frame,
+/// and its result comes back in the first register, which is where the
+/// caller put the first argument.
+///
+/// With profiling on, the VM also counts each function's calls and loop back
+/// edges, and calls native code instead of any function promoted to it; see
+/// jit/Tiered.hpp.
+class VM
+{
+  public:
+    /// NativeFunction - Compiled code standing in for a bytecode function.
+    /// Takes the arguments as an array.
+    using NativeFunction = double (*)(const double *args);
+
+  private:
+    struct frame
+    {
+        const BytecodeFunction *function;
+        const Instruction *pc;
+        double *registers;
+    };
+
+    const BytecodeModule &module;
+    std::vector<const Builtin *> externs;
+    // Left uninitialized, like a native stack: compiled code writes a register
+    // before it reads it.
+    std::unique_ptr<double[]> stack;
+    std::size_t stack_size;
+    std::vector<frame> frames;
+
+    struct function_profile
+    {
+        uint32_t count = 0;
+        std::atomic<NativeFunction> native{ nullptr };
+    };
+    // One per function, only while profiling.
+    std::unique_ptr<function_profile[]> profiles;
+    uint32_t hot_threshold = 0;
+    std::function<void(uint32_t)> on_hot;
+
+  public:
+    /// VM - Bind module's externs to builtins; size registers are shared by
+    /// all the frames of a run.
+    explicit VM(const BytecodeModule &m, std::size_t size = 1 << 20)
+        : module(m), stack(std::make_unique_for_overwrite<double[]>(size)), stack_size(size)
+    {
+        for (auto &e : module.externs)
+        {
+            auto *b = builtin(e.name);
+            externs.push_back(b && b->arity == e.params ? b : nullptr);
+        }
+        frames.reserve(1024);
+    }
+
+    /// profile - Count calls and loop back edges per function from now on,
+    /// and call hot with a function's index, once, when its count reaches
+    /// threshold.
+    void profile(uint32_t threshold, std::function<void(uint32_t)> hot)
+    {
+        profiles = std::make_unique<function_profile[]>(module.functions.size());
+        hot_threshold = threshold;
+        on_hot = std::move(hot);
+    }
+    /// promote - Run fn instead of function index from its next call on. Can
+    /// be called from any thread while the VM runs. Only while profiling.
+    void promote(uint32_t index, NativeFunction fn) { profiles[index].native.store(fn, std::memory_order_release); }
+
+    /// run - Call the nullary function index. Returns nullopt, after saying
+    /// why, if the program failed. With Count, adds the number of
+    /// instructions executed to *executed.
+    template<bool Count = false> std::optional<double> run(uint32_t index, uint64_t *executed = nullptr)
+    {
+        if (profiles) return execute<Count, true>(index, executed);
+        return execute<Count, false>(index, executed);
+    }
+
+  private:
+    template<bool Count, bool Profile> std::optional<double> execute(uint32_t index, uint64_t *executed)
+    {
+        const BytecodeFunction *function = &module.functions[index];
+        if (function->registers > stack_size) return fail("Stack overflow");
+        double *R = stack.get();
+        const double *const limit = stack.get() + stack_size;
+        const double *K = function->constants.data();
+        const Instruction *pc = function->code.data();
+        const Instruction *I;
+        uint64_t count = 0;
+
+#ifdef TOY_VM_COMPUTED_GOTO
+        // Labels as values are a GNU extension, which -Wpedantic reports at
+        // every label taken and every goto through the table.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+        // In Op order.
+        static const void *const dispatch[op_count] = { &&op_Const,
+            &&op_Move,
+            &&op_Add,
+            &&op_Sub,
+            &&op_Mul,
+            &&op_Less,
+            &&op_Jump,
+            &&op_JumpIfFalse,
+            &&op_JumpIfTrue,
+            &&op_Call,
+            &&op_CallExtern,
+            &&op_Return };
+#define VM_CASE(name) op_##name:
+#define VM_NEXT()                                                        \
+    do {                                                                 \
+        if constexpr (Count) ++count;                                    \
+        I = pc++;                                                        \
+        goto *dispatch[static_cast<std::size_t>(I->op)];                 \
+    } while (0)
+        VM_NEXT();
+#else
+#define VM_CASE(name) case Op::name:
+#define VM_NEXT() continue
+        for (;;)
+        {
+            if constexpr (Count) ++count;
+            I = pc++;
+            switch (I->op)
+            {
+#endif
+        VM_CASE(Const)
+        {
+            R[I->a] = K[I->b];
+            VM_NEXT();
+        }
+        VM_CASE(Move)
+        {
+            R[I->a] = R[I->b];
+            VM_NEXT();
+        }
+        VM_CASE(Add)
+        {
+            R[I->a] = R[I->b] + R[I->c];
+            VM_NEXT();
+        }
+        VM_CASE(Sub)
+        {
+            R[I->a] = R[I->b] - R[I->c];
+            VM_NEXT();
+        }
+        VM_CASE(Mul)
+        {
+            R[I->a] = R[I->b] * R[I->c];
+            VM_NEXT();
+        }
+        VM_CASE(Less)
+        {
+            R[I->a] = !(R[I->b] >= R[I->c]) ? 1.0 : 0.0;
+            VM_NEXT();
+        }
+        VM_CASE(Jump)
+        {
+            pc = function->code.data() + I->target();
+            if constexpr (Profile) backedge(function, pc, I);
+            VM_NEXT();
+        }
+        VM_CASE(JumpIfFalse)
+        {
+            if (!(R[I->a] < 0.0 || R[I->a] > 0.0))
+            {
+                pc = function->code.data() + I->target();
+                if constexpr (Profile) backedge(function, pc, I);
+            }
+            VM_NEXT();
+        }
+        VM_CASE(JumpIfTrue)
+        {
+            if (R[I->a] < 0.0 || R[I->a] > 0.0)
+            {
+                pc = function->code.data() + I->target();
+                if constexpr (Profile) backedge(function, pc, I);
+            }
+            VM_NEXT();
+        }
+        VM_CASE(Call)
+        {
+            if constexpr (Profile)
+            {
+                auto &p = profiles[I->b];
+                if (auto *native = p.native.load(std::memory_order_acquire))
+                {
+                    R[I->a] = native(R + I->a);
+                    VM_NEXT();
+                }
+                if (++p.count == hot_threshold) on_hot(I->b);
+            }
+            auto *callee = &module.functions[I->b];
+            double *base = R + I->a;
+            if (callee->registers > limit - base) return fail("Stack overflow", executed, count);
+            frames.push_back({ function, pc, R });
+            function = callee;
+            R = base;
+            K = callee->constants.data();
+            pc = callee->code.data();
+            VM_NEXT();
+        }
+        VM_CASE(CallExtern)
+        {
+            auto *b = externs[I->b];
+            if (!b) return fail(fmt::format("Unknown function referenced: {}", module.externs[I->b].name), executed, count);
+            R[I->a] = b->fn(R + I->a);
+            VM_NEXT();
+        }
+        VM_CASE(Return)
+        {
+            R[0] = R[I->a];
+            if (frames.empty())
+            {
+                if constexpr (Count) *executed += count;
+                return R[0];
+            }
+            auto &caller = frames.back();
+            function = caller.function;
+            pc = caller.pc;
+            R = caller.registers;
+            K = function->constants.data();
+            frames.pop_back();
+            VM_NEXT();
+        }
+#ifdef TOY_VM_COMPUTED_GOTO
+#pragma GCC diagnostic pop
+#else
+            }
+        }
+#endif
+#undef VM_CASE
+#undef VM_NEXT
+    }
+
+    /// backedge - Count a jump from I to pc in function if it goes backwards.
+    void backedge(const BytecodeFunction *function, const Instruction *pc, const Instruction *I)
+    {
+        if (pc > I) return;
+        auto index = static_cast<uint32_t>(function - module.functions.data());
+        if (++profiles[index].count == hot_threshold) on_hot(index);
+    }
+
+    std::optional<double> fail(std::string_view why, uint64_t *executed = nullptr, uint64_t count = 0)
+    {
+        fmt::print(stderr, "Error: {}\n", why);
+        frames.clear();
+        if (executed) *executed += count;
+        return std::nullopt;
+    }
+};
+
+/// vm_run - Run each of module's top level expressions in order, passing
+/// their values to on_result. Returns false if any of them failed.
+template<typename OnResult> bool vm_run(const BytecodeModule &module, VM &vm, OnResult on_result)
+{
+    bool ok = true;
+    for (auto index : module.top_level)
+    {
+        if (auto value = vm.run(index))
+            on_result(*value);
+        else
+            ok = false;
+    }
+    return ok;
+}
+
+#endif// __VM_H_
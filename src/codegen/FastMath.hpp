@@ -0,0 +1,43 @@
+#ifndef __FASTMATH_H_
+#define __FASTMATH_H_
+
+#include "llvm/IR/Operator.h"
+
+// Fast-math flags are kept as bits in the order of llvm::FastMathFlags, which
+// is also the order of fp_flag_names in the argument parser: reassoc, nnan,
+// ninf, nsz, arcp, contract, afn.
+
+/// fast_math_flags - The flags bits has set.
+inline llvm::FastMathFlags fast_math_flags(unsigned bits)
+{
+    llvm::FastMathFlags flags;
+    flags.setAllowReassoc(bits & llvm::FastMathFlags::AllowReassoc);
+    flags.setNoNaNs(bits & llvm::FastMathFlags::NoNaNs);
+    flags.setNoInfs(bits & llvm::FastMathFlags::NoInfs);
+    flags.setNoSignedZeros(bits & llvm::FastMathFlags::NoSignedZeros);
+    flags.setAllowReciprocal(bits & llvm::FastMathFlags::AllowReciprocal);
+    flags.setAllowContract(bits & llvm::FastMathFlags::AllowContract);
+    flags.setApproxFunc(bits & llvm::FastMathFlags::ApproxFunc);
+    return flags;
+}
+
+/// fast_math_bits - flags as bits, e.g. for a key.
+inline unsigned fast_math_bits(llvm::FastMathFlags flags)
+{
+    return (flags.allowReassoc() ? llvm::FastMathFlags::AllowReassoc : 0)
+           | (flags.noNaNs() ? llvm::FastMathFlags::NoNaNs : 0) | (flags.noInfs() ? llvm::FastMathFlags::NoInfs : 0)
+           | (flags.noSignedZeros() ? llvm::FastMathFlags::NoSignedZeros : 0)
+           | (flags.allowReciprocal() ? llvm::FastMathFlags::AllowReciprocal : 0)
+           | (flags.allowContract() ? llvm::FastMathFlags::AllowContract : 0)
+           | (flags.approxFunc() ? llvm::FastMathFlags::ApproxFunc : 0);
+}
+
+/// unsafe_fp_math - Whether flags allow what the backend's UnsafeFPMath
+/// does: reassociate, ignore the sign of zero, use reciprocals, and fuse
+/// multiplies and adds, which it does whatever AllowFPOpFusion says.
+inline bool unsafe_fp_math(llvm::FastMathFlags flags)
+{
+    return flags.allowReassoc() && flags.noSignedZeros() && flags.allowReciprocal() && flags.allowContract();
+}
+
+#endif// __FASTMATH_H_
@@ -0,0 +1,362 @@
+#include "ObjectCache.hpp"
+#include <algorithm>
+#include <bit>
+#include <fmt/format.h>
+#include "codemodule.hpp"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Object/ArchiveWriter.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SmallVectorMemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace {
+/// cache_format - Part of every key. Bump it when codegen changes the code
+/// it generates for the same AST, to leave the old entries behind.
+constexpr uint64_t cache_format = 2;
+
+/// user_operator - The function defining operator op of kind "unary" or
+/// "binary".
+Symbol user_operator(const char *kind, char op) { return symbols().lookup(std::string(kind) + op); }
+}// namespace
+
+void ASTHasher::add(uint64_t value)
+{
+    char bytes[sizeof(value)];
+    for (auto &b : bytes)
+    {
+        b = static_cast<char>(value & 0xff);
+        value >>= 8;
+    }
+    sha.update(llvm::StringRef(bytes, sizeof(bytes)));
+}
+
+void ASTHasher::add(double value) { add(std::bit_cast<uint64_t>(value)); }
+
+void ASTHasher::add(std::string_view name)
+{
+    add(name.size());
+    sha.update(llvm::StringRef(name.data(), name.size()));
+}
+
+std::vector<Symbol> ASTHasher::callees() const
+{
+    auto sorted = called;
+    // By name, not id: ids follow the order names appear in the whole file.
+    std::sort(sorted.begin(), sorted.end(), [](Symbol a, Symbol b) { return symbols().name(a) < symbols().name(b); });
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+    return sorted;
+}
+
+ContentHash ASTHasher::final()
+{
+    ContentHash key;
+    auto digest = sha.final();
+    std::copy(digest.begin(), digest.end(), key.begin());
+    return key;
+}
+
+// Every node adds a tag of its own first, and the number of children where
+// that varies, so different trees can't add the same sequence.
+
+void NumberExprAST::hash(ASTHasher &h) const
+{
+    h.add('n');
+    h.add(Val);
+}
+
+void VariableExprAST::hash(ASTHasher &h) const
+{
+    h.add('v');
+    h.add(Name);
+}
+
+void UnaryExprAST::hash(ASTHasher &h) const
+{
+    h.add('u');
+    h.call(user_operator("unary", Opcode));
+    Operand->hash(h);
+}
+
+void BinaryExprAST::hash(ASTHasher &h) const
+{
+    h.add('b');
+    h.add(Op);
+    switch (Op)
+    {
+    case '=':
+    case '+':
+    case '-':
+    case '*':
+    case '<':
+        break;
+    default:
+        h.call(user_operator("binary", Op));
+    }
+    LHS->hash(h);
+    RHS->hash(h);
+}
+
+void CallExprAST::hash(ASTHasher &h) const
+{
+    h.add('c');
+    h.call(Callee);
+    h.add(Args.size());
+    for (auto *Arg : Args) Arg->hash(h);
+}
+
+void IfExprAST::hash(ASTHasher &h) const
+{
+    h.add('i');
+    Cond->hash(h);
+    Then->hash(h);
+    Else->hash(h);
+}
+
+void ForExprAST::hash(ASTHasher &h) const
+{
+    h.add('f');
+    h.add(VarName);
+    Start->hash(h);
+    End->hash(h);
+    h.add(Step ? 's' : '-');
+    if (Step) Step->hash(h);
+    Body->hash(h);
+    h.add(static_cast<uint64_t>(Hints.vectorize));
+    h.add(static_cast<uint64_t>(Hints.unroll));
+}
+
+void VarExprAST::hash(ASTHasher &h) const
+{
+    h.add('r');
+    h.add(VarNames.size());
+    for (auto &[Name, Init] : VarNames)
+    {
+        h.add(Name);
+        h.add(Init ? 'i' : '-');
+        if (Init) Init->hash(h);
+    }
+    Body->hash(h);
+}
+
+void IndexExprAST::hash(ASTHasher &h) const
+{
+    h.add('x');
+    h.add(Array);
+    Index->hash(h);
+}
+
+void LengthExprAST::hash(ASTHasher &h) const
+{
+    h.add('l');
+    h.add(Array);
+}
+
+void ArrayVarExprAST::hash(ASTHasher &h) const
+{
+    h.add('a');
+    h.add(Name);
+    Length->hash(h);
+    Body->hash(h);
+}
+
+std::string ObjectCache::path(const ContentHash &key) const
+{
+    auto hex = llvm::toHex(llvm::ArrayRef<uint8_t>(key), true);
+    llvm::SmallString<256> file(dir);
+    llvm::sys::path::append(file, hex.substr(0, 2), hex.substr(2) + ".o");
+    return std::string(file);
+}
+
+std::unique_ptr<llvm::MemoryBuffer> ObjectCache::lookup(const ContentHash &key) const
+{
+    auto object = llvm::MemoryBuffer::getFile(path(key), false, false);
+    if (!object) return nullptr;
+    return std::move(*object);
+}
+
+bool ObjectCache::store(const ContentHash &key, llvm::StringRef object) const
+{
+    auto file = path(key);
+    if (auto EC = llvm::sys::fs::create_directories(llvm::sys::path::parent_path(file)))
+    {
+        llvm::errs() << "Could not create cache directory: " << EC.message() << "\n";
+        return false;
+    }
+
+    int fd;
+    llvm::SmallString<256> temp;
+    if (auto EC = llvm::sys::fs::createUniqueFile(file + ".tmp%%%%%%", fd, temp))
+    {
+        llvm::errs() << "Could not write to the cache: " << EC.message() << "\n";
+        return false;
+    }
+    {
+        llvm::raw_fd_ostream os(fd, true);
+        os << object;
+    }
+    if (auto EC = llvm::sys::fs::rename(temp, file))
+    {
+        llvm::sys::fs::remove(temp);
+        llvm::errs() << "Could not write to the cache: " << EC.message() << "\n";
+        return false;
+    }
+    return true;
+}
+
+llvm::SmallVector<char, 0> object_code(llvm::Module &module,
+    llvm::TargetMachine &TheTargetMachine,
+    OptimizationLevel level)
+{
+    module.setTargetTriple(TheTargetMachine.getTargetTriple().str());
+    module.setDataLayout(TheTargetMachine.createDataLayout());
+    optimize(module, TheTargetMachine, level);
+
+    llvm::SmallVector<char, 0> object;
+    llvm::raw_svector_ostream os(object);
+    llvm::legacy::PassManager pass;
+    TheTargetMachine.addPassesToEmitFile(pass, os, nullptr, llvm::CGFT_ObjectFile);
+    pass.run(module);
+    return object;
+}
+
+namespace {
+/// add_signature - Add the parameters of proto, which are arrays and which
+/// are numbers, to h.
+void add_signature(ASTHasher &h, const PrototypeAST &proto)
+{
+    h.add(proto.getArgs().size());
+    for (std::size_t i = 0; i < proto.getArgs().size(); ++i) h.add(proto.isArrayArg(i) ? 'a' : 'd');
+}
+
+/// function_key - The cache key of function, given the prototypes declared
+/// before it; h holds its body's hash. Only the prototypes of the callees
+/// count: each function is generated alone, against declarations of them.
+ContentHash function_key(PrototypeAST &proto,
+    ASTHasher &h,
+    SymbolMap<PrototypeAST *> &declared,
+    llvm::TargetMachine &TheTargetMachine,
+    OptimizationLevel level,
+    const CodeOptions &options)
+{
+    h.add('F');
+    h.add(proto.getSymbol());
+    add_signature(h, proto);
+    for (auto Arg : proto.getArgs()) h.add(Arg);
+    for (auto Callee : h.callees())
+    {
+        h.add(Callee);
+        auto *Decl = declared[Callee];
+        if (Decl)
+            add_signature(h, *Decl);
+        else
+            h.add(~uint64_t{ 0 });
+    }
+
+    h.add('T');
+    h.add(cache_format);
+    h.add(std::string_view(LLVM_VERSION_STRING));
+    h.add(std::string_view(TheTargetMachine.getTargetTriple().str()));
+    h.add(std::string_view(TheTargetMachine.getTargetCPU()));
+    h.add(std::string_view(TheTargetMachine.getTargetFeatureString()));
+    h.add(std::string_view(options.cpu));
+    h.add(std::string_view(options.features));
+    h.add(static_cast<uint64_t>(fast_math_bits(options.fast_math)));
+    h.add(static_cast<uint64_t>(TheTargetMachine.Options.AllowFPOpFusion));
+    h.add(static_cast<uint64_t>(level.getSpeedupLevel()));
+    h.add(static_cast<uint64_t>(level.getSizeLevel()));
+    return h.final();
+}
+
+std::unique_ptr<llvm::MemoryBuffer> object_buffer(llvm::SmallVector<char, 0> object, std::string_view name)
+{
+    return std::make_unique<llvm::SmallVectorMemoryBuffer>(std::move(object), llvm::StringRef(name.data(), name.size()));
+}
+}// namespace
+
+CachedBuild build_cached(std::vector<std::variant<ExprAST *, FnAST *>> &top_expressions,
+    ObjectCache &cache,
+    llvm::TargetMachine &TheTargetMachine,
+    OptimizationLevel level,
+    const CodeOptions &options)
+{
+    CachedBuild build;
+
+    // Only a function defined once gets an object of its own.
+    SymbolMap<uint32_t> definitions;
+    for (auto &item : top_expressions)
+    {
+        if (auto **fn = std::get_if<FnAST *>(&item); fn && *fn && (*fn)->getPrototype() != *fn)
+            ++definitions[(*fn)->getPrototype()->getSymbol()];
+    }
+
+    // Everything not cached goes into rest, in order, as codegen would.
+    CodeModule rest(options);
+    SymbolMap<PrototypeAST *> declared;
+    for (auto &item : top_expressions)
+    {
+        if (auto **E = std::get_if<ExprAST *>(&item))
+        {
+            if (*E) (*E)->codegen(rest);
+            continue;
+        }
+        auto *fn = std::get<FnAST *>(item);
+        if (!fn) continue;
+        auto *proto = fn->getPrototype();
+        declared[proto->getSymbol()] = proto;
+        if (proto == fn || definitions[proto->getSymbol()] != 1 || proto->getName() == "__anon_expr")
+        {
+            fn->codegen(rest);
+            continue;
+        }
+        rest.FunctionProtos[proto->getSymbol()] = proto;
+
+        auto &function = static_cast<FunctionAST &>(*fn);
+        ASTHasher h;
+        function.getBody()->hash(h);
+        auto callees = h.callees();
+        auto key = function_key(*proto, h, declared, TheTargetMachine, level, options);
+        auto name = fmt::format("{}.o", proto->getName());
+        if (auto object = cache.lookup(key))
+        {
+            build.objects.push_back({ std::move(name), std::move(object) });
+            ++build.hits;
+            continue;
+        }
+
+        CodeModule part(options);
+        for (auto Callee : callees) part.FunctionProtos[Callee] = declared[Callee];
+        // Errors are reported by codegen, and nothing is cached so they are
+        // reported again next time.
+        if (!function.codegen(part)) continue;
+        auto object = object_code(*part.TheModule, TheTargetMachine, level);
+        cache.store(key, llvm::StringRef(object.data(), object.size()));
+        build.objects.push_back({ name, object_buffer(std::move(object), name) });
+        ++build.misses;
+    }
+
+    bool has_code = llvm::any_of(*rest.TheModule, [](llvm::Function &F) { return !F.isDeclaration(); });
+    if (has_code) build.objects.push_back({ "toplevel.o", object_buffer(object_code(*rest.TheModule, TheTargetMachine, level), "toplevel.o") });
+    return build;
+}
+
+bool write_archive(const std::string &filename, CachedBuild &build, llvm::TargetMachine &TheTargetMachine)
+{
+    std::vector<llvm::NewArchiveMember> members;
+    for (auto &object : build.objects)
+    {
+        members.emplace_back(object.code->getMemBufferRef());
+        members.back().MemberName = object.name;
+    }
+    auto kind = TheTargetMachine.getTargetTriple().isOSDarwin() ? llvm::object::Archive::K_DARWIN
+                                                                : llvm::object::Archive::K_GNU;
+    if (auto Err = llvm::writeArchive(filename, members, true, kind, true, false))
+    {
+        llvm::errs() << "Could not write " << filename << ": " << llvm::toString(std::move(Err)) << "\n";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,107 @@
+#ifndef __OBJECTCACHE_H_
+#define __OBJECTCACHE_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <variant>
+#include <vector>
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Target/TargetMachine.h"
+#include "../AST/AST.hpp"
+#include "../misc/symbol.hpp"
+#include "optimizer.hpp"
+
+/// ContentHash - The key of an object in the cache.
+using ContentHash = std::array<uint8_t, 20>;
+
+/// ASTHasher - Hashes a function's AST for the object cache: node kinds,
+/// operators, literals and names, but not symbol ids or anything of the
+/// source layout, so the hash changes with the code and nothing else. It
+/// also collects the functions called, whose prototypes the code depends on.
+/// The nodes' hash methods feed it; see codegen/ObjectCache.cpp.
+class ASTHasher
+{
+    llvm::SHA1 sha;
+    std::vector<Symbol> called;
+
+  public:
+    void add(char tag) { sha.update(llvm::StringRef(&tag, 1)); }
+    void add(uint64_t value);
+    void add(double value);
+    void add(std::string_view name);
+    void add(Symbol name) { add(symbols().name(name)); }
+    /// call - Add a call of callee.
+    void call(Symbol callee)
+    {
+        add(callee);
+        called.push_back(callee);
+    }
+
+    /// callees - The functions called so far, sorted by name, each once.
+    std::vector<Symbol> callees() const;
+    ContentHash final();
+};
+
+/// ObjectCache - Object code on disk by content hash. Each object is a file
+/// of its own, dir/ab/cdef....o after the hash in hex, so it can be mapped
+/// instead of read; it is written under a temporary name and renamed into
+/// place, so concurrent builds sharing dir never see half an entry.
+class ObjectCache
+{
+    std::string dir;
+
+    std::string path(const ContentHash &key) const;
+
+  public:
+    explicit ObjectCache(std::string _dir) : dir(std::move(_dir)) {}
+
+    /// lookup - The object cached for key, or nullptr.
+    std::unique_ptr<llvm::MemoryBuffer> lookup(const ContentHash &key) const;
+    /// store - Cache object for key. Returns false, after printing why, if
+    /// it couldn't; the build goes on without it.
+    bool store(const ContentHash &key, llvm::StringRef object) const;
+};
+
+/// CachedBuild - A program built through the object cache: one object per
+/// function, and one for the top level expressions and anything else that
+/// isn't cached, with the number of functions found in the cache and built.
+struct CachedBuild
+{
+    struct object
+    {
+        std::string name;
+        std::unique_ptr<llvm::MemoryBuffer> code;
+    };
+    std::vector<object> objects;
+    std::size_t hits = 0;
+    std::size_t misses = 0;
+};
+
+/// object_code - Optimize module at level and generate its object code for
+/// TheTargetMachine.
+llvm::SmallVector<char, 0> object_code(llvm::Module &module,
+    llvm::TargetMachine &TheTargetMachine,
+    OptimizationLevel level);
+
+/// build_cached - Build top_expressions for TheTargetMachine at level, each
+/// function defined once in a module of its own. A function's object is
+/// taken from cache if its key matches: the hash of its AST, the prototypes
+/// of the functions it calls, the target, the options it is generated with
+/// and the level. Otherwise it is generated and cached. Functions defined more than
+/// once and the top level expressions are generated together every time.
+CachedBuild build_cached(std::vector<std::variant<ExprAST *, FnAST *>> &top_expressions,
+    ObjectCache &cache,
+    llvm::TargetMachine &TheTargetMachine,
+    OptimizationLevel level,
+    const CodeOptions &options = {});
+
+/// write_archive - Write the objects of build to filename as a static
+/// archive for TheTargetMachine's platform. Returns false, after printing
+/// why, if it couldn't.
+bool write_archive(const std::string &filename, CachedBuild &build, llvm::TargetMachine &TheTargetMachine);
+
+#endif// __OBJECTCACHE_H_
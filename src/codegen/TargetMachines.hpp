@@ -0,0 +1,190 @@
+#ifndef __TARGETMACHINES_H_
+#define __TARGETMACHINES_H_
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <variant>
+#include <vector>
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+#include "FastMath.hpp"
+#include "optimizer.hpp"
+
+/// TargetSpec - What code is generated for, as createTargetMachine takes it,
+/// and the floating point code fast_math allows the backend to generate.
+struct TargetSpec
+{
+    std::string triple = llvm::sys::getDefaultTargetTriple();
+    std::string cpu = "generic";
+    std::string features;
+    llvm::FastMathFlags fast_math;
+};
+
+/// target_options - The TargetOptions that let the backend do what
+/// fast_math allows: fuse multiplies and adds into FMAs if it allows
+/// contraction, and the rest as the functions' attributes say, which
+/// codegen sets from the same flags.
+inline llvm::TargetOptions target_options(llvm::FastMathFlags fast_math)
+{
+    llvm::TargetOptions options;
+    options.AllowFPOpFusion = fast_math.allowContract() ? llvm::FPOpFusion::Fast : llvm::FPOpFusion::Standard;
+    options.UnsafeFPMath = unsafe_fp_math(fast_math);
+    options.NoNaNsFPMath = fast_math.noNaNs();
+    options.NoInfsFPMath = fast_math.noInfs();
+    options.NoSignedZerosFPMath = fast_math.noSignedZeros();
+    options.ApproxFuncFPMath = fast_math.approxFunc();
+    return options;
+}
+
+/// host_features - The features of the host's CPU as a feature string, e.g.
+/// "+avx2,+fma,-avx512f", sorted so it is the same every time; empty where
+/// LLVM can't tell.
+inline std::string host_features()
+{
+    llvm::StringMap<bool> features;
+    if (!llvm::sys::getHostCPUFeatures(features)) return "";
+    std::vector<std::string> list;
+    for (auto &feature : features) list.push_back((feature.getValue() ? "+" : "-") + feature.getKey().str());
+    std::sort(list.begin(), list.end());
+    std::string joined;
+    for (auto &feature : list) joined += (joined.empty() ? "" : ",") + feature;
+    return joined;
+}
+
+/// initialize_target - Set up the backend that generates code for triple,
+/// and only that one: all of LLVM's backends take several times as long.
+/// Returns false, after printing why, if LLVM doesn't know triple.
+inline bool initialize_target(const std::string &triple)
+{
+    if (triple == llvm::sys::getDefaultTargetTriple())
+        return !llvm::InitializeNativeTarget() && !llvm::InitializeNativeTargetAsmPrinter();
+
+    // Target infos only register the targets' names, which is enough to
+    // find the backend for triple.
+    llvm::InitializeAllTargetInfos();
+    std::string Error;
+    auto *Target = llvm::TargetRegistry::lookupTarget(triple, Error);
+    if (!Target)
+    {
+        llvm::errs() << Error << "\n";
+        return false;
+    }
+    std::string_view backend = Target->getBackendName();
+    bool found = false;
+#define LLVM_TARGET(TargetName)                 \
+    if (backend == #TargetName)                 \
+    {                                           \
+        LLVMInitialize##TargetName##Target();   \
+        LLVMInitialize##TargetName##TargetMC(); \
+        found = true;                           \
+    }
+#include "llvm/Config/Targets.def"
+#define LLVM_ASM_PRINTER(TargetName) \
+    if (backend == #TargetName) LLVMInitialize##TargetName##AsmPrinter();
+#include "llvm/Config/AsmPrinters.def"
+    if (!found)
+    {
+        // A backend registered by another name than its own (PowerPC's is
+        // "PPC"): set them all up.
+        llvm::InitializeAllTargets();
+        llvm::InitializeAllTargetMCs();
+        llvm::InitializeAllAsmPrinters();
+    }
+    return true;
+}
+
+/// TargetMachines - The TargetMachines of a process, created once for each
+/// target, fast-math flags and backend optimization level and reused for every module after.
+/// A TargetMachine is used by one thread at a time, so each configuration
+/// has a pool: acquire hands out an idle one, or creates one if they are all
+/// in use, and the Lease puts it back.
+class TargetMachines
+{
+    using Key = std::tuple<std::string, std::string, std::string, unsigned, llvm::CodeGenOpt::Level>;
+
+    std::mutex mutex;
+    std::map<Key, std::vector<std::unique_ptr<llvm::TargetMachine>>> idle;
+    std::size_t created_ = 0;
+
+  public:
+    class Lease
+    {
+        TargetMachines *owner;
+        Key key;
+        std::unique_ptr<llvm::TargetMachine> machine;
+
+      public:
+        Lease(TargetMachines &_owner, Key _key, std::unique_ptr<llvm::TargetMachine> _machine)
+          : owner(&_owner), key(std::move(_key)), machine(std::move(_machine))
+        {}
+        Lease(Lease &&) = default;
+        Lease &operator=(Lease &&) = delete;
+        ~Lease()
+        {
+            if (!machine) return;
+            std::lock_guard<std::mutex> lock(owner->mutex);
+            owner->idle[key].push_back(std::move(machine));
+        }
+
+        llvm::TargetMachine &operator*() const { return *machine; }
+        llvm::TargetMachine *operator->() const { return machine.get(); }
+    };
+
+    /// acquire - A TargetMachine for target generating code at level, or an
+    /// error message if LLVM has no backend for target.
+    std::variant<Lease, std::string> acquire(const TargetSpec &target, OptimizationLevel level)
+    {
+        Key key{ target.triple, target.cpu, target.features, fast_math_bits(target.fast_math), codegen_opt_level(level) };
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (auto &machines = idle[key]; !machines.empty())
+            {
+                auto machine = std::move(machines.back());
+                machines.pop_back();
+                return Lease(*this, std::move(key), std::move(machine));
+            }
+        }
+
+        std::string Error;
+        auto *Target = llvm::TargetRegistry::lookupTarget(target.triple, Error);
+        if (!Target) return Error;
+        std::unique_ptr<llvm::TargetMachine> machine(Target->createTargetMachine(target.triple,
+            target.cpu,
+            target.features,
+            target_options(target.fast_math),
+            llvm::Optional<llvm::Reloc::Model>(),
+            llvm::None,
+            std::get<4>(key)));
+        if (!machine) return "Could not create a TargetMachine for " + target.triple;
+        std::lock_guard<std::mutex> lock(mutex);
+        ++created_;
+        return Lease(*this, std::move(key), std::move(machine));
+    }
+
+    /// created - How many TargetMachines were created so far.
+    std::size_t created()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return created_;
+    }
+};
+
+/// target_machines - The TargetMachines shared by everything that generates
+/// code in this process.
+inline TargetMachines &target_machines()
+{
+    static TargetMachines machines;
+    return machines;
+}
+
+#endif// __TARGETMACHINES_H_
@@ -0,0 +1,108 @@
+#ifndef __ARRAYS_H_
+#define __ARRAYS_H_
+
+#include <cstdint>
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/Module.h"
+#include "ssa.hpp"
+
+/// ArrayValue - An array where code is being generated: a pointer to its
+/// elements, which are contiguous doubles, and how many there are, an i64.
+/// Across calls it is these two arguments, so a C function sees an array
+/// parameter as 'double *, int64_t'.
+struct ArrayValue
+{
+    llvm::Value *Data = nullptr;
+    llvm::Value *Length = nullptr;
+
+    explicit operator bool() const { return Data != nullptr; }
+};
+
+/// array_align - The alignment of the arrays 'var' allocates, that of a
+/// cache line and of the widest vector loads (AVX-512).
+constexpr uint64_t array_align = 64;
+
+/// array_length - The number of elements 'var a[n]' allocates for n: n
+/// rounded toward zero, no more than 2^53, and none if n is not positive
+/// or NaN.
+inline llvm::Value *array_length(llvm::IRBuilder<> &Builder, llvm::Value *N)
+{
+    llvm::IRBuilderBase::FastMathFlagGuard Strict(Builder);
+    Builder.clearFastMathFlags();
+    auto *Double = Builder.getDoubleTy();
+    auto *Zero = llvm::ConstantFP::get(Double, 0.0);
+    auto *High = llvm::ConstantFP::get(Double, 0x1p53);
+    llvm::Value *Clamped = Builder.CreateSelect(Builder.CreateFCmpOLT(N, High), N, High);
+    Clamped = Builder.CreateSelect(Builder.CreateFCmpOGT(N, Zero), Clamped, Zero);
+    return Builder.CreateFPToSI(Clamped, Builder.getInt64Ty(), "len");
+}
+
+/// array_trap - Branch to a block that traps unless Ok, and continue after
+/// the branch. Code that indexes out of bounds, or whose array can't be
+/// allocated, stops there. Both blocks are sealed in SSA, as they have all
+/// their predecessors.
+inline void array_trap(llvm::IRBuilder<> &Builder, SSABuilder &SSA, llvm::Value *Ok)
+{
+    auto &C = Builder.getContext();
+    llvm::Function *F = Builder.GetInsertBlock()->getParent();
+    auto *OkBB = llvm::BasicBlock::Create(C, "inbounds", F);
+    auto *TrapBB = llvm::BasicBlock::Create(C, "trap", F);
+    Builder.CreateCondBr(Ok, OkBB, TrapBB);
+    SSA.seal(OkBB);
+    SSA.seal(TrapBB);
+    Builder.SetInsertPoint(TrapBB);
+    Builder.CreateIntrinsic(llvm::Intrinsic::trap, {}, {});
+    Builder.CreateUnreachable();
+    Builder.SetInsertPoint(OkBB);
+}
+
+/// allocate_array - Length zeroed elements from aligned_alloc, aligned to
+/// array_align. The size is rounded up to a multiple of the alignment, as
+/// aligned_alloc wants, and never 0, so a null result always means there
+/// wasn't enough memory.
+inline ArrayValue allocate_array(llvm::Module &M, llvm::IRBuilder<> &Builder, SSABuilder &SSA, llvm::Value *Length)
+{
+    auto *I64 = Builder.getInt64Ty();
+    auto *Bytes = Builder.CreateAdd(Builder.CreateOr(Builder.CreateNUWMul(Length, Builder.getInt64(sizeof(double))),
+                                        Builder.getInt64(array_align - 1)),
+        Builder.getInt64(1),
+        "bytes");
+    auto AlignedAlloc = M.getOrInsertFunction("aligned_alloc", Builder.getInt8PtrTy(), I64, I64);
+    auto *Call = Builder.CreateCall(AlignedAlloc, { Builder.getInt64(array_align), Bytes });
+    Call->addRetAttr(llvm::Attribute::NoAlias);
+    Call->addRetAttr(llvm::Attribute::getWithAlignment(Builder.getContext(), llvm::Align(array_align)));
+    array_trap(Builder, SSA, Builder.CreateIsNotNull(Call));
+    Builder.CreateMemSet(Call, Builder.getInt8(0), Bytes, llvm::MaybeAlign(array_align));
+    return { Builder.CreateBitCast(Call, Builder.getDoubleTy()->getPointerTo(), "data"), Length };
+}
+
+/// free_array - Give the elements of an array from allocate_array back.
+inline void free_array(llvm::Module &M, llvm::IRBuilder<> &Builder, ArrayValue Array)
+{
+    auto Free = M.getOrInsertFunction("free", Builder.getVoidTy(), Builder.getInt8PtrTy());
+    Builder.CreateCall(Free, Builder.CreateBitCast(Array.Data, Builder.getInt8PtrTy()));
+}
+
+/// array_index - The i64 index of element Index, a double, of Array, after
+/// a check that it is one: Index from 0 up to the length, rounded toward
+/// zero. A NaN index fails the check, which is made without fast-math
+/// flags so that still holds under --ffast-math.
+inline llvm::Value *array_index(llvm::IRBuilder<> &Builder, SSABuilder &SSA, ArrayValue Array, llvm::Value *Index)
+{
+    llvm::IRBuilderBase::FastMathFlagGuard Strict(Builder);
+    Builder.clearFastMathFlags();
+    auto *Double = Builder.getDoubleTy();
+    auto *AboveZero = Builder.CreateFCmpOGE(Index, llvm::ConstantFP::get(Double, 0.0));
+    auto *BelowLength = Builder.CreateFCmpOLT(Index, Builder.CreateSIToFP(Array.Length, Double));
+    array_trap(Builder, SSA, Builder.CreateAnd(AboveZero, BelowLength));
+    return Builder.CreateFPToSI(Index, Builder.getInt64Ty(), "index");
+}
+
+/// array_element - The address of element Index, an i64, of Array.
+inline llvm::Value *array_element(llvm::IRBuilder<> &Builder, ArrayValue Array, llvm::Value *Index)
+{
+    return Builder.CreateInBoundsGEP(Builder.getDoubleTy(), Array.Data, Index, "element");
+}
+
+#endif// __ARRAYS_H_
@@ -1,11 +1,15 @@
 #ifndef __CODEGEN_H_
 #define __CODEGEN_H_
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
+#include <thread>
 #include <variant>
 #include <fmt/format.h>
 #include "codemodule.hpp"
 #include "../AST/AST.hpp"
+#include "../AST/FlatAST.hpp"
 
 // helper type for the visitor #4
 template<class... Ts>
@@ -18,23 +22,155 @@ template<class... Ts>
 overloaded(Ts...) -> overloaded<Ts...>;
 
 
-using ExprAST_ptr = std::unique_ptr<ExprAST>;
-using FnAST_ptr = std::unique_ptr<FnAST>;
+using ExprAST_ptr = ExprAST *;
+using FnAST_ptr = FnAST *;
 inline std::unique_ptr<CodeModule> codegen(
-    std::vector<std::variant<ExprAST_ptr, FnAST_ptr>> &top_expressions)
+    std::vector<std::variant<ExprAST_ptr, FnAST_ptr>> &top_expressions, const CodeOptions &options = {})
 {
-    auto mod = std::make_unique<CodeModule>();
+    auto mod = std::make_unique<CodeModule>(options);
     for (auto &expr : top_expressions)
     {
 
         std::visit(overloaded{
-                       [&mod](ExprAST_ptr &arg) { arg->codegen(*mod); },
-                       [&mod](FnAST_ptr &arg) { arg->codegen(*mod); },
+                       [&mod](ExprAST_ptr arg) {
+                           if (arg) arg->codegen(*mod);
+                       },
+                       [&mod](FnAST_ptr arg) {
+                           if (arg) arg->codegen(*mod);
+                       },
                    },
             expr);
     }
     return mod;
 }
 
+inline std::unique_ptr<CodeModule> codegen(const FlatAST &ast, const CodeOptions &options = {})
+{
+    auto mod = std::make_unique<CodeModule>(options);
+    FlatCodegen gen(ast, *mod);
+    for (auto &item : ast.top_level)
+    {
+        std::visit([&gen](auto id) {
+            if (id) gen.emit(id);
+        },
+            item);
+    }
+    return mod;
+}
+
+/// codegen_unit_size - Top level items per codegen unit when generating on
+/// several threads. Fixed rather than derived from the thread count, so the
+/// units, and the objects made from them, are the same for any thread count.
+constexpr std::size_t codegen_unit_size = 512;
+
+inline std::size_t codegen_unit_count(std::size_t items)
+{
+    return std::max<std::size_t>(1, (items + codegen_unit_size - 1) / codegen_unit_size);
+}
+
+/// localize_top_level - Every unit with a top level expression defines its
+/// own __anon_expr, so when there are several units, rename it to
+/// __anon_expr.<unit> with internal linkage, and their objects link together.
+inline void localize_top_level(CodeModule &part, std::size_t unit)
+{
+    auto *F = part.TheModule->getFunction("__anon_expr");
+    if (!F || F->isDeclaration()) return;
+    F->setName(fmt::format("__anon_expr.{}", unit));
+    F->setLinkage(llvm::Function::InternalLinkage);
+}
+
+/// codegen_units - Split count top level items into codegen units and, on up
+/// to jobs threads, generate each into its own CodeModule with options by
+/// emit(code_module, begin, end), then pass it to finish(unit, code_module)
+/// on the same thread, e.g. to write it out as an object file.
+///
+/// emit must first make known the prototypes of the items before begin, so
+/// each unit sees the functions a single module would have had by then and
+/// declares whichever of them it uses. With more than one unit, the top
+/// level expressions are kept local to their unit; see localize_top_level.
+template<typename Emit, typename Finish>
+void codegen_units(std::size_t count, unsigned jobs, Emit emit, Finish finish, const CodeOptions &options)
+{
+    auto units = codegen_unit_count(count);
+    std::atomic<std::size_t> next_unit{ 0 };
+    auto work = [&] {
+        for (std::size_t unit; (unit = next_unit++) < units;)
+        {
+            CodeModule part(options);
+            emit(part, unit * codegen_unit_size, std::min(count, (unit + 1) * codegen_unit_size));
+            if (units > 1) localize_top_level(part, unit);
+            finish(unit, part);
+        }
+    };
+
+    std::vector<std::jthread> workers;
+    for (std::size_t i = 1; i < std::min<std::size_t>(jobs, units); ++i) workers.emplace_back(work);
+    work();
+}
+
+/// codegen - Generate top_expressions as codegen units on jobs threads; see
+/// codegen_units. Codegen only reads the AST and looks symbols up, so the
+/// threads share both.
+template<typename Finish>
+void codegen(std::vector<std::variant<ExprAST_ptr, FnAST_ptr>> &top_expressions,
+    unsigned jobs,
+    Finish finish,
+    const CodeOptions &options = {})
+{
+    codegen_units(
+        top_expressions.size(),
+        jobs,
+        [&](CodeModule &part, std::size_t begin, std::size_t end) {
+            for (std::size_t i = 0; i < begin; ++i)
+            {
+                if (auto **fn = std::get_if<FnAST_ptr>(&top_expressions[i]); fn && *fn)
+                {
+                    auto *proto = (*fn)->getPrototype();
+                    part.FunctionProtos[proto->getSymbol()] = proto;
+                }
+            }
+            for (std::size_t i = begin; i < end; ++i)
+            {
+                std::visit([&part](auto *arg) {
+                    if (arg) arg->codegen(part);
+                },
+                    top_expressions[i]);
+            }
+        },
+        finish,
+        options);
+}
+
+template<typename Finish> void codegen(const FlatAST &ast, unsigned jobs, Finish finish, const CodeOptions &options = {})
+{
+    codegen_units(
+        ast.top_level.size(),
+        jobs,
+        [&](CodeModule &part, std::size_t begin, std::size_t end) {
+            FlatCodegen gen(ast, part);
+            for (std::size_t i = 0; i < begin; ++i)
+            {
+                std::visit(overloaded{
+                               [&gen](FlatProto p) {
+                                   if (p) gen.addPrototype(p);
+                               },
+                               [&gen, &ast](FlatFn f) {
+                                   if (f) gen.addPrototype(ast.function(f).proto);
+                               },
+                           },
+                    ast.top_level[i]);
+            }
+            for (std::size_t i = begin; i < end; ++i)
+            {
+                std::visit([&gen](auto id) {
+                    if (id) gen.emit(id);
+                },
+                    ast.top_level[i]);
+            }
+        },
+        finish,
+        options);
+}
+
 #endif
 // __CODEGEN_H_
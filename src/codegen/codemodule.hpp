@@ -6,22 +6,162 @@
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/Module.h"
 #include <memory>
+#include <string>
+#include <vector>
+#include "../misc/symbol.hpp"
+#include "FastMath.hpp"
+#include "arrays.hpp"
+#include "ssa.hpp"
 //#include "../AST/AST.hpp"
 
 
+/// SymbolMap - Table keyed by Symbol, stored as a vector indexed by symbol id
+/// so a lookup is a single index. clear() starts a new generation instead of
+/// touching the entries; an entry from an older generation reads as empty.
+template<typename T> class SymbolMap
+{
+    struct entry
+    {
+        T value{};
+        uint32_t generation = 0;
+    };
+    std::vector<entry> entries;
+    uint32_t generation = 1;
+
+  public:
+    T &operator[](Symbol s)
+    {
+        if (s.id >= entries.size()) entries.resize(std::max<std::size_t>(s.id + 1, symbols().size()));
+        auto &e = entries[s.id];
+        if (e.generation != generation)
+        {
+            e.value = T{};
+            e.generation = generation;
+        }
+        return e.value;
+    }
+    void erase(Symbol s) { (*this)[s] = T{}; }
+    void clear() { ++generation; }
+};
+
+/// ScopedSymbolMap - A SymbolMap of bindings made in nested scopes. Binding
+/// a symbol saves the value it shadows on one flat stack; restoring a scope
+/// pops back to its mark and puts the shadowed values back, innermost first,
+/// so callers don't keep their own list of what to undo.
+template<typename T> class ScopedSymbolMap
+{
+    SymbolMap<T> values;
+    std::vector<std::pair<Symbol, T>> shadowed;
+
+  public:
+    /// lookup - The innermost binding of s, or T{} if it has none.
+    T lookup(Symbol s) { return values[s]; }
+
+    /// scope - Marks the current scope; see restore.
+    std::size_t scope() const { return shadowed.size(); }
+    /// bind - Make value the innermost binding of s.
+    void bind(Symbol s, T value)
+    {
+        auto &slot = values[s];
+        shadowed.emplace_back(s, slot);
+        slot = value;
+    }
+    /// restore - Unbind everything bound since scope returned mark.
+    void restore(std::size_t mark)
+    {
+        while (shadowed.size() > mark)
+        {
+            values[shadowed.back().first] = shadowed.back().second;
+            shadowed.pop_back();
+        }
+    }
+    /// clear - Drop every binding, for the next function.
+    void clear()
+    {
+        values.clear();
+        shadowed.clear();
+    }
+};
+
+/// CodeOptions - How the functions of a module are generated: the CPU and
+/// features they are tuned for, given them as their "target-cpu" and
+/// "target-features" attributes (empty leaves that to the TargetMachine the
+/// module is compiled with), and the fast-math flags of their floating point
+/// operations, which are strict IEEE arithmetic without any.
+struct CodeOptions
+{
+    std::string cpu;
+    std::string features;
+    llvm::FastMathFlags fast_math;
+};
+
+/// CountedLoop - A for loop being generated that counts with an i64 (see
+/// counted_bound): its variable, that i64, and the arrays (by their Data)
+/// it was checked once before the loop that every value of the variable
+/// indexes, so indexing them with the variable needs no check.
+struct CountedLoop
+{
+    SSAVariable Variable;
+    llvm::Value *Counter = nullptr;
+    llvm::SmallVector<llvm::Value *, 4> InBounds;
+};
+
 class PrototypeAST;
+/// CodeModule - The module being generated, with the context it lives in and
+/// codegen's symbol tables. The context is owned through a pointer so the
+/// module and its context can be handed over together, e.g. to the JIT.
 struct CodeModule
 {
-    llvm::LLVMContext TheContext;
+    std::unique_ptr<llvm::LLVMContext> TheContext;
     llvm::IRBuilder<> Builder;
     std::unique_ptr<llvm::Module> TheModule;
-    std::map<std::string, llvm::AllocaInst *> NamedValues;
-    std::map<std::string, std::unique_ptr<PrototypeAST>> FunctionProtos;
+    // The variables in scope in the function being generated, and their
+    // values.
+    ScopedSymbolMap<SSAVariable> NamedValues;
+    // The arrays in scope, which aren't variables: a name always refers to
+    // the same elements.
+    ScopedSymbolMap<ArrayValue> NamedArrays;
+    // The counted loops around the code being generated, innermost last.
+    std::vector<CountedLoop> CountedLoops;
+    SSABuilder SSA;
+    SymbolMap<PrototypeAST *> FunctionProtos;
+    CodeOptions Options;
+
+    explicit CodeModule(CodeOptions _options = {})
+        : TheContext(std::make_unique<llvm::LLVMContext>()),
+          Builder(*TheContext),
+          TheModule(std::make_unique<llvm::Module>("Kaleoscope AOT ", *TheContext)),
+          Options(std::move(_options))
+    {
+        Builder.setFastMathFlags(Options.fast_math);
+    }
+
+    /// setFunctionAttributes - Tune F for the CPU and features of Options,
+    /// if it names any, and let the backend generate its floating point code
+    /// as the fast-math flags allow. The backend takes that from each
+    /// function's attributes, not from its TargetOptions.
+    void setFunctionAttributes(llvm::Function &F) const
+    {
+        if (!Options.cpu.empty()) F.addFnAttr("target-cpu", Options.cpu);
+        if (!Options.features.empty()) F.addFnAttr("target-features", Options.features);
+        auto &fast_math = Options.fast_math;
+        if (unsafe_fp_math(fast_math)) F.addFnAttr("unsafe-fp-math", "true");
+        if (fast_math.noNaNs()) F.addFnAttr("no-nans-fp-math", "true");
+        if (fast_math.noInfs()) F.addFnAttr("no-infs-fp-math", "true");
+        if (fast_math.noSignedZeros()) F.addFnAttr("no-signed-zeros-fp-math", "true");
+        if (fast_math.approxFunc()) F.addFnAttr("approx-func-fp-math", "true");
+    }
 
-    CodeModule()
-        : Builder(TheContext),
-          TheModule(std::make_unique<llvm::Module>("Kaleoscope AOT ", TheContext))
-    {}
+    /// countedLoop - The innermost counted loop whose variable is V, or
+    /// null if V isn't one's.
+    const CountedLoop *countedLoop(SSAVariable V) const
+    {
+        for (auto it = CountedLoops.rbegin(); it != CountedLoops.rend(); ++it)
+        {
+            if (it->Variable.id == V.id) return &*it;
+        }
+        return nullptr;
+    }
 };
 
 #endif
@@ -0,0 +1,200 @@
+#ifndef __LOOPS_H_
+#define __LOOPS_H_
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/DiagnosticHandler.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Metadata.h"
+
+/// LoopHints - What a for loop asks of LLVM's loop optimizations with
+/// 'vectorize(N)' and 'unroll(N)' after its end condition and step. Zero
+/// asks nothing; a width or count of 1 keeps the loop scalar or rolled.
+struct LoopHints
+{
+    uint32_t vectorize = 0;
+    uint32_t unroll = 0;
+
+    bool any() const { return vectorize || unroll; }
+};
+
+/// LoopName - What the loop report calls a loop: the function it is written
+/// in and its variable, and for a loop that runs in two copies, which one
+/// (see ForExprAST::codegen).
+struct LoopName
+{
+    enum Copy { Only, Elided, Checked };
+
+    llvm::StringRef function;
+    llvm::StringRef variable;
+    Copy copy = Only;
+};
+
+/// loop_id - The llvm.loop metadata for the branch back to the header of the
+/// loop name, with hints. It always holds a "toy.loop" entry with the name,
+/// which LLVM keeps on the copies its loop passes and the inliner make, so
+/// LoopReport can tell which loop of the source a remark is about. A loop
+/// with hints must also make progress, so LLVM may assume it terminates.
+inline llvm::MDNode *loop_id(llvm::LLVMContext &C, LoopHints hints, const LoopName &name)
+{
+    auto flag = [&](const char *flag_name) { return llvm::MDNode::get(C, llvm::MDString::get(C, flag_name)); };
+    auto count = [&](const char *count_name, uint32_t n) {
+        llvm::Metadata *Ops[] = { llvm::MDString::get(C, count_name),
+            llvm::ConstantAsMetadata::get(llvm::ConstantInt::get(llvm::Type::getInt32Ty(C), n)) };
+        return llvm::MDNode::get(C, Ops);
+    };
+
+    // The first operand refers to the node itself, which makes it distinct
+    // for each loop.
+    llvm::Metadata *Name[] = { llvm::MDString::get(C, "toy.loop"),
+        llvm::MDString::get(C, name.function),
+        llvm::MDString::get(C, name.variable),
+        llvm::ConstantAsMetadata::get(llvm::ConstantInt::get(llvm::Type::getInt32Ty(C), name.copy)) };
+    llvm::SmallVector<llvm::Metadata *, 5> Ops{ nullptr, llvm::MDNode::get(C, Name) };
+    if (hints.any()) Ops.push_back(flag("llvm.loop.mustprogress"));
+    if (hints.vectorize == 1)
+        Ops.push_back(count("llvm.loop.vectorize.width", 1));
+    else if (hints.vectorize)
+    {
+        llvm::Metadata *Enable[] = { llvm::MDString::get(C, "llvm.loop.vectorize.enable"),
+            llvm::ConstantAsMetadata::get(llvm::ConstantInt::getTrue(C)) };
+        Ops.push_back(llvm::MDNode::get(C, Enable));
+        Ops.push_back(count("llvm.loop.vectorize.width", hints.vectorize));
+    }
+    if (hints.unroll == 1)
+        Ops.push_back(flag("llvm.loop.unroll.disable"));
+    else if (hints.unroll)
+        Ops.push_back(count("llvm.loop.unroll.count", hints.unroll));
+    auto *ID = llvm::MDNode::getDistinct(C, Ops);
+    ID->replaceOperandWith(0, ID);
+    return ID;
+}
+
+/// counted_start, counted_step - The start value and step of a for loop that
+/// codegen counts with an integer (see counted_bound): whole numbers the
+/// loop variable holds exactly, a step of 1 to 2^31.
+inline std::optional<int64_t> counted_start(std::optional<double> start)
+{
+    if (!start || !(*start >= -0x1p53 && *start <= 0x1p53) || *start != static_cast<double>(static_cast<int64_t>(*start)))
+        return std::nullopt;
+    return static_cast<int64_t>(*start);
+}
+inline std::optional<int64_t> counted_step(std::optional<double> step)
+{
+    if (!step || !(*step >= 1 && *step <= 0x1p31) || *step != static_cast<double>(static_cast<int64_t>(*step)))
+        return std::nullopt;
+    return static_cast<int64_t>(*step);
+}
+/// counted_constant - The i64 a counted start or step is counted with.
+inline llvm::ConstantInt *counted_constant(llvm::IRBuilder<> &Builder, int64_t value)
+{
+    return llvm::ConstantInt::getSigned(Builder.getInt64Ty(), value);
+}
+
+/// counted_bound - For a loop whose variable v takes whole numbers and runs
+/// while v < end, with end the same in every iteration: an i64 bound with
+/// v < bound exactly when v < end, so the loop can count with an i64 that
+/// LLVM's loop passes see is an induction variable with a trip count, where
+/// they can't work one out for a double compared with a double. That is
+/// ceil(end), kept to +-2^62 so the count can't overflow; end is NaN makes
+/// v < end always true, as '<' is an unordered compare. It is rounded up
+/// here rather than with llvm.ceil, which stays a call to libm's ceil at
+/// -O0 that every program linking the object would need -lm for. Built
+/// without fast-math flags: a NaN or infinite end must still give a bound,
+/// not poison, as array bounds checks are dropped on it.
+inline llvm::Value *counted_bound(llvm::IRBuilder<> &Builder, llvm::Value *End)
+{
+    llvm::IRBuilderBase::FastMathFlagGuard Strict(Builder);
+    Builder.clearFastMathFlags();
+    auto *Double = Builder.getDoubleTy();
+    auto *I64 = Builder.getInt64Ty();
+    auto *Low = llvm::ConstantFP::get(Double, -0x1p62);
+    auto *High = llvm::ConstantFP::get(Double, 0x1p62);
+    llvm::Value *Clamped = Builder.CreateSelect(Builder.CreateFCmpOLT(End, Low), Low, End);
+    Clamped = Builder.CreateSelect(Builder.CreateFCmpUGT(Clamped, High), High, Clamped, "bound");
+    llvm::Value *Truncated = Builder.CreateFPToSI(Clamped, I64);
+    llvm::Value *Fraction = Builder.CreateFCmpOLT(Builder.CreateSIToFP(Truncated, Double), Clamped);
+    return Builder.CreateAdd(Truncated, Builder.CreateZExt(Fraction, I64), "bound");
+}
+
+/// LoopReport - Collects what LLVM's loop vectorizer and unroller made of
+/// each loop, from their optimization remarks, into report, one line per
+/// remark: the function, the loop and the message. A loop is named after
+/// the "toy.loop" entry loop_id gave it, e.g. 'loop i', 'loop i, bounds
+/// checks elided', or 'loop i of fill' once inlined into another function,
+/// and by its header block if it has none. Other diagnostics are left to
+/// LLVM. Installed with LLVMContext::setDiagnosticHandler.
+class LoopReport : public llvm::DiagnosticHandler
+{
+    std::string &report;
+
+    static bool reported(llvm::StringRef PassName) { return PassName == "loop-vectorize" || PassName == "loop-unroll"; }
+
+    /// loop_name - The "toy.loop" entry of the loop with header Header: its
+    /// latch, a predecessor, holds the loop's llvm.loop metadata.
+    static const llvm::MDNode *loop_name(const llvm::BasicBlock &Header)
+    {
+        for (const auto *Pred : llvm::predecessors(&Header))
+        {
+            const auto *ID = Pred->getTerminator()->getMetadata(llvm::LLVMContext::MD_loop);
+            if (!ID) continue;
+            for (const auto &Op : llvm::drop_begin(ID->operands()))
+            {
+                const auto *Entry = llvm::dyn_cast<llvm::MDNode>(Op.get());
+                if (!Entry || Entry->getNumOperands() != 4) continue;
+                if (const auto *Tag = llvm::dyn_cast<llvm::MDString>(Entry->getOperand(0));
+                    Tag && Tag->getString() == "toy.loop")
+                    return Entry;
+            }
+        }
+        return nullptr;
+    }
+
+    /// describe - A loop, named as above, in function Function.
+    static std::string describe(llvm::StringRef Function, const llvm::BasicBlock &Header)
+    {
+        const auto *Entry = loop_name(Header);
+        if (!Entry) return Header.getName().str();
+        auto Written = llvm::cast<llvm::MDString>(Entry->getOperand(1))->getString();
+        auto Variable = llvm::cast<llvm::MDString>(Entry->getOperand(2))->getString();
+        auto Copy = llvm::mdconst::extract<llvm::ConstantInt>(Entry->getOperand(3))->getZExtValue();
+        std::string Name = "loop " + Variable.str();
+        if (Written != Function) Name += " of " + Written.str();
+        if (Copy == LoopName::Elided) Name += ", bounds checks elided";
+        if (Copy == LoopName::Checked) Name += ", bounds checked";
+        return Name;
+    }
+
+  public:
+    explicit LoopReport(std::string &_report) : report(_report) {}
+
+    bool isAnalysisRemarkEnabled(llvm::StringRef PassName) const override { return reported(PassName); }
+    bool isMissedOptRemarkEnabled(llvm::StringRef PassName) const override { return reported(PassName); }
+    bool isPassedOptRemarkEnabled(llvm::StringRef PassName) const override { return reported(PassName); }
+    bool isAnyRemarkEnabled() const override { return true; }
+
+    bool handleDiagnostics(const llvm::DiagnosticInfo &DI) override
+    {
+        auto *Remark = llvm::dyn_cast<llvm::DiagnosticInfoIROptimization>(&DI);
+        if (!Remark || !reported(Remark->getPassName())) return false;
+        auto Message = Remark->getMsg();
+        if (Message.empty()) return true;
+        auto Function = Remark->getFunction().getName();
+        report += Function.str();
+        if (auto *Header = llvm::dyn_cast_or_null<llvm::BasicBlock>(Remark->getCodeRegion()))
+            report += ": " + describe(Function, *Header);
+        else if (auto *Region = Remark->getCodeRegion(); Region && Region->hasName())
+            report += ": " + Region->getName().str();
+        report += ": " + Message + "\n";
+        return true;
+    }
+};
+
+#endif// __LOOPS_H_
@@ -0,0 +1,50 @@
+#ifndef __OPTIMIZER_H_
+#define __OPTIMIZER_H_
+#include "llvm/Analysis/CGSCCPassManager.h"
+#include "llvm/Analysis/LoopAnalysisManager.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/CodeGen.h"
+#include "llvm/Target/TargetMachine.h"
+
+#if LLVM_VERSION_MAJOR >= 14
+using OptimizationLevel = llvm::OptimizationLevel;
+#else
+using OptimizationLevel = llvm::PassBuilder::OptimizationLevel;
+#endif
+
+/// optimize - Run the new pass manager's default per-module pipeline for
+/// level over module. TheTargetMachine supplies target specific analyses
+/// and tuning; module should already have its data layout and triple.
+inline void optimize(llvm::Module &module, llvm::TargetMachine &TheTargetMachine, OptimizationLevel level)
+{
+    if (level == OptimizationLevel::O0) return;
+
+    llvm::LoopAnalysisManager LAM;
+    llvm::FunctionAnalysisManager FAM;
+    llvm::CGSCCAnalysisManager CGAM;
+    llvm::ModuleAnalysisManager MAM;
+
+    llvm::PassBuilder PB(&TheTargetMachine);
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    llvm::ModulePassManager MPM = PB.buildPerModuleDefaultPipeline(level);
+    MPM.run(module, MAM);
+}
+
+/// codegen_opt_level - The backend optimization level that goes with level.
+inline llvm::CodeGenOpt::Level codegen_opt_level(OptimizationLevel level)
+{
+    if (level == OptimizationLevel::O0) return llvm::CodeGenOpt::None;
+    if (level == OptimizationLevel::O1) return llvm::CodeGenOpt::Less;
+    if (level == OptimizationLevel::O3) return llvm::CodeGenOpt::Aggressive;
+    return llvm::CodeGenOpt::Default;
+}
+
+#endif// __OPTIMIZER_H_
@@ -0,0 +1,256 @@
+#ifndef __SSA_H_
+#define __SSA_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/ValueHandle.h"
+
+/// SSAVariable - A variable of the function being generated: one per
+/// argument, for loop variable and var binding, so a shadowing binding is a
+/// different variable. The empty variable means "not bound".
+struct SSAVariable
+{
+    uint32_t id = 0;
+
+    explicit operator bool() const { return id != 0; }
+};
+
+/// SSABuilder - Builds SSA form for variables while codegen emits their
+/// reads and writes, following Braun et al., "Simple and Efficient
+/// Construction of Static Single Assignment Form" (CC 2013). Variables live
+/// in registers from the start; no allocas, loads or stores, so even -O0
+/// code keeps loop variables in registers and the optimizer has less to
+/// clean up.
+///
+/// Reads look for the variable's last write in the current block and
+/// otherwise ask the predecessors, placing a phi where they may disagree.
+/// A block must be sealed once all its predecessors have branched to it;
+/// until then a read places an operandless phi that sealing completes.
+/// Phis that turn out to merge just one value are removed again.
+class SSABuilder
+{
+    struct def_key
+    {
+        uint32_t variable;
+        llvm::BasicBlock *block;
+    };
+    struct def_key_info
+    {
+        static def_key getEmptyKey() { return { ~0u, llvm::DenseMapInfo<llvm::BasicBlock *>::getEmptyKey() }; }
+        static def_key getTombstoneKey() { return { ~0u, llvm::DenseMapInfo<llvm::BasicBlock *>::getTombstoneKey() }; }
+        static unsigned getHashValue(const def_key &k)
+        {
+            return llvm::DenseMapInfo<std::pair<uint32_t, llvm::BasicBlock *>>::getHashValue({ k.variable, k.block });
+        }
+        static bool isEqual(const def_key &a, const def_key &b)
+        {
+            return a.variable == b.variable && a.block == b.block;
+        }
+    };
+
+    // The value of each variable at the end of each block that writes it or
+    // has looked it up, possibly a phi removed since; see resolve.
+    llvm::DenseMap<def_key, llvm::Value *, def_key_info> defs;
+    llvm::SmallPtrSet<llvm::BasicBlock *, 16> sealed;
+    // Operandless phis of unsealed blocks, by block.
+    llvm::DenseMap<llvm::BasicBlock *, llvm::SmallVector<std::pair<uint32_t, llvm::PHINode *>, 4>> incomplete;
+    // Unsealed loop headers, with the variables their back edges may change
+    // (sorted); see loop.
+    llvm::DenseMap<llvm::BasicBlock *, llvm::SmallVector<uint32_t, 4>> loops;
+    // Phis placed by this builder, the only ones it may remove.
+    llvm::SmallPtrSet<llvm::PHINode *, 16> phis;
+    // Removed phis and what replaced each. They are only deleted on reset,
+    // so no new value can take an address defs still holds. Tracking handles
+    // in defs would do the same, but a removal then walks every block's
+    // handle on the phi, which makes deep loop nests cubic.
+    llvm::DenseMap<llvm::Value *, llvm::Value *> replaced;
+    std::vector<llvm::PHINode *> removed;
+    std::vector<llvm::StringRef> names{ llvm::StringRef() };
+
+    /// resolve - V, or what replaced it if it is a removed phi.
+    llvm::Value *resolve(llvm::Value *V)
+    {
+        llvm::Value *Root = V;
+        for (auto it = replaced.find(Root); it != replaced.end(); it = replaced.find(Root)) Root = it->second;
+        // Shorten the chain for next time.
+        while (V != Root)
+        {
+            auto &Next = replaced[V];
+            V = Next;
+            Next = Root;
+        }
+        return Root;
+    }
+
+    llvm::PHINode *placePhi(uint32_t variable, llvm::BasicBlock *block)
+    {
+        auto *Ty = llvm::Type::getDoubleTy(block->getContext());
+        llvm::PHINode *Phi;
+        // Phis go first. In front of the others rather than after them: a
+        // loop header can collect one per variable used in the loop, and
+        // finding the end of those each time makes deep nests quadratic.
+        if (!block->empty())
+            Phi = llvm::PHINode::Create(Ty, 2, names[variable], &block->front());
+        else
+            Phi = llvm::PHINode::Create(Ty, 2, names[variable], block);
+        phis.insert(Phi);
+        return Phi;
+    }
+
+    /// pending - Whether block may still gain predecessors that bring
+    /// variable a different value.
+    bool pending(uint32_t variable, llvm::BasicBlock *block) const
+    {
+        if (sealed.count(block)) return false;
+        auto it = loops.find(block);
+        return it == loops.end() || std::binary_search(it->second.begin(), it->second.end(), variable);
+    }
+
+    llvm::Value *readRecursive(uint32_t variable, llvm::BasicBlock *block)
+    {
+        llvm::Value *Val;
+        if (pending(variable, block))
+        {
+            auto *Phi = placePhi(variable, block);
+            incomplete[block].push_back({ variable, Phi });
+            Val = Phi;
+        }
+        else if (auto *Pred = block->getSinglePredecessor())
+            Val = read(variable, Pred);
+        else
+        {
+            // Write the phi first, so a cycle through a loop finds it.
+            auto *Phi = placePhi(variable, block);
+            defs[{ variable, block }] = Phi;
+            Val = addOperands(variable, Phi);
+        }
+        defs[{ variable, block }] = Val;
+        return Val;
+    }
+
+    llvm::Value *addOperands(uint32_t variable, llvm::PHINode *Phi)
+    {
+        for (auto *Pred : llvm::predecessors(Phi->getParent())) Phi->addIncoming(read(variable, Pred), Pred);
+        return removeTrivial(Phi);
+    }
+
+    /// removeTrivial - Phi, or the one value it merges, with Phi replaced
+    /// by it everywhere.
+    llvm::Value *removeTrivial(llvm::PHINode *Phi)
+    {
+        llvm::Value *Same = nullptr;
+        for (llvm::Value *Op : Phi->incoming_values())
+        {
+            if (Op == Same || Op == Phi) continue;
+            if (Same) return Phi;// Merges at least two values.
+            Same = Op;
+        }
+        // No operands at all: the variable is read before any write.
+        if (!Same) Same = llvm::UndefValue::get(Phi->getType());
+
+        // Removing Phi may make the phis using it trivial in turn.
+        llvm::SmallVector<llvm::PHINode *, 4> Users;
+        for (auto *U : Phi->users())
+        {
+            if (auto *P = llvm::dyn_cast<llvm::PHINode>(U); P && P != Phi && phis.count(P)) Users.push_back(P);
+        }
+        Phi->replaceAllUsesWith(Same);
+        phis.erase(Phi);
+        replaced[Phi] = Same;
+        Phi->dropAllReferences();
+        Phi->removeFromParent();
+        removed.push_back(Phi);
+
+        for (auto *P : Users)
+        {
+            // Skip users already removed, and incomplete phis.
+            if (phis.count(P) && sealed.count(P->getParent())) removeTrivial(P);
+        }
+        // Same may itself have been one of those phis.
+        return resolve(Same);
+    }
+
+  public:
+    SSABuilder() = default;
+    SSABuilder(const SSABuilder &) = delete;
+    SSABuilder &operator=(const SSABuilder &) = delete;
+    ~SSABuilder() { reset(); }
+
+    /// reset - Forget everything, once a function is done. Deletes the phis
+    /// removed from it, so it must run while their context is alive.
+    void reset()
+    {
+        defs.clear();
+        sealed.clear();
+        incomplete.clear();
+        loops.clear();
+        phis.clear();
+        replaced.clear();
+        for (auto *Phi : removed) Phi->deleteValue();
+        removed.clear();
+        names.resize(1);
+    }
+
+    /// create - A new variable. name, which names its phis, must stay valid
+    /// until reset.
+    SSAVariable create(llvm::StringRef name)
+    {
+        names.push_back(name);
+        return SSAVariable{ static_cast<uint32_t>(names.size() - 1) };
+    }
+
+    /// write - variable is value from here to the end of block, or its next
+    /// write.
+    void write(SSAVariable variable, llvm::BasicBlock *block, llvm::Value *value)
+    {
+        defs[{ variable.id, block }] = value;
+    }
+
+    /// read - The value of variable at the end of block so far.
+    llvm::Value *read(SSAVariable variable, llvm::BasicBlock *block) { return read(variable.id, block); }
+    llvm::Value *read(uint32_t variable, llvm::BasicBlock *block)
+    {
+        if (auto it = defs.find({ variable, block }); it != defs.end()) return it->second = resolve(it->second);
+        return readRecursive(variable, block);
+    }
+
+    /// loop - Declare block a loop header that has just its entry edge so
+    /// far, and whose back edges can only change the variables in changing.
+    /// Reading any other variable in the loop then finds its value from
+    /// before the loop, rather than placing a phi in every header it is
+    /// nested in for sealing to remove again. seal(block) as usual once the
+    /// back edges are in.
+    void loop(llvm::BasicBlock *block, llvm::ArrayRef<SSAVariable> changing)
+    {
+        auto &ids = loops[block];
+        for (auto variable : changing) ids.push_back(variable.id);
+        llvm::sort(ids);
+    }
+
+    /// seal - Declare that block has all its predecessors.
+    void seal(llvm::BasicBlock *block)
+    {
+        loops.erase(block);
+        if (auto it = incomplete.find(block); it != incomplete.end())
+        {
+            auto Phis = std::move(it->second);
+            incomplete.erase(it);
+            for (auto &[variable, Phi] : Phis) addOperands(variable, Phi);
+        }
+        // Only now, so completing one of its phis can't remove another that
+        // has no operands yet.
+        sealed.insert(block);
+    }
+};
+
+#endif// __SSA_H_
@@ -0,0 +1,35 @@
+#include "Builtins.hpp"
+#include <cmath>
+
+// The runtime functions compiled code calls, from jit/runtime.cpp.
+extern "C" double putchard(double X);
+extern "C" double printd(double X);
+
+namespace {
+const Builtin builtins[] = {
+    { "putchard", 1, [](const double *a) { return putchard(a[0]); } },
+    { "printd", 1, [](const double *a) { return printd(a[0]); } },
+    { "sin", 1, [](const double *a) { return std::sin(a[0]); } },
+    { "cos", 1, [](const double *a) { return std::cos(a[0]); } },
+    { "tan", 1, [](const double *a) { return std::tan(a[0]); } },
+    { "atan", 1, [](const double *a) { return std::atan(a[0]); } },
+    { "exp", 1, [](const double *a) { return std::exp(a[0]); } },
+    { "log", 1, [](const double *a) { return std::log(a[0]); } },
+    { "sqrt", 1, [](const double *a) { return std::sqrt(a[0]); } },
+    { "fabs", 1, [](const double *a) { return std::fabs(a[0]); } },
+    { "floor", 1, [](const double *a) { return std::floor(a[0]); } },
+    { "ceil", 1, [](const double *a) { return std::ceil(a[0]); } },
+    { "pow", 2, [](const double *a) { return std::pow(a[0], a[1]); } },
+    { "atan2", 2, [](const double *a) { return std::atan2(a[0], a[1]); } },
+    { "fmod", 2, [](const double *a) { return std::fmod(a[0], a[1]); } },
+};
+}// namespace
+
+const Builtin *builtin(std::string_view name)
+{
+    for (auto &b : builtins)
+    {
+        if (b.name == name) return &b;
+    }
+    return nullptr;
+}
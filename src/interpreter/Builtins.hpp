@@ -0,0 +1,22 @@
+#ifndef __BUILTINS_H_
+#define __BUILTINS_H_
+
+#include <cstddef>
+#include <string_view>
+
+/// Builtin - A function an extern can name when interpreting, standing in for
+/// the runtime functions and C library the compiled code links against.
+struct Builtin
+{
+    std::string_view name;
+    std::size_t arity;
+    double (*fn)(const double *args);
+};
+
+/// max_builtin_arity - The most arguments any builtin takes.
+constexpr std::size_t max_builtin_arity = 2;
+
+/// builtin - The builtin called name, or nullptr.
+const Builtin *builtin(std::string_view name);
+
+#endif// __BUILTINS_H_
@@ -0,0 +1,276 @@
+#include "Interpreter.hpp"
+#include <utility>
+#include <fmt/format.h>
+
+namespace {
+/// is_true - A condition as codegen tests it: ordered and not equal to 0.0,
+/// so NaN is false.
+bool is_true(double V) { return V < 0.0 || V > 0.0; }
+
+constexpr std::string_view no_arrays = "arrays need compiled code, not --interpret";
+}// namespace
+
+std::optional<double> Interpreter::error(std::string_view message)
+{
+    if (!quiet) fmt::print(stderr, "Error: {}\n", message);
+    return std::nullopt;
+}
+
+void Interpreter::declare(PrototypeAST &proto) { externs[proto.getSymbol()] = builtin(proto.getName()); }
+
+void Interpreter::define(FunctionAST &function)
+{
+    auto &P = *function.getPrototype();
+    functions[P.getSymbol()] = &function;
+
+    // If this is an operator, install it.
+    if (P.isUnaryOp()) unary_ops[P.getOperatorName() & 127] = P.getSymbol();
+    if (P.isBinaryOp())
+    {
+        binary_ops[P.getOperatorName() & 127] = P.getSymbol();
+        installBinop(P.getName(), P.getBinaryPrecedence());
+    }
+}
+
+std::optional<double> Interpreter::enter(FunctionAST &function, std::size_t base)
+{
+    auto params = function.getPrototype()->getArgs();
+    for (std::size_t i = 0; i < params.size(); ++i) bindings[base + i].name = params[i];
+
+    if (!step() || depth_left == 0)
+    {
+        restore(base);
+        return error(depth_left == 0 ? "Stack overflow" : "Evaluation limit reached");
+    }
+
+    auto caller = std::exchange(frame, base);
+    --depth_left;
+    auto result = function.getBody()->evaluate(*this);
+    ++depth_left;
+    frame = caller;
+    restore(base);
+    return result;
+}
+
+std::optional<double> Interpreter::call(Symbol callee, std::span<ExprAST *const> args)
+{
+    if (auto *function = functions[callee])
+    {
+        auto params = function->getPrototype()->getArgs();
+        if (params.size() != args.size()) return error("Incorrect # arguments passed");
+
+        // Evaluate the arguments in the caller's scope, bound to no name until
+        // they are all done so they can't shadow the caller's variables.
+        auto base = bindings.size();
+        for (auto *arg : args)
+        {
+            auto value = arg->evaluate(*this);
+            if (!value)
+            {
+                restore(base);
+                return std::nullopt;
+            }
+            bind(Symbol{}, *value);
+        }
+        return enter(*function, base);
+    }
+
+    if (auto *b = externs[callee])
+    {
+        if (b->arity != args.size()) return error("Incorrect # arguments passed");
+        double values[max_builtin_arity];
+        for (std::size_t i = 0; i < args.size(); ++i)
+        {
+            auto value = args[i]->evaluate(*this);
+            if (!value) return std::nullopt;
+            values[i] = *value;
+        }
+        return b->fn(values);
+    }
+
+    return error("Unknown function referenced");
+}
+
+std::optional<double> Interpreter::unary(char op, double operand)
+{
+    auto *function = functions[unary_ops[op & 127]];
+    if (!function) return error("Unknown unary operator");
+
+    auto base = bindings.size();
+    bind(Symbol{}, operand);
+    return enter(*function, base);
+}
+
+std::optional<double> Interpreter::binary(char op, double lhs, double rhs)
+{
+    auto *function = functions[binary_ops[op & 127]];
+    if (!function) return error("binary operator not found!");
+
+    auto base = bindings.size();
+    bind(Symbol{}, lhs);
+    bind(Symbol{}, rhs);
+    return enter(*function, base);
+}
+
+std::optional<double> Interpreter::run(FunctionAST &function) { return enter(function, bindings.size()); }
+
+std::optional<double> NumberExprAST::evaluate(Interpreter &) { return Val; }
+
+std::optional<double> VariableExprAST::evaluate(Interpreter &interp)
+{
+    // Look this variable up in the running call.
+    if (auto *V = interp.variable(Name)) return *V;
+    return interp.error(fmt::format("Unknown variable name: {}", symbols().name(Name)));
+}
+
+std::optional<double> UnaryExprAST::evaluate(Interpreter &interp)
+{
+    auto OperandV = Operand->evaluate(interp);
+    if (!OperandV) return std::nullopt;
+    return interp.unary(Opcode, *OperandV);
+}
+
+std::optional<double> BinaryExprAST::evaluate(Interpreter &interp)
+{
+    // Special case '=' because we don't want to evaluate the LHS as an
+    // expression.
+    if (Op == '=')
+    {
+        // Assignment requires the LHS to be an identifier.
+        if (LHS->getElement()) return LHS->evaluate(interp);
+        VariableExprAST *LHSE = static_cast<VariableExprAST *>(LHS);
+        auto Val = RHS->evaluate(interp);
+        if (!Val) return std::nullopt;
+
+        // Look up the name.
+        double *Variable = interp.variable(LHSE->getName());
+        if (!Variable) return interp.error("Unknown variable name");
+        *Variable = *Val;
+        return Val;
+    }
+
+    auto L = LHS->evaluate(interp);
+    if (!L) return std::nullopt;
+    auto R = RHS->evaluate(interp);
+    if (!R) return std::nullopt;
+
+    switch (Op)
+    {
+    case '+':
+        return *L + *R;
+    case '-':
+        return *L - *R;
+    case '*':
+        return *L * *R;
+    case '<':
+        // Unordered or less than, like codegen's fcmp ult.
+        return !(*L >= *R) ? 1.0 : 0.0;
+    default:
+        break;
+    }
+
+    // If it wasn't a builtin binary operator, it must be a user defined one.
+    return interp.binary(Op, *L, *R);
+}
+
+std::optional<double> CallExprAST::evaluate(Interpreter &interp) { return interp.call(Callee, Args); }
+
+std::optional<double> IfExprAST::evaluate(Interpreter &interp)
+{
+    auto CondV = Cond->evaluate(interp);
+    if (!CondV) return std::nullopt;
+    return is_true(*CondV) ? Then->evaluate(interp) : Else->evaluate(interp);
+}
+
+// Evaluated like the loop codegen emits: the body runs at least once, then
+// the step and end condition are evaluated and the variable incremented.
+std::optional<double> ForExprAST::evaluate(Interpreter &interp)
+{
+    // Evaluate the start first, without 'variable' in scope.
+    auto StartVal = Start->evaluate(interp);
+    if (!StartVal) return std::nullopt;
+
+    auto mark = interp.scope();
+    interp.bind(VarName, *StartVal);
+
+    // for expr always returns 0.0.
+    std::optional<double> Result = 0.0;
+    for (;;)
+    {
+        if (!interp.step())
+        {
+            Result = interp.error("Evaluation limit reached");
+            break;
+        }
+        if (!Body->evaluate(interp))
+        {
+            Result = std::nullopt;
+            break;
+        }
+
+        // If not specified, use 1.0.
+        double StepVal = 1.0;
+        if (Step)
+        {
+            auto V = Step->evaluate(interp);
+            if (!V)
+            {
+                Result = std::nullopt;
+                break;
+            }
+            StepVal = *V;
+        }
+
+        auto EndCond = End->evaluate(interp);
+        if (!EndCond)
+        {
+            Result = std::nullopt;
+            break;
+        }
+
+        // Increment the variable as it is now, the body may have changed it.
+        interp.bound(mark) += StepVal;
+        if (!is_true(*EndCond)) break;
+    }
+
+    // Restore the unshadowed variable.
+    interp.restore(mark);
+    return Result;
+}
+
+std::optional<double> VarExprAST::evaluate(Interpreter &interp)
+{
+    auto mark = interp.scope();
+
+    for (auto &[VarName, Init] : VarNames)
+    {
+        // Evaluate the initializer before adding the variable to scope, so
+        // var a = a in ... refers to an outer 'a'. If not specified, use 0.0.
+        double InitVal = 0.0;
+        if (Init)
+        {
+            auto V = Init->evaluate(interp);
+            if (!V)
+            {
+                interp.restore(mark);
+                return std::nullopt;
+            }
+            InitVal = *V;
+        }
+        interp.bind(VarName, InitVal);
+    }
+
+    auto BodyVal = Body->evaluate(interp);
+
+    // Pop all our variables from scope.
+    interp.restore(mark);
+    return BodyVal;
+}
+
+// Arrays only exist in generated code.
+
+std::optional<double> IndexExprAST::evaluate(Interpreter &interp) { return interp.error(no_arrays); }
+
+std::optional<double> LengthExprAST::evaluate(Interpreter &interp) { return interp.error(no_arrays); }
+
+std::optional<double> ArrayVarExprAST::evaluate(Interpreter &interp) { return interp.error(no_arrays); }
@@ -0,0 +1,147 @@
+#ifndef __INTERPRETER_H_
+#define __INTERPRETER_H_
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <variant>
+#include <vector>
+#include "../AST/AST.hpp"
+#include "../codegen/codemodule.hpp"
+#include "../misc/symbol.hpp"
+#include "Builtins.hpp"
+
+/// Interpreter - Evaluates the tree AST directly, without LLVM. Holds the
+/// functions defined so far and the variables of the calls in progress;
+/// the nodes' evaluate methods do the rest.
+class Interpreter
+{
+    struct binding
+    {
+        Symbol name;
+        double value;
+    };
+
+    // Variables in scope, innermost last. Those of the running call start at
+    // frame, so a call can't see its caller's variables.
+    std::vector<binding> bindings;
+    std::size_t frame = 0;
+
+    SymbolMap<FunctionAST *> functions;
+    SymbolMap<const Builtin *> externs;
+    // User defined operators, indexed by operator character.
+    std::array<Symbol, 128> unary_ops{};
+    std::array<Symbol, 128> binary_ops{};
+
+    // Calls and loop iterations left, and how much deeper calls may nest;
+    // see limit.
+    uint64_t steps_left = std::numeric_limits<uint64_t>::max();
+    std::size_t depth_left = std::numeric_limits<std::size_t>::max();
+    bool quiet = false;
+
+    /// enter - Call function with the values bound since base, which must
+    /// be one per parameter, as its arguments.
+    std::optional<double> enter(FunctionAST &function, std::size_t base);
+
+  public:
+    /// limit - Give up evaluating after steps more calls and loop iterations,
+    /// or when calls nest deeper than depth, e.g. to bound evaluation at
+    /// compile time.
+    void limit(uint64_t steps, std::size_t depth)
+    {
+        steps_left = steps;
+        depth_left = depth;
+    }
+    /// steps - Calls and loop iterations left before the limit.
+    uint64_t steps() const { return steps_left; }
+    /// step - Count a call or loop iteration; false once over the limit.
+    bool step()
+    {
+        if (steps_left == 0) return false;
+        --steps_left;
+        return true;
+    }
+    /// silence - Fail without reporting errors, for evaluation that is only
+    /// an attempt.
+    void silence() { quiet = true; }
+    /// error - Report an evaluation error, the interpreter's LogErrorV.
+    std::optional<double> error(std::string_view message);
+
+    /// declare - Bind an extern to the builtin of the same name, if any.
+    void declare(PrototypeAST &proto);
+    /// define - Make a function definition callable, replacing any earlier
+    /// one of the same name.
+    void define(FunctionAST &function);
+
+    /// variable - The variable name of the running call, innermost binding
+    /// first, or nullptr. Only valid until the next bind.
+    double *variable(Symbol name)
+    {
+        for (auto i = bindings.size(); i-- > frame;)
+        {
+            if (bindings[i].name == name) return &bindings[i].value;
+        }
+        return nullptr;
+    }
+    /// scope - Marks the current scope; see restore.
+    std::size_t scope() const { return bindings.size(); }
+    void bind(Symbol name, double value) { bindings.push_back({ name, value }); }
+    /// bound - The value bound at slot, the scope from just before its bind.
+    /// Unlike a variable pointer it stays valid across later binds.
+    double &bound(std::size_t slot)
+    {
+        assert(slot < bindings.size() && "slot is not bound");
+        return bindings[slot].value;
+    }
+    /// restore - Unbind the variables bound since scope returned mark.
+    void restore(std::size_t mark) { bindings.resize(mark); }
+
+    /// call - Evaluate args in the running call and call callee with them.
+    std::optional<double> call(Symbol callee, std::span<ExprAST *const> args);
+    /// unary, binary - Call the user defined operator op.
+    std::optional<double> unary(char op, double operand);
+    std::optional<double> binary(char op, double lhs, double rhs);
+
+    /// run - Evaluate a nullary function, such as a top level expression.
+    std::optional<double> run(FunctionAST &function);
+};
+
+/// interpret - Evaluate a program in order, defining functions and binding
+/// externs as they come and passing the value of each top level expression
+/// to on_result. Returns false if an expression couldn't be evaluated; the
+/// rest of the program still runs.
+template<typename OnResult>
+bool interpret(std::vector<std::variant<ExprAST *, FnAST *>> &top_expressions, Interpreter &interp, OnResult on_result)
+{
+    bool ok = true;
+    for (auto &item : top_expressions)
+    {
+        auto **fn = std::get_if<FnAST *>(&item);
+        if (!fn || !*fn) continue;
+        auto *proto = (*fn)->getPrototype();
+        if (proto == *fn)
+        {
+            interp.declare(*proto);
+            continue;
+        }
+
+        auto &function = static_cast<FunctionAST &>(**fn);
+        if (proto->getName() != "__anon_expr")
+        {
+            interp.define(function);
+            continue;
+        }
+        if (auto value = interp.run(function))
+            on_result(*value);
+        else
+            ok = false;
+    }
+    return ok;
+}
+
+#endif// __INTERPRETER_H_
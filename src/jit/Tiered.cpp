@@ -0,0 +1,169 @@
+#include "Tiered.hpp"
+#include <fmt/format.h>
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/Support/TargetSelect.h"
+
+namespace {
+/// emit_entry - Define double name(double *args) in code_module, calling
+/// target with args[0], args[1], ..., so the VM can call any function
+/// through the one signature.
+void emit_entry(CodeModule &code_module, llvm::Function &target, llvm::StringRef name)
+{
+    auto &C = *code_module.TheContext;
+    auto *Double = llvm::Type::getDoubleTy(C);
+    auto *FT = llvm::FunctionType::get(Double, { llvm::PointerType::getUnqual(Double) }, false);
+    auto *F = llvm::Function::Create(FT, llvm::Function::ExternalLinkage, name, *code_module.TheModule);
+
+    auto &Builder = code_module.Builder;
+    Builder.SetInsertPoint(llvm::BasicBlock::Create(C, "entry", F));
+    std::vector<llvm::Value *> Args;
+    for (unsigned i = 0; i < target.arg_size(); ++i)
+        Args.push_back(Builder.CreateLoad(Double, Builder.CreateConstInBoundsGEP1_64(Double, F->getArg(0), i)));
+    Builder.CreateRet(Builder.CreateCall(&target, Args));
+}
+
+std::string entry_name(uint32_t index) { return fmt::format("__tier_entry{}", index); }
+}// namespace
+
+TieredRuntime::TieredRuntime(std::vector<std::variant<ExprAST *, FnAST *>> &top_expressions, uint32_t threshold)
+    : module(load(top_expressions)), vm(module), native(module.functions.size())
+{
+    vm.profile(threshold, [this](uint32_t index) {
+        // Top-level expressions have no source to compile; their loops
+        // still count back edges, but they stay in the VM.
+        if (index >= sources.size() || !sources[index]) return;
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(index);
+        wake.notify_one();
+    });
+    worker = std::thread(&TieredRuntime::work, this);
+}
+
+TieredRuntime::~TieredRuntime()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    worker.join();
+}
+
+BytecodeModule TieredRuntime::load(std::vector<std::variant<ExprAST *, FnAST *>> &top_expressions)
+{
+    BytecodeModule compiled;
+    BytecodeCompiler bc(compiled);
+    for (auto &item : top_expressions)
+    {
+        auto **fn = std::get_if<FnAST *>(&item);
+        if (!fn || !*fn) continue;
+        auto *proto = (*fn)->getPrototype();
+        if (proto == *fn)
+        {
+            bc.declare(*proto);
+            externs[proto->getSymbol()] = proto;
+            continue;
+        }
+
+        auto &function = static_cast<FunctionAST &>(**fn);
+        auto index = compiled.functions.size();
+        bool ok = proto->getName() == "__anon_expr" ? bc.top_level(function) : bc.define(function);
+        all_compiled &= ok;
+        sources.resize(compiled.functions.size());
+        if (ok && proto->getName() != "__anon_expr") sources[index] = &function;
+    }
+    return compiled;
+}
+
+void TieredRuntime::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [&] { return queue.empty() && !busy; });
+}
+
+void TieredRuntime::work()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;)
+    {
+        wake.wait(lock, [&] { return stopping || !queue.empty(); });
+        if (stopping) return;
+        auto index = queue.front();
+        queue.pop_front();
+        busy = true;
+        lock.unlock();
+
+        if (!native[index] && !promote(index))
+            fmt::print(stderr, "Error: could not compile {}, it stays in the VM\n", module.functions[index].name);
+
+        lock.lock();
+        busy = false;
+        if (queue.empty()) idle.notify_all();
+    }
+}
+
+bool TieredRuntime::promote(uint32_t index)
+{
+    if (!jit && !jit_failed)
+    {
+        llvm::InitializeNativeTarget();
+        llvm::InitializeNativeTargetAsmPrinter();
+        auto created = ToyJIT::create(OptimizationLevel::O3);
+        if (auto *Error = std::get_if<std::string>(&created))
+        {
+            llvm::errs() << *Error << "\n";
+            jit_failed = true;
+        }
+        else
+            jit = std::move(std::get<0>(created));
+    }
+    if (!jit) return false;
+
+    // The function and everything it calls, found through the bytecode's
+    // calls, go into one module so the optimizer can inline across them.
+    std::vector<uint32_t> reachable{ index };
+    std::vector<char> seen(module.functions.size());
+    seen[index] = true;
+    for (std::size_t i = 0; i < reachable.size(); ++i)
+    {
+        for (auto &I : module.functions[reachable[i]].code)
+        {
+            if (I.op != Op::Call || seen[I.b]) continue;
+            seen[I.b] = true;
+            reachable.push_back(I.b);
+        }
+    }
+
+    CodeModule part;
+    part.FunctionProtos = externs;
+    SymbolMap<bool> defined;
+    for (auto i : reachable)
+    {
+        if (!sources[i]) return false;
+        auto *P = sources[i]->getPrototype();
+        // LLVM names functions by name, so the module can't hold two
+        // definitions of one, as when an earlier one was redefined.
+        if (defined[P->getSymbol()]) return false;
+        defined[P->getSymbol()] = true;
+        part.FunctionProtos[P->getSymbol()] = P;
+    }
+    for (auto i : reachable)
+    {
+        auto *F = sources[i]->codegen(part);
+        if (!F) return false;
+        emit_entry(part, *F, entry_name(i));
+    }
+
+    auto *JD = jit->createJITDylib(fmt::format("<tier {}>", index));
+    if (!JD || !jit->add(part, *JD)) return false;
+    for (auto i : reachable)
+    {
+        auto *fn = jit->lookup<VM::NativeFunction>(entry_name(i), JD);
+        if (!fn) return false;
+        if (native[i]) continue;
+        native[i] = true;
+        vm.promote(i, fn);
+        promoted_count.fetch_add(1, std::memory_order_relaxed);
+    }
+    return true;
+}
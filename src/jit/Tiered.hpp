@@ -0,0 +1,88 @@
+#ifndef __TIERED_H_
+#define __TIERED_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <variant>
+#include <vector>
+#include "../AST/AST.hpp"
+#include "../bytecode/BytecodeCompiler.hpp"
+#include "../bytecode/VM.hpp"
+#include "../codegen/codemodule.hpp"
+#include "ToyJIT.hpp"
+
+/// TieredRuntime - Runs a program in the bytecode VM and moves its hot
+/// functions to native code. The VM counts each function's calls and loop
+/// back edges; a function whose count reaches the threshold is queued for a
+/// background thread, which generates it from its AST together with every
+/// function it calls, compiles that at -O3 in its own JITDylib, and swaps it
+/// in. Calls made after the swap run the native code; a call already running
+/// finishes in the VM.
+///
+/// The JIT is only set up when the first function gets hot, so programs that
+/// never get hot start as fast as --vm.
+class TieredRuntime
+{
+    // The definition each bytecode function was compiled from, nullptr for
+    // top level expressions, and the externs the program declares.
+    std::vector<FunctionAST *> sources;
+    SymbolMap<PrototypeAST *> externs;
+    bool all_compiled = true;
+    BytecodeModule module;
+    VM vm;
+
+    // Only touched by the worker thread: the JIT, and which functions it has
+    // promoted.
+    std::vector<char> native;
+    std::unique_ptr<ToyJIT> jit;
+    bool jit_failed = false;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    std::deque<uint32_t> queue;
+    bool busy = false;
+    bool stopping = false;
+    std::atomic<unsigned> promoted_count{ 0 };
+    std::thread worker;
+
+    TieredRuntime(std::vector<std::variant<ExprAST *, FnAST *>> &top_expressions, uint32_t threshold);
+    /// load - Compile top_expressions to bytecode, noting where each function
+    /// came from.
+    BytecodeModule load(std::vector<std::variant<ExprAST *, FnAST *>> &top_expressions);
+
+    void work();
+    /// promote - Compile function index and its callees and swap them in.
+    /// Returns false, after printing why, if it couldn't.
+    bool promote(uint32_t index);
+
+  public:
+    /// create - A runtime for a parsed program, which must outlive it.
+    /// Functions are promoted once called or looped threshold times.
+    static std::unique_ptr<TieredRuntime> create(std::vector<std::variant<ExprAST *, FnAST *>> &top_expressions,
+        uint32_t threshold)
+    {
+        return std::unique_ptr<TieredRuntime>(new TieredRuntime(top_expressions, threshold));
+    }
+    /// ~TieredRuntime - Waits for a compile in progress; queued ones are
+    /// dropped.
+    ~TieredRuntime();
+
+    /// compiled - Whether all of the program compiled to bytecode.
+    bool compiled() const { return all_compiled; }
+    /// promoted - Functions running as native code so far.
+    unsigned promoted() const { return promoted_count.load(std::memory_order_relaxed); }
+    /// wait - Block until every function queued so far is compiled.
+    void wait();
+
+    /// run - Run the top level expressions in order, passing their values to
+    /// on_result. Returns false if any of them failed.
+    template<typename OnResult> bool run(OnResult on_result) { return vm_run(module, vm, on_result); }
+};
+
+#endif// __TIERED_H_
@@ -0,0 +1,318 @@
+#ifndef __TOYJIT_H_
+#define __TOYJIT_H_
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <variant>
+#include <vector>
+#include "llvm/Config/llvm-config.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/IndirectionUtils.h"
+#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/LazyReexports.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/raw_ostream.h"
+#include "../AST/AST.hpp"
+#include "../codegen/codemodule.hpp"
+#include "../codegen/optimizer.hpp"
+
+/// ToyJIT - Compiles CodeModules in process with ORC's LLJIT so their
+/// functions can be called right away. Symbols a module doesn't define are
+/// looked up in the JIT first and then in the host process, so externs bind
+/// to the runtime functions (printd, putchard) and the C library.
+///
+/// A lazy ToyJIT can also take function definitions as ASTs: callers get a
+/// stub, and the function is generated and compiled on its first call.
+class ToyJIT
+{
+    std::unique_ptr<llvm::TargetMachine> TheTargetMachine;
+    std::unique_ptr<llvm::orc::LLJIT> TheJIT;
+    // Only for lazy JITs. Declared after TheJIT so they go first: the call
+    // through manager holds symbol names interned in TheJIT's session.
+    std::unique_ptr<llvm::orc::LazyCallThroughManager> CallThrough;
+    std::unique_ptr<llvm::orc::IndirectStubsManager> Stubs;
+    // Where lazy function bodies are defined; the main JITDylib holds the
+    // stubs everybody else calls.
+    llvm::orc::JITDylib *Bodies = nullptr;
+
+    ToyJIT(std::unique_ptr<llvm::TargetMachine> TM, std::unique_ptr<llvm::orc::LLJIT> JIT)
+        : TheTargetMachine(std::move(TM)), TheJIT(std::move(JIT))
+    {}
+
+    /// lazy_compile_failed - Where a stub goes if its function can't be
+    /// generated or compiled; codegen has already said why.
+    static void lazy_compile_failed()
+    {
+        std::fputs("Lazy compilation failed, exiting\n", stderr);
+        std::exit(1);
+    }
+
+    /// make_lazy - Set up the stubs and the JITDylib for lazy functions.
+    llvm::Error make_lazy()
+    {
+        auto &ES = TheJIT->getExecutionSession();
+#if LLVM_VERSION_MAJOR >= 15
+        auto ErrorHandler = llvm::orc::ExecutorAddr::fromPtr(&lazy_compile_failed);
+#else
+        auto ErrorHandler = llvm::pointerToJITTargetAddress(&lazy_compile_failed);
+#endif
+        auto LCTM = llvm::orc::createLocalLazyCallThroughManager(TheJIT->getTargetTriple(), ES, ErrorHandler);
+        if (!LCTM) return LCTM.takeError();
+        CallThrough = std::move(*LCTM);
+        Stubs = llvm::orc::createLocalIndirectStubsManagerBuilder(TheJIT->getTargetTriple())();
+
+        auto JD = TheJIT->createJITDylib("<lazy bodies>");
+        if (!JD) return JD.takeError();
+        Bodies = &*JD;
+        // A body's calls go through the stubs too, so compiling one function
+        // never pulls in the functions it calls.
+        Bodies->setLinkOrder({ { &TheJIT->getMainJITDylib(), llvm::orc::JITDylibLookupFlags::MatchExportedSymbolsOnly } }, false);
+        return llvm::Error::success();
+    }
+
+  public:
+    /// create - A JIT for the host, lazy if asked for. Modules are optimized
+    /// at level when they are compiled, that is when one of their functions
+    /// is first looked up or called.
+    static std::variant<std::unique_ptr<ToyJIT>, std::string> create(OptimizationLevel level, bool lazy = false)
+    {
+        auto JTMB = llvm::orc::JITTargetMachineBuilder::detectHost();
+        if (!JTMB) return llvm::toString(JTMB.takeError());
+        JTMB->setCodeGenOptLevel(codegen_opt_level(level));
+
+        // The optimizer gets its own TargetMachine, the JIT builds the one it
+        // compiles with from JTMB. The JIT compiles on the calling thread, so
+        // the transform never runs concurrently.
+        auto TM = JTMB->createTargetMachine();
+        if (!TM) return llvm::toString(TM.takeError());
+
+        auto JIT = llvm::orc::LLJITBuilder().setJITTargetMachineBuilder(std::move(*JTMB)).create();
+        if (!JIT) return llvm::toString(JIT.takeError());
+
+        auto Host = llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+            (*JIT)->getDataLayout().getGlobalPrefix());
+        if (!Host) return llvm::toString(Host.takeError());
+        (*JIT)->getMainJITDylib().addGenerator(std::move(*Host));
+
+        (*JIT)->getIRTransformLayer().setTransform(
+            [OptTM = TM->get(), level](llvm::orc::ThreadSafeModule TSM, const llvm::orc::MaterializationResponsibility &) {
+                TSM.withModuleDo([&](llvm::Module &module) { optimize(module, *OptTM, level); });
+                return llvm::Expected<llvm::orc::ThreadSafeModule>(std::move(TSM));
+            });
+
+        auto TheJIT = std::unique_ptr<ToyJIT>(new ToyJIT(std::move(*TM), std::move(*JIT)));
+        if (lazy)
+        {
+            if (auto Err = TheJIT->make_lazy()) return llvm::toString(std::move(Err));
+        }
+        return TheJIT;
+    }
+
+    bool lazy() const { return Bodies != nullptr; }
+
+    /// add - Hand code_module's module, with its context, to the JIT;
+    /// code_module can't be used for codegen afterwards. With a tracker the
+    /// code can be removed again through it. Returns false, after printing
+    /// why, if the JIT refused the module.
+    bool add(CodeModule &code_module, llvm::orc::ResourceTrackerSP tracker = nullptr)
+    {
+        auto &module = *code_module.TheModule;
+        module.setDataLayout(TheJIT->getDataLayout());
+        module.setTargetTriple(TheTargetMachine->getTargetTriple().str());
+
+        llvm::orc::ThreadSafeModule TSM(std::move(code_module.TheModule), std::move(code_module.TheContext));
+        auto Err = tracker ? TheJIT->addIRModule(std::move(tracker), std::move(TSM))
+                           : TheJIT->addIRModule(std::move(TSM));
+        if (Err)
+        {
+            llvm::errs() << llvm::toString(std::move(Err)) << "\n";
+            return false;
+        }
+        return true;
+    }
+
+    /// emit - Compile code_module to fulfil R, i.e. define the symbols R is
+    /// responsible for; see LazyFunction.
+    void emit(std::unique_ptr<llvm::orc::MaterializationResponsibility> R, CodeModule &code_module)
+    {
+        code_module.TheModule->setDataLayout(TheJIT->getDataLayout());
+        code_module.TheModule->setTargetTriple(TheTargetMachine->getTargetTriple().str());
+        TheJIT->getIRTransformLayer().emit(std::move(R),
+            llvm::orc::ThreadSafeModule(std::move(code_module.TheModule), std::move(code_module.TheContext)));
+    }
+
+    /// addLazy - Define fn behind a stub, to be generated from its AST with
+    /// the prototypes in protos the first time it is called. Returns false,
+    /// after printing why, if fn can't be defined. Only for lazy JITs.
+    bool addLazy(FnAST &fn, std::shared_ptr<const SymbolMap<PrototypeAST *>> protos);
+
+    /// add - Like add above, but into JD instead of the main JITDylib.
+    bool add(CodeModule &code_module, llvm::orc::JITDylib &JD)
+    {
+        auto &module = *code_module.TheModule;
+        module.setDataLayout(TheJIT->getDataLayout());
+        module.setTargetTriple(TheTargetMachine->getTargetTriple().str());
+
+        llvm::orc::ThreadSafeModule TSM(std::move(code_module.TheModule), std::move(code_module.TheContext));
+        if (auto Err = TheJIT->addIRModule(JD, std::move(TSM)))
+        {
+            llvm::errs() << llvm::toString(std::move(Err)) << "\n";
+            return false;
+        }
+        return true;
+    }
+
+    /// createJITDylib - A new JITDylib whose symbols shadow the main
+    /// JITDylib's, so the same names can be defined again in it. Returns
+    /// nullptr, after printing why, if it can't be created.
+    llvm::orc::JITDylib *createJITDylib(const std::string &name)
+    {
+        auto JD = TheJIT->createJITDylib(name);
+        if (!JD)
+        {
+            llvm::errs() << llvm::toString(JD.takeError()) << "\n";
+            return nullptr;
+        }
+        JD->setLinkOrder({ { &TheJIT->getMainJITDylib(), llvm::orc::JITDylibLookupFlags::MatchExportedSymbolsOnly } });
+        return &*JD;
+    }
+
+    /// lookup - Address of the function name, by default nullary and in the
+    /// main JITDylib, compiling it and whatever it needs first. Returns
+    /// nullptr, after printing why, if it can't be found or compiled.
+    template<typename Fn = double (*)()> Fn lookup(llvm::StringRef name, llvm::orc::JITDylib *JD = nullptr)
+    {
+        auto Sym = JD ? TheJIT->lookup(*JD, name) : TheJIT->lookup(name);
+        if (!Sym)
+        {
+            llvm::errs() << llvm::toString(Sym.takeError()) << "\n";
+            return nullptr;
+        }
+#if LLVM_VERSION_MAJOR >= 15
+        return Sym->toPtr<Fn>();
+#else
+        return reinterpret_cast<Fn>(Sym->getAddress());
+#endif
+    }
+
+    llvm::orc::ResourceTrackerSP createResourceTracker() { return TheJIT->getMainJITDylib().createResourceTracker(); }
+};
+
+/// LazyFunction - One function definition, generated into its own module and
+/// compiled when the JIT first needs its body. protos is shared with the
+/// caller of addLazy and read at that point.
+class LazyFunction : public llvm::orc::MaterializationUnit
+{
+    ToyJIT &jit;
+    FnAST &fn;
+    std::shared_ptr<const SymbolMap<PrototypeAST *>> protos;
+
+  public:
+    LazyFunction(ToyJIT &TheJIT,
+        FnAST &function,
+        std::shared_ptr<const SymbolMap<PrototypeAST *>> known,
+        llvm::orc::SymbolFlagsMap symbol)
+#if LLVM_VERSION_MAJOR >= 14
+        : MaterializationUnit(Interface(std::move(symbol), nullptr)),
+#else
+        : MaterializationUnit(std::move(symbol), nullptr),
+#endif
+          jit(TheJIT), fn(function), protos(std::move(known))
+    {}
+
+    llvm::StringRef getName() const override { return "LazyFunction"; }
+
+    void materialize(std::unique_ptr<llvm::orc::MaterializationResponsibility> R) override
+    {
+        CodeModule part;
+        part.FunctionProtos = *protos;
+        if (!fn.codegen(part))
+        {
+            R->failMaterialization();
+            return;
+        }
+        jit.emit(std::move(R), part);
+    }
+
+    void discard(const llvm::orc::JITDylib &, const llvm::orc::SymbolStringPtr &) override {}
+};
+
+inline bool ToyJIT::addLazy(FnAST &fn, std::shared_ptr<const SymbolMap<PrototypeAST *>> protos)
+{
+    auto Name = TheJIT->mangleAndIntern(getSymbolName(fn.getPrototype()->getSymbol()));
+    auto Flags = llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable;
+
+    auto Err = Bodies->define(
+        std::make_unique<LazyFunction>(*this, fn, std::move(protos), llvm::orc::SymbolFlagsMap{ { Name, Flags } }));
+    if (!Err)
+        Err = TheJIT->getMainJITDylib().define(llvm::orc::lazyReexports(
+            *CallThrough, *Stubs, *Bodies, llvm::orc::SymbolAliasMap{ { Name, llvm::orc::SymbolAliasMapEntry(Name, Flags) } }));
+    if (Err)
+    {
+        llvm::errs() << llvm::toString(std::move(Err)) << "\n";
+        return false;
+    }
+    return true;
+}
+
+/// jit_run - Evaluate a program in order: definitions and externs are added
+/// to jit as they come, each top level expression is compiled on its own,
+/// called, passed to on_result and then removed again, so every one of them
+/// can be named __anon_expr. Definitions after the last expression are never
+/// called and not added. A lazy jit gets the definitions as ASTs instead;
+/// they see every prototype known when they are first called. Returns false
+/// if the JIT failed.
+template<typename OnResult>
+bool jit_run(std::vector<std::variant<ExprAST *, FnAST *>> &top_expressions, ToyJIT &jit, OnResult on_result)
+{
+    // Every prototype seen so far, so each new module can declare the
+    // functions earlier modules define.
+    auto protos = std::make_shared<SymbolMap<PrototypeAST *>>();
+    auto pending = std::make_unique<CodeModule>();
+
+    auto flush = [&] {
+        auto &module = *pending->TheModule;
+        bool defines = std::any_of(module.begin(), module.end(), [](auto &F) { return !F.isDeclaration(); });
+        bool added = !defines || jit.add(*pending);
+        pending = std::make_unique<CodeModule>();
+        pending->FunctionProtos = *protos;
+        return added;
+    };
+
+    for (auto &item : top_expressions)
+    {
+        auto **fn = std::get_if<FnAST *>(&item);
+        if (!fn || !*fn) continue;
+        auto *proto = (*fn)->getPrototype();
+
+        if (proto->getName() != "__anon_expr")
+        {
+            (*protos)[proto->getSymbol()] = proto;
+            if (!jit.lazy() || proto == *fn)
+                (*fn)->codegen(*pending);
+            else if (!jit.addLazy(**fn, protos))
+                return false;
+            continue;
+        }
+
+        if (!flush()) return false;
+        CodeModule expr;
+        expr.FunctionProtos = *protos;
+        if (!(*fn)->codegen(expr)) continue;
+
+        auto tracker = jit.createResourceTracker();
+        if (!jit.add(expr, tracker)) return false;
+        auto *Fn = jit.lookup("__anon_expr");
+        if (!Fn) return false;
+        on_result(Fn());
+        if (auto Err = tracker->remove()) llvm::errs() << llvm::toString(std::move(Err)) << "\n";
+    }
+    return true;
+}
+
+#endif// __TOYJIT_H_
@@ -0,0 +1,231 @@
+#ifndef __NATIVELEXER_H_
+#define __NATIVELEXER_H_
+#include "token.hpp"
+#include "SimdScan.hpp"
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+/// Hand-written replacement for the Flex scanner in tokens.l. Every decision is
+/// a table lookup on the current byte: start_states picks which sub-scanner
+/// handles a token, char_classes drives the loops inside it, and keywords are
+/// recognised by a perfect hash instead of extra DFA states. The long runs
+/// (whitespace, identifiers, comment bodies) go through the SimdScan kernels.
+namespace native_lexer {
+
+enum char_class : uint8_t {
+    cc_space = 1 << 0,
+    cc_ident = 1 << 1,
+    cc_digit = 1 << 2,
+};
+
+constexpr std::size_t byte(char c) { return static_cast<unsigned char>(c); }
+
+enum start_state : uint8_t {
+    st_invalid,
+    st_space,
+    st_ident,
+    st_number,
+    st_slash,// '/' or the start of a block comment
+    st_hash,// line comment
+    st_op,// single character binop
+    st_op_eq,// may be followed by '=' to form a two character operator
+    st_punct,// ( ) [ ] , ;
+};
+
+constexpr std::array<uint8_t, 256> make_char_classes()
+{
+    std::array<uint8_t, 256> table{};
+    for (char c : std::string_view(" \t\n\r")) table[byte(c)] |= cc_space;
+    for (char c = 'a'; c <= 'z'; ++c) table[byte(c)] |= cc_ident;
+    for (char c = 'A'; c <= 'Z'; ++c) table[byte(c)] |= cc_ident;
+    for (char c = '0'; c <= '9'; ++c) table[byte(c)] |= cc_ident | cc_digit;
+    table[byte('_')] |= cc_ident;
+    return table;
+}
+inline constexpr auto char_classes = make_char_classes();
+
+constexpr std::array<uint8_t, 256> make_start_states()
+{
+    constexpr auto classes = make_char_classes();
+    std::array<uint8_t, 256> table{};
+    for (std::size_t c = 0; c < 256; ++c)
+    {
+        if (classes[c] & cc_space) table[c] = st_space;
+        else if (classes[c] & cc_digit)
+            table[c] = st_number;
+        else if (classes[c] & cc_ident)
+            table[c] = st_ident;
+    }
+    table[byte('/')] = st_slash;
+    table[byte('#')] = st_hash;
+    for (char c : std::string_view("*+-")) table[byte(c)] = st_op;
+    for (char c : std::string_view("=!<>")) table[byte(c)] = st_op_eq;
+    for (char c : std::string_view("()[],;")) table[byte(c)] = st_punct;
+    return table;
+}
+inline constexpr auto start_states = make_start_states();
+
+constexpr std::array<token_t, 256> make_punct_tokens()
+{
+    std::array<token_t, 256> table{};
+    table[byte('(')] = tok_leftbracket;
+    table[byte(')')] = tok_rightbracket;
+    table[byte('[')] = tok_leftsquare;
+    table[byte(']')] = tok_rightsquare;
+    table[byte(',')] = tok_comma;
+    table[byte(';')] = tok_semi;
+    return table;
+}
+inline constexpr auto punct_tokens = make_punct_tokens();
+
+struct keyword
+{
+    std::string_view text;
+    token_t type = tok_identifier;
+};
+
+inline constexpr std::array<keyword, 10> keywords{ { { "binary", tok_binary },
+    { "unary", tok_unary },
+    { "for", tok_for },
+    { "in", tok_in },
+    { "extern", tok_extern },
+    { "if", tok_if },
+    { "then", tok_then },
+    { "else", tok_else },
+    { "def", tok_def },
+    { "var", tok_var } } };
+
+constexpr unsigned keyword_hash(std::string_view s)
+{
+    return (static_cast<unsigned>(s.size()) * 2 + static_cast<unsigned char>(s.front())
+               + static_cast<unsigned char>(s.back()))
+           & 31;
+}
+
+constexpr std::array<keyword, 32> make_keyword_table()
+{
+    std::array<keyword, 32> table{};
+    for (auto &k : keywords) table[keyword_hash(k.text)] = k;
+    return table;
+}
+inline constexpr auto keyword_table = make_keyword_table();
+
+constexpr bool keyword_hash_is_perfect()
+{
+    for (auto &k : keywords)
+        if (keyword_table[keyword_hash(k.text)].text != k.text) return false;
+    return true;
+}
+static_assert(keyword_hash_is_perfect(), "keyword_hash collides, adjust its multipliers");
+
+constexpr token_t classify_identifier(std::string_view s)
+{
+    const auto &k = keyword_table[keyword_hash(s)];
+    return k.text == s ? k.type : tok_identifier;
+}
+
+inline bool is(char c, char_class cc) { return char_classes[byte(c)] & cc; }
+
+}// namespace native_lexer
+
+/// NativeScanner - Pulls tokens one at a time out of an in-memory buffer. Token
+/// text is a view into that buffer. Input the rules in tokens.l don't cover
+/// ends the stream, just like the catch-all yyterminate() rule.
+///
+/// A buffer that isn't final is one chunk of a longer stream. A token (or
+/// comment) that runs into the end of such a chunk might continue in the next,
+/// so next() backs up to its start and reports needs_more() instead; the
+/// caller appends more input and rescans from position().
+class NativeScanner
+{
+    std::string_view source;
+    std::size_t pos = 0;
+    bool final = true;
+    bool more = false;
+
+    token make_token(token_t type, const char *start, const char *stop)
+    {
+        auto offset = static_cast<std::size_t>(start - source.data());
+        pos = static_cast<std::size_t>(stop - source.data());
+        std::string_view text(start, static_cast<std::size_t>(stop - start));
+        return token(type, text, offset, type == tok_number ? parse_number(text) : std::nullopt);
+    }
+
+    token need_more(const char *start)
+    {
+        pos = static_cast<std::size_t>(start - source.data());
+        more = true;
+        return token(tok_eof, {}, pos, std::nullopt);
+    }
+
+  public:
+    explicit NativeScanner(std::string_view _source, bool _final = true) : source(_source), final(_final) {}
+
+    bool needs_more() const { return more; }
+    std::size_t position() const { return pos; }
+
+    token next()
+    {
+        using namespace native_lexer;
+        const char *p = source.data() + pos;
+        const char *end = source.data() + source.size();
+        more = false;
+        while (p != end)
+        {
+            switch (start_states[byte(*p)])
+            {
+            case st_space:
+                p = simd_scan::skip_space(p + 1, end);
+                continue;
+            case st_hash: {
+                auto *nl = static_cast<const char *>(std::memchr(p, '\n', static_cast<std::size_t>(end - p)));
+                if (!nl && !final) return need_more(p);
+                p = nl ? nl + 1 : end;
+                continue;
+            }
+            case st_slash:
+                if (p + 1 == end && !final) return need_more(p);
+                if (p + 1 != end && p[1] == '*')
+                {
+                    auto *close = simd_scan::find_comment_end(p + 2, end);
+                    if (close == end && !final) return need_more(p);
+                    p = close == end ? end : close + 2;
+                    continue;
+                }
+                return make_token(tok_binop, p, p + 1);
+            case st_ident: {
+                const char *start = p;
+                p = simd_scan::skip_ident(p + 1, end);
+                if (p == end && !final) return need_more(start);
+                return make_token(classify_identifier({ start, static_cast<std::size_t>(p - start) }), start, p);
+            }
+            case st_number: {
+                const char *start = p++;
+                while (p != end && is(*p, cc_digit)) ++p;
+                if (p != end && *p == '.')
+                    for (++p; p != end && is(*p, cc_digit);) ++p;
+                if (p == end && !final) return need_more(start);
+                return make_token(tok_number, start, p);
+            }
+            case st_op_eq:
+                if (p + 1 == end && !final) return need_more(p);
+                if (p + 1 != end && p[1] == '=') return make_token(tok_binop, p, p + 2);
+                return make_token(*p == '=' ? tok_equal : tok_binop, p, p + 1);
+            case st_op:
+                return make_token(tok_binop, p, p + 1);
+            case st_punct:
+                return make_token(punct_tokens[byte(*p)], p, p + 1);
+            default:
+                pos = source.size();
+                return token(tok_eof, {}, pos, std::nullopt);
+            }
+        }
+        if (!final) return need_more(p);
+        pos = source.size();
+        return token(tok_eof, {}, pos, std::nullopt);
+    }
+};
+
+#endif// __NATIVELEXER_H_
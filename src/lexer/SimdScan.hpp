@@ -0,0 +1,223 @@
+#ifndef __SIMDSCAN_H_
+#define __SIMDSCAN_H_
+#include <cstring>
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define TOY_SIMD_X86 1
+#endif
+
+/// Run-skipping kernels for NativeScanner's inner loops: whitespace, identifier
+/// characters and the body of a block comment. Each returns the first byte at
+/// or after p that ends the run (or end). The SSE2 and AVX2 versions test 16 or
+/// 32 bytes per step and finish the last partial block with the scalar code;
+/// which set is used is decided once at runtime from the host CPU.
+namespace simd_scan {
+
+using kernel_fn = const char *(*)(const char *p, const char *end);
+
+struct kernels
+{
+    const char *name;
+    kernel_fn skip_space;
+    kernel_fn skip_ident;
+    kernel_fn find_comment_end;// returns the '*' of the closing "*/"
+};
+
+namespace scalar {
+    inline bool is_space(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+    inline bool is_ident(char c)
+    {
+        auto lower = static_cast<unsigned char>(c | 0x20);
+        return (lower >= 'a' && lower <= 'z') || (c >= '0' && c <= '9') || c == '_';
+    }
+
+    inline const char *skip_space(const char *p, const char *end)
+    {
+        while (p != end && is_space(*p)) ++p;
+        return p;
+    }
+    inline const char *skip_ident(const char *p, const char *end)
+    {
+        while (p != end && is_ident(*p)) ++p;
+        return p;
+    }
+    inline const char *find_comment_end(const char *p, const char *end)
+    {
+        while (p != end)
+        {
+            auto *star = static_cast<const char *>(std::memchr(p, '*', static_cast<std::size_t>(end - p)));
+            if (!star || star + 1 == end) return end;
+            if (star[1] == '/') return star;
+            p = star + 1;
+        }
+        return end;
+    }
+
+    inline const kernels table{ "scalar", skip_space, skip_ident, find_comment_end };
+}// namespace scalar
+
+#ifdef TOY_SIMD_X86
+/// Bit i of the returned masks is set when byte i belongs to the class. The
+/// range tests use the unsigned "min(x - lo, hi - lo) == x - lo" idiom since
+/// SSE2 only has signed byte compares.
+namespace sse2 {
+    __attribute__((target("sse2"))) inline unsigned space_mask(__m128i v)
+    {
+        auto m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+        return static_cast<unsigned>(_mm_movemask_epi8(m));
+    }
+    __attribute__((target("sse2"))) inline __m128i in_range(__m128i v, char lo, char hi)
+    {
+        auto t = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+        return _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(static_cast<char>(hi - lo))), t);
+    }
+    __attribute__((target("sse2"))) inline unsigned ident_mask(__m128i v)
+    {
+        auto lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+        auto m = _mm_or_si128(_mm_or_si128(in_range(lower, 'a', 'z'), in_range(v, '0', '9')),
+            _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+        return static_cast<unsigned>(_mm_movemask_epi8(m));
+    }
+
+    __attribute__((target("sse2"))) inline const char *skip_space(const char *p, const char *end)
+    {
+        for (; end - p >= 16; p += 16)
+        {
+            auto stop = ~space_mask(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p))) & 0xffffu;
+            if (stop) return p + __builtin_ctz(stop);
+        }
+        return scalar::skip_space(p, end);
+    }
+    __attribute__((target("sse2"))) inline const char *skip_ident(const char *p, const char *end)
+    {
+        for (; end - p >= 16; p += 16)
+        {
+            auto stop = ~ident_mask(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p))) & 0xffffu;
+            if (stop) return p + __builtin_ctz(stop);
+        }
+        return scalar::skip_ident(p, end);
+    }
+    __attribute__((target("sse2"))) inline const char *find_comment_end(const char *p, const char *end)
+    {
+        // Compare each block against '*' and against '/' one byte further on,
+        // so a "*/" straddling two blocks is still found.
+        for (; end - p >= 17; p += 16)
+        {
+            auto star = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)), _mm_set1_epi8('*'));
+            auto slash =
+                _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 1)), _mm_set1_epi8('/'));
+            if (auto hit = static_cast<unsigned>(_mm_movemask_epi8(_mm_and_si128(star, slash))))
+                return p + __builtin_ctz(hit);
+        }
+        return scalar::find_comment_end(p, end);
+    }
+
+    inline const kernels table{ "sse2", skip_space, skip_ident, find_comment_end };
+}// namespace sse2
+
+namespace avx2 {
+    __attribute__((target("avx2"))) inline unsigned space_mask(__m256i v)
+    {
+        auto m = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))));
+        return static_cast<unsigned>(_mm256_movemask_epi8(m));
+    }
+    __attribute__((target("avx2"))) inline __m256i in_range(__m256i v, char lo, char hi)
+    {
+        auto t = _mm256_sub_epi8(v, _mm256_set1_epi8(lo));
+        return _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(static_cast<char>(hi - lo))), t);
+    }
+    __attribute__((target("avx2"))) inline unsigned ident_mask(__m256i v)
+    {
+        auto lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+        auto m = _mm256_or_si256(_mm256_or_si256(in_range(lower, 'a', 'z'), in_range(v, '0', '9')),
+            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+        return static_cast<unsigned>(_mm256_movemask_epi8(m));
+    }
+
+    __attribute__((target("avx2"))) inline const char *skip_space(const char *p, const char *end)
+    {
+        // Most runs end within a few bytes, so probe 16 first and only
+        // switch to 32 byte blocks once the run is known to be long.
+        if (end - p >= 16)
+        {
+            auto stop = ~sse2::space_mask(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p))) & 0xffffu;
+            if (stop) return p + __builtin_ctz(stop);
+            p += 16;
+        }
+        for (; end - p >= 32; p += 32)
+        {
+            auto stop = ~space_mask(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p)));
+            if (stop) return p + __builtin_ctz(stop);
+        }
+        return sse2::skip_space(p, end);
+    }
+    __attribute__((target("avx2"))) inline const char *skip_ident(const char *p, const char *end)
+    {
+        if (end - p >= 16)
+        {
+            auto stop = ~sse2::ident_mask(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p))) & 0xffffu;
+            if (stop) return p + __builtin_ctz(stop);
+            p += 16;
+        }
+        for (; end - p >= 32; p += 32)
+        {
+            auto stop = ~ident_mask(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p)));
+            if (stop) return p + __builtin_ctz(stop);
+        }
+        return sse2::skip_ident(p, end);
+    }
+    __attribute__((target("avx2"))) inline const char *find_comment_end(const char *p, const char *end)
+    {
+        for (; end - p >= 33; p += 32)
+        {
+            auto star =
+                _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p)), _mm256_set1_epi8('*'));
+            auto slash =
+                _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 1)), _mm256_set1_epi8('/'));
+            if (auto hit = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_and_si256(star, slash))))
+                return p + __builtin_ctz(hit);
+        }
+        return sse2::find_comment_end(p, end);
+    }
+
+    inline const kernels table{ "avx2", skip_space, skip_ident, find_comment_end };
+}// namespace avx2
+#endif
+
+/// select - Best kernel set the host CPU supports.
+inline const kernels &select()
+{
+#ifdef TOY_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return avx2::table;
+    if (__builtin_cpu_supports("sse2")) return sse2::table;
+#endif
+    return scalar::table;
+}
+
+inline const kernels &active()
+{
+    static const kernels &k = select();
+    return k;
+}
+
+// Most runs are a single byte (one space between tokens, one letter names),
+// so the first byte is checked inline before paying for the indirect call.
+inline const char *skip_space(const char *p, const char *end)
+{
+    if (p == end || !scalar::is_space(*p)) return p;
+    return active().skip_space(p + 1, end);
+}
+inline const char *skip_ident(const char *p, const char *end)
+{
+    if (p == end || !scalar::is_ident(*p)) return p;
+    return active().skip_ident(p + 1, end);
+}
+inline const char *find_comment_end(const char *p, const char *end) { return active().find_comment_end(p, end); }
+
+}// namespace simd_scan
+
+#endif// __SIMDSCAN_H_
@@ -0,0 +1,119 @@
+#ifndef __SOURCEBUFFER_H_
+#define __SOURCEBUFFER_H_
+#include <algorithm>
+#include <fstream>
+#include <istream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+#include <fmt/format.h>
+#if __has_include(<sys/mman.h>)
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define TOY_HAVE_MMAP 1
+#endif
+
+/// SourceBuffer - The complete text of one source file. Regular files are
+/// memory-mapped read-only so tokens can be handed out as slices of the
+/// mapping; streams and anything else that can't be mapped are read into an
+/// owned buffer instead. Either way view() stays valid until the buffer dies.
+class SourceBuffer
+{
+    const char *mapped = nullptr;
+    std::size_t mapped_size = 0;
+    std::vector<char> owned;
+
+    void release()
+    {
+#ifdef TOY_HAVE_MMAP
+        if (mapped) munmap(const_cast<char *>(mapped), mapped_size);
+#endif
+        mapped = nullptr;
+        mapped_size = 0;
+    }
+
+  public:
+    SourceBuffer() = default;
+    SourceBuffer(const SourceBuffer &) = delete;
+    SourceBuffer &operator=(const SourceBuffer &) = delete;
+    SourceBuffer(SourceBuffer &&other) noexcept
+        : mapped(std::exchange(other.mapped, nullptr)), mapped_size(std::exchange(other.mapped_size, 0)),
+          owned(std::move(other.owned))
+    {}
+    SourceBuffer &operator=(SourceBuffer &&other) noexcept
+    {
+        if (this != &other)
+        {
+            release();
+            mapped = std::exchange(other.mapped, nullptr);
+            mapped_size = std::exchange(other.mapped_size, 0);
+            owned = std::move(other.owned);
+        }
+        return *this;
+    }
+    ~SourceBuffer() { release(); }
+
+    /// from_stream - Read everything left in is into an owned buffer.
+    static SourceBuffer from_stream(std::istream &is)
+    {
+        SourceBuffer buf;
+        buf.owned.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+        return buf;
+    }
+
+    /// map_file - Map filename into memory, falling back to reading it when it
+    /// isn't a regular file (pipes, /dev/stdin) or mmap isn't available.
+    static std::variant<SourceBuffer, std::string> map_file(const std::string &filename)
+    {
+#ifdef TOY_HAVE_MMAP
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) return fmt::format("Could not open {}: {}\n", filename, std::strerror(errno));
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+        {
+            auto size = static_cast<std::size_t>(st.st_size);
+            void *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if (addr == MAP_FAILED) return fmt::format("Could not map {}: {}\n", filename, std::strerror(errno));
+            madvise(addr, size, MADV_SEQUENTIAL);
+
+            SourceBuffer buf;
+            buf.mapped = static_cast<const char *>(addr);
+            buf.mapped_size = size;
+            return buf;
+        }
+        close(fd);
+#endif
+        std::ifstream is(filename, std::ios::binary);
+        if (!is) return fmt::format("Could not open {}\n", filename);
+        return from_stream(is);
+    }
+
+    std::string_view view() const
+    {
+        if (mapped) return { mapped, mapped_size };
+        return { owned.data(), owned.size() };
+    }
+    bool is_mapped() const { return mapped != nullptr; }
+};
+
+/// read_available - Read at most n bytes from is, waiting only until the first
+/// byte arrives, so a reader on a pipe sees data as soon as it is written.
+/// Returns 0 at end of stream.
+inline std::size_t read_available(std::istream &is, char *dst, std::size_t n)
+{
+    auto *buf = is.rdbuf();
+    if (n == 0 || buf->sgetc() == std::char_traits<char>::eof()) return 0;
+    auto avail = std::max<std::streamsize>(buf->in_avail(), 1);
+    return static_cast<std::size_t>(buf->sgetn(dst, std::min(avail, static_cast<std::streamsize>(n))));
+}
+
+#endif// __SOURCEBUFFER_H_
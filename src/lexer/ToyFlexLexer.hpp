@@ -0,0 +1,43 @@
+#ifndef __TOYFLEXLEXER_H_
+#define __TOYFLEXLEXER_H_
+// The scanner flex generates from tokens.l has already pulled in FlexLexer.h,
+// which can't be included twice.
+#ifndef yyFlexLexerOnce
+#include <FlexLexer.h>
+#endif
+#include "SourceBuffer.hpp"
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+
+/// ToyFlexLexer - Flex scanner fed straight from an in-memory source buffer,
+/// or from a stream a chunk at a time. The YY_USER_ACTION in tokens.l
+/// advances source_offset over every match, so after yylex() returns,
+/// token_offset is the position of YYText() in the input.
+class ToyFlexLexer : public yyFlexLexer
+{
+    std::string_view source;
+    std::size_t read_pos = 0;
+    std::istream *stream = nullptr;
+
+  public:
+    std::size_t source_offset = 0;
+    std::size_t token_offset = 0;
+
+    explicit ToyFlexLexer(std::string_view _source) : source(_source) {}
+    explicit ToyFlexLexer(std::istream &is) : stream(&is) {}
+
+    int yylex() override;
+
+  protected:
+    int LexerInput(char *buf, int max_size) override
+    {
+        if (stream) return static_cast<int>(read_available(*stream, buf, static_cast<std::size_t>(max_size)));
+        auto n = std::min(source.size() - read_pos, static_cast<std::size_t>(max_size));
+        std::memcpy(buf, source.data() + read_pos, n);
+        read_pos += n;
+        return static_cast<int>(n);
+    }
+};
+
+#endif// __TOYFLEXLEXER_H_
@@ -1,63 +1,165 @@
 #ifndef __TOYLEXER_H_
 #define __TOYLEXER_H_
 #include "token.hpp"
-#include <FlexLexer.h>
+#include "SourceBuffer.hpp"
+#ifdef TOY_NATIVE_LEXER
+#include "NativeLexer.hpp"
+#else
+#include "ToyFlexLexer.hpp"
+#include <memory>
+#endif
+#include <array>
+#include <cassert>
+#include <iostream>
 #include <vector>
+
+/// ToyLexer - Pull-based token stream for the parser. Tokens are scanned on
+/// demand into a ring of max_lookahead slots, so memory use doesn't grow with
+/// the input and parsing can begin before the input has all arrived.
+///
+/// Over a SourceBuffer token text is a view into the buffer. Over a stream
+/// the text is copied into the token's ring slot, whose storage is reused, and
+/// stays valid until the slot is recycled max_lookahead tokens later.
 class ToyLexer
 {
+  public:
+    static constexpr std::size_t max_lookahead = 4;
+
   private:
-    std::vector<token> tokenlist;
-    std::vector<token>::iterator tok_iter = tokenlist.begin();
+    struct slot
+    {
+        token tok{ tok_eof };
+        std::string storage;
+    };
+    std::array<slot, max_lookahead> ring;
+    std::size_t head = 0;
+    std::size_t count = 0;
+    bool exhausted = true;
 
-  public:
-    auto current_token()
+    SourceBuffer source;
+    std::istream *stream = nullptr;
+#ifdef TOY_NATIVE_LEXER
+    static constexpr std::size_t chunk_size = 64 * 1024;
+    NativeScanner scanner{ {} };
+    std::vector<char> window;
+    std::size_t window_base = 0;
+
+    /// refill - Drop the input the scanner is done with and append the next
+    /// chunk of the stream. Reads grow with the window so that rescanning a
+    /// token longer than a chunk stays linear overall.
+    void refill()
     {
-        if (tok_iter != tokenlist.end()) { return *tok_iter; }
-        else
-            return token(tok_eof);
+        auto done = scanner.position();
+        window.erase(window.begin(), window.begin() + static_cast<std::ptrdiff_t>(done));
+        window_base += done;
+
+        auto kept = window.size();
+        window.resize(kept + std::max(chunk_size, kept));
+        auto got = read_available(*stream, window.data() + kept, window.size() - kept);
+        window.resize(kept + got);
+        scanner = NativeScanner({ window.data(), window.size() }, got == 0);
     }
-    auto next_token()
+
+    token scan()
     {
-        if (tok_iter != tokenlist.end())
+        auto tok = scanner.next();
+        while (scanner.needs_more())
         {
-            tok_iter++;
-            return *tok_iter;
+            refill();
+            tok = scanner.next();
         }
-        else
-            return token(tok_eof);
+        tok.offset += window_base;
+        return tok;
+    }
+#else
+    std::unique_ptr<ToyFlexLexer> flex;
+
+    token scan()
+    {
+        int t = flex->yylex();
+        if (t == 0) return token(tok_eof, {}, flex->source_offset, std::nullopt);
+
+        auto len = static_cast<std::size_t>(flex->YYLeng());
+        std::string_view lexeme =
+            stream ? std::string_view(flex->YYText(), len) : source.view().substr(flex->token_offset, len);
+        return token(static_cast<token_t>(t),
+            lexeme,
+            flex->token_offset,
+            t == tok_number ? parse_number(lexeme) : std::nullopt);
     }
+#endif
 
-    void scan_tokens()
+    /// fill - Make sure the ring holds at least n + 1 tokens.
+    void fill(std::size_t n)
     {
-        tokenlist.clear();
-        yyFlexLexer lexer;
-        int t;
-        while ((t = lexer.yylex()) != 0)
+        assert(n < max_lookahead && "lookahead past the end of the token ring");
+        while (count <= n)
         {
-            std::optional<double> dval = std::nullopt;
-            if (t == token_t::tok_number) dval = std::stod(lexer.YYText());
-            tokenlist.emplace_back(static_cast<token_t>(t), lexer.YYText(), dval);
+            auto &s = ring[(head + count) % max_lookahead];
+            s.tok = exhausted ? token(tok_eof) : scan();
+            if (s.tok == tok_eof) exhausted = true;
+            if (s.tok == tok_identifier) s.tok.symbol = symbols().intern(s.tok.text);
+            if (stream)
+            {
+                s.storage.assign(s.tok.text);
+                s.tok.text = s.storage;
+            }
+            ++count;
         }
-        tok_iter = tokenlist.begin();
     }
+
+    void reset()
+    {
+        head = count = 0;
+        exhausted = false;
+#ifdef TOY_NATIVE_LEXER
+        window.clear();
+        window_base = 0;
+#endif
+    }
+
+  public:
+    const token &current_token() { return peek(0); }
+    const token &next_token()
+    {
+        if (count == 0) fill(0);
+        head = (head + 1) % max_lookahead;
+        --count;
+        return current_token();
+    }
+    /// peek - The token n places after the current one, n < max_lookahead.
+    const token &peek(std::size_t n)
+    {
+        fill(n);
+        return ring[(head + n) % max_lookahead].tok;
+    }
+
+    /// scan_tokens - Lex buffer, which the lexer keeps alive; token text is a
+    /// view into it, so no lexeme is ever copied.
+    void scan_tokens(SourceBuffer buffer)
+    {
+        reset();
+        source = std::move(buffer);
+        stream = nullptr;
+#ifdef TOY_NATIVE_LEXER
+        scanner = NativeScanner(source.view());
+#else
+        flex = std::make_unique<ToyFlexLexer>(source.view());
+#endif
+    }
+    /// scan_tokens - Lex is as it arrives; is must outlive the lexer's use.
     void scan_tokens(std::istream &is)
     {
-        tokenlist.clear();
-        yyFlexLexer lexer;
-        lexer.switch_streams(is, std::cout);
-        int t;
-        while ((t = lexer.yylex()) != 0)
-        {
-            std::optional<double> dval = std::nullopt;
-            if (t == token_t::tok_number) dval = std::stod(lexer.YYText());
-            tokenlist.emplace_back(static_cast<token_t>(t), lexer.YYText(), dval);
-        }
-        tok_iter = tokenlist.begin();
+        reset();
+        source = SourceBuffer();
+        stream = &is;
+#ifdef TOY_NATIVE_LEXER
+        scanner = NativeScanner({}, false);
+#else
+        flex = std::make_unique<ToyFlexLexer>(is);
+#endif
     }
-    auto begin() { return tokenlist.begin(); }
-    auto end() { return tokenlist.end(); }
-    auto begin() const { return tokenlist.cbegin(); }
-    auto end() const { return tokenlist.cend(); }
+    void scan_tokens() { scan_tokens(std::cin); }
 };
 
 #endif// __TOYLEXER_H_
@@ -1,7 +1,10 @@
 #ifndef __TOKEN_H_
 #define __TOKEN_H_
-#include <string>
+#include <charconv>
+#include <cstddef>
+#include <string_view>
 #include <optional>
+#include "../misc/symbol.hpp"
 enum token_t {
     tok_eof = 0,
 
@@ -37,23 +40,43 @@ enum token_t {
     tok_semi = -18,
 
     // operators
-    tok_binop = -19
+    tok_binop = -19,
+
+    // array subscripts
+    tok_leftsquare = -20,
+    tok_rightsquare = -21
 
 
 };
 
+/// token - One lexeme. text is a slice of the lexer's SourceBuffer rather than
+/// a copy, so a token is only valid while the lexer that produced it is.
+/// Identifiers are interned as they are lexed and carry their Symbol.
 struct token
 {
     token_t type;
-    std::string text;
+    std::string_view text;
+    std::size_t offset = 0;
     std::optional<double> num_val = std::nullopt;
-    token(token_t t, const std::string &s, std::optional<double> d) : type(t), text(s), num_val(d) {}
+    Symbol symbol;
+    token(token_t t, std::string_view s, std::size_t off, std::optional<double> d)
+        : type(t), text(s), offset(off), num_val(d)
+    {}
 
     explicit token(token_t t) : type(t) {}
 
+    std::size_t length() const { return text.size(); }
 
     bool operator==(const token_t tok) const { return type == tok; }
     bool operator!=(const token_t tok) const { return type != tok; }
 };
 
+/// parse_number - Value of a tok_number lexeme, without copying it.
+inline std::optional<double> parse_number(std::string_view text)
+{
+    double val = 0;
+    std::from_chars(text.data(), text.data() + text.size(), val);
+    return val;
+}
+
 #endif// __TOKEN_H_
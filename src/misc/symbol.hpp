@@ -0,0 +1,94 @@
+#ifndef __SYMBOL_H_
+#define __SYMBOL_H_
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/// Symbol - An interned identifier. Ids are dense, starting at 1 in the order
+/// names are first seen, so tables keyed by symbol can be plain vectors; id 0
+/// is the empty name and doubles as "no symbol".
+struct Symbol
+{
+    uint32_t id = 0;
+
+    explicit operator bool() const { return id != 0; }
+    bool operator==(const Symbol &) const = default;
+};
+
+template<> struct std::hash<Symbol>
+{
+    std::size_t operator()(Symbol s) const noexcept { return s.id; }
+};
+
+/// SymbolTable - Maps names to Symbols and back. Names are copied once into
+/// large blocks, so interning a name costs no allocation of its own.
+class SymbolTable
+{
+    static constexpr std::size_t block_size = 64 * 1024;
+
+    std::vector<std::unique_ptr<char[]>> blocks;
+    std::size_t block_used = block_size;
+    std::unordered_map<std::string_view, uint32_t> ids;
+    std::vector<std::string_view> names{ std::string_view() };
+
+    std::string_view store(std::string_view name)
+    {
+        if (name.size() > block_size)
+        {
+            // Too big for any block: give it one of its own and mark it
+            // full, so the next name starts a fresh block.
+            blocks.push_back(std::make_unique<char[]>(name.size()));
+            std::memcpy(blocks.back().get(), name.data(), name.size());
+            block_used = block_size;
+            return { blocks.back().get(), name.size() };
+        }
+        if (name.size() > block_size - block_used)
+        {
+            blocks.push_back(std::make_unique<char[]>(block_size));
+            block_used = 0;
+        }
+        char *dst = blocks.back().get() + block_used;
+        std::memcpy(dst, name.data(), name.size());
+        block_used += name.size();
+        return { dst, name.size() };
+    }
+
+  public:
+    SymbolTable() { ids.emplace(std::string_view(), 0); }
+
+    Symbol intern(std::string_view name)
+    {
+        if (auto it = ids.find(name); it != ids.end()) return Symbol{ it->second };
+        auto stored = store(name);
+        auto id = static_cast<uint32_t>(names.size());
+        names.push_back(stored);
+        ids.emplace(stored, id);
+        return Symbol{ id };
+    }
+
+    /// lookup - The symbol for name if it was interned already, else the
+    /// empty symbol. Never modifies the table, so once parsing is done
+    /// codegen threads can share it.
+    Symbol lookup(std::string_view name) const
+    {
+        auto it = ids.find(name);
+        return Symbol{ it != ids.end() ? it->second : 0 };
+    }
+
+    std::string_view name(Symbol s) const { return names[s.id]; }
+    /// size - One more than the largest id handed out so far.
+    std::size_t size() const { return names.size(); }
+};
+
+/// symbols - The interner shared by the lexer, parser and codegen.
+inline SymbolTable &symbols()
+{
+    static SymbolTable table;
+    return table;
+}
+
+#endif// __SYMBOL_H_
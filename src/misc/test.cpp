@@ -1,81 +1,572 @@
 #include "../lexer/ToyLexer.hpp"
 #include "../codegen/codegen.hpp"
+#include "../codegen/optimizer.hpp"
+#include "../codegen/ObjectCache.hpp"
+#include "../codegen/TargetMachines.hpp"
 #include "../parser/ToyParser.hpp"
+#include "../AST/Simplify.hpp"
 #include "../argparser/argparser.hpp"
+#include "../interpreter/Interpreter.hpp"
+#include "../bytecode/BytecodeCompiler.hpp"
+#include "../bytecode/VM.hpp"
+#include "../jit/ToyJIT.hpp"
+#include "../jit/Tiered.hpp"
+#include "../server/Client.hpp"
+#include <chrono>
 #include <iostream>
-#include <fstream>
+#include <sstream>
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Host.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/TargetRegistry.h"
 #include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/thread.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Target/TargetOptions.h"
 #include "llvm/IR/Module.h"
-int main(int argc, char **argv)
-{
-    auto args = std::get<Arguments>(get_args(argc, argv));
-    ToyParser parser;
-    std::ifstream src_stream(args.srcfilename);
-    auto expr_vec = parser.MainLoop(src_stream);
-    src_stream.close();
-    auto mod = codegen(expr_vec);
-#ifndef NDEBUG
-    mod->TheModule->print(llvm::errs(), nullptr);
-#endif
-    // Initialize the target registry etc.
-    llvm ::InitializeAllTargetInfos();
-    llvm::InitializeAllTargets();
-    llvm::InitializeAllTargetMCs();
-    llvm::InitializeAllAsmParsers();
-    llvm::InitializeAllAsmPrinters();
+#include <optional>
 
-    auto TargetTriple = llvm::sys::getDefaultTargetTriple();
-    mod->TheModule->setTargetTriple(TargetTriple);
-
-    std::string Error;
-    auto Target = llvm::TargetRegistry::lookupTarget(TargetTriple, Error);
+/// parse_source - Parse filename, or standard input for "-", with parser.
+template<typename Parser>
+std::optional<decltype(std::declval<Parser &>().MainLoop())> parse_source(Parser &parser, const std::string &filename)
+{
+    if (filename == "-")
+    {
+        std::ios::sync_with_stdio(false);
+        return parser.MainLoop(std::cin);
+    }
+    auto source = SourceBuffer::map_file(filename);
+    if (auto *Error = std::get_if<std::string>(&source))
+    {
+        llvm::errs() << *Error;
+        return std::nullopt;
+    }
+    return parser.MainLoop(std::move(std::get<SourceBuffer>(source)));
+}
 
-    // Print an error and exit if we couldn't find the requested target.
-    // This generally occurs if we've forgotten to initialise the
-    // TargetRegistry or we have a bogus target triple.
-    if (!Target)
+/// optimization_level - The pipeline for an --opt argument.
+OptimizationLevel optimization_level(char opt_level)
+{
+    switch (opt_level)
     {
-        llvm::errs() << Error;
-        return 1;
+    case '1':
+        return OptimizationLevel::O1;
+    case '2':
+        return OptimizationLevel::O2;
+    case '3':
+        return OptimizationLevel::O3;
+    case 's':
+        return OptimizationLevel::Os;
+    case 'z':
+        return OptimizationLevel::Oz;
+    default:
+        return OptimizationLevel::O0;
     }
+}
 
-    auto CPU = "generic";
-    auto Features = "";
+/// target_spec - The target args ask for. Without --mcpu, the host is
+/// generated for a generic CPU of its kind, and another target, which may
+/// have no CPU called "generic", for its default one. --mcpu=native is the
+/// host's CPU with the features it has, before --mattr's.
+TargetSpec target_spec(const Arguments &args)
+{
+    TargetSpec target;
+    target.fast_math = fast_math_flags(args.fp_flags);
+    if (args.target && *args.target != target.triple)
+    {
+        target.triple = *args.target;
+        target.cpu.clear();
+    }
+    if (args.mcpu == "native")
+    {
+        target.cpu = llvm::sys::getHostCPUName().str();
+        target.features = host_features();
+    }
+    else if (args.mcpu)
+        target.cpu = *args.mcpu;
+    if (args.mattr) target.features += (target.features.empty() ? "" : ",") + *args.mattr;
+    return target;
+}
 
-    llvm::TargetOptions opt;
-    auto RM = llvm::Optional<llvm::Reloc::Model>();
-    auto TheTargetMachine = Target->createTargetMachine(TargetTriple, CPU, Features, opt, RM);
+/// code_options - The tuning and fast-math flags args ask for, for the
+/// functions' attributes and floating point operations.
+CodeOptions code_options(const Arguments &args)
+{
+    auto target = target_spec(args);
+    if (!args.mcpu && !args.mattr) return { "", "", target.fast_math };
+    return { target.cpu, target.features, target.fast_math };
+}
 
-    mod->TheModule->setDataLayout(TheTargetMachine->createDataLayout());
+/// emit_object - Optimize module at level and write it as an object file for
+/// TheTargetMachine to filename. Returns false, after printing why, if it
+/// couldn't.
+bool emit_object(llvm::Module &module,
+    llvm::TargetMachine &TheTargetMachine,
+    OptimizationLevel level,
+    const std::string &filename)
+{
+    module.setTargetTriple(TheTargetMachine.getTargetTriple().str());
+    module.setDataLayout(TheTargetMachine.createDataLayout());
+    optimize(module, TheTargetMachine, level);
 
     std::error_code EC;
-    llvm::raw_fd_ostream dest(args.outfilename, EC, llvm::sys::fs::OF_None);
+    llvm::raw_fd_ostream dest(filename, EC, llvm::sys::fs::OF_None);
 
     if (EC)
     {
         llvm::errs() << "Could not open file: " << EC.message();
-        return 1;
+        return false;
     }
 
     llvm::legacy::PassManager pass;
     auto FileType = llvm::CGFT_ObjectFile;
 
-    if (TheTargetMachine->addPassesToEmitFile(pass, dest, nullptr, FileType))
+    if (TheTargetMachine.addPassesToEmitFile(pass, dest, nullptr, FileType))
     {
         llvm::errs() << "TheTargetMachine can't emit a file of this type";
-        return 1;
+        return false;
     }
 
-    pass.run(*(mod->TheModule));
+    pass.run(module);
     dest.flush();
+    return true;
+}
+
+/// unit_filename - Object file for codegen unit i of count: output.o becomes
+/// output.0.o, output.1.o, ... unless there is just one unit.
+std::string unit_filename(const std::string &outfilename, std::size_t i, std::size_t count)
+{
+    if (count == 1) return outfilename;
+    auto dot = outfilename.rfind('.');
+    if (dot == std::string::npos || outfilename.find('/', dot) != std::string::npos) dot = outfilename.size();
+    return fmt::format("{}.{}{}", outfilename.substr(0, dot), i, outfilename.substr(dot));
+}
 
+std::size_t item_count(const std::vector<std::variant<ExprAST_ptr, FnAST_ptr>> &top_expressions)
+{
+    return top_expressions.size();
+}
+std::size_t item_count(const FlatAST &ast) { return ast.top_level.size(); }
+
+/// compile - Generate code for a parsed program and write the object file(s).
+template<typename AST> int compile(AST &ast, const Arguments &args)
+{
+    auto level = optimization_level(args.opt_level);
+    auto target = target_spec(args);
+    if (!args.jobs)
+    {
+        auto mod = codegen(ast, code_options(args));
+#ifndef NDEBUG
+        mod->TheModule->print(llvm::errs(), nullptr);
+#endif
+        auto TheTargetMachine = target_machines().acquire(target, level);
+        if (auto *Error = std::get_if<std::string>(&TheTargetMachine))
+        {
+            llvm::errs() << *Error;
+            return 1;
+        }
+        std::string report;
+        if (args.loop_report) mod->TheContext->setDiagnosticHandler(std::make_unique<LoopReport>(report));
+        bool written = emit_object(*mod->TheModule, *std::get<0>(TheTargetMachine), level, args.outfilename);
+        llvm::errs() << report;
+        if (!written) return 1;
+        llvm::outs() << "Wrote " << args.outfilename << "\n";
+        return 0;
+    }
+
+    // Each unit is compiled and written by the thread that generated it. IR
+    // dumps, loop reports and results are collected per unit and reported in
+    // unit order.
+    auto units = codegen_unit_count(item_count(ast));
+    std::vector<std::string> unit_ir(units);
+    std::vector<char> written(units);
+    codegen(ast, *args.jobs, [&](std::size_t unit, CodeModule &part) {
+#ifndef NDEBUG
+        llvm::raw_string_ostream ir(unit_ir[unit]);
+        part.TheModule->print(ir, nullptr);
+#endif
+        auto TheTargetMachine = target_machines().acquire(target, level);
+        if (auto *Error = std::get_if<std::string>(&TheTargetMachine))
+        {
+            unit_ir[unit] += *Error;
+            return;
+        }
+        if (args.loop_report) part.TheContext->setDiagnosticHandler(std::make_unique<LoopReport>(unit_ir[unit]));
+        written[unit] = emit_object(
+            *part.TheModule, *std::get<0>(TheTargetMachine), level, unit_filename(args.outfilename, unit, units));
+    }, code_options(args));
+
+    int status = 0;
+    for (std::size_t unit = 0; unit < units; ++unit)
+    {
+        llvm::errs() << unit_ir[unit];
+        if (written[unit])
+            llvm::outs() << "Wrote " << unit_filename(args.outfilename, unit, units) << "\n";
+        else
+            status = 1;
+    }
+    return status;
+}
+
+/// milliseconds - Time from start to end, for reports.
+double milliseconds(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+/// compile_cached - compile, generating only the functions not found in the
+/// object cache, and write them as an archive. Reports the cache hit rate
+/// on stderr.
+int compile_cached(TranslationUnit &unit, const Arguments &args)
+{
+    auto start = std::chrono::steady_clock::now();
+    auto level = optimization_level(args.opt_level);
+    auto TheTargetMachine = target_machines().acquire(target_spec(args), level);
+    if (auto *Error = std::get_if<std::string>(&TheTargetMachine))
+    {
+        llvm::errs() << *Error;
+        return 1;
+    }
+    auto &TM = *std::get<0>(TheTargetMachine);
+
+    ObjectCache cache(*args.cache_dir);
+    auto build = build_cached(unit.top_expressions, cache, TM, level, code_options(args));
+    if (!write_archive(args.outfilename, build, TM)) return 1;
+
+    auto functions = build.hits + build.misses;
+    fmt::print(stderr,
+        "cache: {} of {} functions from the cache ({:.1f}%), {} generated, in {:.2f} ms\n",
+        build.hits,
+        functions,
+        functions ? 100.0 * static_cast<double>(build.hits) / static_cast<double>(functions) : 100.0,
+        build.misses,
+        milliseconds(start, std::chrono::steady_clock::now()));
     llvm::outs() << "Wrote " << args.outfilename << "\n";
+    return 0;
+}
+
+/// simplify_unit - Simplify a parsed program for codegen, and with report,
+/// report on stderr how much that removed.
+void simplify_unit(TranslationUnit &unit, bool report)
+{
+    if (!report)
+    {
+        simplify(unit);
+        return;
+    }
+    std::size_t nodes = 0;
+    for (auto &item : unit.top_expressions)
+    {
+        std::visit([&](auto *node) {
+            if (node) nodes += node->countNodes();
+        },
+            item);
+    }
+    auto start = std::chrono::steady_clock::now();
+    auto stats = simplify(unit);
+    fmt::print(stderr,
+        "simplify: removed {} of {} nodes, evaluated {} calls ({} gave up) in {:.2f} ms\n",
+        stats.removed,
+        nodes,
+        stats.evaluated,
+        stats.abandoned,
+        milliseconds(start, std::chrono::steady_clock::now()));
+}
+
+/// serve_compiles - Run as a compile server for the host: set up its target
+/// and a TargetMachine for each optimization level once, then compile each
+/// request as compile does without --jobs.
+int serve_compiles(const Arguments &args)
+{
+    // Much of LLVM sets itself up on first use. Doing that here, once, saves
+    // every worker doing it for its first compile.
+    for (char opt_level : std::string_view("0123sz"))
+    {
+        auto level = optimization_level(opt_level);
+        auto TheTargetMachine = target_machines().acquire(TargetSpec(), level);
+        if (auto *Error = std::get_if<std::string>(&TheTargetMachine))
+        {
+            llvm::errs() << *Error;
+            return 1;
+        }
+        ToyParser parser;
+        std::istringstream is("def warm(x) x * 2 + 1\n");
+        auto unit = parser.MainLoop(SourceBuffer::from_stream(is));
+        auto mod = codegen(unit.top_expressions);
+        object_code(*mod->TheModule, *std::get<0>(TheTargetMachine), level);
+    }
 
+    auto jobs = args.jobs.value_or(std::max(1u, std::thread::hardware_concurrency()));
+    return serve(*args.serve_socket, jobs, [&](const CompileRequest &request, std::string &object) {
+        if (std::string_view("0123sz").find(request.opt_level) == std::string_view::npos)
+        {
+            llvm::errs() << "Unknown optimization level " << request.opt_level << "\n";
+            return 1;
+        }
+        auto level = optimization_level(request.opt_level);
+        auto TheTargetMachine = target_machines().acquire(TargetSpec(), level);
+        if (auto *Error = std::get_if<std::string>(&TheTargetMachine))
+        {
+            llvm::errs() << *Error;
+            return 1;
+        }
+        // Operators a program defines are for its own parse only.
+        auto operators = BinopPrecedence;
+        ToyParser parser;
+        std::istringstream is(request.source);
+        auto unit = parser.MainLoop(SourceBuffer::from_stream(is));
+        simplify_unit(unit, false);
+        auto mod = codegen(unit.top_expressions);
+#ifndef NDEBUG
+        mod->TheModule->print(llvm::errs(), nullptr);
+#endif
+        auto code = object_code(*mod->TheModule, *std::get<0>(TheTargetMachine), level);
+        object.assign(code.begin(), code.end());
+        BinopPrecedence = std::move(operators);
+        return 0;
+    });
+}
+
+/// run - Run a parsed program in the JIT, printing the value of each top level
+/// expression, then report on stderr how long parsing (since start), JIT
+/// startup and running took.
+int run(TranslationUnit &unit, const Arguments &args, std::chrono::steady_clock::time_point start)
+{
+    using clock = std::chrono::steady_clock;
+    auto parsed = clock::now();
+    auto TheJIT = ToyJIT::create(optimization_level(args.opt_level), args.lazy);
+    if (auto *Error = std::get_if<std::string>(&TheJIT))
+    {
+        llvm::errs() << *Error << "\n";
+        return 1;
+    }
+    auto started = clock::now();
+
+    std::optional<clock::time_point> first_result;
+    std::size_t results = 0;
+    bool ok = jit_run(unit.top_expressions, *std::get<0>(TheJIT), [&](double value) {
+        if (!first_result) first_result = clock::now();
+        ++results;
+        fmt::print("{}\n", value);
+    });
+    std::fflush(stdout);
+    auto done = clock::now();
+
+    fmt::print(stderr,
+        "jit: parse {:.2f} ms, startup {:.2f} ms, first result at {:.2f} ms, ran {} expressions in {:.2f} ms\n",
+        milliseconds(start, parsed),
+        milliseconds(parsed, started),
+        milliseconds(start, first_result.value_or(done)),
+        results,
+        milliseconds(start, done));
+    return ok ? 0 : 1;
+}
+
+/// The interpreter evaluates calls on the native stack, so run_interpreted
+/// runs it on a thread with a stack of interpret_stack_size bytes and stops
+/// calls nesting deeper than interpret_call_depth, which leaves each call
+/// about 25 KB, enough for deeply nested expressions in an unoptimized build.
+constexpr unsigned interpret_stack_size = 256u << 20;
+constexpr std::size_t interpret_call_depth = 10'000;
+
+/// run_interpreted - run, with the tree walking interpreter instead of the JIT.
+int run_interpreted(TranslationUnit &unit, std::chrono::steady_clock::time_point start)
+{
+    using clock = std::chrono::steady_clock;
+    auto parsed = clock::now();
+
+    Interpreter interp;
+    interp.limit(std::numeric_limits<uint64_t>::max(), interpret_call_depth);
+    std::optional<clock::time_point> first_result;
+    std::size_t results = 0;
+    bool ok = false;
+    llvm::thread(llvm::Optional<unsigned>(interpret_stack_size), [&] {
+        ok = interpret(unit.top_expressions, interp, [&](double value) {
+            if (!first_result) first_result = clock::now();
+            ++results;
+            fmt::print("{}\n", value);
+        });
+    }).join();
+    std::fflush(stdout);
+    auto done = clock::now();
+
+    fmt::print(stderr,
+        "interpret: parse {:.2f} ms, first result at {:.2f} ms, ran {} expressions in {:.2f} ms\n",
+        milliseconds(start, parsed),
+        milliseconds(start, first_result.value_or(done)),
+        results,
+        milliseconds(start, done));
+    return ok ? 0 : 1;
+}
+
+/// run_tiered - run, starting in the bytecode VM and moving hot functions to
+/// the JIT.
+int run_tiered(TranslationUnit &unit, const Arguments &args, std::chrono::steady_clock::time_point start)
+{
+    using clock = std::chrono::steady_clock;
+    auto parsed = clock::now();
+
+    auto runtime = TieredRuntime::create(unit.top_expressions, args.hot);
+    std::optional<clock::time_point> first_result;
+    std::size_t results = 0;
+    bool ok = runtime->run([&](double value) {
+        if (!first_result) first_result = clock::now();
+        ++results;
+        fmt::print("{}\n", value);
+    });
+    std::fflush(stdout);
+    auto done = clock::now();
+
+    fmt::print(stderr,
+        "tiered: parse {:.2f} ms, first result at {:.2f} ms, ran {} expressions in {:.2f} ms, {} functions promoted\n",
+        milliseconds(start, parsed),
+        milliseconds(start, first_result.value_or(done)),
+        results,
+        milliseconds(start, done),
+        runtime->promoted());
+    return ok && runtime->compiled() ? 0 : 1;
+}
+
+/// load_bytecode - filename as bytecode: a file written by --emit-bytecode is
+/// loaded as it is, source is parsed and compiled. complete is set to whether
+/// all of it compiled. Returns nullopt, after printing why, if there is
+/// nothing to run.
+std::optional<BytecodeModule> load_bytecode(const std::string &filename, bool &complete)
+{
+    ToyParser parser;
+    std::optional<TranslationUnit> unit;
+    if (filename == "-")
+        unit = parse_source(parser, filename);
+    else
+    {
+        auto source = SourceBuffer::map_file(filename);
+        if (auto *Error = std::get_if<std::string>(&source))
+        {
+            llvm::errs() << *Error;
+            return std::nullopt;
+        }
+        auto &buffer = std::get<SourceBuffer>(source);
+        if (is_bytecode(buffer.view()))
+        {
+            auto module = deserialize(buffer.view());
+            if (auto *Error = std::get_if<std::string>(&module))
+            {
+                llvm::errs() << *Error;
+                return std::nullopt;
+            }
+            complete = true;
+            return std::move(std::get<BytecodeModule>(module));
+        }
+        unit = parser.MainLoop(std::move(buffer));
+    }
+    if (!unit) return std::nullopt;
+
+    BytecodeModule module;
+    complete = compile_program(unit->top_expressions, module);
+    return module;
+}
+
+/// run_bytecode - run, with the bytecode VM instead of the JIT.
+int run_bytecode(const Arguments &args, std::chrono::steady_clock::time_point start)
+{
+    using clock = std::chrono::steady_clock;
+    bool complete = false;
+    auto module = load_bytecode(args.srcfilename, complete);
+    if (!module) return 1;
+    auto loaded = clock::now();
+
+    VM vm(*module);
+    std::optional<clock::time_point> first_result;
+    std::size_t results = 0;
+    bool ok = vm_run(*module, vm, [&](double value) {
+        if (!first_result) first_result = clock::now();
+        ++results;
+        fmt::print("{}\n", value);
+    });
+    std::fflush(stdout);
+    auto done = clock::now();
+
+    fmt::print(stderr,
+        "vm: load {:.2f} ms, first result at {:.2f} ms, ran {} expressions in {:.2f} ms\n",
+        milliseconds(start, loaded),
+        milliseconds(start, first_result.value_or(done)),
+        results,
+        milliseconds(start, done));
+    return ok && complete ? 0 : 1;
+}
+
+/// emit_bytecode - Compile a program to bytecode and write it to the output
+/// file.
+int emit_bytecode(const Arguments &args)
+{
+    bool complete = false;
+    auto module = load_bytecode(args.srcfilename, complete);
+    if (!module || !complete) return 1;
+
+    std::error_code EC;
+    llvm::raw_fd_ostream dest(args.outfilename, EC, llvm::sys::fs::OF_None);
+    if (EC)
+    {
+        llvm::errs() << "Could not open file: " << EC.message();
+        return 1;
+    }
+    dest << serialize(*module);
+    dest.flush();
+    llvm::outs() << "Wrote " << args.outfilename << "\n";
     return 0;
 }
+
+int main(int argc, char **argv)
+{
+    auto parsed_args = get_args(argc, argv);
+    if (auto *Error = std::get_if<std::string>(&parsed_args))
+    {
+        llvm::errs() << *Error;
+        return 1;
+    }
+    auto &args = std::get<Arguments>(parsed_args);
+    auto start = std::chrono::steady_clock::now();
+
+    // Bytecode files are loaded without parsing, so these come first.
+    if (args.vm) return run_bytecode(args, start);
+    if (args.emit_bytecode) return emit_bytecode(args);
+    // A client leaves the targets to the server.
+    if (args.connect_socket) return compile_on_server(args);
+
+    // Set up the backend for the target. The interpreter doesn't need one,
+    // and the tiered runtime sets up the host's once something gets hot.
+    if (args.mcpu == "native" && target_spec(args).triple != llvm::sys::getDefaultTargetTriple())
+    {
+        llvm::errs() << "--mcpu=native is the host's CPU, not one for --target\n";
+        return 1;
+    }
+    if (!args.interpret && !args.tiered && !initialize_target(target_spec(args).triple)) return 1;
+
+    if (args.serve_socket) return serve_compiles(args);
+    if (args.flat_ast && args.cache_dir)
+    {
+        llvm::errs() << "--cache needs the node tree AST, not --flat-ast\n";
+        return 1;
+    }
+    if (args.flat_ast && args.simplify_report)
+    {
+        llvm::errs() << "--simplify-report needs the node tree AST, --flat-ast isn't simplified\n";
+        return 1;
+    }
+    if (args.flat_ast)
+    {
+        FlatToyParser parser;
+        auto ast = parse_source(parser, args.srcfilename);
+        if (!ast) return 1;
+        return compile(*ast, args);
+    }
+    ToyParser parser;
+    auto unit = parse_source(parser, args.srcfilename);
+    if (!unit) return 1;
+    if (args.interpret) return run_interpreted(*unit, start);
+    if (args.tiered) return run_tiered(*unit, args, start);
+    simplify_unit(*unit, args.simplify_report);
+    if (args.jit) return run(*unit, args, start);
+    if (args.cache_dir) return compile_cached(*unit, args);
+    return compile(unit->top_expressions, args);
+}
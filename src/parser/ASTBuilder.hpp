@@ -0,0 +1,153 @@
+#ifndef __ASTBUILDER_H_
+#define __ASTBUILDER_H_
+#include "../AST/AST.hpp"
+#include "../AST/FlatAST.hpp"
+#include <fmt/format.h>
+#include <span>
+#include <utility>
+
+// Builders are what BasicToyParser calls to create nodes, so the same parser
+// can produce either representation. Each provides handle types expr, proto
+// and function, whose default value is the error result, and collects the top
+// level items into its result type.
+
+/// TreeBuilder - Builds the ExprAST object tree in a TranslationUnit.
+class TreeBuilder
+{
+    TranslationUnit unit;
+
+  public:
+    using expr = ExprAST *;
+    using proto = PrototypeAST *;
+    using function = FunctionAST *;
+    using result = TranslationUnit;
+
+    expr number(double val) { return unit.arena.make<NumberExprAST>(val); }
+    expr variable(Symbol name) { return unit.arena.make<VariableExprAST>(name); }
+    bool is_assignable(expr e) const { return e->getVariable() || e->getElement(); }
+    expr index(Symbol array, expr index) { return unit.arena.make<IndexExprAST>(array, index); }
+    expr length(Symbol array) { return unit.arena.make<LengthExprAST>(array); }
+    expr unary(char op, expr operand) { return unit.arena.make<UnaryExprAST>(op, operand); }
+    expr binary(char op, expr lhs, expr rhs) { return unit.arena.make<BinaryExprAST>(op, lhs, rhs); }
+    expr call(Symbol callee, std::span<const expr> args)
+    {
+        return unit.arena.make<CallExprAST>(callee, unit.arena.copy(args));
+    }
+    expr if_expr(expr cond, expr then, expr els) { return unit.arena.make<IfExprAST>(cond, then, els); }
+    expr for_expr(Symbol var, expr start, expr end, expr step, expr body, LoopHints hints)
+    {
+        return unit.arena.make<ForExprAST>(var, start, end, step, body, hints);
+    }
+    expr var_expr(std::span<const std::pair<Symbol, expr>> vars, expr body)
+    {
+        return unit.arena.make<VarExprAST>(unit.arena.copy(vars), body);
+    }
+    expr array_var(Symbol name, expr length, expr body) { return unit.arena.make<ArrayVarExprAST>(name, length, body); }
+    proto prototype(Symbol name,
+        std::span<const Symbol> params,
+        bool is_operator = false,
+        uint32_t precedence = 0,
+        std::span<const bool> array_params = {})
+    {
+        if (!array_params.empty()) array_params = unit.arena.copy(array_params);
+        return unit.arena.make<PrototypeAST>(name, unit.arena.copy(params), is_operator, precedence, array_params);
+    }
+    function definition(proto p, expr body) { return unit.arena.make<FunctionAST>(p, body); }
+
+    void top_level(proto p) { unit.top_expressions.push_back(static_cast<FnAST *>(p)); }
+    void top_level(function f) { unit.top_expressions.push_back(static_cast<FnAST *>(f)); }
+    result finish() { return std::move(unit); }
+};
+
+/// FlatBuilder - Appends nodes to a FlatAST; see there for the layout. It
+/// has no arrays: they fail to parse.
+class FlatBuilder
+{
+  public:
+    using expr = FlatExpr;
+    using proto = FlatProto;
+    using function = FlatFn;
+    using result = FlatAST;
+
+  private:
+    FlatAST ast;
+
+    expr node(FlatKind kind, char op, uint32_t first, uint32_t second)
+    {
+        ast.kinds.push_back(kind);
+        ast.ops.push_back(op);
+        ast.first.push_back(first);
+        ast.second.push_back(second);
+        return expr{ static_cast<uint32_t>(ast.kinds.size() - 1) };
+    }
+    uint32_t tail_begin() const { return static_cast<uint32_t>(ast.extra.size()); }
+    template<typename Handle> Handle no_arrays()
+    {
+        fmt::print(stderr, "Error: arrays need the node tree AST, not --flat-ast\n");
+        return {};
+    }
+
+  public:
+    expr number(double val)
+    {
+        ast.numbers.push_back(val);
+        return node(FlatKind::number, 0, static_cast<uint32_t>(ast.numbers.size() - 1), 0);
+    }
+    expr variable(Symbol name) { return node(FlatKind::variable, 0, name.id, 0); }
+    bool is_assignable(expr e) const { return ast.kind(e) == FlatKind::variable; }
+    expr index(Symbol, expr) { return no_arrays<expr>(); }
+    expr length(Symbol) { return no_arrays<expr>(); }
+    expr unary(char op, expr operand) { return node(FlatKind::unary, op, operand.index, 0); }
+    expr binary(char op, expr lhs, expr rhs) { return node(FlatKind::binary, op, lhs.index, rhs.index); }
+    expr call(Symbol callee, std::span<const expr> args)
+    {
+        auto tail = tail_begin();
+        ast.extra.push_back(static_cast<uint32_t>(args.size()));
+        for (auto arg : args) ast.extra.push_back(arg.index);
+        return node(FlatKind::call, 0, callee.id, tail);
+    }
+    expr if_expr(expr cond, expr then, expr els)
+    {
+        auto tail = tail_begin();
+        ast.extra.insert(ast.extra.end(), { then.index, els.index });
+        return node(FlatKind::if_expr, 0, cond.index, tail);
+    }
+    expr for_expr(Symbol var, expr start, expr end, expr step, expr body, LoopHints hints)
+    {
+        auto tail = tail_begin();
+        ast.extra.insert(
+            ast.extra.end(), { start.index, end.index, step.index, body.index, hints.vectorize, hints.unroll });
+        return node(FlatKind::for_expr, 0, var.id, tail);
+    }
+    expr var_expr(std::span<const std::pair<Symbol, expr>> vars, expr body)
+    {
+        auto tail = tail_begin();
+        ast.extra.push_back(static_cast<uint32_t>(vars.size()));
+        for (auto &[name, init] : vars) ast.extra.insert(ast.extra.end(), { name.id, init.index });
+        return node(FlatKind::var_expr, 0, body.index, tail);
+    }
+    expr array_var(Symbol, expr, expr) { return no_arrays<expr>(); }
+    proto prototype(Symbol name,
+        std::span<const Symbol> params,
+        bool is_operator = false,
+        uint32_t precedence = 0,
+        std::span<const bool> array_params = {})
+    {
+        if (!array_params.empty()) return no_arrays<proto>();
+        auto begin = static_cast<uint32_t>(ast.params.size());
+        ast.params.insert(ast.params.end(), params.begin(), params.end());
+        ast.prototypes.push_back({ name, begin, static_cast<uint32_t>(params.size()), is_operator, precedence });
+        return proto{ static_cast<uint32_t>(ast.prototypes.size() - 1) };
+    }
+    function definition(proto p, expr body)
+    {
+        ast.functions.push_back({ p, body });
+        return function{ static_cast<uint32_t>(ast.functions.size() - 1) };
+    }
+
+    void top_level(proto p) { ast.top_level.emplace_back(p); }
+    void top_level(function f) { ast.top_level.emplace_back(f); }
+    result finish() { return std::exchange(ast, FlatAST()); }
+};
+
+#endif// __ASTBUILDER_H_
@@ -6,16 +6,48 @@
 #include <variant>
 #include "../lexer/ToyLexer.hpp"
 #include "../codegen/codemodule.hpp"
-#include "../AST/AST.hpp"
+#include "ASTBuilder.hpp"
 
-class ToyParser
+/// BasicToyParser - Recursive descent parser; Builder (see ASTBuilder.hpp)
+/// decides which AST representation it produces.
+template<typename Builder> class BasicToyParser
 {
 
   private:
+    using expr_t = typename Builder::expr;
+    using proto_t = typename Builder::proto;
+    using fn_t = typename Builder::function;
+
     ToyLexer lexer;
+    Builder build;
+
+    // Lists being parsed are collected here and handed to the builder once
+    // complete. Calls nest, so arg_scratch is used as a stack.
+    std::vector<expr_t> arg_scratch;
+    std::vector<Symbol> name_scratch;
+    llvm::SmallVector<bool, 8> array_scratch;
+
+    // The names bound where the parser is, innermost last, and whether each
+    // is an array: 'len(a)' is an array's length only if a is one, and a
+    // call of a function 'len' otherwise.
+    std::vector<std::pair<Symbol, bool>> bindings;
 
-    using ExprAST_ptr = std::unique_ptr<ExprAST>;
-    using FnAST_ptr = std::unique_ptr<FnAST>;
+    /// BindingScope - Drops the bindings made while it lives.
+    struct BindingScope
+    {
+        std::vector<std::pair<Symbol, bool>> &names;
+        std::size_t size;
+        ~BindingScope() { names.resize(size); }
+    };
+
+    bool isArray(Symbol Name) const
+    {
+        for (auto It = bindings.rbegin(); It != bindings.rend(); ++It)
+        {
+            if (It->first == Name) return It->second;
+        }
+        return false;
+    }
 
   public:
     /// GetTokPrecedence - Get the precedence of the pending binary operator token.
@@ -30,32 +62,32 @@ class ToyParser
     }
 
     /// LogError* - These are little helper functions for error handling.
-    std::unique_ptr<ExprAST> LogError(const std::string_view Str)
+    expr_t LogError(const std::string_view Str)
     {
         fmt::print(stderr, "Error: {}\n", Str);
-        return nullptr;
+        return {};
     }
 
-    std::unique_ptr<PrototypeAST> LogErrorP(const std::string_view Str)
+    proto_t LogErrorP(const std::string_view Str)
     {
         LogError(Str);
-        return nullptr;
+        return {};
     }
 
     /// numberexpr ::= number
-    std::unique_ptr<ExprAST> ParseNumberExpr()
+    expr_t ParseNumberExpr()
     {
-        auto Result = std::make_unique<NumberExprAST>(lexer.current_token().num_val.value());
+        auto Result = build.number(lexer.current_token().num_val.value());
         lexer.next_token();// consume the number
         return Result;
     }
 
     /// parenexpr ::= '(' expression ')'
-    std::unique_ptr<ExprAST> ParseParenExpr()
+    expr_t ParseParenExpr()
     {
         lexer.next_token();// eat (.
         auto V = ParseExpression();
-        if (!V) return nullptr;
+        if (!V) return {};
 
         if (lexer.current_token() != tok_rightbracket) return LogError("expected ')'");
         lexer.next_token();// eat ).
@@ -64,31 +96,62 @@ class ToyParser
 
     /// identifierexpr
     ///   ::= identifier
+    ///   ::= identifier '[' expression ']'
+    ///   ::= 'len' '(' identifier ')', for an array
     ///   ::= identifier '(' expression* ')'
-    std::unique_ptr<ExprAST> ParseIdentifierExpr()
+    expr_t ParseIdentifierExpr()
     {
-        std::string IdName = lexer.current_token().text;
+        Symbol IdName = lexer.current_token().symbol;
+        bool IsLen = lexer.current_token().text == "len";
 
         lexer.next_token();// eat identifier.
 
+        // Array element.
+        if (lexer.current_token() == tok_leftsquare)
+        {
+            lexer.next_token();// eat [
+            auto Index = ParseExpression();
+            if (!Index) return {};
+            if (lexer.current_token() != tok_rightsquare) return LogError("expected ']' after array index");
+            lexer.next_token();// eat ]
+            return build.index(IdName, Index);
+        }
+
         if (lexer.current_token() != tok_leftbracket)// Simple variable ref.
-            return std::make_unique<VariableExprAST>(IdName);
+            return build.variable(IdName);
+
+        // The length of an array in scope; anything else is a call.
+        if (IsLen && lexer.peek(1) == tok_identifier && lexer.peek(2) == tok_rightbracket
+            && isArray(lexer.peek(1).symbol))
+        {
+            Symbol Array = lexer.next_token().symbol;
+            lexer.next_token();// eat the array's name.
+            lexer.next_token();// eat ).
+            return build.length(Array);
+        }
 
         // Call.
         lexer.next_token();// eat (
-        std::vector<std::unique_ptr<ExprAST>> Args;
+        auto ArgsBegin = arg_scratch.size();
         if (lexer.current_token() != tok_rightbracket)
         {
             while (true)
             {
                 if (auto Arg = ParseExpression())
-                    Args.push_back(std::move(Arg));
+                    arg_scratch.push_back(Arg);
                 else
-                    return nullptr;
+                {
+                    arg_scratch.resize(ArgsBegin);
+                    return {};
+                }
 
                 if (lexer.current_token() == tok_rightbracket) break;
 
-                if (lexer.current_token() != tok_comma) return LogError("Expected ')' or ',' in argument list");
+                if (lexer.current_token() != tok_comma)
+                {
+                    arg_scratch.resize(ArgsBegin);
+                    return LogError("Expected ')' or ',' in argument list");
+                }
                 lexer.next_token();
             }
         }
@@ -96,103 +159,147 @@ class ToyParser
         // Eat the ')'.
         lexer.next_token();
 
-        return std::make_unique<CallExprAST>(IdName, std::move(Args));
+        auto Call = build.call(IdName, std::span<const expr_t>(arg_scratch).subspan(ArgsBegin));
+        arg_scratch.resize(ArgsBegin);
+        return Call;
     }
 
     /// ifexpr ::= 'if' expression 'then' expression 'else' expression
-    std::unique_ptr<ExprAST> ParseIfExpr()
+    expr_t ParseIfExpr()
     {
         lexer.next_token();// eat the if.
 
         // condition.
         auto Cond = ParseExpression();
-        if (!Cond) return nullptr;
+        if (!Cond) return {};
 
         if (lexer.current_token() != tok_then) return LogError("expected then");
         lexer.next_token();// eat the then
 
         auto Then = ParseExpression();
-        if (!Then) return nullptr;
+        if (!Then) return {};
 
         if (lexer.current_token() != tok_else) return LogError("expected else");
 
         lexer.next_token();
 
         auto Else = ParseExpression();
-        if (!Else) return nullptr;
+        if (!Else) return {};
 
-        return std::make_unique<IfExprAST>(std::move(Cond), std::move(Then), std::move(Else));
+        return build.if_expr(Cond, Then, Else);
     }
 
-    /// forexpr ::= 'for' identifier '=' expr ',' expr (',' expr)? 'in' expression
-    std::unique_ptr<ExprAST> ParseForExpr()
+    /// forexpr ::= 'for' identifier '=' expr ',' expr (',' expr)? hint* 'in' expression
+    /// hint ::= ('vectorize' | 'unroll') '(' number ')'
+    expr_t ParseForExpr()
     {
         lexer.next_token();// eat the for.
 
         if (lexer.current_token() != tok_identifier) return LogError("expected identifier after for");
 
-        std::string IdName = lexer.current_token().text;
+        Symbol IdName = lexer.current_token().symbol;
         lexer.next_token();// eat identifier.
 
         if (lexer.current_token() != tok_equal) return LogError("expected '=' after for");
         lexer.next_token();// eat '='.
 
         auto Start = ParseExpression();
-        if (!Start) return nullptr;
+        if (!Start) return {};
         if (lexer.current_token() != tok_comma) return LogError("expected ',' after for start value");
         lexer.next_token();
 
+        // The variable is in scope from the end condition on.
+        BindingScope Scope{ bindings, bindings.size() };
+        bindings.emplace_back(IdName, false);
+
         auto End = ParseExpression();
-        if (!End) return nullptr;
+        if (!End) return {};
 
         // The step value is optional.
-        std::unique_ptr<ExprAST> Step;
+        expr_t Step{};
         if (lexer.current_token() == tok_comma)
         {
             lexer.next_token();
             Step = ParseExpression();
-            if (!Step) return nullptr;
+            if (!Step) return {};
+        }
+
+        LoopHints Hints;
+        while (lexer.current_token() == tok_identifier)
+        {
+            auto Hint = lexer.current_token().text;
+            uint32_t *Value = Hint == "vectorize" ? &Hints.vectorize : Hint == "unroll" ? &Hints.unroll : nullptr;
+            if (!Value) return LogError("expected 'vectorize', 'unroll' or 'in' after for");
+            lexer.next_token();// eat the hint.
+            if (lexer.current_token() != tok_leftbracket) return LogError("expected '(' after loop hint");
+            lexer.next_token();
+            auto N = lexer.current_token() == tok_number ? lexer.current_token().num_val : std::nullopt;
+            if (!N || *N < 1 || *N > 1024 || *N != static_cast<uint32_t>(*N))
+                return LogError("expected a count from 1 to 1024 in loop hint");
+            *Value = static_cast<uint32_t>(*N);
+            if (Value == &Hints.vectorize && (*Value & (*Value - 1)))
+                return LogError("vectorize width must be a power of two");
+            lexer.next_token();
+            if (lexer.current_token() != tok_rightbracket) return LogError("expected ')' after loop hint");
+            lexer.next_token();
         }
 
         if (lexer.current_token() != tok_in) return LogError("expected 'in' after for");
         lexer.next_token();// eat 'in'.
 
         auto Body = ParseExpression();
-        if (!Body) return nullptr;
+        if (!Body) return {};
 
-        return std::make_unique<ForExprAST>(IdName, std::move(Start), std::move(End), std::move(Step), std::move(Body));
+        return build.for_expr(IdName, Start, End, Step, Body, Hints);
     }
 
-    /// varexpr ::= 'var' identifier ('=' expression)?
-    //                    (',' identifier ('=' expression)?)* 'in' expression
-    std::unique_ptr<ExprAST> ParseVarExpr()
+    /// varexpr ::= 'var' binding (',' binding)* 'in' expression
+    /// binding ::= identifier ('=' expression)? | identifier '[' expression ']'
+    expr_t ParseVarExpr()
     {
         lexer.next_token();// eat the var.
 
-        std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> VarNames;
+        // An array binding has its length for Init.
+        struct Binding
+        {
+            Symbol Name;
+            expr_t Init;
+            bool IsArray;
+        };
+        std::vector<Binding> Bindings;
+
+        // Each binding is in scope from the next on.
+        BindingScope Scope{ bindings, bindings.size() };
 
         // At least one variable name is required.
         if (lexer.current_token() != tok_identifier) return LogError("expected identifier after var");
 
         while (true)
         {
-            std::string Name = lexer.current_token().text;
+            Symbol Name = lexer.current_token().symbol;
             lexer.next_token();// eat identifier.
 
-            // Read the optional initializer.
-            std::unique_ptr<ExprAST> Init = nullptr;
-            if (lexer.current_token() == tok_equal)
+            // Read the optional initializer, or the array's length.
+            expr_t Init{};
+            bool IsArray = lexer.current_token() == tok_leftsquare;
+            if (IsArray || lexer.current_token() == tok_equal)
             {
-                lexer.next_token();// eat the '='.
+                lexer.next_token();// eat the '=' or '['.
 
                 Init = ParseExpression();
-                if (!Init) return nullptr;
+                if (!Init) return {};
+            }
+            if (IsArray)
+            {
+                if (lexer.current_token() != tok_rightsquare) return LogError("expected ']' after array length");
+                lexer.next_token();// eat ']'.
             }
 
-            VarNames.push_back(std::make_pair(Name, std::move(Init)));
+            Bindings.push_back({ Name, Init, IsArray });
+            bindings.emplace_back(Name, IsArray);
 
             // End of var list, exit loop.
-            if (lexer.current_token() != tok_equal) break;
+            if (lexer.current_token() != tok_comma) break;
             lexer.next_token();// eat the ','.
 
             if (lexer.current_token() != tok_identifier) return LogError("expected identifier list after var");
@@ -203,9 +310,29 @@ class ToyParser
         lexer.next_token();// eat 'in'.
 
         auto Body = ParseExpression();
-        if (!Body) return nullptr;
+        if (!Body) return {};
 
-        return std::make_unique<VarExprAST>(std::move(VarNames), std::move(Body));
+        // Each array, and each run of variables in between, is a node of its
+        // own around the ones after it, so every binding is in scope from
+        // the next on, as in a single var_expr.
+        std::vector<std::pair<Symbol, expr_t>> VarNames;
+        for (auto End = Bindings.size(); End;)
+        {
+            if (Bindings[End - 1].IsArray)
+            {
+                --End;
+                Body = build.array_var(Bindings[End].Name, Bindings[End].Init, Body);
+                if (!Body) return {};
+                continue;
+            }
+            auto Begin = End;
+            while (Begin && !Bindings[Begin - 1].IsArray) --Begin;
+            VarNames.clear();
+            for (auto i = Begin; i != End; ++i) VarNames.emplace_back(Bindings[i].Name, Bindings[i].Init);
+            Body = build.var_expr(VarNames, Body);
+            End = Begin;
+        }
+        return Body;
     }
 
     /// primary
@@ -215,7 +342,7 @@ class ToyParser
     ///   ::= ifexpr
     ///   ::= forexpr
     ///   ::= varexpr
-    std::unique_ptr<ExprAST> ParsePrimary()
+    expr_t ParsePrimary()
     {
         switch (lexer.current_token().type)
         {
@@ -239,7 +366,7 @@ class ToyParser
     /// unary
     ///   ::= primary
     ///   ::= '!' unary
-    std::unique_ptr<ExprAST> ParseUnary()
+    expr_t ParseUnary()
     {
         // If the current token is not an operator, it must be a primary expr.
         if (lexer.current_token().type != tok_binop || lexer.current_token() == tok_leftbracket
@@ -247,15 +374,15 @@ class ToyParser
             return ParsePrimary();
 
         // If this is a unary operator, read it.
-        int Opc = lexer.current_token().text[0];
+        char Opc = lexer.current_token().text[0];
         lexer.next_token();
-        if (auto Operand = ParseUnary()) return std::make_unique<UnaryExprAST>(Opc, std::move(Operand));
-        return nullptr;
+        if (auto Operand = ParseUnary()) return build.unary(Opc, Operand);
+        return {};
     }
 
     /// binoprhs
     ///   ::= ('+' unary)*
-    std::unique_ptr<ExprAST> ParseBinOpRHS(int ExprPrec, std::unique_ptr<ExprAST> LHS)
+    expr_t ParseBinOpRHS(int ExprPrec, expr_t LHS)
     {
         // If this is a binop, find its precedence.
         while (true)
@@ -267,45 +394,48 @@ class ToyParser
             if (TokPrec < ExprPrec) return LHS;
 
             // Okay, we know this is a binop.
-            int BinOp = lexer.current_token().text[0];
+            char BinOp = lexer.current_token().text[0];
             lexer.next_token();// eat binop
 
             // Parse the unary expression after the binary operator.
             auto RHS = ParseUnary();
-            if (!RHS) return nullptr;
+            if (!RHS) return {};
 
             // If BinOp binds less tightly with RHS than the operator after RHS, let
             // the pending operator take RHS as its LHS.
             int NextPrec = GetTokPrecedence();
             if (TokPrec < NextPrec)
             {
-                RHS = ParseBinOpRHS(TokPrec + 1, std::move(RHS));
-                if (!RHS) return nullptr;
+                RHS = ParseBinOpRHS(TokPrec + 1, RHS);
+                if (!RHS) return {};
             }
 
             // Merge LHS/RHS.
-            LHS = std::make_unique<BinaryExprAST>(BinOp, std::move(LHS), std::move(RHS));
+            if (BinOp == '=' && !build.is_assignable(LHS))
+                return LogError("destination of '=' must be a variable or an array element");
+            LHS = build.binary(BinOp, LHS, RHS);
         }
     }
 
     /// expression
     ///   ::= unary binoprhs
     ///
-    std::unique_ptr<ExprAST> ParseExpression()
+    expr_t ParseExpression()
     {
         auto LHS = ParseUnary();
-        if (!LHS) return nullptr;
+        if (!LHS) return {};
 
-        return ParseBinOpRHS(0, std::move(LHS));
+        return ParseBinOpRHS(0, LHS);
     }
 
     /// prototype
-    ///   ::= id '(' id* ')'
+    ///   ::= id '(' param* ')'
     ///   ::= binary LETTER number? (id, id)
     ///   ::= unary LETTER (id)
-    std::unique_ptr<PrototypeAST> ParsePrototype()
+    /// param ::= id | id '[' ']'
+    proto_t ParsePrototype()
     {
-        std::string FnName;
+        Symbol FnName;
 
         unsigned Kind = 0;// 0 = identifier, 1 = unary, 2 = binary.
         unsigned BinaryPrecedence = 30;
@@ -315,23 +445,21 @@ class ToyParser
         default:
             return LogErrorP("Expected function name in prototype");
         case tok_identifier:
-            FnName = lexer.current_token().text;
+            FnName = lexer.current_token().symbol;
             Kind = 0;
             lexer.next_token();
             break;
         case tok_unary:
             lexer.next_token();
             if (lexer.current_token() != token_t::tok_binop) return LogErrorP("Expected unary operator");
-            FnName = "unary";
-            FnName += lexer.current_token().text;
+            FnName = symbols().intern(fmt::format("unary{}", lexer.current_token().text));
             Kind = 1;
             lexer.next_token();
             break;
         case tok_binary:
             lexer.next_token();
             if (lexer.current_token() != token_t::tok_binop) return LogErrorP("Expected binary operator");
-            FnName = "binary";
-            FnName += lexer.current_token().text;
+            FnName = symbols().intern(fmt::format("binary{}", lexer.current_token().text));
             Kind = 2;
             lexer.next_token();
 
@@ -348,8 +476,21 @@ class ToyParser
 
         if (lexer.current_token() != tok_leftbracket) return LogErrorP("Expected '(' in prototype");
 
-        std::vector<std::string> ArgNames;
-        while (lexer.next_token() == tok_identifier) ArgNames.push_back(lexer.current_token().text);
+        auto &ArgNames = name_scratch;
+        auto &ArgArrays = array_scratch;
+        ArgNames.clear();
+        ArgArrays.clear();
+        while (lexer.next_token() == tok_identifier)
+        {
+            ArgNames.push_back(lexer.current_token().symbol);
+            bool IsArray = lexer.peek(1) == tok_leftsquare;
+            if (IsArray)
+            {
+                lexer.next_token();// eat the name.
+                if (lexer.next_token() != tok_rightsquare) return LogErrorP("Expected ']' after '[' in prototype");
+            }
+            ArgArrays.push_back(IsArray);
+        }
         if (lexer.current_token() != tok_rightbracket)
             return LogErrorP(fmt::format("Expected ')' in prototype got: {}", lexer.current_token().text));
 
@@ -359,34 +500,46 @@ class ToyParser
         // Verify right number of names for operator.
         if (Kind && ArgNames.size() != Kind) return LogErrorP("Invalid number of operands for operator");
 
-        return std::make_unique<PrototypeAST>(FnName, ArgNames, Kind != 0, BinaryPrecedence);
+        bool AnyArray = llvm::is_contained(ArgArrays, true);
+        if (Kind && AnyArray) return LogErrorP("Operators take numbers, not arrays");
+
+        return build.prototype(FnName,
+            ArgNames,
+            Kind != 0,
+            BinaryPrecedence,
+            AnyArray ? std::span<const bool>(ArgArrays) : std::span<const bool>());
     }
 
     /// definition ::= 'def' prototype expression
-    std::unique_ptr<FunctionAST> ParseDefinition()
+    fn_t ParseDefinition()
     {
         lexer.next_token();// eat def.
         auto Proto = ParsePrototype();
-        if (!Proto) return nullptr;
+        if (!Proto) return {};
+
+        // The body sees the parameters, as ParsePrototype left them.
+        bindings.clear();
+        for (std::size_t i = 0; i < name_scratch.size(); ++i) bindings.emplace_back(name_scratch[i], array_scratch[i]);
 
-        if (auto E = ParseExpression()) return std::make_unique<FunctionAST>(std::move(Proto), std::move(E));
-        return nullptr;
+        if (auto E = ParseExpression()) return build.definition(Proto, E);
+        return {};
     }
 
     /// toplevelexpr ::= expression
-    std::unique_ptr<FunctionAST> ParseTopLevelExpr()
+    fn_t ParseTopLevelExpr()
     {
+        bindings.clear();
         if (auto E = ParseExpression())
         {
             // Make an anonymous proto.
-            auto Proto = std::make_unique<PrototypeAST>("__anon_expr", std::vector<std::string>());
-            return std::make_unique<FunctionAST>(std::move(Proto), std::move(E));
+            auto Proto = build.prototype(symbols().intern("__anon_expr"), {});
+            return build.definition(Proto, E);
         }
-        return nullptr;
+        return {};
     }
 
     /// external ::= 'extern' prototype
-    std::unique_ptr<PrototypeAST> ParseExtern()
+    proto_t ParseExtern()
     {
         lexer.next_token();// eat extern.
         return ParsePrototype();
@@ -394,7 +547,7 @@ class ToyParser
     /*********************
     ** toplevel parsing
     **********************/
-    FnAST_ptr HandleDefinition()
+    fn_t HandleDefinition()
     {
         if (auto FunAST = ParseDefinition())
         {
@@ -414,7 +567,7 @@ class ToyParser
         }
     }
 
-    FnAST_ptr HandleExtern()
+    proto_t HandleExtern()
     {
         if (auto ProtoAST = ParseExtern())
         {
@@ -431,10 +584,10 @@ class ToyParser
         }
         // Skip token for error recovery.
         lexer.next_token();
-        return nullptr;
+        return {};
     }
 
-    FnAST_ptr HandleTopLevelExpression()
+    fn_t HandleTopLevelExpression()
     {
         // Evaluate a top-level expression into an anonymous function.
         if (auto FunAST = ParseTopLevelExpr()) { return FunAST; }
@@ -446,10 +599,8 @@ class ToyParser
         }
     }
 
-    auto MainLoop(std::istream &is)
+    typename Builder::result MainLoop()
     {
-        lexer.scan_tokens(is);
-        std::vector<std::variant<ExprAST_ptr, FnAST_ptr>> top_expressions;
         while (lexer.current_token() != tok_eof)
         {
             switch (lexer.current_token().type)
@@ -460,18 +611,35 @@ class ToyParser
                 lexer.next_token();
                 break;
             case tok_def:
-                top_expressions.push_back(HandleDefinition());
+                build.top_level(HandleDefinition());
                 break;
             case tok_extern:
-                top_expressions.push_back(HandleExtern());
+                build.top_level(HandleExtern());
                 break;
             default:
-                top_expressions.push_back(HandleTopLevelExpression());
+                build.top_level(HandleTopLevelExpression());
                 break;
             }
         }
-        return top_expressions;
+        return build.finish();
+    }
+
+    auto MainLoop(SourceBuffer source)
+    {
+        lexer.scan_tokens(std::move(source));
+        return MainLoop();
+    }
+
+    /// MainLoop - Parse is while it is being read, e.g. generated code piped
+    /// into the compiler.
+    auto MainLoop(std::istream &is)
+    {
+        lexer.scan_tokens(is);
+        return MainLoop();
     }
 };
 
+using ToyParser = BasicToyParser<TreeBuilder>;
+using FlatToyParser = BasicToyParser<FlatBuilder>;
+
 #endif
@@ -0,0 +1,54 @@
+#ifndef __CLIENT_H_
+#define __CLIENT_H_
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <fmt/format.h>
+#include "../argparser/argparser.hpp"
+#include "../lexer/SourceBuffer.hpp"
+#include "CompileServer.hpp"
+
+/// compile_on_server - Compile args.srcfilename on the server at
+/// --connect: print what the compile printed there, write the object it
+/// sent back and return its exit status, as compiling here would.
+inline int compile_on_server(const Arguments &args)
+{
+    CompileRequest request;
+    request.opt_level = args.opt_level;
+    if (args.srcfilename == "-")
+        request.source = std::string(SourceBuffer::from_stream(std::cin).view());
+    else
+    {
+        auto source = SourceBuffer::map_file(args.srcfilename);
+        if (auto *Error = std::get_if<std::string>(&source))
+        {
+            fmt::print(stderr, "{}", *Error);
+            return 1;
+        }
+        request.source = std::string(std::get<SourceBuffer>(source).view());
+    }
+
+    auto response = compile_remote(*args.connect_socket, request);
+    if (auto *Error = std::get_if<std::string>(&response))
+    {
+        fmt::print(stderr, "{}", *Error);
+        return 1;
+    }
+    auto &result = std::get<CompileResult>(response);
+    std::fwrite(result.diagnostics.data(), 1, result.diagnostics.size(), stderr);
+    if (result.object.empty()) return result.status ? result.status : 1;
+
+    std::ofstream dest(args.outfilename, std::ios::binary);
+    dest.write(result.object.data(), static_cast<std::streamsize>(result.object.size()));
+    dest.close();
+    if (!dest)
+    {
+        fmt::print(stderr, "Could not write {}\n", args.outfilename);
+        return 1;
+    }
+    fmt::print("Wrote {}\n", args.outfilename);
+    return result.status;
+}
+
+#endif// __CLIENT_H_
@@ -0,0 +1,297 @@
+#include "CompileServer.hpp"
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+#include <fmt/format.h>
+
+namespace {
+constexpr char magic[4] = { 'T', 'O', 'Y', 'C' };
+constexpr uint32_t protocol_version = 1;
+
+/// write_all - Write all of data to fd. Returns false if the peer went away.
+bool write_all(int fd, const char *data, std::size_t size)
+{
+    while (size)
+    {
+        auto n = ::write(fd, data, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        size -= static_cast<std::size_t>(n);
+    }
+    return true;
+}
+
+/// read_all - Fill data from fd. Returns false if the peer went away first.
+bool read_all(int fd, char *data, std::size_t size)
+{
+    while (size)
+    {
+        auto n = ::read(fd, data, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        size -= static_cast<std::size_t>(n);
+    }
+    return true;
+}
+
+/// put - Append the low bytes of value to message, little endian.
+void put(std::string &message, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; ++i) message += static_cast<char>((value >> (8 * i)) & 0xff);
+}
+
+/// put - Append data to message after its size.
+void put(std::string &message, const std::string &data)
+{
+    put(message, data.size(), 8);
+    message += data;
+}
+
+/// get - Read a little endian integer of bytes bytes from fd.
+bool get(int fd, uint64_t &value, int bytes)
+{
+    unsigned char data[8];
+    if (!read_all(fd, reinterpret_cast<char *>(data), static_cast<std::size_t>(bytes))) return false;
+    value = 0;
+    for (int i = bytes; i-- > 0;) value = value << 8 | data[i];
+    return true;
+}
+
+/// get - Read data written by put(message, data) from fd.
+bool get(int fd, std::string &data)
+{
+    uint64_t size;
+    if (!get(fd, size, 8)) return false;
+    // Grown as it arrives, so a bogus size fails on the read, not on the
+    // allocation.
+    data.clear();
+    char chunk[65536];
+    while (size)
+    {
+        auto n = static_cast<std::size_t>(std::min<uint64_t>(size, sizeof(chunk)));
+        if (!read_all(fd, chunk, n)) return false;
+        data.append(chunk, n);
+        size -= n;
+    }
+    return true;
+}
+
+/// socket_address - The address of the socket at path, or an error message
+/// if path is too long for one.
+std::variant<sockaddr_un, std::string> socket_address(const std::string &path)
+{
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path))
+        return fmt::format("Socket path must be 1 to {} characters: {}\n", sizeof(addr.sun_path) - 1, path);
+    std::memcpy(addr.sun_path, path.data(), path.size());
+    return addr;
+}
+
+/// captured - Everything written to the file behind fd so far.
+std::string captured(int fd)
+{
+    std::string text;
+    if (::lseek(fd, 0, SEEK_SET) < 0) return text;
+    char chunk[65536];
+    for (;;)
+    {
+        auto n = ::read(fd, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        text.append(chunk, static_cast<std::size_t>(n));
+    }
+    return text;
+}
+
+/// worker_requests - How many requests a worker answers before it makes
+/// way for a fresh one, which bounds what global state, like the symbol
+/// table, can pile up.
+constexpr unsigned worker_requests = 1000;
+
+/// handle - Read a request from conn, compile it and send the result. What
+/// the compile prints on stderr goes to the file behind log for the client.
+void handle(int conn, int log, const Compiler &compile)
+{
+    char request_magic[sizeof(magic)];
+    uint64_t version, opt_level;
+    if (!read_all(conn, request_magic, sizeof(request_magic)) || std::memcmp(request_magic, magic, sizeof(magic)) != 0
+        || !get(conn, version, 4))
+        return;
+
+    CompileResult result;
+    if (version != protocol_version)
+    {
+        result.status = 1;
+        result.diagnostics = fmt::format("The server speaks protocol version {}, not {}\n", protocol_version, version);
+    }
+    else
+    {
+        CompileRequest request;
+        if (!get(conn, opt_level, 1) || !get(conn, request.source)) return;
+        request.opt_level = static_cast<char>(opt_level);
+
+        std::fflush(stderr);
+        int server_stderr = ::dup(STDERR_FILENO);
+        ::ftruncate(log, 0);
+        ::lseek(log, 0, SEEK_SET);
+        ::dup2(log, STDERR_FILENO);
+
+        result.status = compile(request, result.object);
+
+        std::fflush(stderr);
+        ::dup2(server_stderr, STDERR_FILENO);
+        ::close(server_stderr);
+        result.diagnostics = captured(log);
+    }
+
+    std::string response;
+    put(response, static_cast<uint64_t>(static_cast<uint32_t>(result.status)), 4);
+    put(response, result.diagnostics);
+    put(response, result.object);
+    write_all(conn, response.data(), response.size());
+}
+
+/// work - The life of a worker of the server process server: answer
+/// worker_requests requests on listener. Returns the process' exit status.
+int work(int listener, [[maybe_unused]] pid_t server, const Compiler &compile)
+{
+#ifdef __linux__
+    // A worker must not outlive the server and go on answering requests.
+    ::prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (::getppid() != server) return 0;
+#endif
+    std::FILE *log = std::tmpfile();
+    if (!log)
+    {
+        fmt::print(stderr, "Could not create a file for diagnostics: {}\n", std::strerror(errno));
+        return 1;
+    }
+    for (unsigned served = 0; served < worker_requests;)
+    {
+        int conn = ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (conn < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            fmt::print(stderr, "Could not accept a connection: {}\n", std::strerror(errno));
+            return 1;
+        }
+        handle(conn, fileno(log), compile);
+        ::close(conn);
+        ++served;
+    }
+    return 0;
+}
+}// namespace
+
+int serve(const std::string &path, unsigned jobs, const Compiler &compile)
+{
+    auto addr = socket_address(path);
+    if (auto *Error = std::get_if<std::string>(&addr))
+    {
+        fmt::print(stderr, "{}", *Error);
+        return 1;
+    }
+
+    // A socket left behind by an earlier server is replaced; anything else
+    // at path is not ours to remove.
+    struct stat st;
+    if (::lstat(path.c_str(), &st) == 0)
+    {
+        if (!S_ISSOCK(st.st_mode))
+        {
+            fmt::print(stderr, "{} exists and is not a socket\n", path);
+            return 1;
+        }
+        ::unlink(path.c_str());
+    }
+
+    int listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0 || ::bind(listener, reinterpret_cast<sockaddr *>(&std::get<sockaddr_un>(addr)), sizeof(sockaddr_un)) < 0
+        || ::listen(listener, SOMAXCONN) < 0)
+    {
+        fmt::print(stderr, "Could not listen on {}: {}\n", path, std::strerror(errno));
+        return 1;
+    }
+    // A client that goes away must not take a worker with it.
+    std::signal(SIGPIPE, SIG_IGN);
+    fmt::print("Listening on {}\n", path);
+    std::fflush(stdout);
+
+    // The workers accept on the listener themselves; this process only
+    // replaces those that finish or die.
+    unsigned workers = 0;
+    auto server = ::getpid();
+    for (;;)
+    {
+        for (; workers < jobs; ++workers)
+        {
+            auto pid = ::fork();
+            if (pid == 0) ::_exit(work(listener, server, compile));
+            if (pid < 0)
+            {
+                fmt::print(stderr, "Could not start a worker: {}\n", std::strerror(errno));
+                break;
+            }
+        }
+
+        int status;
+        auto pid = ::waitpid(-1, &status, 0);
+        if (pid < 0)
+        {
+            if (errno == EINTR) continue;
+            // No worker could be started; try again in a while.
+            ::sleep(1);
+            continue;
+        }
+        --workers;
+        if (WIFSIGNALED(status))
+            fmt::print(stderr, "A worker died of signal {}\n", WTERMSIG(status));
+        else if (WEXITSTATUS(status) != 0)
+            ::sleep(1);// It couldn't work at all, and a new one likely can't either.
+    }
+}
+
+std::variant<CompileResult, std::string> compile_remote(const std::string &path, const CompileRequest &request)
+{
+    auto addr = socket_address(path);
+    if (auto *Error = std::get_if<std::string>(&addr)) return *Error;
+
+    int conn = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (conn < 0 || ::connect(conn, reinterpret_cast<sockaddr *>(&std::get<sockaddr_un>(addr)), sizeof(sockaddr_un)) < 0)
+    {
+        auto Error = fmt::format("Could not connect to the compile server at {}: {}\n", path, std::strerror(errno));
+        if (conn >= 0) ::close(conn);
+        return Error;
+    }
+
+    std::string message(magic, sizeof(magic));
+    put(message, protocol_version, 4);
+    put(message, static_cast<uint64_t>(static_cast<unsigned char>(request.opt_level)), 1);
+    put(message, request.source);
+
+    // The server only closes a connection early if it dies, and writing to
+    // it then must fail, not kill the client.
+    auto old_handler = std::signal(SIGPIPE, SIG_IGN);
+    CompileResult result;
+    uint64_t status;
+    bool ok = write_all(conn, message.data(), message.size()) && get(conn, status, 4) && get(conn, result.diagnostics)
+              && get(conn, result.object);
+    std::signal(SIGPIPE, old_handler);
+    ::close(conn);
+    if (!ok) return fmt::format("The compile server at {} went away\n", path);
+    result.status = static_cast<int>(static_cast<uint32_t>(status));
+    return result;
+}
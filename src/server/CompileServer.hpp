@@ -0,0 +1,53 @@
+#ifndef __COMPILESERVER_H_
+#define __COMPILESERVER_H_
+
+#include <functional>
+#include <string>
+#include <variant>
+
+// A compile server keeps what every compile sets up first, the initialized
+// targets and a TargetMachine per optimization level, and compiles sources
+// sent to it over a Unix domain socket. The protocol is one request and one
+// response per connection, integers little endian:
+//
+//   request:  "TOYC" u32 version, u8 optimization level, u64 size, source
+//   response: u32 exit status, u64 size, diagnostics, u64 size, object
+//
+// The diagnostics are everything the compile printed on stderr, and the
+// object is empty if it didn't write one, so a client can behave just like
+// the command line compiler.
+
+/// CompileRequest - A compile as a client asks for it: the source and the
+/// options that change the object.
+struct CompileRequest
+{
+    char opt_level = '0';// one of 0 1 2 3 s z
+    std::string source;
+};
+
+/// CompileResult - What a compile on the server produced.
+struct CompileResult
+{
+    int status = 0;
+    std::string diagnostics;
+    std::string object;
+};
+
+/// Compiler - Compiles request into object, printing diagnostics on stderr
+/// as the command line compiler would, and returns its exit status. It is
+/// called for one request after another in the same process, so it must
+/// undo what a compile changes that would change the next one.
+using Compiler = std::function<int(const CompileRequest &request, std::string &object)>;
+
+/// serve - Answer compile requests on the Unix domain socket at path with
+/// compile until killed. jobs worker processes, forked from this one, take
+/// a request each at a time, so whatever was set up before is ready in all
+/// of them, and a compile that crashes takes only its own worker, which is
+/// replaced. Returns 1, after printing why, if the socket can't be set up.
+int serve(const std::string &path, unsigned jobs, const Compiler &compile);
+
+/// compile_remote - Have the server at path compile request. Returns an
+/// error message if there is no server or it went away.
+std::variant<CompileResult, std::string> compile_remote(const std::string &path, const CompileRequest &request);
+
+#endif// __COMPILESERVER_H_
@@ -0,0 +1,29 @@
+#include "Client.hpp"
+#include <cstdlib>
+
+// toyclient - toycomp --connect without LLVM, which is most of the time a
+// small compile takes to start. It takes toycomp's arguments, and the
+// server from $TOYCOMP_SERVER if there is no --connect, so it can stand in
+// for toycomp in a build.
+
+int main(int argc, char **argv)
+{
+    auto parsed_args = get_args(argc, argv);
+    if (auto *Error = std::get_if<std::string>(&parsed_args))
+    {
+        fmt::print(stderr, "{}", *Error);
+        return 1;
+    }
+    auto &args = std::get<Arguments>(parsed_args);
+    if (!args.connect_socket)
+    {
+        if (auto *server = std::getenv("TOYCOMP_SERVER")) args.connect_socket = server;
+    }
+    if (!args.connect_socket || args.serve_socket || args.jobs || args.cache_dir || args.target || args.mcpu || args.mattr || args.fp_flags || args.loop_report
+        || args.simplify_report || args.jit || args.interpret || args.vm || args.emit_bytecode || args.tiered)
+    {
+        fmt::print(stderr, "toyclient only compiles to an object file, on the server at --connect or $TOYCOMP_SERVER\n");
+        return 1;
+    }
+    return compile_on_server(args);
+}
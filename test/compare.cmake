@@ -0,0 +1,15 @@
+# cmake -DTOYCOMPILER=toycompiler -DPROGRAM=file.toy -DMODE=--jit -P compare.cmake
+# Fails unless PROGRAM prints the same in MODE as with --interpret.
+execute_process(COMMAND ${TOYCOMPILER} ${PROGRAM} --interpret
+                OUTPUT_VARIABLE expected RESULT_VARIABLE interpret_result ERROR_QUIET)
+if(NOT interpret_result EQUAL 0)
+  message(FATAL_ERROR "${PROGRAM} --interpret failed: ${interpret_result}")
+endif()
+execute_process(COMMAND ${TOYCOMPILER} ${PROGRAM} ${MODE}
+                OUTPUT_VARIABLE actual RESULT_VARIABLE result ERROR_QUIET)
+if(NOT result EQUAL 0)
+  message(FATAL_ERROR "${PROGRAM} ${MODE} failed: ${result}")
+endif()
+if(NOT actual STREQUAL expected)
+  message(FATAL_ERROR "${PROGRAM} ${MODE} printed\n${actual}but --interpret printed\n${expected}")
+endif()
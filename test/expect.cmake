@@ -0,0 +1,20 @@
+# cmake -DTOYCOMPILER=toycompiler -DPROGRAM=file.toy -DMODE=--jit [-DEXPECTED=file] [-DTRAP=ON] -P expect.cmake
+# Fails unless PROGRAM runs in MODE and, given EXPECTED, prints what it holds.
+# With TRAP, fails unless PROGRAM is stopped by a trap instead: a SIGILL or
+# SIGTRAP, which CMake reports by name, not an exit code.
+# For programs --interpret can't run, such as those with arrays.
+execute_process(COMMAND ${TOYCOMPILER} ${PROGRAM} ${MODE}
+                OUTPUT_VARIABLE actual RESULT_VARIABLE result ERROR_QUIET)
+if(TRAP)
+  if(NOT result MATCHES "^(Illegal instruction|Trace/breakpoint trap)")
+    message(FATAL_ERROR "${PROGRAM} ${MODE} should have trapped but ended with: ${result}")
+  endif()
+elseif(NOT result EQUAL 0)
+  message(FATAL_ERROR "${PROGRAM} ${MODE} failed: ${result}")
+endif()
+if(DEFINED EXPECTED)
+  file(READ ${EXPECTED} expected)
+  if(NOT actual STREQUAL expected)
+    message(FATAL_ERROR "${PROGRAM} ${MODE} printed\n${actual}but ${EXPECTED} holds\n${expected}")
+  endif()
+endif()
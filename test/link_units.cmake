@@ -0,0 +1,45 @@
+# cmake -DTOYCOMPILER=toycompiler -DCXX=c++ -DWORK_DIR=dir -P link_units.cmake
+# Fails unless a program of several codegen units, with top level
+# expressions in more than one of them, compiles with --jobs and its objects
+# link into a program that calls functions from the first and last unit.
+file(MAKE_DIRECTORY ${WORK_DIR})
+set(program "")
+foreach(i RANGE 999)
+  if(i EQUAL 0)
+    string(APPEND program "0\n")
+  elseif(i EQUAL 300 OR i EQUAL 600 OR i EQUAL 900)
+    string(APPEND program "f1(${i})\n")
+  else()
+    string(APPEND program "def f${i}(x) x + ${i}\n")
+  endif()
+endforeach()
+file(WRITE ${WORK_DIR}/units.toy "${program}")
+file(WRITE ${WORK_DIR}/main.cpp [=[
+extern "C" double f1(double);
+extern "C" double f999(double);
+int main() { return f1(1) + f999(1) == 1002 ? 0 : 1; }
+]=])
+
+file(GLOB stale ${WORK_DIR}/units*.o)
+if(stale)
+  file(REMOVE ${stale})
+endif()
+execute_process(COMMAND ${TOYCOMPILER} units.toy --out=units.o --jobs=4
+                WORKING_DIRECTORY ${WORK_DIR} RESULT_VARIABLE result ERROR_QUIET OUTPUT_QUIET)
+if(NOT result EQUAL 0)
+  message(FATAL_ERROR "units.toy --jobs=4 failed: ${result}")
+endif()
+file(GLOB objects ${WORK_DIR}/units.*.o)
+list(LENGTH objects count)
+if(count LESS 2)
+  message(FATAL_ERROR "units.toy --jobs=4 wrote ${count} object(s), expected several")
+endif()
+execute_process(COMMAND ${CXX} main.cpp ${objects} -o units
+                WORKING_DIRECTORY ${WORK_DIR} RESULT_VARIABLE result ERROR_VARIABLE errors)
+if(NOT result EQUAL 0)
+  message(FATAL_ERROR "linking the units of units.toy failed:\n${errors}")
+endif()
+execute_process(COMMAND ${WORK_DIR}/units RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+  message(FATAL_ERROR "the linked units of units.toy returned ${result}")
+endif()